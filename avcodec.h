@@ -30,7 +30,7 @@
 #include "libavutil/avutil.h"
 
 #define LIBAVCODEC_VERSION_MAJOR 52
-#define LIBAVCODEC_VERSION_MINOR 48
+#define LIBAVCODEC_VERSION_MINOR 58
 #define LIBAVCODEC_VERSION_MICRO  0
 
 #define LIBAVCODEC_VERSION_INT  AV_VERSION_INT(LIBAVCODEC_VERSION_MAJOR, \
@@ -584,6 +584,8 @@ typedef struct RcOverride{
 #define CODEC_FLAG2_NON_LINEAR_QUANT 0x00010000 ///< Use MPEG-2 nonlinear quantizer.
 #define CODEC_FLAG2_BIT_RESERVOIR 0x00020000 ///< Use a bit reservoir when encoding if possible
 #define CODEC_FLAG2_MBTREE        0x00040000 ///< Use macroblock tree ratecontrol (x264 only)
+#define CODEC_FLAG2_DEFER_DEBLOCK 0x00080000 ///< H.264 and VC-1 decoders: deblock in a separate slice thread, behind decoding
+#define CODEC_FLAG2_PIPELINE      0x00100000 ///< MPEG-1/2/4 encoders: encode in a separate thread, returning each packet one call later
 
 /* Unsupported options :
  *              Syntax Arithmetic coding (SAC)
@@ -629,6 +631,10 @@ typedef struct RcOverride{
  * as a last resort.
  */
 #define CODEC_CAP_SUBFRAMES        0x0100
+/**
+ * Codec supports frame-level multithreading.
+ */
+#define CODEC_CAP_FRAME_THREADS    0x0200
 
 //The following defines may change, don't expect compatibility if you use them.
 #define MB_TYPE_INTRA4x4   0x0001
@@ -683,6 +689,34 @@ typedef struct AVPanScan{
     int16_t position[3][2];
 }AVPanScan;
 
+/**
+ * Statistics of one encoded macroblock, see AVCodecContext.mb_stats.
+ */
+typedef struct AVMBStats{
+    /**
+     * bits spent on the macroblock, including a slice, GOB or video packet
+     * header written right before it
+     */
+    int bits;
+
+    /**
+     * MB_TYPE_* flags of the chosen coding mode, intra macroblocks are
+     * MB_TYPE_INTRA4x4, skipped ones have MB_TYPE_SKIP set
+     */
+    int mb_type;
+
+    int qscale;
+
+    /**
+     * spatial variance of the source luma, the motion compensated variance
+     * left after motion estimation (0 if no motion estimation was done) and
+     * the mean of the source luma, as used by rate control
+     */
+    int var;
+    int mc_var;
+    int mean;
+}AVMBStats;
+
 #define FF_COMMON_FRAME \
     /**\
      * pointer to the picture planes.\
@@ -908,6 +942,27 @@ typedef struct AVPanScan{
      * - decoding: Set by libavcodec\
      */\
     void *hwaccel_picture_private;\
+\
+    /**\
+     * the AVCodecContext which ff_thread_get_buffer() was last called on\
+     * - encoding: Set by libavcodec.\
+     * - decoding: Set by libavcodec.\
+     */\
+    struct AVCodecContext *owner;\
+\
+    /**\
+     * used by multithreading to store frame-specific info\
+     * - encoding: Set by libavcodec.\
+     * - decoding: Set by libavcodec.\
+     */\
+    void *thread_opaque;\
+\
+    /**\
+     * buffer of the pool of avcodec_default_get_buffer() holding the data\
+     * - encoding: Set by libavcodec.\
+     * - decoding: Set by libavcodec.\
+     */\
+    void *pool_buffer;\
 
 
 #define FF_QSCALE_TYPE_MPEG1 0
@@ -1673,6 +1728,7 @@ typedef struct AVCodecContext {
 #define FF_DEBUG_VIS_QP      0x00002000
 #define FF_DEBUG_VIS_MB_TYPE 0x00004000
 #define FF_DEBUG_BUFFERS     0x00008000
+#define FF_DEBUG_THREADS     0x00010000
 
     /**
      * debug
@@ -2576,6 +2632,118 @@ typedef struct AVCodecContext {
      * - decoding: unused
      */
     int weighted_p_pred;
+
+    /**
+     * Whether this is a copy of the context which had init() called on it.
+     * This is used by multithreading - shared tables and picture pointers
+     * should be freed from the original context only.
+     * Frame threading sets it to the index of the thread owning the copy.
+     * - encoding: Set by libavcodec.
+     * - decoding: Set by libavcodec.
+     */
+    int is_copy;
+
+    /**
+     * Which multithreading methods to use.
+     * Use of FF_THREAD_FRAME will increase decoding delay by one frame per thread,
+     * so clients which cannot provide future frames should not use it.
+     *
+     * - encoding: Set by user, otherwise the default is used.
+     * - decoding: Set by user, otherwise the default is used.
+     */
+    int thread_type;
+#define FF_THREAD_FRAME   1 ///< Decode more than one frame at once
+#define FF_THREAD_SLICE   2 ///< Decode more than one part of a single frame at once
+
+    /**
+     * Which multithreading methods are in use by the codec.
+     * - encoding: Set by libavcodec.
+     * - decoding: Set by libavcodec.
+     */
+    int active_thread_type;
+
+    /**
+     * Set by the client if its custom get_buffer() callback can be called
+     * from another thread, which allows faster multithreaded decoding.
+     * draw_horiz_band() will be called from other threads regardless of this setting.
+     * Ignored if the default get_buffer() is used.
+     * - encoding: Set by user.
+     * - decoding: Set by user.
+     */
+    int thread_safe_callbacks;
+
+    /**
+     * Priority of this context's jobs in the shared thread pool, see
+     * avcodec_thread_pool_init(). Jobs of contexts with a higher value are
+     * started first.
+     * - encoding: Set by user.
+     * - decoding: Set by user.
+     */
+    int thread_priority;
+
+    /**
+     * Buffer pool used by avcodec_default_get_buffer(), can be shared by
+     * several contexts. If NULL, the context uses a pool of its own.
+     * @see avcodec_buffer_pool_alloc()
+     * - encoding: Set by user.
+     * - decoding: Set by user.
+     */
+    struct AVCodecBufferPool *buffer_pool;
+
+    /**
+     * Number of slices.
+     * Indicates the number of picture subdivisions. Used for parallelized
+     * encoding.
+     * - encoding: Set by user
+     * - decoding: unused
+     */
+    int slices;
+
+    /**
+     * Number of downscaled levels, each halving the resolution, searched
+     * coarse to fine to seed P-frame motion estimation. 0 disables it.
+     * - encoding: Set by user
+     * - decoding: unused
+     */
+    int me_pyramid_levels;
+
+    /**
+     * Buffer for per macroblock statistics, in raster order.
+     * avcodec_encode_video() fills it with the statistics of the frame it
+     * returns, if any, so no analysis of the bitstream is needed.
+     * Supported by the encoders based on MpegEncContext.
+     * - encoding: Set by user, at least mb_stats_count entries.
+     * - decoding: unused
+     */
+    AVMBStats *mb_stats;
+
+    /**
+     * Number of entries of mb_stats, must be at least
+     * ((width+15)/16) * ((height+15)/16).
+     * - encoding: Set by user.
+     * - decoding: unused
+     */
+    int mb_stats_count;
+
+    /**
+     * Number of frames after the current one that single pass rate control
+     * looks at to keep the VBV buffer from underflowing. The frames are
+     * delayed by this many frames more. 0 disables it.
+     * Needs rc_buffer_size and rc_max_rate.
+     * - encoding: Set by user
+     * - decoding: unused
+     */
+    int rc_lookahead;
+
+    /**
+     * Number of consecutive jobs of an execute() or execute2() call that a
+     * thread claims at once. Larger values lower the locking overhead of many
+     * small jobs, smaller ones balance the load better. 0 lets libavcodec
+     * choose.
+     * - encoding: Set by user or libavcodec.
+     * - decoding: Set by user or libavcodec.
+     */
+    int execute_batch;
 } AVCodecContext;
 
 /**
@@ -2617,6 +2785,26 @@ typedef struct AVCodec {
     const int *supported_samplerates;       ///< array of supported audio samplerates, or NULL if unknown, array is terminated by 0
     const enum SampleFormat *sample_fmts;   ///< array of supported sample formats, or NULL if unknown, array is terminated by -1
     const int64_t *channel_layouts;         ///< array of support channel layouts, or NULL if unknown. array is terminated by 0
+
+    /**
+     * @defgroup framethreading Frame-level threading support functions.
+     * @{
+     */
+    /**
+     * If defined, called on thread contexts when they are created.
+     * If the codec allocates writable tables in init(), re-allocate them here.
+     * priv_data will be set to a copy of the original.
+     */
+    int (*init_thread_copy)(AVCodecContext *);
+    /**
+     * Copy necessary context variables from a previous thread context to the current one.
+     * If not defined, the next thread will start automatically; otherwise, the codec
+     * must call ff_thread_finish_setup().
+     *
+     * dst and src will (rarely) point to the same context, in which case memcpy should be skipped.
+     */
+    int (*update_thread_context)(AVCodecContext *dst, AVCodecContext *src);
+    /** @} */
 } AVCodec;
 
 /**
@@ -3203,6 +3391,53 @@ AVFrame *avcodec_alloc_frame(void);
 int avcodec_default_get_buffer(AVCodecContext *s, AVFrame *pic);
 void avcodec_default_release_buffer(AVCodecContext *s, AVFrame *pic);
 int avcodec_default_reget_buffer(AVCodecContext *s, AVFrame *pic);
+
+/**
+ * Takes an additional reference to the data of a picture returned by a
+ * decoder using avcodec_default_get_buffer(), so that it stays valid
+ * without copying after the decoder has released it, even after the
+ * context has been closed.
+ *
+ * With frame threading, a lock manager must be registered with
+ * av_lockmgr_register() before the context is opened.
+ *
+ * @return 0 on success, a negative value if the picture was not allocated
+ *         by avcodec_default_get_buffer() or if frame threads are used
+ *         without a lock manager
+ */
+int avcodec_default_ref_buffer(AVFrame *pic);
+
+/**
+ * Drops a reference taken with avcodec_default_ref_buffer().
+ */
+void avcodec_default_unref_buffer(AVFrame *pic);
+
+typedef struct AVCodecBufferPool AVCodecBufferPool;
+
+/**
+ * Allocates a pool of picture buffers for avcodec_default_get_buffer(),
+ * which can be shared by several contexts through
+ * AVCodecContext.buffer_pool. Buffers are kept per memory layout and reused
+ * by all contexts with the same dimensions and pixel format.
+ * If the contexts are used from different threads, a lock manager must be
+ * registered with av_lockmgr_register() before.
+ *
+ * @return the pool or NULL on failure
+ */
+AVCodecBufferPool *avcodec_buffer_pool_alloc(void);
+
+/**
+ * Drops the reference of the caller to the pool. The pool is freed once
+ * the last context using it has been closed and all its buffers have been
+ * released.
+ */
+void avcodec_buffer_pool_free(AVCodecBufferPool **pool);
+
+/**
+ * Returns how many buffer requests were served with a free buffer of the
+ * pool and how many needed a new allocation.
+ */
+void avcodec_buffer_pool_get_stats(AVCodecBufferPool *pool, int64_t *hits, int64_t *misses);
 void avcodec_align_dimensions(AVCodecContext *s, int *width, int *height);
 
 /**
@@ -3218,6 +3453,25 @@ enum PixelFormat avcodec_default_get_format(struct AVCodecContext *s, const enum
 
 int avcodec_thread_init(AVCodecContext *s, int thread_count);
 void avcodec_thread_free(AVCodecContext *s);
+
+/**
+ * Creates a pool of threads which is shared by all codec contexts
+ * using slice threading. Contexts opened afterwards do not start threads of
+ * their own; their thread_count instead limits how many threads of the pool
+ * may work for them at the same time, and thread_priority decides which
+ * context is served first. Frame threading is not affected.
+ *
+ * @param thread_count number of threads in the pool, e.g. the number of cores
+ * @return 0 on success, a negative value if the pool exists already or
+ *         could not be created
+ */
+int avcodec_thread_pool_init(int thread_count);
+
+/**
+ * Stops the threads of the shared pool. All contexts using it must have
+ * been closed before.
+ */
+void avcodec_thread_pool_free(void);
 int avcodec_thread_execute(AVCodecContext *s, int (*func)(AVCodecContext *c2, void *arg2),void *arg, int *ret, int count, int size);
 int avcodec_default_execute(AVCodecContext *c, int (*func)(AVCodecContext *c2, void *arg2),void *arg, int *ret, int count, int size);
 int avcodec_default_execute2(AVCodecContext *c, int (*func)(AVCodecContext *c2, void *arg2, int, int),void *arg, int *ret, int count);
@@ -588,7 +588,7 @@ static int av_unused get_cabac(CABACContext *c, uint8_t * const state){
     return get_cabac_inline(c,state);
 }
 
-static int av_unused get_cabac_bypass(CABACContext *c){
+static av_always_inline int get_cabac_bypass_inline(CABACContext *c){
 #if 0 //not faster
     int bit;
     __asm__ volatile(
@@ -619,22 +619,26 @@ static int av_unused get_cabac_bypass(CABACContext *c){
     );
     return bit+1;
 #else
-    int range;
+    int range, mask;
     c->low += c->low;
 
     if(!(c->low & CABAC_MASK))
         refill(c);
 
+    /* bypass bins are close to random, avoid the branch like
+     * get_cabac_bypass_sign() does */
     range= c->range<<(CABAC_BITS+1);
-    if(c->low < range){
-        return 0;
-    }else{
-        c->low -= range;
-        return 1;
-    }
+    c->low -= range;
+    mask= c->low >> 31;
+    c->low += range & mask;
+    return mask + 1;
 #endif
 }
 
+static int av_unused get_cabac_bypass(CABACContext *c){
+    return get_cabac_bypass_inline(c);
+}
+
 
 static av_always_inline int get_cabac_bypass_sign(CABACContext *c, int val){
 #if ARCH_X86 && HAVE_EBX_AVAILABLE
@@ -51,6 +51,12 @@ void ff_lpc_compute_autocorr(const int32_t *data, int len, int lag, double *auto
 
 /* pngdec.c */
 void ff_add_png_paeth_prediction(uint8_t *dst, uint8_t *src, uint8_t *top, int w, int bpp);
+void ff_add_png_avg_prediction(uint8_t *dst, uint8_t *src, uint8_t *top, int w, int bpp);
+void ff_png_rgba_to_rgb32(uint8_t *dst, const uint8_t *src, int w);
+
+/* pngenc.c */
+void ff_sub_png_paeth_prediction(uint8_t *dst, uint8_t *src, uint8_t *top, int w, int bpp);
+void ff_sub_png_avg_prediction(uint8_t *dst, uint8_t *src, uint8_t *top, int w, int bpp);
 
 /* eaidct.c */
 void ff_ea_idct_put_c(uint8_t *dest, int linesize, DCTELEM *block);
@@ -3576,6 +3582,13 @@ static void diff_bytes_c(uint8_t *dst, uint8_t *src1, uint8_t *src2, int w){
         dst[i+0] = src1[i+0]-src2[i+0];
 }
 
+static int sum_abs_int8_c(const uint8_t *src, int w){
+    int i, sum = 0;
+    for(i=0; i<w; i++)
+        sum += abs((int8_t)src[i]);
+    return sum;
+}
+
 static void add_hfyu_median_prediction_c(uint8_t *dst, const uint8_t *src1, const uint8_t *diff, int w, int *left, int *left_top){
     int i;
     uint8_t l, lt;
@@ -4160,6 +4173,14 @@ static void vector_fmul_scalar_c(float *dst, const float *src, float mul,
         dst[i] = src[i] * mul;
 }
 
+static void vector_fmac_scalar_c(float *dst, const float *src, float mul,
+                                 int len)
+{
+    int i;
+    for (i = 0; i < len; i++)
+        dst[i] += src[i] * mul;
+}
+
 static void vector_fmul_sv_scalar_2_c(float *dst, const float *src,
                                       const float **sv, float mul, int len)
 {
@@ -4803,7 +4824,14 @@ av_cold void dsputil_init(DSPContext* c, AVCodecContext *avctx)
     c->bswap_buf= bswap_buf;
 #if CONFIG_PNG_DECODER
     c->add_png_paeth_prediction= ff_add_png_paeth_prediction;
+    c->add_png_avg_prediction= ff_add_png_avg_prediction;
+    c->png_rgba_to_rgb32= ff_png_rgba_to_rgb32;
+#endif
+#if CONFIG_PNG_ENCODER
+    c->sub_png_paeth_prediction= ff_sub_png_paeth_prediction;
+    c->sub_png_avg_prediction= ff_sub_png_avg_prediction;
 #endif
+    c->sum_abs_int8= sum_abs_int8_c;
 
     c->h264_v_loop_filter_luma= h264_v_loop_filter_luma_c;
     c->h264_h_loop_filter_luma= h264_h_loop_filter_luma_c;
@@ -4861,6 +4889,7 @@ av_cold void dsputil_init(DSPContext* c, AVCodecContext *avctx)
     c->scalarproduct_float = scalarproduct_float_c;
     c->butterflies_float = butterflies_float_c;
     c->vector_fmul_scalar = vector_fmul_scalar_c;
+    c->vector_fmac_scalar = vector_fmac_scalar_c;
 
     c->vector_fmul_sv_scalar[0] = vector_fmul_sv_scalar_2_c;
     c->vector_fmul_sv_scalar[1] = vector_fmul_sv_scalar_4_c;
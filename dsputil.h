@@ -353,6 +353,22 @@ typedef struct DSPContext {
     void (*add_hfyu_left_prediction_bgr32)(uint8_t *dst, const uint8_t *src, int w, int *red, int *green, int *blue, int *alpha);
     /* this might write to dst[w] */
     void (*add_png_paeth_prediction)(uint8_t *dst, uint8_t *src, uint8_t *top, int w, int bpp);
+    /* this might write to dst[w] */
+    void (*add_png_avg_prediction)(uint8_t *dst, uint8_t *src, uint8_t *top, int w, int bpp);
+    /**
+     * Converts w PNG RGBA pixels to native endian PIX_FMT_RGB32.
+     */
+    void (*png_rgba_to_rgb32)(uint8_t *dst, const uint8_t *src, int w);
+    /**
+     * PNG encoder row filters, dst[i] = src[i] - prediction.
+     * The prediction reads src[i - bpp] and top[i - bpp].
+     */
+    void (*sub_png_paeth_prediction)(uint8_t *dst, uint8_t *src, uint8_t *top, int w, int bpp);
+    void (*sub_png_avg_prediction)(uint8_t *dst, uint8_t *src, uint8_t *top, int w, int bpp);
+    /**
+     * Sum of the absolute values of w signed bytes.
+     */
+    int  (*sum_abs_int8)(const uint8_t *src, int w);
     void (*bswap_buf)(uint32_t *dst, const uint32_t *src, int w);
 
     void (*h264_v_loop_filter_luma)(uint8_t *pix/*align 16*/, int stride, int alpha, int beta, int8_t *tc0);
@@ -407,6 +423,17 @@ typedef struct DSPContext {
      */
     void (*vector_fmul_scalar)(float *dst, const float *src, float mul,
                                int len);
+    /**
+     * Multiply a vector of floats by a scalar float and add the result
+     * to the destination vector.  Source and destination vectors must
+     * not overlap.
+     * @param dst result vector, 16-byte aligned
+     * @param src input vector, 16-byte aligned
+     * @param mul scalar value
+     * @param len length of vector, multiple of 4
+     */
+    void (*vector_fmac_scalar)(float *dst, const float *src, float mul,
+                               int len);
     /**
      * Multiply a vector of floats by concatenated short vectors of
      * floats and by a scalar float.  Source and destination vectors
@@ -975,16 +975,26 @@ static inline void dv_guess_qnos(EncBlockInfo* blks, int* qnos)
     } while (qnos[0]|qnos[1]|qnos[2]|qnos[3]|qnos[4]);
 
 
+    /* The area bit sizes are exact here, so dropping a coefficient only
+       needs the size of its own VLC and of the run of the next one
+       updated instead of recounting every block on each pass. */
+    size[0] = 0;
+    for (j = 0, b = blks; j < 6 * 5; j++, b++)
+        size[0] += b->bit_size[0] + b->bit_size[1] + b->bit_size[2] + b->bit_size[3];
+
     for (a = 2; a == 2 || vs_total_ac_bits < size[0]; a += a){
         b = blks;
-        size[0] = 5 * 6 * 4; //EOB
         for (j = 0; j < 6 *5; j++, b++) {
             prev = b->prev[0];
             for (k = b->next[prev]; k < 64; k = b->next[k]) {
                 if (b->mb[k] < a && b->mb[k] > -a){
-                    b->next[prev] = b->next[k];
+                    int n = b->next[k];
+                    size[0] -= dv_rl2vlc_size(k - prev - 1, b->mb[k]);
+                    if (n < 64)
+                        size[0] += dv_rl2vlc_size(n - prev - 1, b->mb[n])
+                                  -dv_rl2vlc_size(n -    k - 1, b->mb[n]);
+                    b->next[prev] = n;
                 }else{
-                    size[0] += dv_rl2vlc_size(k - prev - 1, b->mb[k]);
                     prev = k;
                 }
             }
@@ -1050,3 +1050,164 @@ ec_clean:
         s->mbintra_table[mb_xy]=1;
     }
 }
+
+/**
+ * Copies the vector of an undamaged inter neighbour above or below to mv,
+ * zero if there is none.
+ */
+static void neighbour_mv(MpegEncContext *s, int mb_x, int mb_y, int dir, int16_t mv[2]){
+    int n;
+
+    mv[0]= mv[1]= 0;
+    if(!s->current_picture.motion_val[dir])
+        return;
+    for(n=-1; n<=1; n+=2){
+        const int y= mb_y + n;
+        const int mb_xy= mb_x + y*s->mb_stride;
+        int16_t *src;
+
+        if(y<0 || y>=s->mb_height)
+            continue;
+        if(s->error_status_table[mb_xy]&(DC_ERROR|AC_ERROR|MV_ERROR))
+            continue;
+        if(IS_INTRA(s->current_picture.mb_type[mb_xy]) || !USES_LIST(s->current_picture.mb_type[mb_xy], dir))
+            continue;
+        src= s->current_picture.motion_val[dir][mb_x*2 + y*2*s->b8_stride];
+        mv[0]= src[0];
+        mv[1]= src[1];
+        return;
+    }
+}
+
+/**
+ * Fills a macroblock with the average of the pixels around it, skipping
+ * damaged neighbours in the row below and to the right.
+ */
+static void put_edge_dc(MpegEncContext *s, int mb_x, int mb_y){
+    const int bottom_ok= mb_y+1 < s->mb_height &&
+        !(s->error_status_table[mb_x + (mb_y+1)*s->mb_stride]&(DC_ERROR|AC_ERROR|MV_ERROR));
+    int plane;
+
+    for(plane=0; plane<3; plane++){
+        const int w= plane ? 16>>s->chroma_x_shift : 16;
+        const int h= plane ? 16>>s->chroma_y_shift : 16;
+        const int stride= plane ? s->uvlinesize : s->linesize;
+        uint8_t *dest= s->current_picture.data[plane] + mb_x*w + mb_y*h*stride;
+        int x, y, sum= 0, count= 0, dc= 128;
+
+        if(mb_y > 0){
+            for(x=0; x<w; x++) sum+= dest[x - stride];
+            count+= w;
+        }
+        if(bottom_ok){
+            for(x=0; x<w; x++) sum+= dest[x + h*stride];
+            count+= w;
+        }
+        if(mb_x > 0){
+            for(y=0; y<h; y++) sum+= dest[y*stride - 1];
+            count+= h;
+        }
+        if(mb_x+1 < s->mb_width &&
+           !(s->error_status_table[mb_x+1 + mb_y*s->mb_stride]&(DC_ERROR|AC_ERROR|MV_ERROR))){
+            for(y=0; y<h; y++) sum+= dest[y*stride + w];
+            count+= h;
+        }
+        if(count)
+            dc= (sum + count/2) / count;
+        for(y=0; y<h; y++)
+            memset(dest + y*stride, dc, w);
+    }
+}
+
+/**
+ * Conceals the damaged macroblocks of one row of a frame picture, for
+ * decoders which hand rows on while later ones are still being decoded.
+ * The row and the row below it must be decoded and the rows above must have
+ * been passed to this function already. As only these rows are used,
+ * damaged macroblocks are simply predicted with the vector of an undamaged
+ * neighbour, or filled with the average of the pixels around them if there
+ * is no reference picture. They are marked as undamaged afterwards, so
+ * ff_er_frame_end() leaves them alone.
+ */
+void ff_er_conceal_row(MpegEncContext *s, int mb_y){
+    const int threshold= 50;
+    const int last_xy= s->mb_width-1 + FFMIN(mb_y+1, s->mb_height-1)*s->mb_stride;
+    int mb_x, distance, i, inter, any= 0;
+
+    if(!s->error_recognition || s->avctx->lowres ||
+       s->avctx->hwaccel ||
+       s->avctx->codec->capabilities&CODEC_CAP_HWACCEL_VDPAU ||
+       s->picture_structure != PICT_FRAME ||
+       (CONFIG_MPEG_XVMC_DECODER && s->avctx->xvmc_acceleration))
+        return;
+
+    /* errors are found late, so as in ff_er_frame_end() the macroblocks of
+     * the slice before one are treated as damaged too */
+    distance= 9999999;
+    for(i=last_xy; i>=mb_y*s->mb_stride; i--){
+        const int x= i % s->mb_stride;
+        int error;
+
+        if(x >= s->mb_width)
+            continue;
+        error= s->error_status_table[i];
+        if(!s->mbskip_table[i])
+            distance++;
+        if(error&(DC_ERROR|AC_ERROR|MV_ERROR))
+            distance= 0;
+        if(i < (mb_y+1)*s->mb_stride && distance < threshold){
+            s->error_status_table[i]|= DC_ERROR|AC_ERROR|MV_ERROR;
+            any= 1;
+        }
+        if(error&VP_START)
+            distance= 9999999;
+    }
+    if(!any)
+        return;
+
+    inter= s->last_picture.data[0] || (s->pict_type==FF_B_TYPE && s->next_picture.data[0]);
+
+    for(mb_x=0; mb_x<s->mb_width; mb_x++){
+        const int mb_xy= mb_x + mb_y*s->mb_stride;
+        int dir;
+
+        if(!(s->error_status_table[mb_xy]&(DC_ERROR|AC_ERROR|MV_ERROR)))
+            continue;
+
+        if(inter){
+            s->mv_dir = 0;
+            s->mv_type = MV_TYPE_16X16;
+            s->mb_intra=0;
+            s->mb_skipped=0;
+            s->current_picture.mb_type[mb_xy]= MB_TYPE_16x16;
+            for(dir=0; dir<2; dir++){
+                if(!(dir ? s->next_picture.data[0] : s->last_picture.data[0]) ||
+                   (dir && s->pict_type != FF_B_TYPE))
+                    continue;
+                s->mv_dir |= dir ? MV_DIR_BACKWARD : MV_DIR_FORWARD;
+                s->current_picture.mb_type[mb_xy] |= dir ? MB_TYPE_L1 : MB_TYPE_L0;
+                neighbour_mv(s, mb_x, mb_y, dir, s->mv[dir][0]);
+                if(s->current_picture.motion_val[dir]){
+                    const int xy= mb_x*2 + mb_y*2*s->b8_stride;
+                    for(i=0; i<4; i++){
+                        s->current_picture.motion_val[dir][xy + (i&1) + (i>>1)*s->b8_stride][0]= s->mv[dir][0][0];
+                        s->current_picture.motion_val[dir][xy + (i&1) + (i>>1)*s->b8_stride][1]= s->mv[dir][0][1];
+                    }
+                }
+            }
+
+            s->dsp.clear_blocks(s->block[0]);
+            s->mb_x= mb_x;
+            s->mb_y= mb_y;
+            decode_mb(s);
+        }else{
+            s->current_picture.mb_type[mb_xy]= MB_TYPE_INTRA4x4;
+            put_edge_dc(s, mb_x, mb_y);
+        }
+
+        if(s->pict_type!=FF_B_TYPE)
+            s->mbskip_table[mb_xy]=0;
+        s->mbintra_table[mb_xy]=1;
+        s->error_status_table[mb_xy]= (s->error_status_table[mb_xy]&VP_START) | AC_END|DC_END|MV_END;
+    }
+}
@@ -32,9 +32,13 @@
 #include "rangecoder.h"
 #include "golomb.h"
 #include "mathops.h"
+#include "thread.h"
+#include "libavutil/crc.h"
+#include "libavutil/intreadwrite.h"
 
 #define MAX_PLANES 4
 #define CONTEXT_SIZE 32
+#define MAX_SLICES 256
 
 extern const uint8_t ff_log2_run[32];
 
@@ -217,6 +221,17 @@ typedef struct FFV1Context{
     int16_t quant_table[5][256];
     int run_index;
     int colorspace;
+    int context_count;
+
+    int ec;                              ///< version 2: every slice ends with a CRC32
+    int intra;                           ///< version 2: every frame is a keyframe
+    int num_h_slices, num_v_slices;
+    int slice_count;
+    struct FFV1Context *slice_context[MAX_SLICES]; ///< slice_context[0] is the context itself
+    int slice_x, slice_y;
+    int slice_width, slice_height;
+    const uint8_t *slice_buf;            ///< decoder: start of the slice data
+    int slice_size;                      ///< decoder: size of the slice data without the trailer
 
     DSPContext dsp;
 }FFV1Context;
@@ -589,6 +604,13 @@ static void write_header(FFV1Context *f){
 
     for(i=0; i<5; i++)
         write_quant_table(c, f->quant_table[i]);
+
+    if(f->version>1){
+        put_symbol(c, state, f->num_h_slices-1, 0);
+        put_symbol(c, state, f->num_v_slices-1, 0);
+        put_rac(c, state, f->ec);
+        put_rac(c, state, f->intra);
+    }
 }
 #endif /* CONFIG_FFV1_ENCODER */
 
@@ -605,6 +627,101 @@ static av_cold int common_init(AVCodecContext *avctx){
 
     assert(s->width && s->height);
 
+    s->num_h_slices=
+    s->num_v_slices= 1;
+    s->slice_context[0]= s;
+
+    return 0;
+}
+
+/**
+ * Size of the size field and CRC that follow every slice of a version 2 frame.
+ */
+static inline int slice_trailer_size(FFV1Context *f){
+    return f->version > 1 ? 3 + 4*f->ec : 0;
+}
+
+/**
+ * Splits the picture into num_h_slices x num_v_slices slices on chroma
+ * sample boundaries and allocates the slice contexts.
+ */
+static int init_slice_contexts(FFV1Context *f){
+    const int chroma_width = -((-f->width )>>f->chroma_h_shift);
+    const int chroma_height= -((-f->height)>>f->chroma_v_shift);
+    int i;
+
+    if(   f->num_h_slices < 1 || f->num_h_slices > chroma_width
+       || f->num_v_slices < 1 || f->num_v_slices > chroma_height
+       || f->num_h_slices * f->num_v_slices > MAX_SLICES)
+        return -1;
+
+    f->slice_count= f->num_h_slices * f->num_v_slices;
+
+    for(i=0; i<f->slice_count; i++){
+        const int sx= i % f->num_h_slices;
+        const int sy= i / f->num_h_slices;
+        const int x0= (chroma_width  *  sx    / f->num_h_slices) << f->chroma_h_shift;
+        const int x1= (chroma_width  * (sx+1) / f->num_h_slices) << f->chroma_h_shift;
+        const int y0= (chroma_height *  sy    / f->num_v_slices) << f->chroma_v_shift;
+        const int y1= (chroma_height * (sy+1) / f->num_v_slices) << f->chroma_v_shift;
+        FFV1Context *fs= f->slice_context[i];
+
+        if(!fs){
+            fs= f->slice_context[i]= av_mallocz(sizeof(FFV1Context));
+            if(!fs)
+                return AVERROR(ENOMEM);
+        }
+
+        fs->slice_x     = x0;
+        fs->slice_y     = y0;
+        fs->slice_width = FFMIN(x1, f->width ) - x0;
+        fs->slice_height= FFMIN(y1, f->height) - y0;
+    }
+    return 0;
+}
+
+/**
+ * Copies the header parameters into the slice contexts and allocates their
+ * plane states for context_count contexts.
+ */
+static int init_slice_state(FFV1Context *f){
+    int i, j;
+
+    for(i=0; i<f->slice_count; i++){
+        FFV1Context *fs= f->slice_context[i];
+
+        if(fs != f){
+            fs->avctx         = f->avctx;
+            fs->version       = f->version;
+            fs->ac            = f->ac;
+            fs->colorspace    = f->colorspace;
+            fs->chroma_h_shift= f->chroma_h_shift;
+            fs->chroma_v_shift= f->chroma_v_shift;
+            fs->plane_count   = f->plane_count;
+            fs->ec            = f->ec;
+            memcpy(fs->quant_table, f->quant_table, sizeof(f->quant_table));
+        }
+
+        for(j=0; j<f->plane_count; j++){
+            PlaneContext * const p= &fs->plane[j];
+
+            if(p->context_count < f->context_count){
+                av_freep(&p->state);
+                av_freep(&p->vlc_state);
+            }
+            p->context_count= f->context_count;
+
+            if(fs->ac){
+                if(!p->state) p->state= av_malloc(CONTEXT_SIZE*p->context_count*sizeof(uint8_t));
+                if(!p->state)
+                    return AVERROR(ENOMEM);
+            }else{
+                if(!p->vlc_state) p->vlc_state= av_malloc(p->context_count*sizeof(VlcState));
+                if(!p->vlc_state)
+                    return AVERROR(ENOMEM);
+            }
+        }
+    }
     return 0;
 }
 
@@ -648,20 +765,10 @@ static av_cold int encode_init(AVCodecContext *avctx)
         }
     }
 
-    for(i=0; i<s->plane_count; i++){
-        PlaneContext * const p= &s->plane[i];
-
-        if(avctx->context_model==0){
-            p->context_count= (11*11*11+1)/2;
-        }else{
-            p->context_count= (11*11*5*5*5+1)/2;
-        }
-
-        if(s->ac){
-            if(!p->state) p->state= av_malloc(CONTEXT_SIZE*p->context_count*sizeof(uint8_t));
-        }else{
-            if(!p->vlc_state) p->vlc_state= av_malloc(p->context_count*sizeof(VlcState));
-        }
+    if(avctx->context_model==0){
+        s->context_count= (11*11*11+1)/2;
+    }else{
+        s->context_count= (11*11*5*5*5+1)/2;
     }
 
     avctx->coded_frame= &s->picture;
@@ -695,6 +802,22 @@ static av_cold int encode_init(AVCodecContext *avctx)
     }
     avcodec_get_chroma_sub_sample(avctx->pix_fmt, &s->chroma_h_shift, &s->chroma_v_shift);
 
+    if(avctx->slices > 1){
+        if(avctx->strict_std_compliance > FF_COMPLIANCE_EXPERIMENTAL){
+            av_log(avctx, AV_LOG_ERROR, "Multiple slices are still experimental and no gurantee is yet made for future compatibility\n"
+               "Use vstrict=-2 / -strict -2 to use it anyway.\n");
+            return -1;
+        }
+        s->version= 2;
+        /* at least 8 chroma rows per slice, thinner slices only cost bits */
+        s->num_v_slices= FFMIN(avctx->slices, FFMIN((-((-s->height)>>s->chroma_v_shift)+7)>>3, MAX_SLICES));
+        s->ec= 1;
+        s->intra= avctx->gop_size <= 1;
+    }
+
+    if(init_slice_contexts(s) < 0 || init_slice_state(s) < 0)
+        return -1;
+
     s->picture_number=0;
 
     return 0;
@@ -725,15 +848,69 @@ static void clear_state(FFV1Context *f){
 }
 
 #if CONFIG_FFV1_ENCODER
+static int encode_slice(AVCodecContext *avctx, void *arg){
+    FFV1Context *fs= *(void**)arg;
+    FFV1Context *f= avctx->priv_data;
+    const int width = fs->slice_width;
+    const int height= fs->slice_height;
+    const int x= fs->slice_x;
+    const int y= fs->slice_y;
+    const int ps= avctx->bits_per_raw_sample > 8 ? 2 : 1;
+    AVFrame * const p= &f->picture;
+    uint8_t * const start= fs->c.bytestream_start;
+    int used_count= 0;
+
+    if(!fs->ac){
+        if(fs == f)
+            used_count += ff_rac_terminate(&fs->c);
+//printf("pos=%d\n", used_count);
+        init_put_bits(&fs->pb, start + used_count, fs->c.bytestream_end - start - used_count);
+    }
+
+    if(f->colorspace==0){
+        const int chroma_width = -((-width )>>f->chroma_h_shift);
+        const int chroma_height= -((-height)>>f->chroma_v_shift);
+        const int cx= x>>f->chroma_h_shift;
+        const int cy= y>>f->chroma_v_shift;
+
+        encode_plane(fs, p->data[0] + ps*x + y*p->linesize[0], width, height, p->linesize[0], 0);
+
+        encode_plane(fs, p->data[1] + ps*cx + cy*p->linesize[1], chroma_width, chroma_height, p->linesize[1], 1);
+        encode_plane(fs, p->data[2] + ps*cx + cy*p->linesize[2], chroma_width, chroma_height, p->linesize[2], 1);
+    }else{
+        encode_rgb_frame(fs, (uint32_t*)(p->data[0]) + x + y*(p->linesize[0]/4), width, height, p->linesize[0]/4);
+    }
+    emms_c();
+
+    if(fs->ac){
+        used_count= ff_rac_terminate(&fs->c);
+    }else{
+        flush_put_bits(&fs->pb); //nicer padding FIXME
+        used_count += (put_bits_count(&fs->pb)+7)/8;
+    }
+
+    if(f->version > 1){
+        AV_WB24(start + used_count, used_count);
+        used_count += 3;
+        if(f->ec){
+            AV_WB32(start + used_count, av_crc(av_crc_get_table(AV_CRC_32_IEEE), 0, start, used_count));
+            used_count += 4;
+        }
+    }
+
+    return used_count;
+}
+
 static int encode_frame(AVCodecContext *avctx, unsigned char *buf, int buf_size, void *data){
     FFV1Context *f = avctx->priv_data;
     RangeCoder * const c= &f->c;
     AVFrame *pict = data;
-    const int width= f->width;
-    const int height= f->height;
     AVFrame * const p= &f->picture;
-    int used_count= 0;
+    const int trailer= slice_trailer_size(f);
+    int slice_bytes[MAX_SLICES];
     uint8_t keystate=128;
+    uint8_t *buf_p;
+    int i;
 
     ff_init_range_encoder(c, buf, buf_size);
     ff_build_rac_states(c, 0.05*(1LL<<32), 256-8);
@@ -745,51 +922,62 @@ static int encode_frame(AVCodecContext *avctx, unsigned char *buf, int buf_size,
         put_rac(c, &keystate, 1);
         p->key_frame= 1;
         write_header(f);
-        clear_state(f);
+        for(i=0; i<f->slice_count; i++)
+            clear_state(f->slice_context[i]);
     }else{
         put_rac(c, &keystate, 0);
         p->key_frame= 0;
     }
 
-    if(!f->ac){
-        used_count += ff_rac_terminate(c);
-//printf("pos=%d\n", used_count);
-        init_put_bits(&f->pb, buf + used_count, buf_size - used_count);
+    /* every slice gets an equal part of the buffer, the first one shares
+     * its range coder with the frame header */
+    for(i=0; i<f->slice_count; i++){
+        FFV1Context *fs= f->slice_context[i];
+        uint8_t *start= buf + buf_size* (int64_t) i    / f->slice_count;
+        uint8_t *end  = buf + buf_size* (int64_t)(i+1) / f->slice_count - trailer;
+
+        if(fs != f){
+            ff_init_range_encoder(&fs->c, start, end - start);
+            ff_build_rac_states(&fs->c, 0.05*(1LL<<32), 256-8);
+        }else
+            c->bytestream_end= end;
     }
 
-    if(f->colorspace==0){
-        const int chroma_width = -((-width )>>f->chroma_h_shift);
-        const int chroma_height= -((-height)>>f->chroma_v_shift);
+    avctx->execute(avctx, encode_slice, &f->slice_context[0], slice_bytes, f->slice_count, sizeof(void*));
 
-        encode_plane(f, p->data[0], width, height, p->linesize[0], 0);
+    buf_p= buf;
+    for(i=0; i<f->slice_count; i++){
+        FFV1Context *fs= f->slice_context[i];
 
-        encode_plane(f, p->data[1], chroma_width, chroma_height, p->linesize[1], 1);
-        encode_plane(f, p->data[2], chroma_width, chroma_height, p->linesize[2], 1);
-    }else{
-        encode_rgb_frame(f, (uint32_t*)(p->data[0]), width, height, p->linesize[0]/4);
+        if(fs->c.bytestream_start != buf_p)
+            memmove(buf_p, fs->c.bytestream_start, slice_bytes[i]);
+        buf_p += slice_bytes[i];
     }
-    emms_c();
 
     f->picture_number++;
 
-    if(f->ac){
-        return ff_rac_terminate(c);
-    }else{
-        flush_put_bits(&f->pb); //nicer padding FIXME
-        return used_count + (put_bits_count(&f->pb)+7)/8;
-    }
+    return buf_p - buf;
 }
 #endif /* CONFIG_FFV1_ENCODER */
 
 static av_cold int common_end(AVCodecContext *avctx){
     FFV1Context *s = avctx->priv_data;
-    int i;
+    int i, j;
+
+    for(j=MAX_SLICES-1; j>=0; j--){
+        FFV1Context *fs= s->slice_context[j];
+
+        if(!fs)
+            continue;
 
-    for(i=0; i<s->plane_count; i++){
-        PlaneContext *p= &s->plane[i];
+        for(i=0; i<MAX_PLANES; i++){
+            PlaneContext *p= &fs->plane[i];
 
-        av_freep(&p->state);
-        av_freep(&p->vlc_state);
+            av_freep(&p->state);
+            av_freep(&p->vlc_state);
+        }
+        if(fs != s)
+            av_freep(&s->slice_context[j]);
     }
 
     return 0;
@@ -1020,19 +1208,26 @@ static int read_header(FFV1Context *f){
             return -1;
         }
     }
-    context_count= (context_count+1)/2;
+    f->context_count= (context_count+1)/2;
 
-    for(i=0; i<f->plane_count; i++){
-        PlaneContext * const p= &f->plane[i];
-
-        p->context_count= context_count;
+    if(f->version>1){
+        f->num_h_slices= get_symbol(c, state, 0) + 1;
+        f->num_v_slices= get_symbol(c, state, 0) + 1;
+        f->ec   = get_rac(c, state);
+        f->intra= get_rac(c, state);
+    }else{
+        f->num_h_slices=
+        f->num_v_slices= 1;
+        f->ec   =
+        f->intra= 0;
+    }
 
-        if(f->ac){
-            if(!p->state) p->state= av_malloc(CONTEXT_SIZE*p->context_count*sizeof(uint8_t));
-        }else{
-            if(!p->vlc_state) p->vlc_state= av_malloc(p->context_count*sizeof(VlcState));
-        }
+    if(init_slice_contexts(f) < 0){
+        av_log(f->avctx, AV_LOG_ERROR, "invalid slice count %dx%d\n", f->num_h_slices, f->num_v_slices);
+        return -1;
     }
+    if(init_slice_state(f) < 0)
+        return -1;
 
     return 0;
 }
@@ -1046,19 +1241,125 @@ static av_cold int decode_init(AVCodecContext *avctx)
     return 0;
 }
 
+static av_cold int decode_init_thread_copy(AVCodecContext *avctx){
+    FFV1Context *f= avctx->priv_data;
+
+    if (!avctx->is_copy) return 0;
+
+    /* the copy starts out with the pointers of the first thread's context */
+    memset(f->plane, 0, sizeof(f->plane));
+    memset(f->slice_context, 0, sizeof(f->slice_context));
+    memset(&f->picture, 0, sizeof(f->picture));
+    f->avctx= avctx;
+    f->slice_context[0]= f;
+    f->slice_count= 0;
+
+    return 0;
+}
+
+static int decode_update_thread_context(AVCodecContext *dst, AVCodecContext *src){
+    FFV1Context *f= dst->priv_data, *f1= src->priv_data;
+    int i, j;
+
+    if(dst == src || !f1->slice_count) return 0;
+
+    f->version       = f1->version;
+    f->ac            = f1->ac;
+    f->colorspace    = f1->colorspace;
+    f->chroma_h_shift= f1->chroma_h_shift;
+    f->chroma_v_shift= f1->chroma_v_shift;
+    f->plane_count   = f1->plane_count;
+    f->context_count = f1->context_count;
+    f->ec            = f1->ec;
+    f->intra         = f1->intra;
+    f->num_h_slices  = f1->num_h_slices;
+    f->num_v_slices  = f1->num_v_slices;
+    f->picture_number= f1->picture_number;
+    memcpy(f->quant_table, f1->quant_table, sizeof(f->quant_table));
+
+    if(init_slice_contexts(f) < 0 || init_slice_state(f) < 0)
+        return -1;
+
+    /* a non-keyframe continues with the states the previous frame left */
+    if(!f->intra){
+        for(i=0; i<f->slice_count; i++){
+            for(j=0; j<f->plane_count; j++){
+                PlaneContext * const p = &f ->slice_context[i]->plane[j];
+                PlaneContext * const p1= &f1->slice_context[i]->plane[j];
+
+                if(f->ac)
+                    memcpy(p->state, p1->state, CONTEXT_SIZE*p->context_count*sizeof(uint8_t));
+                else
+                    memcpy(p->vlc_state, p1->vlc_state, p->context_count*sizeof(VlcState));
+                p->interlace_bit_state[0]= p1->interlace_bit_state[0];
+                p->interlace_bit_state[1]= p1->interlace_bit_state[1];
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int decode_slice(AVCodecContext *avctx, void *arg){
+    FFV1Context *fs= *(void**)arg;
+    FFV1Context *f= avctx->priv_data;
+    const int width = fs->slice_width;
+    const int height= fs->slice_height;
+    const int x= fs->slice_x;
+    const int y= fs->slice_y;
+    const int ps= avctx->bits_per_raw_sample > 8 ? 2 : 1;
+    AVFrame * const p= &f->picture;
+
+    if(f->version > 1 && f->ec){
+        const uint8_t *crc= fs->slice_buf + fs->slice_size + 3;
+        if(av_crc(av_crc_get_table(AV_CRC_32_IEEE), 0, fs->slice_buf, fs->slice_size + 3) != AV_RB32(crc))
+            av_log(avctx, AV_LOG_ERROR, "CRC mismatch in slice at %dx%d\n", x, y);
+    }
+
+    if(!fs->ac){
+        int bytes_read= 0;
+        if(fs == f){
+            bytes_read = fs->c.bytestream - fs->c.bytestream_start - 1;
+            if(bytes_read ==0) av_log(avctx, AV_LOG_ERROR, "error at end of AC stream\n"); //FIXME
+        }
+//printf("pos=%d\n", bytes_read);
+        init_get_bits(&fs->gb, fs->slice_buf + bytes_read, (fs->slice_size - bytes_read)*8);
+    }
+
+    if(f->colorspace==0){
+        const int chroma_width = -((-width )>>f->chroma_h_shift);
+        const int chroma_height= -((-height)>>f->chroma_v_shift);
+        const int cx= x>>f->chroma_h_shift;
+        const int cy= y>>f->chroma_v_shift;
+
+        decode_plane(fs, p->data[0] + ps*x + y*p->linesize[0], width, height, p->linesize[0], 0);
+
+        decode_plane(fs, p->data[1] + ps*cx + cy*p->linesize[1], chroma_width, chroma_height, p->linesize[1], 1);
+        decode_plane(fs, p->data[2] + ps*cx + cy*p->linesize[2], chroma_width, chroma_height, p->linesize[2], 1);
+    }else{
+        decode_rgb_frame(fs, (uint32_t*)p->data[0] + x + y*(p->linesize[0]/4), width, height, p->linesize[0]/4);
+    }
+
+    emms_c();
+
+    return 0;
+}
+
 static int decode_frame(AVCodecContext *avctx, void *data, int *data_size, AVPacket *avpkt){
     const uint8_t *buf = avpkt->data;
     int buf_size = avpkt->size;
     FFV1Context *f = avctx->priv_data;
     RangeCoder * const c= &f->c;
-    const int width= f->width;
-    const int height= f->height;
     AVFrame * const p= &f->picture;
-    int bytes_read;
+    int bytes_read, i;
     uint8_t keystate= 128;
 
     AVFrame *picture = data;
 
+    /* release previously stored data */
+    if(p->data[0])
+        ff_thread_release_buffer(avctx, p);
+
     ff_init_range_decoder(c, buf, buf_size);
     ff_build_rac_states(c, 0.05*(1LL<<32), 256-8);
 
@@ -1068,62 +1369,99 @@ static int decode_frame(AVCodecContext *avctx, void *data, int *data_size, AVPac
         p->key_frame= 1;
         if(read_header(f) < 0)
             return -1;
-        clear_state(f);
+        for(i=0; i<f->slice_count; i++)
+            clear_state(f->slice_context[i]);
     }else{
         p->key_frame= 0;
+        if(f->intra){
+            av_log(avctx, AV_LOG_ERROR, "non-keyframe in an intra-only stream\n");
+            return -1;
+        }
     }
     if(!f->plane[0].state && !f->plane[0].vlc_state)
         return -1;
 
     p->reference= 0;
-    if(avctx->get_buffer(avctx, p) < 0){
+    if(ff_thread_get_buffer(avctx, p) < 0){
         av_log(avctx, AV_LOG_ERROR, "get_buffer() failed\n");
         return -1;
     }
 
+    /* keyframes do not depend on the states of the previous frame, so the
+     * next frame can start decoding right away */
+    if(f->intra)
+        ff_thread_finish_setup(avctx);
+
     if(avctx->debug&FF_DEBUG_PICT_INFO)
         av_log(avctx, AV_LOG_ERROR, "keyframe:%d coder:%d\n", p->key_frame, f->ac);
 
-    if(!f->ac){
-        bytes_read = c->bytestream - c->bytestream_start - 1;
-        if(bytes_read ==0) av_log(avctx, AV_LOG_ERROR, "error at end of AC stream\n"); //FIXME
-//printf("pos=%d\n", bytes_read);
-        init_get_bits(&f->gb, buf + bytes_read, buf_size - bytes_read);
-    } else {
-        bytes_read = 0; /* avoid warning */
-    }
+    if(f->version > 1){
+        /* the slices are found from the end of the frame, each one is
+         * followed by its size and CRC */
+        const int trailer= slice_trailer_size(f);
+        const uint8_t *buf_p= buf + buf_size;
 
-    if(f->colorspace==0){
-        const int chroma_width = -((-width )>>f->chroma_h_shift);
-        const int chroma_height= -((-height)>>f->chroma_v_shift);
-        decode_plane(f, p->data[0], width, height, p->linesize[0], 0);
+        for(i=f->slice_count-1; i>=0; i--){
+            FFV1Context *fs= f->slice_context[i];
+            int size;
+
+            if(buf_p - buf < trailer){
+                av_log(avctx, AV_LOG_ERROR, "slice %d truncated\n", i);
+                return -1;
+            }
+            size= AV_RB24(buf_p - trailer);
+            if(size > buf_p - trailer - buf || (!i && buf_p - trailer - size != buf)){
+                av_log(avctx, AV_LOG_ERROR, "slice %d has invalid size %d\n", i, size);
+                return -1;
+            }
+            buf_p -= size + trailer;
 
-        decode_plane(f, p->data[1], chroma_width, chroma_height, p->linesize[1], 1);
-        decode_plane(f, p->data[2], chroma_width, chroma_height, p->linesize[2], 1);
+            fs->slice_buf = buf_p;
+            fs->slice_size= size;
+            if(fs != f){
+                ff_init_range_decoder(&fs->c, buf_p, size);
+                ff_build_rac_states(&fs->c, 0.05*(1LL<<32), 256-8);
+            }else
+                c->bytestream_end= (uint8_t*)buf_p + size;
+        }
     }else{
-        decode_rgb_frame(f, (uint32_t*)p->data[0], width, height, p->linesize[0]/4);
+        f->slice_buf = buf;
+        f->slice_size= buf_size;
     }
 
-    emms_c();
+    avctx->execute(avctx, decode_slice, &f->slice_context[0], NULL, f->slice_count, sizeof(void*));
+
+    if(!f->intra)
+        ff_thread_finish_setup(avctx);
 
     f->picture_number++;
 
     *picture= *p;
 
-    avctx->release_buffer(avctx, p); //FIXME
-
     *data_size = sizeof(AVFrame);
 
-    if(f->ac){
+    if(f->version > 1){
+        bytes_read= buf_size;
+    }else if(f->ac){
         bytes_read= c->bytestream - c->bytestream_start - 1;
         if(bytes_read ==0) av_log(f->avctx, AV_LOG_ERROR, "error at end of frame\n");
     }else{
+        bytes_read = c->bytestream - c->bytestream_start - 1;
         bytes_read+= (get_bits_count(&f->gb)+7)/8;
     }
 
     return bytes_read;
 }
 
+static av_cold int decode_end(AVCodecContext *avctx){
+    FFV1Context *f = avctx->priv_data;
+
+    if(f->picture.data[0])
+        ff_thread_release_buffer(avctx, &f->picture);
+
+    return common_end(avctx);
+}
+
 AVCodec ffv1_decoder = {
     "ffv1",
     CODEC_TYPE_VIDEO,
@@ -1131,11 +1469,13 @@ AVCodec ffv1_decoder = {
     sizeof(FFV1Context),
     decode_init,
     NULL,
-    common_end,
+    decode_end,
     decode_frame,
-    CODEC_CAP_DR1 /*| CODEC_CAP_DRAW_HORIZ_BAND*/,
+    CODEC_CAP_DR1 /*| CODEC_CAP_DRAW_HORIZ_BAND*/ | CODEC_CAP_FRAME_THREADS,
     NULL,
     .long_name= NULL_IF_CONFIG_SMALL("FFmpeg video codec #1"),
+    .init_thread_copy= decode_init_thread_copy,
+    .update_thread_context= decode_update_thread_context,
 };
 
 #if CONFIG_FFV1_ENCODER
@@ -36,6 +36,7 @@
 #include "golomb.h"
 #include "mathops.h"
 #include "rectangle.h"
+#include "thread.h"
 #include "vdpau_internal.h"
 
 #include "cabac.h"
@@ -45,6 +46,7 @@
 
 static void svq3_luma_dc_dequant_idct_c(DCTELEM *block, int qp);
 static void svq3_add_idct_c(uint8_t *dst, DCTELEM *block, int stride, int qp, int dc);
+static int deblock_deferred_rows(H264Context *h, int wait, int flush);
 
 static const uint8_t rem6[52]={
 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3,
@@ -370,6 +372,29 @@ static void chroma_dc_dct_c(DCTELEM *block){
 }
 #endif
 
+void ff_h264_await_reference(H264Context *h, Picture *ref, int y, int parity){
+    MpegEncContext * const s = &h->s;
+    const int field_height = 8*s->mb_height;
+
+    if(!(s->avctx->active_thread_type & FF_THREAD_FRAME))
+        return;
+
+    if(ref->field_picture){
+        /* progress of field pictures is counted in rows of each field */
+        if(parity >= 0){
+            ff_thread_await_progress((AVFrame*)ref, av_clip(y, 0, field_height-1), parity);
+        }else{
+            y = av_clip(y>>1, 0, field_height-1);
+            ff_thread_await_progress((AVFrame*)ref, y, 0);
+            ff_thread_await_progress((AVFrame*)ref, y, 1);
+        }
+    }else{
+        if(parity >= 0)
+            y = 2*av_clip(y, 0, field_height-1) + 1;
+        ff_thread_await_progress((AVFrame*)ref, av_clip(y, 0, 2*field_height-1), 0);
+    }
+}
+
 static inline void mc_dir_part(H264Context *h, Picture *pic, int n, int square, int chroma_height, int delta, int list,
                            uint8_t *dest_y, uint8_t *dest_cb, uint8_t *dest_cr,
                            int src_x_offset, int src_y_offset,
@@ -388,6 +413,9 @@ static inline void mc_dir_part(H264Context *h, Picture *pic, int n, int square,
     const int pic_width  = 16*s->mb_width;
     const int pic_height = 16*s->mb_height >> MB_FIELD;
 
+    if(s->avctx->active_thread_type & FF_THREAD_FRAME)
+        ff_h264_await_reference(h, pic, full_my + 16 + 3, MB_FIELD ? pic->reference - 1 : -1);
+
     if(mx&7) extra_width -= 3;
     if(my&7) extra_height -= 3;
 
@@ -667,6 +695,9 @@ static void free_tables(H264Context *h){
 
     av_freep(&h->mb2b_xy);
     av_freep(&h->mb2b8_xy);
+    av_freep(&h->deblock_ctx);
+    av_freep(&h->deblock_prev_ctx);
+    h->deblock_deferred = 0;
 
     for(i = 0; i < MAX_THREADS; i++) {
         hx = h->thread_context[i];
@@ -886,6 +917,14 @@ av_cold int ff_h264_decode_init(AVCodecContext *avctx){
     return 0;
 }
 
+/**
+ * Returns the number of slice decoding contexts; frame threads decode
+ * their slices one after the other with a single context.
+ */
+static inline int slice_thread_count(MpegEncContext *s){
+    return (s->avctx->active_thread_type & FF_THREAD_FRAME) ? 1 : s->avctx->thread_count;
+}
+
 int ff_h264_frame_start(H264Context *h){
     MpegEncContext * const s = &h->s;
     int i;
@@ -917,7 +956,7 @@ int ff_h264_frame_start(H264Context *h){
 
     /* can't be in alloc_tables because linesize isn't known there.
      * FIXME: redo bipred weight to not require extra buffer? */
-    for(i = 0; i < s->avctx->thread_count; i++)
+    for(i = 0; i < slice_thread_count(s); i++)
         if(!h->thread_context[i]->s.obmc_scratchpad)
             h->thread_context[i]->s.obmc_scratchpad = av_malloc(16*2*s->linesize + 8*2*s->uvlinesize);
 
@@ -938,6 +977,7 @@ int ff_h264_frame_start(H264Context *h){
 
     s->current_picture_ptr->field_poc[0]=
     s->current_picture_ptr->field_poc[1]= INT_MAX;
+    s->current_picture_ptr->field_picture= s->picture_structure != PICT_FRAME;
     assert(s->current_picture_ptr->long_ref==0);
 
     return 0;
@@ -1106,7 +1146,7 @@ static av_always_inline void hl_decode_mb_internal(H264Context *h, int simple){
         }
     } else {
         if(IS_INTRA(mb_type)){
-            if(h->deblocking_filter)
+            if(h->deblocking_filter && !h->deblock_deferred)
                 xchg_mb_border(h, dest_y, dest_cb, dest_cr, linesize, uvlinesize, 1, simple);
 
             if(simple || !CONFIG_GRAY || !(s->flags&CODEC_FLAG_GRAY)){
@@ -1192,7 +1232,7 @@ static av_always_inline void hl_decode_mb_internal(H264Context *h, int simple){
                 }else
                     svq3_luma_dc_dequant_idct_c(h->mb, s->qscale);
             }
-            if(h->deblocking_filter)
+            if(h->deblocking_filter && !h->deblock_deferred)
                 xchg_mb_border(h, dest_y, dest_cb, dest_cr, linesize, uvlinesize, 0, simple);
         }else if(is_h264){
             hl_motion(h, dest_y, dest_cb, dest_cr,
@@ -1579,7 +1619,134 @@ static void init_scan_tables(H264Context *h){
     }
 }
 
-static void field_end(H264Context *h){
+static av_cold int decode_init_thread_copy(AVCodecContext *avctx){
+    H264Context *h= avctx->priv_data;
+
+    if (!avctx->is_copy) return 0;
+
+    /* the copy starts out with the state of the first thread's context
+     * right after init, before anything was allocated */
+    memset(h->sps_buffers, 0, sizeof(h->sps_buffers));
+    memset(h->pps_buffers, 0, sizeof(h->pps_buffers));
+    h->s.avctx = avctx;
+    h->thread_context[0] = h;
+
+    return 0;
+}
+
+static void copy_parameter_set(void **to, void **from, int count, int size){
+    int i;
+
+    for (i=0; i<count; i++){
+        if (to[i] && !from[i]) av_freep(&to[i]);
+        else if (from[i] && !to[i]) to[i] = av_malloc(size);
+
+        if (from[i]) memcpy(to[i], from[i], size);
+    }
+}
+
+#define copy_fields(to, from, start_field, end_field) memcpy(&to->start_field, &from->start_field, (char*)&to->end_field - (char*)&to->start_field)
+
+static int decode_update_thread_context(AVCodecContext *dst, AVCodecContext *src){
+    H264Context *h= dst->priv_data, *h1= src->priv_data;
+    MpegEncContext * const s = &h->s, * const s1 = &h1->s;
+    int inited = s->context_initialized, err;
+    int i;
+
+    if(dst == src) return 0;
+
+    /* parameter sets may arrive in a packet without any slice */
+    copy_parameter_set((void**)h->sps_buffers, (void**)h1->sps_buffers, MAX_SPS_COUNT, sizeof(SPS));
+    copy_parameter_set((void**)h->pps_buffers, (void**)h1->pps_buffers, MAX_PPS_COUNT, sizeof(PPS));
+    h->sps             = h1->sps;
+    h->pps             = h1->pps;
+    h->is_avc          = h1->is_avc;
+    h->got_avcC        = h1->got_avcC;
+    h->nal_length_size = h1->nal_length_size;
+    h->x264_build      = h1->x264_build;
+
+    if(!s1->context_initialized) return 0;
+
+    err = ff_mpeg_update_thread_context(dst, src);
+    if(err) return err;
+
+    if(!inited){
+        for(i = 0; i < MAX_SPS_COUNT; i++)
+            av_freep(h->sps_buffers + i);
+        for(i = 0; i < MAX_PPS_COUNT; i++)
+            av_freep(h->pps_buffers + i);
+
+        memcpy(&h->s + 1, &h1->s + 1, sizeof(H264Context) - sizeof(MpegEncContext)); //copy all fields after MpegEnc
+        memset(h->sps_buffers, 0, sizeof(h->sps_buffers));
+        memset(h->pps_buffers, 0, sizeof(h->pps_buffers));
+        memset(h->thread_context, 0, sizeof(h->thread_context));
+        memset(h->rbsp_buffer, 0, sizeof(h->rbsp_buffer));
+        memset(h->rbsp_buffer_size, 0, sizeof(h->rbsp_buffer_size));
+        h->deblock_ctx = NULL;
+        h->deblock_prev_ctx = NULL;
+        copy_parameter_set((void**)h->sps_buffers, (void**)h1->sps_buffers, MAX_SPS_COUNT, sizeof(SPS));
+        copy_parameter_set((void**)h->pps_buffers, (void**)h1->pps_buffers, MAX_PPS_COUNT, sizeof(PPS));
+
+        h->thread_context[0] = h;
+        init_scan_tables(h);
+        if(ff_h264_alloc_tables(h) < 0 || context_init(h) < 0)
+            return -1;
+    }
+
+    //extradata/NAL handling
+    h->dequant_coeff_pps = h1->dequant_coeff_pps;
+    memcpy(h->dequant4_buffer, h1->dequant4_buffer, sizeof(h->dequant4_buffer));
+    memcpy(h->dequant8_buffer, h1->dequant8_buffer, sizeof(h->dequant8_buffer));
+    for(i = 0; i < 6; i++)
+        h->dequant4_coeff[i] = h1->dequant4_coeff[i] ? h->dequant4_buffer[0] + (h1->dequant4_coeff[i] - h1->dequant4_buffer[0]) : NULL;
+    for(i = 0; i < 2; i++)
+        h->dequant8_coeff[i] = h1->dequant8_coeff[i] ? h->dequant8_buffer[0] + (h1->dequant8_coeff[i] - h1->dequant8_buffer[0]) : NULL;
+
+    //POC timing
+    copy_fields(h, h1, poc_lsb, use_weight);
+
+    //reference lists
+    h->ref_count[0]    = h1->ref_count[0];
+    h->ref_count[1]    = h1->ref_count[1];
+    h->list_count      = h1->list_count;
+    h->long_ref_count  = h1->long_ref_count;
+    h->short_ref_count = h1->short_ref_count;
+    for(i = 0; i < 32; i++){
+        h->short_ref[i] = REBASE_PICTURE(h1->short_ref[i], s, s1);
+        h->long_ref[i]  = REBASE_PICTURE(h1->long_ref[i],  s, s1);
+    }
+    for(i = 0; i < MAX_DELAYED_PIC_COUNT+2; i++)
+        h->delayed_pic[i] = REBASE_PICTURE(h1->delayed_pic[i], s, s1);
+    h->outputed_poc = h1->outputed_poc;
+
+    memcpy(h->mmco, h1->mmco, sizeof(h->mmco));
+    h->mmco_index = h1->mmco_index;
+
+    h->last_slice_type       = h1->last_slice_type;
+    h->prev_interlaced_frame = h1->prev_interlaced_frame;
+
+    if(!s->current_picture_ptr) return 0;
+
+    /* the source thread left the reference marking of its last picture
+     * to us, see field_end() */
+    if(!s->dropable) {
+        ff_h264_execute_ref_pic_marking(h, h->mmco, h->mmco_index);
+        h->prev_poc_msb = h->poc_msb;
+        h->prev_poc_lsb = h->poc_lsb;
+    }
+    h->prev_frame_num_offset = h->frame_num_offset;
+    h->prev_frame_num        = h->frame_num;
+
+    return 0;
+}
+
+/**
+ * Finishes decoding of the current field or frame.
+ *
+ * @param in_setup 1 if called while the next frame thread may not have
+ *                 started yet, i.e. between two fields of the same packet
+ */
+static void field_end(H264Context *h, int in_setup){
     MpegEncContext * const s = &h->s;
     AVCodecContext * const avctx= s->avctx;
     s->mb_y= 0;
@@ -1590,13 +1757,18 @@ static void field_end(H264Context *h){
     if (CONFIG_H264_VDPAU_DECODER && s->avctx->codec->capabilities&CODEC_CAP_HWACCEL_VDPAU)
         ff_vdpau_h264_set_reference_frames(s);
 
-    if(!s->dropable) {
-        ff_h264_execute_ref_pic_marking(h, h->mmco, h->mmco_index);
-        h->prev_poc_msb= h->poc_msb;
-        h->prev_poc_lsb= h->poc_lsb;
+    /* with frame threading the marking is done by the next thread in
+     * decode_update_thread_context(), as this thread's slices still
+     * need the reference lists as they are now */
+    if (in_setup || !(avctx->active_thread_type & FF_THREAD_FRAME)) {
+        if(!s->dropable) {
+            ff_h264_execute_ref_pic_marking(h, h->mmco, h->mmco_index);
+            h->prev_poc_msb= h->poc_msb;
+            h->prev_poc_lsb= h->poc_lsb;
+        }
+        h->prev_frame_num_offset= h->frame_num_offset;
+        h->prev_frame_num= h->frame_num;
     }
-    h->prev_frame_num_offset= h->frame_num_offset;
-    h->prev_frame_num= h->frame_num;
 
     if (avctx->hwaccel) {
         if (avctx->hwaccel->end_frame(avctx) < 0)
@@ -1606,6 +1778,12 @@ static void field_end(H264Context *h){
     if (CONFIG_H264_VDPAU_DECODER && s->avctx->codec->capabilities&CODEC_CAP_HWACCEL_VDPAU)
         ff_vdpau_h264_picture_complete(s);
 
+    /* rows followed by missing slices have not been deblocked yet */
+    if (h->deblock_deferred) {
+        deblock_deferred_rows(h->deblock_ctx, 0, 1);
+        h->deblock_deferred = 0;
+    }
+
     /*
      * FIXME: Error handling code does not seem to support interlaced
      * when slices span multiple rows
@@ -1618,8 +1796,19 @@ static void field_end(H264Context *h){
      * past end by one (callers fault) and resync_mb_y != 0
      * causes problems for the first MB line, too.
      */
-    if (!FIELD_PICTURE)
+    if (!FIELD_PICTURE){
+        if ((avctx->active_thread_type & FF_THREAD_FRAME) && s->error_count){
+            /* concealment may copy from the reference frames */
+            if (s->last_picture_ptr && s->last_picture_ptr->data[0])
+                ff_h264_await_reference(h, s->last_picture_ptr, INT_MAX, -1);
+            if (s->next_picture_ptr && s->next_picture_ptr->data[0])
+                ff_h264_await_reference(h, s->next_picture_ptr, INT_MAX, -1);
+        }
         ff_er_frame_end(s);
+    }
+
+    ff_thread_report_progress((AVFrame*)s->current_picture_ptr, INT_MAX,
+                              s->picture_structure == PICT_BOTTOM_FIELD);
 
     MPV_frame_end(s);
 
@@ -1686,7 +1875,7 @@ static int decode_slice_header(H264Context *h, H264Context *h0){
 
     if(first_mb_in_slice == 0){ //FIXME better field boundary detection
         if(h0->current_slice && FIELD_PICTURE){
-            field_end(h);
+            field_end(h, 1);
         }
 
         h0->current_slice = 0;
@@ -1756,8 +1945,10 @@ static int decode_slice_header(H264Context *h, H264Context *h0){
 
     if (s->context_initialized
         && (   s->width != s->avctx->width || s->height != s->avctx->height)) {
-        if(h != h0)
+        if(h != h0 || (s->avctx->active_thread_type & FF_THREAD_FRAME)){
+            av_log_missing_feature(s->avctx, "Width/height changing with threads is", 0);
             return -1;   // width / height changed during parallelized decoding
+        }
         free_tables(h);
         flush_dpb(s->avctx);
         MPV_common_end(s);
@@ -1798,7 +1989,7 @@ static int decode_slice_header(H264Context *h, H264Context *h0){
         init_scan_tables(h);
         ff_h264_alloc_tables(h);
 
-        for(i = 1; i < s->avctx->thread_count; i++) {
+        for(i = 1; i < slice_thread_count(s); i++) {
             H264Context *c;
             c = h->thread_context[i] = av_malloc(sizeof(H264Context));
             memcpy(c, h->s.thread_context[i], sizeof(MpegEncContext));
@@ -1809,7 +2000,7 @@ static int decode_slice_header(H264Context *h, H264Context *h0){
             clone_tables(c, h);
         }
 
-        for(i = 0; i < s->avctx->thread_count; i++)
+        for(i = 0; i < slice_thread_count(s); i++)
             if(context_init(h->thread_context[i]) < 0)
                 return -1;
     }
@@ -1840,6 +2031,8 @@ static int decode_slice_header(H264Context *h, H264Context *h0){
             h->prev_frame_num++;
             h->prev_frame_num %= 1<<h->sps.log2_max_frame_num;
             s->current_picture_ptr->frame_num= h->prev_frame_num;
+            ff_thread_report_progress((AVFrame*)s->current_picture_ptr, INT_MAX, 0);
+            ff_thread_report_progress((AVFrame*)s->current_picture_ptr, INT_MAX, 1);
             ff_h264_execute_ref_pic_marking(h, NULL, 0);
         }
 
@@ -1855,6 +2048,8 @@ static int decode_slice_header(H264Context *h, H264Context *h0){
                  * Previous field is unmatched. Don't display it, but let it
                  * remain for reference if marked as such.
                  */
+                ff_thread_report_progress((AVFrame*)s0->current_picture_ptr, INT_MAX,
+                                          last_pic_structure == PICT_TOP_FIELD);
                 s0->current_picture_ptr = NULL;
                 s0->first_field = FIELD_PICTURE;
 
@@ -1868,6 +2063,8 @@ static int decode_slice_header(H264Context *h, H264Context *h0){
                      * pair. Throw away previous field except for reference
                      * purposes.
                      */
+                    ff_thread_report_progress((AVFrame*)s0->current_picture_ptr, INT_MAX,
+                                              last_pic_structure == PICT_TOP_FIELD);
                     s0->first_field = 1;
                     s0->current_picture_ptr = NULL;
 
@@ -2083,6 +2280,24 @@ static int decode_slice_header(H264Context *h, H264Context *h0){
         slice_group_change_cycle= get_bits(&s->gb, ?);
 #endif
 
+    if(h0->current_slice == 0){
+        /* deferred deblocking needs the slices to be decoded one at a time */
+        h0->deblock_deferred = 0;
+        if(   (s->avctx->flags2 & CODEC_FLAG2_DEFER_DEBLOCK) && h->deblocking_filter
+           && (s->avctx->active_thread_type & FF_THREAD_SLICE) && s->avctx->thread_count > 1
+           && h0->max_contexts == 1 && !FIELD_OR_MBAFF_PICTURE
+           && !s->avctx->hwaccel && !(s->avctx->codec->capabilities&CODEC_CAP_HWACCEL_VDPAU)){
+            if(!h0->deblock_ctx)
+                h0->deblock_ctx = av_malloc(sizeof(H264Context));
+            if(!h0->deblock_prev_ctx)
+                h0->deblock_prev_ctx = av_malloc(sizeof(H264Context));
+            h0->deblock_deferred = h0->deblock_ctx && h0->deblock_prev_ctx;
+        }
+        h0->deblock_row = 0;
+        h0->deblock_rows_decoded = 0;
+        h0->deblock_prev_rows = 0;
+    }
+
     h0->last_slice_type = slice_type;
     h->slice_num = ++h0->current_slice;
     if(h->slice_num >= MAX_SLICES){
@@ -2122,7 +2337,9 @@ static int decode_slice_header(H264Context *h, H264Context *h0){
                           +(h->ref_list[j][i].reference&3);
     }
 
-    h->emu_edge_width= (s->flags&CODEC_FLAG_EMU_EDGE) ? 0 : 16;
+    /* the edges of pictures decoded by other frame threads are not ready
+     * until the whole picture is, so always emulate them in that case */
+    h->emu_edge_width= (s->flags&CODEC_FLAG_EMU_EDGE) || (s->avctx->active_thread_type & FF_THREAD_FRAME) ? 0 : 16;
     h->emu_edge_height= (FRAME_MBAFF || FIELD_PICTURE) ? 0 : h->emu_edge_width;
 
     s->avctx->refs= h->sps.ref_frame_count;
@@ -2205,7 +2422,8 @@ static void loop_filter(H264Context *h){
                     linesize   = h->mb_linesize   = s->linesize;
                     uvlinesize = h->mb_uvlinesize = s->uvlinesize;
                 }
-                backup_mb_border(h, dest_y, dest_cb, dest_cr, linesize, uvlinesize, !is_complex);
+                if(!h->deblock_deferred)
+                    backup_mb_border(h, dest_y, dest_cb, dest_cr, linesize, uvlinesize, !is_complex);
                 if(fill_filter_caches(h, mb_type) < 0)
                     continue;
                 h->chroma_qp[0] = get_chroma_qp(h, 0, s->current_picture.qscale_table[mb_xy]);
@@ -2224,6 +2442,77 @@ static void loop_filter(H264Context *h){
     s->mb_y= end_mb_y - FRAME_MBAFF;
 }
 
+/**
+ * Tells later frame threads how far the current picture is finished after
+ * a macroblock row has been decoded and deblocked.
+ */
+static void report_row_progress(H264Context *h){
+    MpegEncContext * const s = &h->s;
+    int top, height;
+
+    if(!(s->avctx->active_thread_type & FF_THREAD_FRAME))
+        return;
+
+    top    = 16*(s->mb_y >> FIELD_PICTURE);
+    height = 16 << FRAME_MBAFF;
+    /* deblocking the next row still modifies the bottom lines of this one */
+    if(h->deblocking_filter)
+        height -= 4 << FRAME_MBAFF;
+
+    ff_thread_report_progress((AVFrame*)s->current_picture_ptr, top + height - 1,
+                              s->picture_structure == PICT_BOTTOM_FIELD);
+}
+
+/**
+ * Called after a macroblock row has been decoded.
+ */
+static void decode_finish_row(H264Context *h){
+    MpegEncContext * const s = &h->s;
+
+    if(h->deblock_deferred){
+        h->deblock_rows_decoded = s->mb_y + 1;
+        ff_thread_report_row_progress(s->avctx, s->mb_y);
+        return;
+    }
+
+    loop_filter(h);
+    report_row_progress(h);
+    ff_draw_horiz_band(s, 16*s->mb_y, 16);
+}
+
+/**
+ * Deblocks the decoded rows of the current picture which are not needed
+ * unfiltered anymore, that is all rows but the last one decoded, unless
+ * that is the bottom row of the picture.
+ * Rows finished by the previous slice are deblocked with its parameters.
+ *
+ * @param h the deblocking context, see decode_slice_deferred()
+ * @param wait whether to wait for the decoding job to finish rows
+ * @param flush deblock the last decoded row as well
+ */
+static int deblock_deferred_rows(H264Context *h, int wait, int flush){
+    H264Context * const h0 = h->deblock_parent;
+    MpegEncContext * const s = &h->s;
+    int row;
+
+    for(row = h0->deblock_row; row < s->mb_height; row++){
+        const int next = FFMIN(row + 1, s->mb_height - 1);
+        H264Context * const hr = row < h0->deblock_prev_rows ? h0->deblock_prev_ctx : h;
+
+        if(wait)
+            ff_thread_await_row_progress(s->avctx, next);
+        if(h0->deblock_rows_decoded <= (flush ? row : next))
+            break;
+
+        hr->s.mb_y = row;
+        loop_filter(hr);
+        ff_draw_horiz_band(&hr->s, 16*row, 16);
+    }
+    h0->deblock_row = row;
+
+    return 0;
+}
+
 static int decode_slice(struct AVCodecContext *avctx, void *arg){
     H264Context *h = *(void**)arg;
     MpegEncContext * const s = &h->s;
@@ -2272,8 +2561,7 @@ static int decode_slice(struct AVCodecContext *avctx, void *arg){
 
             if( ++s->mb_x >= s->mb_width ) {
                 s->mb_x = 0;
-                loop_filter(h);
-                ff_draw_horiz_band(s, 16*s->mb_y, 16);
+                decode_finish_row(h);
                 ++s->mb_y;
                 if(FIELD_OR_MBAFF_PICTURE) {
                     ++s->mb_y;
@@ -2310,8 +2598,7 @@ static int decode_slice(struct AVCodecContext *avctx, void *arg){
 
             if(++s->mb_x >= s->mb_width){
                 s->mb_x=0;
-                loop_filter(h);
-                ff_draw_horiz_band(s, 16*s->mb_y, 16);
+                decode_finish_row(h);
                 ++s->mb_y;
                 if(FIELD_OR_MBAFF_PICTURE) {
                     ++s->mb_y;
@@ -2394,6 +2681,66 @@ static int decode_slice(struct AVCodecContext *avctx, void *arg){
     return -1; //not reached
 }
 
+static int decode_slice_deferred_job(struct AVCodecContext *avctx, void *arg){
+    H264Context *h = *(void**)arg;
+    MpegEncContext * const s = &h->s;
+    int ret, row;
+
+    if(h->deblock_parent)
+        return deblock_deferred_rows(h, 1, 0);
+
+    ret = decode_slice(avctx, arg);
+
+    /* wake up the deblocking job, deblock_rows_decoded tells it where to stop */
+    for(row = h->deblock_rows_decoded; row < s->mb_height; row++)
+        ff_thread_report_row_progress(avctx, row);
+
+    return ret;
+}
+
+/**
+ * Decodes a slice while a second slice thread deblocks the rows decoded
+ * so far. Intra prediction of a row uses the unfiltered pixels of the row
+ * above, so a row is only deblocked once the row below it is decoded.
+ *
+ * @param h h264 master context, decoding the slice
+ */
+static void decode_slice_deferred(H264Context *h){
+    MpegEncContext * const s = &h->s;
+    AVCodecContext * const avctx= s->avctx;
+    H264Context *hf = h->deblock_ctx;
+    H264Context *args[2];
+    int row;
+
+    /* the row held back by the slice which finished it keeps that slice's
+     * snapshot, so that it is filtered with its deblocking parameters */
+    if(h->deblock_rows_decoded > h->deblock_prev_rows){
+        if(h->deblock_row < h->deblock_rows_decoded){
+            FFSWAP(H264Context*, h->deblock_ctx, h->deblock_prev_ctx);
+            hf = h->deblock_ctx;
+        }
+        h->deblock_prev_rows = h->deblock_rows_decoded;
+    }
+
+    /* the deblocking job needs its own caches, the slice parameters
+     * and tables are those of the slice being decoded */
+    memcpy(hf, h, sizeof(*hf));
+    hf->deblock_parent = h;
+
+    if(ff_thread_init_row_progress(avctx, s->mb_height) < 0){
+        decode_slice(avctx, &h);
+        deblock_deferred_rows(hf, 0, 0);
+        return;
+    }
+    for(row = h->deblock_row; row < h->deblock_rows_decoded; row++)
+        ff_thread_report_row_progress(avctx, row);
+
+    /* only the first job may wait for row progress */
+    args[0] = hf;
+    args[1] = h;
+    avctx->execute(avctx, decode_slice_deferred_job, args, NULL, 2, sizeof(void*));
+}
+
 /**
  * Call decode_slice() for each context.
  *
@@ -2411,7 +2758,10 @@ static void execute_decode_slices(H264Context *h, int context_count){
     if(s->avctx->codec->capabilities&CODEC_CAP_HWACCEL_VDPAU)
         return;
     if(context_count == 1) {
-        decode_slice(avctx, &h);
+        if(h->deblock_deferred)
+            decode_slice_deferred(h);
+        else
+            decode_slice(avctx, &h);
     } else {
         for(i = 1; i < context_count; i++) {
             hx = h->thread_context[i];
@@ -2434,6 +2784,239 @@ static void execute_decode_slices(H264Context *h, int context_count){
 }
 
 
+/**
+ * Decides which picture, if any, is output for the current one and
+ * stores it in h->next_output_pic. With frame threading this runs once the
+ * first slice header of the picture is parsed, so later threads may start.
+ *
+ * @param setup_finished whether ff_thread_finish_setup() may be called
+ */
+static void decode_postinit(H264Context *h, int setup_finished){
+    MpegEncContext * const s = &h->s;
+    Picture *out = s->current_picture_ptr;
+    Picture *cur = s->current_picture_ptr;
+    int i, pics, out_of_order, out_idx;
+    int mmco_reset_pending = 0, saved_poc[3];
+
+    if (h->next_output_pic) return;
+
+    if (cur->field_poc[0]==INT_MAX || cur->field_poc[1]==INT_MAX) {
+        /* Wait for second field. */
+        if (setup_finished)
+            ff_thread_finish_setup(s->avctx);
+        return;
+    }
+
+    cur->qscale_type= FF_QSCALE_TYPE_H264;
+    cur->pict_type= s->pict_type;
+
+    /* With frame threading the reference marking of this picture is only
+     * executed by the next thread, but an MMCO_RESET in it zeroes its POC
+     * and must be taken into account for output ordering already. */
+    if ((s->avctx->active_thread_type & FF_THREAD_FRAME) && !s->dropable) {
+        for (i = 0; i < h->mmco_index; i++)
+            if (h->mmco[i].opcode == MMCO_RESET)
+                mmco_reset_pending = 1;
+    }
+    if (mmco_reset_pending) {
+        saved_poc[0] = cur->poc;
+        saved_poc[1] = cur->field_poc[0];
+        saved_poc[2] = cur->field_poc[1];
+        cur->poc = cur->field_poc[0] = cur->field_poc[1] = 0;
+        cur->mmco_reset = 1;
+    }
+
+    cur->interlaced_frame = 0;
+    cur->repeat_pict = 0;
+
+    /* Signal interlacing information externally. */
+    /* Prioritize picture timing SEI information over used decoding process if it exists. */
+
+    if(h->sps.pic_struct_present_flag){
+        switch (h->sei_pic_struct)
+        {
+        case SEI_PIC_STRUCT_FRAME:
+            break;
+        case SEI_PIC_STRUCT_TOP_FIELD:
+        case SEI_PIC_STRUCT_BOTTOM_FIELD:
+            cur->interlaced_frame = 1;
+            break;
+        case SEI_PIC_STRUCT_TOP_BOTTOM:
+        case SEI_PIC_STRUCT_BOTTOM_TOP:
+            if (FIELD_OR_MBAFF_PICTURE)
+                cur->interlaced_frame = 1;
+            else
+                // try to flag soft telecine progressive
+                cur->interlaced_frame = h->prev_interlaced_frame;
+            break;
+        case SEI_PIC_STRUCT_TOP_BOTTOM_TOP:
+        case SEI_PIC_STRUCT_BOTTOM_TOP_BOTTOM:
+            // Signal the possibility of telecined film externally (pic_struct 5,6)
+            // From these hints, let the applications decide if they apply deinterlacing.
+            cur->repeat_pict = 1;
+            break;
+        case SEI_PIC_STRUCT_FRAME_DOUBLING:
+            // Force progressive here, as doubling interlaced frame is a bad idea.
+            cur->repeat_pict = 2;
+            break;
+        case SEI_PIC_STRUCT_FRAME_TRIPLING:
+            cur->repeat_pict = 4;
+            break;
+        }
+
+        if ((h->sei_ct_type & 3) && h->sei_pic_struct <= SEI_PIC_STRUCT_BOTTOM_TOP)
+            cur->interlaced_frame = (h->sei_ct_type & (1<<1)) != 0;
+    }else{
+        /* Derive interlacing flag from used decoding process. */
+        cur->interlaced_frame = FIELD_OR_MBAFF_PICTURE;
+    }
+    h->prev_interlaced_frame = cur->interlaced_frame;
+
+    if (cur->field_poc[0] != cur->field_poc[1]){
+        /* Derive top_field_first from field pocs. */
+        cur->top_field_first = cur->field_poc[0] < cur->field_poc[1];
+    }else{
+        if(cur->interlaced_frame || h->sps.pic_struct_present_flag){
+            /* Use picture timing SEI information. Even if it is a information of a past frame, better than nothing. */
+            if(h->sei_pic_struct == SEI_PIC_STRUCT_TOP_BOTTOM
+              || h->sei_pic_struct == SEI_PIC_STRUCT_TOP_BOTTOM_TOP)
+                cur->top_field_first = 1;
+            else
+                cur->top_field_first = 0;
+        }else{
+            /* Most likely progressive */
+            cur->top_field_first = 0;
+        }
+    }
+
+//FIXME do something with unavailable reference frames
+
+    /* Sort B-frames into display order */
+
+    if(h->sps.bitstream_restriction_flag
+       && s->avctx->has_b_frames < h->sps.num_reorder_frames){
+        s->avctx->has_b_frames = h->sps.num_reorder_frames;
+        s->low_delay = 0;
+    }
+
+    if(   s->avctx->strict_std_compliance >= FF_COMPLIANCE_STRICT
+       && !h->sps.bitstream_restriction_flag){
+        s->avctx->has_b_frames= MAX_DELAYED_PIC_COUNT;
+        s->low_delay= 0;
+    }
+
+    pics = 0;
+    while(h->delayed_pic[pics]) pics++;
+
+    assert(pics <= MAX_DELAYED_PIC_COUNT);
+
+    h->delayed_pic[pics++] = cur;
+    if(cur->reference == 0)
+        cur->reference = DELAYED_PIC_REF;
+
+    out = h->delayed_pic[0];
+    out_idx = 0;
+    for(i=1; h->delayed_pic[i] && !h->delayed_pic[i]->key_frame && !h->delayed_pic[i]->mmco_reset; i++)
+        if(h->delayed_pic[i]->poc < out->poc){
+            out = h->delayed_pic[i];
+            out_idx = i;
+        }
+    if(s->avctx->has_b_frames == 0 && (h->delayed_pic[0]->key_frame || h->delayed_pic[0]->mmco_reset))
+        h->outputed_poc= INT_MIN;
+    out_of_order = out->poc < h->outputed_poc;
+
+    if(h->sps.bitstream_restriction_flag && s->avctx->has_b_frames >= h->sps.num_reorder_frames)
+        { }
+    else if((out_of_order && pics-1 == s->avctx->has_b_frames && s->avctx->has_b_frames < MAX_DELAYED_PIC_COUNT)
+       || (s->low_delay &&
+        ((h->outputed_poc != INT_MIN && out->poc > h->outputed_poc + 2)
+         || cur->pict_type == FF_B_TYPE)))
+    {
+        s->low_delay = 0;
+        s->avctx->has_b_frames++;
+    }
+
+    if(out_of_order || pics > s->avctx->has_b_frames){
+        out->reference &= ~DELAYED_PIC_REF;
+        for(i=out_idx; h->delayed_pic[i]; i++)
+            h->delayed_pic[i] = h->delayed_pic[i+1];
+    }
+    if(!out_of_order && pics > s->avctx->has_b_frames){
+        h->next_output_pic = out;
+
+        if(out_idx==0 && h->delayed_pic[0] && (h->delayed_pic[0]->key_frame || h->delayed_pic[0]->mmco_reset)) {
+            h->outputed_poc = INT_MIN;
+        } else
+            h->outputed_poc = out->poc;
+    }else{
+        av_log(s->avctx, AV_LOG_DEBUG, "no picture\n");
+    }
+
+    if (mmco_reset_pending) {
+        cur->poc          = saved_poc[0];
+        cur->field_poc[0] = saved_poc[1];
+        cur->field_poc[1] = saved_poc[2];
+    }
+
+    if (setup_finished)
+        ff_thread_finish_setup(s->avctx);
+}
+
+/**
+ * Finds the number of NAL units a frame thread has to parse before the next
+ * thread can start: up to the last parameter set or first slice of a picture.
+ * Only the NAL framing is looked at, mirroring decode_nal_units().
+ */
+static int find_setup_nals(H264Context *h, const uint8_t *buf, int buf_size){
+    int buf_index = 0, nal_index = 0, nals_needed = 0;
+    int next_avc= h->is_avc ? 0 : buf_size;
+
+    for(;;){
+        int i, nalsize = 0;
+
+        if(buf_index >= next_avc) {
+            if(buf_index >= buf_size) break;
+            for(i = 0; i < h->nal_length_size; i++)
+                nalsize = (nalsize << 8) | buf[buf_index++];
+            if(nalsize <= 1 || nalsize > buf_size - buf_index){
+                if(nalsize == 1){
+                    buf_index++;
+                    continue;
+                }else
+                    break;
+            }
+            next_avc= buf_index + nalsize;
+        } else {
+            for(; buf_index + 3 < next_avc; buf_index++){
+                if(buf[buf_index] == 0 && buf[buf_index+1] == 0 && buf[buf_index+2] == 1)
+                    break;
+            }
+
+            if(buf_index+3 >= buf_size) break;
+
+            buf_index+=3;
+            if(buf_index >= next_avc) continue;
+        }
+
+        nal_index++;
+        switch(buf[buf_index] & 0x1F){
+        case NAL_SLICE:
+        case NAL_IDR_SLICE:
+        case NAL_DPA:
+            // first_mb_in_slice == 0 is coded as a single set bit
+            if(buf_index + 1 >= next_avc || !(buf[buf_index+1] & 0x80))
+                break;
+        case NAL_SPS:
+        case NAL_PPS:
+            nals_needed = nal_index;
+        }
+
+        buf_index = h->is_avc ? next_avc : buf_index + 1;
+    }
+
+    return nals_needed;
+}
+
 static int decode_nal_units(H264Context *h, const uint8_t *buf, int buf_size){
     MpegEncContext * const s = &h->s;
     AVCodecContext * const avctx= s->avctx;
@@ -2441,8 +3024,9 @@ static int decode_nal_units(H264Context *h, const uint8_t *buf, int buf_size){
     H264Context *hx; ///< thread context
     int context_count = 0;
     int next_avc= h->is_avc ? 0 : buf_size;
+    int nal_index = 0, nals_needed = 0;
 
-    h->max_contexts = avctx->thread_count;
+    h->max_contexts = slice_thread_count(s);
 #if 0
     int i;
     for(i=0; i<50; i++){
@@ -2456,6 +3040,9 @@ static int decode_nal_units(H264Context *h, const uint8_t *buf, int buf_size){
         ff_h264_reset_sei(h);
     }
 
+    if (avctx->active_thread_type & FF_THREAD_FRAME)
+        nals_needed = find_setup_nals(h, buf, buf_size);
+
     for(;;){
         int consumed;
         int dst_length;
@@ -2512,6 +3099,7 @@ static int decode_nal_units(H264Context *h, const uint8_t *buf, int buf_size){
         }
 
         buf_index += consumed;
+        nal_index++;
 
         if(  (s->hurry_up == 1 && h->nal_ref_idc  == 0) //FIXME do not discard SEI id
            ||(avctx->skip_frame >= AVDISCARD_NONREF && h->nal_ref_idc  == 0))
@@ -2543,6 +3131,9 @@ static int decode_nal_units(H264Context *h, const uint8_t *buf, int buf_size){
             s->current_picture_ptr->key_frame |=
                     (hx->nal_unit_type == NAL_IDR_SLICE) ||
                     (h->sei_recovery_frame_cnt >= 0);
+
+            if ((avctx->active_thread_type & FF_THREAD_FRAME) && h->current_slice == 1)
+                decode_postinit(h, nal_index >= nals_needed);
             if(hx->redundant_pic_count==0 && hx->s.hurry_up < 5
                && (avctx->skip_frame < AVDISCARD_NONREF || hx->nal_ref_idc)
                && (avctx->skip_frame < AVDISCARD_BIDIR  || hx->slice_type_nos!=FF_B_TYPE)
@@ -2568,6 +3159,9 @@ static int decode_nal_units(H264Context *h, const uint8_t *buf, int buf_size){
             if ((err = decode_slice_header(hx, h)) < 0)
                 break;
 
+            if ((avctx->active_thread_type & FF_THREAD_FRAME) && h->current_slice == 1)
+                decode_postinit(h, nal_index >= nals_needed);
+
             hx->s.data_partitioning = 1;
 
             break;
@@ -2688,6 +3282,11 @@ static int decode_frame(AVCodecContext *avctx,
             *pict= *(AVFrame*)out;
         }
 
+        /* the last picture was completed in an earlier call; make sure the
+         * next frame thread does not execute its reference marking again */
+        if(avctx->active_thread_type & FF_THREAD_FRAME)
+            s->current_picture_ptr = NULL;
+
         return 0;
     }
 
@@ -2738,9 +3337,17 @@ static int decode_frame(AVCodecContext *avctx,
         h->got_avcC = 1;
     }
 
+    h->next_output_pic = NULL;
+
     buf_index=decode_nal_units(h, buf, buf_size);
-    if(buf_index < 0)
+    if(buf_index < 0){
+        /* do not leave later frame threads waiting for this picture */
+        if(s->current_picture_ptr){
+            ff_thread_report_progress((AVFrame*)s->current_picture_ptr, INT_MAX, 0);
+            ff_thread_report_progress((AVFrame*)s->current_picture_ptr, INT_MAX, 1);
+        }
         return -1;
+    }
 
     if(!(s->flags2 & CODEC_FLAG2_CHUNKS) && !s->current_picture_ptr){
         if (avctx->skip_frame >= AVDISCARD_NONREF || s->hurry_up) return 0;
@@ -2749,143 +3356,18 @@ static int decode_frame(AVCodecContext *avctx,
     }
 
     if(!(s->flags2 & CODEC_FLAG2_CHUNKS) || (s->mb_y >= s->mb_height && s->mb_height)){
-        Picture *out = s->current_picture_ptr;
-        Picture *cur = s->current_picture_ptr;
-        int i, pics, out_of_order, out_idx;
+        field_end(h, 0);
 
-        field_end(h);
+        if(!(avctx->active_thread_type & FF_THREAD_FRAME))
+            decode_postinit(h, 0);
 
-        if (cur->field_poc[0]==INT_MAX || cur->field_poc[1]==INT_MAX) {
+        if (!h->next_output_pic) {
             /* Wait for second field. */
             *data_size = 0;
 
         } else {
-            cur->interlaced_frame = 0;
-            cur->repeat_pict = 0;
-
-            /* Signal interlacing information externally. */
-            /* Prioritize picture timing SEI information over used decoding process if it exists. */
-
-            if(h->sps.pic_struct_present_flag){
-                switch (h->sei_pic_struct)
-                {
-                case SEI_PIC_STRUCT_FRAME:
-                    break;
-                case SEI_PIC_STRUCT_TOP_FIELD:
-                case SEI_PIC_STRUCT_BOTTOM_FIELD:
-                    cur->interlaced_frame = 1;
-                    break;
-                case SEI_PIC_STRUCT_TOP_BOTTOM:
-                case SEI_PIC_STRUCT_BOTTOM_TOP:
-                    if (FIELD_OR_MBAFF_PICTURE)
-                        cur->interlaced_frame = 1;
-                    else
-                        // try to flag soft telecine progressive
-                        cur->interlaced_frame = h->prev_interlaced_frame;
-                    break;
-                case SEI_PIC_STRUCT_TOP_BOTTOM_TOP:
-                case SEI_PIC_STRUCT_BOTTOM_TOP_BOTTOM:
-                    // Signal the possibility of telecined film externally (pic_struct 5,6)
-                    // From these hints, let the applications decide if they apply deinterlacing.
-                    cur->repeat_pict = 1;
-                    break;
-                case SEI_PIC_STRUCT_FRAME_DOUBLING:
-                    // Force progressive here, as doubling interlaced frame is a bad idea.
-                    cur->repeat_pict = 2;
-                    break;
-                case SEI_PIC_STRUCT_FRAME_TRIPLING:
-                    cur->repeat_pict = 4;
-                    break;
-                }
-
-                if ((h->sei_ct_type & 3) && h->sei_pic_struct <= SEI_PIC_STRUCT_BOTTOM_TOP)
-                    cur->interlaced_frame = (h->sei_ct_type & (1<<1)) != 0;
-            }else{
-                /* Derive interlacing flag from used decoding process. */
-                cur->interlaced_frame = FIELD_OR_MBAFF_PICTURE;
-            }
-            h->prev_interlaced_frame = cur->interlaced_frame;
-
-            if (cur->field_poc[0] != cur->field_poc[1]){
-                /* Derive top_field_first from field pocs. */
-                cur->top_field_first = cur->field_poc[0] < cur->field_poc[1];
-            }else{
-                if(cur->interlaced_frame || h->sps.pic_struct_present_flag){
-                    /* Use picture timing SEI information. Even if it is a information of a past frame, better than nothing. */
-                    if(h->sei_pic_struct == SEI_PIC_STRUCT_TOP_BOTTOM
-                      || h->sei_pic_struct == SEI_PIC_STRUCT_TOP_BOTTOM_TOP)
-                        cur->top_field_first = 1;
-                    else
-                        cur->top_field_first = 0;
-                }else{
-                    /* Most likely progressive */
-                    cur->top_field_first = 0;
-                }
-            }
-
-        //FIXME do something with unavailable reference frames
-
-            /* Sort B-frames into display order */
-
-            if(h->sps.bitstream_restriction_flag
-               && s->avctx->has_b_frames < h->sps.num_reorder_frames){
-                s->avctx->has_b_frames = h->sps.num_reorder_frames;
-                s->low_delay = 0;
-            }
-
-            if(   s->avctx->strict_std_compliance >= FF_COMPLIANCE_STRICT
-               && !h->sps.bitstream_restriction_flag){
-                s->avctx->has_b_frames= MAX_DELAYED_PIC_COUNT;
-                s->low_delay= 0;
-            }
-
-            pics = 0;
-            while(h->delayed_pic[pics]) pics++;
-
-            assert(pics <= MAX_DELAYED_PIC_COUNT);
-
-            h->delayed_pic[pics++] = cur;
-            if(cur->reference == 0)
-                cur->reference = DELAYED_PIC_REF;
-
-            out = h->delayed_pic[0];
-            out_idx = 0;
-            for(i=1; h->delayed_pic[i] && !h->delayed_pic[i]->key_frame && !h->delayed_pic[i]->mmco_reset; i++)
-                if(h->delayed_pic[i]->poc < out->poc){
-                    out = h->delayed_pic[i];
-                    out_idx = i;
-                }
-            if(s->avctx->has_b_frames == 0 && (h->delayed_pic[0]->key_frame || h->delayed_pic[0]->mmco_reset))
-                h->outputed_poc= INT_MIN;
-            out_of_order = out->poc < h->outputed_poc;
-
-            if(h->sps.bitstream_restriction_flag && s->avctx->has_b_frames >= h->sps.num_reorder_frames)
-                { }
-            else if((out_of_order && pics-1 == s->avctx->has_b_frames && s->avctx->has_b_frames < MAX_DELAYED_PIC_COUNT)
-               || (s->low_delay &&
-                ((h->outputed_poc != INT_MIN && out->poc > h->outputed_poc + 2)
-                 || cur->pict_type == FF_B_TYPE)))
-            {
-                s->low_delay = 0;
-                s->avctx->has_b_frames++;
-            }
-
-            if(out_of_order || pics > s->avctx->has_b_frames){
-                out->reference &= ~DELAYED_PIC_REF;
-                for(i=out_idx; h->delayed_pic[i]; i++)
-                    h->delayed_pic[i] = h->delayed_pic[i+1];
-            }
-            if(!out_of_order && pics > s->avctx->has_b_frames){
-                *data_size = sizeof(AVFrame);
-
-                if(out_idx==0 && h->delayed_pic[0] && (h->delayed_pic[0]->key_frame || h->delayed_pic[0]->mmco_reset)) {
-                    h->outputed_poc = INT_MIN;
-                } else
-                    h->outputed_poc = out->poc;
-                *pict= *(AVFrame*)out;
-            }else{
-                av_log(avctx, AV_LOG_DEBUG, "no picture\n");
-            }
+            *data_size = sizeof(AVFrame);
+            *pict = *(AVFrame*)h->next_output_pic;
         }
     }
 
@@ -3128,10 +3610,12 @@ AVCodec h264_decoder = {
     NULL,
     ff_h264_decode_end,
     decode_frame,
-    /*CODEC_CAP_DRAW_HORIZ_BAND |*/ CODEC_CAP_DR1 | CODEC_CAP_DELAY,
+    /*CODEC_CAP_DRAW_HORIZ_BAND |*/ CODEC_CAP_DR1 | CODEC_CAP_DELAY | CODEC_CAP_FRAME_THREADS,
     .flush= flush_dpb,
     .long_name = NULL_IF_CONFIG_SMALL("H.264 / AVC / MPEG-4 AVC / MPEG-4 part 10"),
     .pix_fmts= ff_hwaccel_pixfmt_list_420,
+    .init_thread_copy= decode_init_thread_copy,
+    .update_thread_context= decode_update_thread_context,
 };
 
 #if CONFIG_H264_VDPAU_DECODER
@@ -440,6 +440,7 @@ typedef struct H264Context{
     int ref2frm[MAX_SLICES][2][64];  ///< reference to frame number lists, used in the loop filter, the first 2 are for -2,-1
     Picture *delayed_pic[MAX_DELAYED_PIC_COUNT+2]; //FIXME size?
     int outputed_poc;
+    Picture *next_output_pic;   ///< picture to return from the current decode_frame() call
 
     /**
      * memory management control operations buffer.
@@ -520,6 +521,18 @@ typedef struct H264Context{
     int single_decode_warning;
 
     int last_slice_type;
+
+    /**
+     * 1 if the current picture is deblocked by a separate slice thread
+     * behind decoding, see CODEC_FLAG2_DEFER_DEBLOCK, 0 otherwise
+     */
+    int deblock_deferred;
+    int deblock_row;                    ///< first macroblock row not deblocked yet
+    int deblock_rows_decoded;           ///< number of completely decoded macroblock rows
+    struct H264Context *deblock_ctx;    ///< context used by the deferred deblocking job
+    struct H264Context *deblock_prev_ctx; ///< deblock_ctx of the previous slice, for the rows it finished
+    int deblock_prev_rows;              ///< rows finished before the current slice, deblocked with deblock_prev_ctx
+    struct H264Context *deblock_parent; ///< decoding context, only set in deblock_ctx
     /** @} */
 
     int mb_xy;
@@ -655,6 +668,14 @@ int ff_h264_check_intra_pred_mode(H264Context *h, int mode);
 void ff_h264_write_back_intra_pred_mode(H264Context *h);
 void ff_h264_hl_decode_mb(H264Context *h);
 int ff_h264_frame_start(H264Context *h);
+
+/**
+ * Waits until line y of a reference picture is decoded by the frame thread
+ * producing it. Does nothing unless frame threading is active.
+ * @param y line in field rows if parity >= 0, in frame rows otherwise
+ * @param parity 0/1 for the top/bottom field of ref, -1 for the whole frame
+ */
+void ff_h264_await_reference(H264Context *h, Picture *ref, int y, int parity);
 av_cold int ff_h264_decode_init(AVCodecContext *avctx);
 av_cold int ff_h264_decode_end(AVCodecContext *avctx);
 av_cold void ff_h264_decode_init_vlc(void);
@@ -1115,20 +1115,7 @@ static av_always_inline void decode_cabac_residual_internal( H264Context *h, DCT
      *      5-> Luma8x8   n = 4 * luma8x8idx
      */
 
-    /* read coded block flag */
-    if( is_dc || cat != 5 ) {
-        if( get_cabac( CC, &h->cabac_state[85 + get_cabac_cbf_ctx( h, cat, n, is_dc ) ] ) == 0 ) {
-            if( !is_dc )
-                h->non_zero_count_cache[scan8[n]] = 0;
-
-#ifdef CABAC_ON_STACK
-            h->cabac.range     = cc.range     ;
-            h->cabac.low       = cc.low       ;
-            h->cabac.bytestream= cc.bytestream;
-#endif
-            return;
-        }
-    }
+    /* the coded block flag, if any, has been read by the caller */
 
     significant_coeff_ctx_base = h->cabac_state
         + significant_coeff_flag_offset[MB_FIELD][cat];
@@ -1141,10 +1128,10 @@ static av_always_inline void decode_cabac_residual_internal( H264Context *h, DCT
 #define DECODE_SIGNIFICANCE( coefs, sig_off, last_off ) \
         for(last= 0; last < coefs; last++) { \
             uint8_t *sig_ctx = significant_coeff_ctx_base + sig_off; \
-            if( get_cabac( CC, sig_ctx )) { \
+            if( get_cabac_inline( CC, sig_ctx )) { \
                 uint8_t *last_ctx = last_coeff_ctx_base + last_off; \
                 index[coeff_count++] = last; \
-                if( get_cabac( CC, last_ctx ) ) { \
+                if( get_cabac_inline( CC, last_ctx ) ) { \
                     last= max_coeff; \
                     break; \
                 } \
@@ -1180,12 +1167,15 @@ static av_always_inline void decode_cabac_residual_internal( H264Context *h, DCT
         }
     }
 
+    /* all bins of the significance map and of the levels are decoded
+     * inline, get_cabac() and get_cabac_bypass() are not inlined in the
+     * rest of the file and a call per bin is measurable at high bitrates */
     do {
         uint8_t *ctx = coeff_abs_level1_ctx[node_ctx] + abs_level_m1_ctx_base;
 
         int j= scantable[index[--coeff_count]];
 
-        if( get_cabac( CC, ctx ) == 0 ) {
+        if( get_cabac_inline( CC, ctx ) == 0 ) {
             node_ctx = coeff_abs_level_transition[0][node_ctx];
             if( is_dc ) {
                 block[j] = get_cabac_bypass_sign( CC, -1);
@@ -1197,19 +1187,19 @@ static av_always_inline void decode_cabac_residual_internal( H264Context *h, DCT
             ctx = coeff_abs_levelgt1_ctx[node_ctx] + abs_level_m1_ctx_base;
             node_ctx = coeff_abs_level_transition[1][node_ctx];
 
-            while( coeff_abs < 15 && get_cabac( CC, ctx ) ) {
+            while( coeff_abs < 15 && get_cabac_inline( CC, ctx ) ) {
                 coeff_abs++;
             }
 
             if( coeff_abs >= 15 ) {
                 int j = 0;
-                while( get_cabac_bypass( CC ) ) {
+                while( get_cabac_bypass_inline( CC ) ) {
                     j++;
                 }
 
                 coeff_abs=1;
                 while( j-- ) {
-                    coeff_abs += coeff_abs + get_cabac_bypass( CC );
+                    coeff_abs += coeff_abs + get_cabac_bypass_inline( CC );
                 }
                 coeff_abs+= 14;
             }
@@ -1229,23 +1219,39 @@ static av_always_inline void decode_cabac_residual_internal( H264Context *h, DCT
 
 }
 
-#if !CONFIG_SMALL
-static void decode_cabac_residual_dc( H264Context *h, DCTELEM *block, int cat, int n, const uint8_t *scantable, const uint32_t *qmul, int max_coeff ) {
+#if CONFIG_SMALL
+static av_noinline void decode_cabac_residual_small( H264Context *h, DCTELEM *block, int cat, int n, const uint8_t *scantable, const uint32_t *qmul, int max_coeff ) {
+    decode_cabac_residual_internal(h, block, cat, n, scantable, qmul, max_coeff, cat == 0 || cat == 3);
+}
+#define decode_cabac_residual_dc_internal    decode_cabac_residual_small
+#define decode_cabac_residual_nondc_internal decode_cabac_residual_small
+#else
+static av_noinline void decode_cabac_residual_dc_internal( H264Context *h, DCTELEM *block, int cat, int n, const uint8_t *scantable, const uint32_t *qmul, int max_coeff ) {
     decode_cabac_residual_internal(h, block, cat, n, scantable, qmul, max_coeff, 1);
 }
 
-static void decode_cabac_residual_nondc( H264Context *h, DCTELEM *block, int cat, int n, const uint8_t *scantable, const uint32_t *qmul, int max_coeff ) {
+static av_noinline void decode_cabac_residual_nondc_internal( H264Context *h, DCTELEM *block, int cat, int n, const uint8_t *scantable, const uint32_t *qmul, int max_coeff ) {
     decode_cabac_residual_internal(h, block, cat, n, scantable, qmul, max_coeff, 0);
 }
 #endif
 
-static void decode_cabac_residual( H264Context *h, DCTELEM *block, int cat, int n, const uint8_t *scantable, const uint32_t *qmul, int max_coeff ) {
-#if CONFIG_SMALL
-    decode_cabac_residual_internal(h, block, cat, n, scantable, qmul, max_coeff, cat == 0 || cat == 3);
-#else
-    if( cat == 0 || cat == 3 ) decode_cabac_residual_dc(h, block, cat, n, scantable, qmul, max_coeff);
-    else decode_cabac_residual_nondc(h, block, cat, n, scantable, qmul, max_coeff);
-#endif
+/* Most coded blocks of a high bitrate stream are still empty, so the
+ * coded block flag is read inline by the callers and the residual
+ * decoder (with its on-stack CABAC state) is only entered when needed. */
+static av_always_inline void decode_cabac_residual_dc( H264Context *h, DCTELEM *block, int cat, int n, const uint8_t *scantable, int max_coeff ) {
+    /* read coded block flag */
+    if( get_cabac( &h->cabac, &h->cabac_state[85 + get_cabac_cbf_ctx( h, cat, n, 1 ) ] ) == 0 )
+        return;
+    decode_cabac_residual_dc_internal( h, block, cat, n, scantable, NULL, max_coeff );
+}
+
+static av_always_inline void decode_cabac_residual_nondc( H264Context *h, DCTELEM *block, int cat, int n, const uint8_t *scantable, const uint32_t *qmul, int max_coeff ) {
+    /* read coded block flag */
+    if( cat != 5 && get_cabac( &h->cabac, &h->cabac_state[85 + get_cabac_cbf_ctx( h, cat, n, 0 ) ] ) == 0 ) {
+        h->non_zero_count_cache[scan8[n]] = 0;
+        return;
+    }
+    decode_cabac_residual_nondc_internal( h, block, cat, n, scantable, qmul, max_coeff );
 }
 
 static inline void compute_mb_neighbors(H264Context *h)
@@ -1709,13 +1715,13 @@ decode_intra_mb:
         if( IS_INTRA16x16( mb_type ) ) {
             int i;
             //av_log( s->avctx, AV_LOG_ERROR, "INTRA16x16 DC\n" );
-            decode_cabac_residual( h, h->mb, 0, 0, dc_scan, NULL, 16);
+            decode_cabac_residual_dc( h, h->mb, 0, 0, dc_scan, 16);
 
             if( cbp&15 ) {
                 qmul = h->dequant4_coeff[0][s->qscale];
                 for( i = 0; i < 16; i++ ) {
                     //av_log( s->avctx, AV_LOG_ERROR, "INTRA16x16 AC:%d\n", i );
-                    decode_cabac_residual(h, h->mb + 16*i, 1, i, scan + 1, qmul, 15);
+                    decode_cabac_residual_nondc(h, h->mb + 16*i, 1, i, scan + 1, qmul, 15);
                 }
             } else {
                 fill_rectangle(&h->non_zero_count_cache[scan8[0]], 4, 4, 8, 0, 1);
@@ -1725,7 +1731,7 @@ decode_intra_mb:
             for( i8x8 = 0; i8x8 < 4; i8x8++ ) {
                 if( cbp & (1<<i8x8) ) {
                     if( IS_8x8DCT(mb_type) ) {
-                        decode_cabac_residual(h, h->mb + 64*i8x8, 5, 4*i8x8,
+                        decode_cabac_residual_nondc(h, h->mb + 64*i8x8, 5, 4*i8x8,
                             scan8x8, h->dequant8_coeff[IS_INTRA( mb_type ) ? 0:1][s->qscale], 64);
                     } else {
                         qmul = h->dequant4_coeff[IS_INTRA( mb_type ) ? 0:3][s->qscale];
@@ -1733,7 +1739,7 @@ decode_intra_mb:
                             const int index = 4*i8x8 + i4x4;
                             //av_log( s->avctx, AV_LOG_ERROR, "Luma4x4: %d\n", index );
 //START_TIMER
-                            decode_cabac_residual(h, h->mb + 16*index, 2, index, scan, qmul, 16);
+                            decode_cabac_residual_nondc(h, h->mb + 16*index, 2, index, scan, qmul, 16);
 //STOP_TIMER("decode_residual")
                         }
                     }
@@ -1748,7 +1754,7 @@ decode_intra_mb:
             int c;
             for( c = 0; c < 2; c++ ) {
                 //av_log( s->avctx, AV_LOG_ERROR, "INTRA C%d-DC\n",c );
-                decode_cabac_residual(h, h->mb + 256 + 16*4*c, 3, c, chroma_dc_scan, NULL, 4);
+                decode_cabac_residual_dc(h, h->mb + 256 + 16*4*c, 3, c, chroma_dc_scan, 4);
             }
         }
 
@@ -1759,7 +1765,7 @@ decode_intra_mb:
                 for( i = 0; i < 4; i++ ) {
                     const int index = 16 + 4 * c + i;
                     //av_log( s->avctx, AV_LOG_ERROR, "INTRA C%d-AC %d\n",c, index - 16 );
-                    decode_cabac_residual(h, h->mb + 16*index, 4, index, scan + 1, qmul, 15);
+                    decode_cabac_residual_nondc(h, h->mb + 16*index, 4, index, scan + 1, qmul, 15);
                 }
             }
         } else {
@@ -1785,3 +1791,133 @@ decode_intra_mb:
 
     return 0;
 }
+
+#ifdef TEST
+#undef printf
+#include "libavutil/lfg.h"
+
+#define COUNT 20000
+#define SIZE  (COUNT*64)
+
+/**
+ * Writes the significance map and the levels of a 4x4 luma block (cat 2,
+ * frame macroblock), the inverse of decode_cabac_residual_internal().
+ */
+static void put_cabac_residual(CABACContext *c, uint8_t *state, const int *coeff){
+    static const uint8_t abs_level1_ctx[8] = { 1, 2, 3, 4, 0, 0, 0, 0 };
+    static const uint8_t abs_levelgt1_ctx[8] = { 5, 5, 5, 5, 6, 7, 8, 9 };
+    static const uint8_t abs_level_transition[2][8] = {
+        { 1, 2, 3, 3, 4, 5, 6, 7 },
+        { 4, 4, 4, 4, 5, 6, 7, 7 }
+    };
+    int i, k, last= 0, node_ctx= 0;
+
+    for(i=0; i<16; i++)
+        if(coeff[i])
+            last= i;
+
+    for(i=0; i<last; i++){
+        put_cabac(c, state + 105+29 + i, coeff[i] != 0);
+        if(coeff[i])
+            put_cabac(c, state + 166+29 + i, 0);
+    }
+    if(last < 15){
+        put_cabac(c, state + 105+29 + last, 1);
+        put_cabac(c, state + 166+29 + last, 1);
+    }
+
+    for(i=last; i>=0; i--){
+        int coeff_abs= FFABS(coeff[i]);
+
+        if(!coeff_abs)
+            continue;
+        put_cabac(c, state + 227+20 + abs_level1_ctx[node_ctx], coeff_abs > 1);
+        if(coeff_abs > 1){
+            uint8_t *ctx= state + 227+20 + abs_levelgt1_ctx[node_ctx];
+
+            for(k=2; k<FFMIN(coeff_abs, 15); k++)
+                put_cabac(c, ctx, 1);
+            if(coeff_abs < 15)
+                put_cabac(c, ctx, 0);
+            else{
+                int v= coeff_abs - 14, n= av_log2(v);
+
+                for(k=0; k<n; k++)
+                    put_cabac_bypass(c, 1);
+                put_cabac_bypass(c, 0);
+                while(n--)
+                    put_cabac_bypass(c, (v>>n)&1);
+            }
+        }
+        node_ctx= abs_level_transition[coeff_abs > 1][node_ctx];
+        put_cabac_bypass(c, coeff[i] < 0);
+    }
+}
+
+int main(void){
+    static int coeff[COUNT][16];
+    static uint8_t buf[SIZE];
+    uint8_t state[460];
+    uint8_t scantable[16];
+    uint32_t qmul[16];
+    DCTELEM block[16];
+    CABACContext c;
+    H264Context *h;
+    AVLFG prng;
+    int i, j;
+
+    h= av_mallocz(sizeof(H264Context));
+    h->cbp_table= av_mallocz(sizeof(*h->cbp_table));
+
+    av_lfg_init(&prng, 1);
+    for(i=0; i<460; i++)
+        state[i]= av_lfg_get(&prng) % 126;
+    for(i=0; i<16; i++){
+        scantable[i]= i;
+        qmul[i]= 16 + 4*(i&3);
+    }
+
+    /* high bitrate statistics: dense low frequencies, mostly small levels */
+    for(i=0; i<COUNT; i++){
+        for(j=0; j<16; j++){
+            int r= av_lfg_get(&prng) % 100;
+            int v= 0;
+
+            if(r < (j < 4 ? 80 : j < 8 ? 45 : 15)){
+                r= av_lfg_get(&prng) % 100;
+                v= r < 60 ? 1 : r < 85 ? 2 + r%3 : r < 97 ? 5 + r%10 : 15 + av_lfg_get(&prng)%200;
+                if(av_lfg_get(&prng)&1)
+                    v= -v;
+            }
+            coeff[i][j]= v;
+        }
+        coeff[i][0] |= !coeff[i][0];
+    }
+
+    ff_init_cabac_encoder(&c, buf, SIZE);
+    ff_init_cabac_states(&c);
+    memcpy(h->cabac_state, state, sizeof(state));
+    for(i=0; i<COUNT; i++)
+        put_cabac_residual(&c, h->cabac_state, coeff[i]);
+    put_cabac_terminate(&c, 1);
+
+    ff_init_cabac_decoder(&h->cabac, buf, SIZE);
+    memcpy(h->cabac_state, state, sizeof(state));
+    for(i=0; i<COUNT; i++){
+        memset(block, 0, sizeof(block));
+START_TIMER
+        decode_cabac_residual_nondc_internal(h, block, 2, 0, scantable, qmul, 16);
+STOP_TIMER("decode_cabac_residual")
+        for(j=0; j<16; j++){
+            if(block[j] != (DCTELEM)((coeff[i][j] * qmul[j] + 32) >> 6)){
+                av_log(NULL, AV_LOG_ERROR, "residual mismatch in block %d at %d\n", i, j);
+                return 1;
+            }
+        }
+    }
+
+    av_free(h->cbp_table);
+    av_free(h);
+    return 0;
+}
+#endif /* TEST */
@@ -144,6 +144,9 @@ void ff_h264_pred_direct_motion(H264Context * const h, int *mb_type){
 
     assert(h->ref_list[1][0].reference&3);
 
+    /* the co-located macroblock pair has to be decoded already */
+    ff_h264_await_reference(h, &h->ref_list[1][0], 16*((s->mb_y|1)+1) - 1, -1);
+
 #define MB_TYPE_16x16_OR_INTRA (MB_TYPE_16x16|MB_TYPE_INTRA4x4|MB_TYPE_INTRA16x16|MB_TYPE_INTRA_PCM)
 
     if(IS_INTERLACED(h->ref_list[1][0].mb_type[mb_xy])){ // AFL/AFR/FR/FL -> AFL/FL
@@ -1074,10 +1074,7 @@ static void pred8x8_horizontal_add_c(uint8_t *pix, const int *block_offset, cons
 }
 
 
-/**
- * Sets the intra prediction function pointers.
- */
-void ff_h264_pred_init(H264PredContext *h, int codec_id){
+static void h264_pred_init_c(H264PredContext *h, int codec_id){
 //    MpegEncContext * const s = &h->s;
 
     if(codec_id != CODEC_ID_RV40){
@@ -1172,6 +1169,140 @@ void ff_h264_pred_init(H264PredContext *h, int codec_id){
     h->pred8x8_add  [ HOR_PRED8x8]= pred8x8_horizontal_add_c;
     h->pred16x16_add[VERT_PRED8x8]= pred16x16_vertical_add_c;
     h->pred16x16_add[ HOR_PRED8x8]= pred16x16_horizontal_add_c;
+}
+
+/**
+ * Sets the intra prediction function pointers.
+ */
+void ff_h264_pred_init(H264PredContext *h, int codec_id){
+    h264_pred_init_c(h, codec_id);
 
     if (ARCH_ARM) ff_h264_pred_init_arm(h, codec_id);
+    if (HAVE_MMX) ff_h264_pred_init_x86(h, codec_id);
+}
+
+#ifdef TEST
+#undef printf
+#include <stdio.h>
+#include "libavutil/lfg.h"
+
+#define STRIDE 64
+#define ITERATIONS 2000
+
+static AVLFG prng;
+
+/**
+ * Fills the buffer with random pixels, every fourth run
+ * with only black and white ones to stress the clipping.
+ */
+static void fill_random(uint8_t *buf, int size, int iteration)
+{
+    int i;
+    for (i = 0; i < size; i++) {
+        buf[i] = av_lfg_get(&prng);
+        if (!(iteration & 3))
+            buf[i] = buf[i] & 1 ? 255 : 0;
+    }
+}
+
+static int report(const char *size, int mode, int codec_id,
+                  int has_topleft, int has_topright)
+{
+    printf("pred%s[%d] codec %d topleft %d topright %d: mismatch\n",
+           size, mode, codec_id, has_topleft, has_topright);
+    return 1;
+}
+
+/**
+ * Checks all prediction functions replaced by the architecture specific
+ * init against the C reference, on a block in the middle of a random
+ * 64x48 picture; the whole picture has to match, not just the block.
+ */
+int main(void)
+{
+    static const int codec_ids[] = { CODEC_ID_H264, CODEC_ID_SVQ3, CODEC_ID_RV40 };
+    DECLARE_ALIGNED_16(uint8_t, buf_c  )[STRIDE*48];
+    DECLARE_ALIGNED_16(uint8_t, buf_opt)[STRIDE*48];
+    uint8_t *src_c   = buf_c   + 16*STRIDE + 16;
+    uint8_t *src_opt = buf_opt + 16*STRIDE + 16;
+    H264PredContext c, opt;
+    int i, j, k, it, ret = 0, tested = 0;
+
+    av_lfg_init(&prng, 1);
+
+    for (i = 0; i < FF_ARRAY_ELEMS(codec_ids); i++) {
+        const int codec_id = codec_ids[i];
+        h264_pred_init_c(&c, codec_id);
+        ff_h264_pred_init(&opt, codec_id);
+
+        for (j = 0; j < FF_ARRAY_ELEMS(c.pred4x4); j++) {
+            if (c.pred4x4[j] == opt.pred4x4[j])
+                continue;
+            tested++;
+            for (it = 0; it < ITERATIONS; it++) {
+                fill_random(buf_c, sizeof(buf_c), it);
+                memcpy(buf_opt, buf_c, sizeof(buf_c));
+                c  .pred4x4[j](src_c  , src_c   + 4 - STRIDE, STRIDE);
+                opt.pred4x4[j](src_opt, src_opt + 4 - STRIDE, STRIDE);
+                if (memcmp(buf_c, buf_opt, sizeof(buf_c))) {
+                    ret |= report("4x4", j, codec_id, 1, 1);
+                    break;
+                }
+            }
+        }
+
+        for (j = 0; j < FF_ARRAY_ELEMS(c.pred8x8l); j++) {
+            if (c.pred8x8l[j] == opt.pred8x8l[j])
+                continue;
+            tested++;
+            for (k = 0; k < 4; k++) {
+                for (it = 0; it < ITERATIONS; it++) {
+                    fill_random(buf_c, sizeof(buf_c), it);
+                    memcpy(buf_opt, buf_c, sizeof(buf_c));
+                    c  .pred8x8l[j](src_c  , k & 1, k >> 1, STRIDE);
+                    opt.pred8x8l[j](src_opt, k & 1, k >> 1, STRIDE);
+                    if (memcmp(buf_c, buf_opt, sizeof(buf_c))) {
+                        ret |= report("8x8l", j, codec_id, k & 1, k >> 1);
+                        break;
+                    }
+                }
+            }
+        }
+
+        for (j = 0; j < FF_ARRAY_ELEMS(c.pred8x8); j++) {
+            if (c.pred8x8[j] == opt.pred8x8[j])
+                continue;
+            tested++;
+            for (it = 0; it < ITERATIONS; it++) {
+                fill_random(buf_c, sizeof(buf_c), it);
+                memcpy(buf_opt, buf_c, sizeof(buf_c));
+                c  .pred8x8[j](src_c  , STRIDE);
+                opt.pred8x8[j](src_opt, STRIDE);
+                if (memcmp(buf_c, buf_opt, sizeof(buf_c))) {
+                    ret |= report("8x8", j, codec_id, 1, 1);
+                    break;
+                }
+            }
+        }
+
+        for (j = 0; j < FF_ARRAY_ELEMS(c.pred16x16); j++) {
+            if (c.pred16x16[j] == opt.pred16x16[j])
+                continue;
+            tested++;
+            for (it = 0; it < ITERATIONS; it++) {
+                fill_random(buf_c, sizeof(buf_c), it);
+                memcpy(buf_opt, buf_c, sizeof(buf_c));
+                c  .pred16x16[j](src_c  , STRIDE);
+                opt.pred16x16[j](src_opt, STRIDE);
+                if (memcmp(buf_c, buf_opt, sizeof(buf_c))) {
+                    ret |= report("16x16", j, codec_id, 1, 1);
+                    break;
+                }
+            }
+        }
+    }
+
+    printf("%d optimized functions tested, %s\n", tested, ret ? "FAILED" : "all ok");
+    return ret;
 }
+#endif /* TEST */
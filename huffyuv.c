@@ -32,8 +32,10 @@
 #include "get_bits.h"
 #include "put_bits.h"
 #include "dsputil.h"
+#include "libavutil/intreadwrite.h"
 
 #define VLC_BITS 11
+#define MAX_STRIPS 64
 
 #if HAVE_BIGENDIAN
 #define B 3
@@ -79,6 +81,9 @@ typedef struct HYuvContext{
     uint8_t *bitstream_buffer;
     unsigned int bitstream_buffer_size;
     DSPContext dsp;
+    int strip_count;                        //ffvhuff: number of independently coded horizontal strips
+    int strip_y, strip_height;
+    struct HYuvContext *strip[MAX_STRIPS];
 }HYuvContext;
 
 static const unsigned char classic_shift_luma[] = {
@@ -412,6 +417,56 @@ static av_cold void alloc_temp(HYuvContext *s){
     }
 }
 
+/**
+ * Returns the first line of strip i, all strips but the last one are
+ * a multiple of 4 lines high.
+ */
+static int strip_start(HYuvContext *s, int i){
+    if(i == s->strip_count)
+        return s->height;
+    return ((s->height>>2) * i / s->strip_count) << 2;
+}
+
+static av_cold int alloc_strips(HYuvContext *s){
+    int i;
+
+    for(i=0; i<s->strip_count; i++){
+        HYuvContext *sc= s->strip[i]= av_mallocz(sizeof(HYuvContext));
+        if(!sc)
+            return AVERROR(ENOMEM);
+        sc->width= s->width;
+        sc->bitstream_bpp= s->bitstream_bpp;
+        alloc_temp(sc);
+    }
+    return 0;
+}
+
+/**
+ * Prepares strip i for the current frame. The strip context is a copy of
+ * the frame context, with its own temporary buffers and a picture that
+ * starts at the first line of the strip.
+ */
+static void setup_strip(HYuvContext *s, int i){
+    HYuvContext * const sc= s->strip[i];
+    uint8_t *temp[3];
+    int y, cy;
+
+    memcpy(temp, sc->temp, sizeof(temp));
+    memcpy(sc, s, sizeof(HYuvContext));
+    memcpy(sc->temp, temp, sizeof(temp));
+    memset(sc->strip, 0, sizeof(sc->strip));
+
+    y = sc->strip_y= strip_start(s, i);
+    sc->strip_height= strip_start(s, i+1) - y;
+
+    sc->picture.data[0]+= y*sc->picture.linesize[0];
+    if(s->bitstream_bpp<24){
+        cy= s->bitstream_bpp==12 ? y>>1 : y;
+        sc->picture.data[1]+= cy*sc->picture.linesize[1];
+        sc->picture.data[2]+= cy*sc->picture.linesize[2];
+    }
+}
+
 static av_cold int common_init(AVCodecContext *avctx){
     HYuvContext *s = avctx->priv_data;
 
@@ -461,6 +516,8 @@ s->bgr32=1;
         interlace= (((uint8_t*)avctx->extradata)[2] & 0x30) >> 4;
         s->interlaced= (interlace==1) ? 1 : (interlace==2) ? 0 : s->interlaced;
         s->context= ((uint8_t*)avctx->extradata)[2] & 0x40 ? 1 : 0;
+        if(avctx->codec->id==CODEC_ID_FFVHUFF)
+            s->strip_count= ((uint8_t*)avctx->extradata)[3];
 
         if(read_huffman_tables(s, ((uint8_t*)avctx->extradata)+4, avctx->extradata_size) < 0)
             return -1;
@@ -519,6 +576,16 @@ s->bgr32=1;
 
     alloc_temp(s);
 
+    if(s->strip_count > 1){
+        if(s->strip_count > MAX_STRIPS || s->strip_count > s->height>>3){
+            av_log(avctx, AV_LOG_ERROR, "invalid number of strips %d\n", s->strip_count);
+            return -1;
+        }
+        if(alloc_strips(s) < 0)
+            return -1;
+    }else
+        s->strip_count= 1;
+
 //    av_log(NULL, AV_LOG_DEBUG, "pred:%d bpp:%d hbpp:%d il:%d\n", s->predictor, s->bitstream_bpp, avctx->bits_per_coded_sample, s->interlaced);
 
     return 0;
@@ -614,6 +681,15 @@ static av_cold int encode_init(AVCodecContext *avctx)
     ((uint8_t*)avctx->extradata)[3]= 0;
     s->avctx->extradata_size= 4;
 
+    /* ffvhuff can split frames into strips which are coded independently */
+    s->strip_count= 1;
+    if(avctx->codec->id==CODEC_ID_FFVHUFF && avctx->slices > 1)
+        s->strip_count= FFMIN3(avctx->slices, s->height>>3, MAX_STRIPS);
+    if(s->strip_count > 1)
+        ((uint8_t*)avctx->extradata)[3]= s->strip_count;
+    else
+        s->strip_count= 1;
+
     if(avctx->stats_in){
         char *p= avctx->stats_in;
 
@@ -670,6 +746,8 @@ static av_cold int encode_init(AVCodecContext *avctx)
 //    printf("pred:%d bpp:%d hbpp:%d il:%d\n", s->predictor, s->bitstream_bpp, avctx->bits_per_coded_sample, s->interlaced);
 
     alloc_temp(s);
+    if(s->strip_count > 1 && alloc_strips(s) < 0)
+        return -1;
 
     s->picture_number=0;
 
@@ -902,7 +980,7 @@ static void draw_slice(HYuvContext *s, int y){
     int h, cy;
     int offset[4];
 
-    if(s->avctx->draw_horiz_band==NULL)
+    if(s->avctx->draw_horiz_band==NULL || s->strip_count > 1)
         return;
 
     h= y - s->last_slice_end;
@@ -925,51 +1003,16 @@ static void draw_slice(HYuvContext *s, int y){
     s->last_slice_end= y + h;
 }
 
-static int decode_frame(AVCodecContext *avctx, void *data, int *data_size, AVPacket *avpkt){
-    const uint8_t *buf = avpkt->data;
-    int buf_size = avpkt->size;
-    HYuvContext *s = avctx->priv_data;
+/**
+ * Decodes a picture of the given height, or one strip of it, from s->gb.
+ */
+static int decode_picture(HYuvContext *s, AVFrame *p, int height){
+    AVCodecContext * const avctx= s->avctx;
     const int width= s->width;
     const int width2= s->width>>1;
-    const int height= s->height;
-    int fake_ystride, fake_ustride, fake_vstride;
-    AVFrame * const p= &s->picture;
-    int table_size= 0;
-
-    AVFrame *picture = data;
-
-    av_fast_malloc(&s->bitstream_buffer, &s->bitstream_buffer_size, buf_size + FF_INPUT_BUFFER_PADDING_SIZE);
-    if (!s->bitstream_buffer)
-        return AVERROR(ENOMEM);
-
-    memset(s->bitstream_buffer + buf_size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
-    s->dsp.bswap_buf((uint32_t*)s->bitstream_buffer, (const uint32_t*)buf, buf_size/4);
-
-    if(p->data[0])
-        avctx->release_buffer(avctx, p);
-
-    p->reference= 0;
-    if(avctx->get_buffer(avctx, p) < 0){
-        av_log(avctx, AV_LOG_ERROR, "get_buffer() failed\n");
-        return -1;
-    }
-
-    if(s->context){
-        table_size = read_huffman_tables(s, s->bitstream_buffer, buf_size);
-        if(table_size < 0)
-            return -1;
-    }
-
-    if((unsigned)(buf_size-table_size) >= INT_MAX/8)
-        return -1;
-
-    init_get_bits(&s->gb, s->bitstream_buffer+table_size, (buf_size-table_size)*8);
-
-    fake_ystride= s->interlaced ? p->linesize[0]*2  : p->linesize[0];
-    fake_ustride= s->interlaced ? p->linesize[1]*2  : p->linesize[1];
-    fake_vstride= s->interlaced ? p->linesize[2]*2  : p->linesize[2];
-
-    s->last_slice_end= 0;
+    const int fake_ystride= s->interlaced ? p->linesize[0]*2  : p->linesize[0];
+    const int fake_ustride= s->interlaced ? p->linesize[1]*2  : p->linesize[1];
+    const int fake_vstride= s->interlaced ? p->linesize[2]*2  : p->linesize[2];
 
     if(s->bitstream_bpp<24){
         int y, cy;
@@ -1001,7 +1044,7 @@ static int decode_frame(AVCodecContext *avctx, void *data, int *data_size, AVPac
                     leftv= s->dsp.add_hfyu_left_prediction(p->data[2] + 1, s->temp[2], width2-1, leftv);
                 }
 
-                for(cy=y=1; y<s->height; y++,cy++){
+                for(cy=y=1; y<height; y++,cy++){
                     uint8_t *ydst, *udst, *vdst;
 
                     if(s->bitstream_bpp==12){
@@ -1015,7 +1058,7 @@ static int decode_frame(AVCodecContext *avctx, void *data, int *data_size, AVPac
                                 s->dsp.add_bytes(ydst, ydst - fake_ystride, width);
                         }
                         y++;
-                        if(y>=s->height) break;
+                        if(y>=height) break;
                     }
 
                     draw_slice(s, y);
@@ -1141,13 +1184,13 @@ static int decode_frame(AVCodecContext *avctx, void *data, int *data_size, AVPac
                 decode_bgr_bitstream(s, width-1);
                 s->dsp.add_hfyu_left_prediction_bgr32(p->data[0] + last_line+4, s->temp[0], width-1, &leftr, &leftg, &leftb, &lefta);
 
-                for(y=s->height-2; y>=0; y--){ //Yes it is stored upside down.
+                for(y=height-2; y>=0; y--){ //Yes it is stored upside down.
                     decode_bgr_bitstream(s, width);
 
                     s->dsp.add_hfyu_left_prediction_bgr32(p->data[0] + p->linesize[0]*y, s->temp[0], width, &leftr, &leftg, &leftb, &lefta);
                     if(s->predictor == PLANE){
                         if(s->bitstream_bpp!=32) lefta=0;
-                        if((y&s->interlaced)==0 && y<s->height-1-s->interlaced){
+                        if((y&s->interlaced)==0 && y<height-1-s->interlaced){
                             s->dsp.add_bytes(p->data[0] + p->linesize[0]*y,
                                              p->data[0] + p->linesize[0]*y + fake_ystride, fake_ystride);
                         }
@@ -1164,6 +1207,102 @@ static int decode_frame(AVCodecContext *avctx, void *data, int *data_size, AVPac
             return -1;
         }
     }
+
+    return 0;
+}
+
+static int decode_strip(AVCodecContext *avctx, void *arg){
+    HYuvContext *sc= *(void**)arg;
+    int ret;
+
+    ret= decode_picture(sc, &sc->picture, sc->strip_height);
+    emms_c();
+
+    return ret;
+}
+
+/**
+ * Decodes all strips of a frame in parallel. The (byteswapped) frame data
+ * continues after the huffman tables, padded to 4 bytes, with the 32-bit
+ * sizes of the strips and then the strips themselves.
+ */
+static int decode_strips(HYuvContext *s, AVFrame *picture, int *data_size, int buf_size, int table_size){
+    AVCodecContext * const avctx= s->avctx;
+    const int header= FFALIGN(table_size, 4) + 4*s->strip_count;
+    int i, pos= header;
+
+    if(buf_size < header)
+        return -1;
+
+    for(i=0; i<s->strip_count; i++){
+        unsigned int size= AV_RB32(s->bitstream_buffer + header - 4*(s->strip_count - i));
+
+        if(size > buf_size - pos){
+            av_log(avctx, AV_LOG_ERROR, "strip %d has invalid size %u\n", i, size);
+            return -1;
+        }
+        setup_strip(s, i);
+        init_get_bits(&s->strip[i]->gb, s->bitstream_buffer + pos, size*8);
+        pos+= size;
+    }
+
+    avctx->execute(avctx, decode_strip, s->strip, NULL, s->strip_count, sizeof(void*));
+
+    if(avctx->draw_horiz_band){
+        int offset[4]= {0};
+        avctx->draw_horiz_band(avctx, &s->picture, offset, 0, 3, s->height);
+    }
+
+    *picture= s->picture;
+    *data_size = sizeof(AVFrame);
+
+    return pos;
+}
+
+static int decode_frame(AVCodecContext *avctx, void *data, int *data_size, AVPacket *avpkt){
+    const uint8_t *buf = avpkt->data;
+    int buf_size = avpkt->size;
+    HYuvContext *s = avctx->priv_data;
+    const int height= s->height;
+    AVFrame * const p= &s->picture;
+    int table_size= 0;
+
+    AVFrame *picture = data;
+
+    av_fast_malloc(&s->bitstream_buffer, &s->bitstream_buffer_size, buf_size + FF_INPUT_BUFFER_PADDING_SIZE);
+    if (!s->bitstream_buffer)
+        return AVERROR(ENOMEM);
+
+    memset(s->bitstream_buffer + buf_size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+    s->dsp.bswap_buf((uint32_t*)s->bitstream_buffer, (const uint32_t*)buf, buf_size/4);
+
+    if(p->data[0])
+        avctx->release_buffer(avctx, p);
+
+    p->reference= 0;
+    if(avctx->get_buffer(avctx, p) < 0){
+        av_log(avctx, AV_LOG_ERROR, "get_buffer() failed\n");
+        return -1;
+    }
+
+    if(s->context){
+        table_size = read_huffman_tables(s, s->bitstream_buffer, buf_size);
+        if(table_size < 0)
+            return -1;
+    }
+
+    if((unsigned)(buf_size-table_size) >= INT_MAX/8)
+        return -1;
+
+    if(s->strip_count > 1)
+        return decode_strips(s, picture, data_size, buf_size, table_size);
+
+    init_get_bits(&s->gb, s->bitstream_buffer+table_size, (buf_size-table_size)*8);
+
+    s->last_slice_end= 0;
+
+    if(decode_picture(s, p, height) < 0)
+        return -1;
     emms_c();
 
     *picture= *p;
@@ -1179,6 +1318,11 @@ static int common_end(HYuvContext *s){
     for(i=0; i<3; i++){
         av_freep(&s->temp[i]);
     }
+    for(i=0; i<MAX_STRIPS; i++){
+        if(s->strip[i])
+            common_end(s->strip[i]);
+        av_freep(&s->strip[i]);
+    }
     return 0;
 }
 
@@ -1203,36 +1347,16 @@ static av_cold int decode_end(AVCodecContext *avctx)
 #endif /* CONFIG_HUFFYUV_DECODER || CONFIG_FFVHUFF_DECODER */
 
 #if CONFIG_HUFFYUV_ENCODER || CONFIG_FFVHUFF_ENCODER
-static int encode_frame(AVCodecContext *avctx, unsigned char *buf, int buf_size, void *data){
-    HYuvContext *s = avctx->priv_data;
-    AVFrame *pict = data;
+/**
+ * Encodes a picture of the given height, or one strip of it, into s->pb.
+ */
+static void encode_picture(HYuvContext *s, AVFrame *p, int height){
+    AVCodecContext * const avctx= s->avctx;
     const int width= s->width;
     const int width2= s->width>>1;
-    const int height= s->height;
-    const int fake_ystride= s->interlaced ? pict->linesize[0]*2  : pict->linesize[0];
-    const int fake_ustride= s->interlaced ? pict->linesize[1]*2  : pict->linesize[1];
-    const int fake_vstride= s->interlaced ? pict->linesize[2]*2  : pict->linesize[2];
-    AVFrame * const p= &s->picture;
-    int i, j, size=0;
-
-    *p = *pict;
-    p->pict_type= FF_I_TYPE;
-    p->key_frame= 1;
-
-    if(s->context){
-        for(i=0; i<3; i++){
-            generate_len_table(s->len[i], s->stats[i], 256);
-            if(generate_bits_table(s->bits[i], s->len[i])<0)
-                return -1;
-            size+= store_table(s, s->len[i], &buf[size]);
-        }
-
-        for(i=0; i<3; i++)
-            for(j=0; j<256; j++)
-                s->stats[i][j] >>= 1;
-    }
-
-    init_put_bits(&s->pb, buf+size, buf_size-size);
+    const int fake_ystride= s->interlaced ? p->linesize[0]*2  : p->linesize[0];
+    const int fake_ustride= s->interlaced ? p->linesize[1]*2  : p->linesize[1];
+    const int fake_vstride= s->interlaced ? p->linesize[2]*2  : p->linesize[2];
 
     if(avctx->pix_fmt == PIX_FMT_YUV422P || avctx->pix_fmt == PIX_FMT_YUV420P){
         int lefty, leftu, leftv, y, cy;
@@ -1353,7 +1477,7 @@ static int encode_frame(AVCodecContext *avctx, unsigned char *buf, int buf_size,
         sub_left_prediction_bgr32(s, s->temp[0], data+4, width-1, &leftr, &leftg, &leftb);
         encode_bgr_bitstream(s, width-1);
 
-        for(y=1; y<s->height; y++){
+        for(y=1; y<height; y++){
             uint8_t *dst = data + y*stride;
             if(s->predictor == PLANE && s->interlaced < y){
                 s->dsp.diff_bytes(s->temp[1], dst, dst - fake_stride, width*4);
@@ -1366,12 +1490,111 @@ static int encode_frame(AVCodecContext *avctx, unsigned char *buf, int buf_size,
     }else{
         av_log(avctx, AV_LOG_ERROR, "Format not supported!\n");
     }
+}
+
+static int encode_strip(AVCodecContext *avctx, void *arg){
+    HYuvContext *sc= *(void**)arg;
+    int size;
+
+    encode_picture(sc, &sc->picture, sc->strip_height);
     emms_c();
 
-    size+= (put_bits_count(&s->pb)+31)/8;
-    put_bits(&s->pb, 16, 0);
-    put_bits(&s->pb, 15, 0);
-    size/= 4;
+    if(avctx->flags2 & CODEC_FLAG2_NO_OUTPUT)
+        return 0;
+
+    size= (put_bits_count(&sc->pb)+31)/32*4;
+    put_bits(&sc->pb, 16, 0);
+    put_bits(&sc->pb, 15, 0);
+    flush_put_bits(&sc->pb);
+
+    return size;
+}
+
+/**
+ * Encodes the strips of a frame in parallel, each into its own part of buf,
+ * and moves them together behind the table of their sizes.
+ * @return the size of the frame in 32-bit words
+ */
+static int encode_strips(HYuvContext *s, uint8_t *buf, int buf_size, int table_size){
+    const int header= FFALIGN(table_size, 4) + 4*s->strip_count;
+    int strip_size[MAX_STRIPS];
+    uint8_t *buf_p;
+    int i, j, k;
+
+    if(buf_size < header){
+        av_log(s->avctx, AV_LOG_ERROR, "encoded frame too large\n");
+        return -1;
+    }
+    memset(buf + table_size, 0, header - table_size);
+
+    for(i=0; i<s->strip_count; i++){
+        uint8_t *start= buf + header + (((buf_size - header)>>2) *  i    / s->strip_count << 2);
+        uint8_t *end  = buf + header + (((buf_size - header)>>2) * (i+1) / s->strip_count << 2);
+
+        setup_strip(s, i);
+        memset(s->strip[i]->stats, 0, sizeof(s->stats));
+        init_put_bits(&s->strip[i]->pb, start, end - start);
+    }
+
+    s->avctx->execute(s->avctx, encode_strip, s->strip, strip_size, s->strip_count, sizeof(void*));
+
+    buf_p= buf + header;
+    for(i=0; i<s->strip_count; i++){
+        HYuvContext * const sc= s->strip[i];
+
+        for(j=0; j<3; j++)
+            for(k=0; k<256; k++)
+                s->stats[j][k]+= sc->stats[j][k];
+
+        AV_WB32(buf + header - 4*(s->strip_count - i), strip_size[i]);
+        memmove(buf_p, sc->pb.buf, strip_size[i]);
+        buf_p+= strip_size[i];
+    }
+
+    return (buf_p - buf)/4;
+}
+
+static int encode_frame(AVCodecContext *avctx, unsigned char *buf, int buf_size, void *data){
+    HYuvContext *s = avctx->priv_data;
+    AVFrame *pict = data;
+    const int height= s->height;
+    AVFrame * const p= &s->picture;
+    int i, j, size=0;
+
+    *p = *pict;
+    p->pict_type= FF_I_TYPE;
+    p->key_frame= 1;
+
+    if(s->context){
+        for(i=0; i<3; i++){
+            generate_len_table(s->len[i], s->stats[i], 256);
+            if(generate_bits_table(s->bits[i], s->len[i])<0)
+                return -1;
+            size+= store_table(s, s->len[i], &buf[size]);
+        }
+
+        for(i=0; i<3; i++)
+            for(j=0; j<256; j++)
+                s->stats[i][j] >>= 1;
+    }
+
+    if(s->strip_count > 1){
+        size= encode_strips(s, buf, buf_size, size);
+        if(size < 0)
+            return -1;
+    }else{
+        init_put_bits(&s->pb, buf+size, buf_size-size);
+
+        encode_picture(s, p, height);
+        emms_c();
+
+        size+= (put_bits_count(&s->pb)+31)/8;
+        put_bits(&s->pb, 16, 0);
+        put_bits(&s->pb, 15, 0);
+        size/= 4;
+        if(!(s->avctx->flags2 & CODEC_FLAG2_NO_OUTPUT))
+            flush_put_bits(&s->pb);
+    }
 
     if((s->flags&CODEC_FLAG_PASS1) && (s->picture_number&31)==0){
         int j;
@@ -1388,10 +1611,8 @@ static int encode_frame(AVCodecContext *avctx, unsigned char *buf, int buf_size,
         }
     } else
         avctx->stats_out[0] = '\0';
-    if(!(s->avctx->flags2 & CODEC_FLAG2_NO_OUTPUT)){
-        flush_put_bits(&s->pb);
+    if(!(s->avctx->flags2 & CODEC_FLAG2_NO_OUTPUT))
         s->dsp.bswap_buf((uint32_t*)buf, (uint32_t*)buf, size);
-    }
 
     s->picture_number++;
 
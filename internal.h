@@ -48,4 +48,12 @@ AVHWAccel *ff_find_hwaccel(enum CodecID codec_id, enum PixelFormat pix_fmt);
  */
 int ff_match_2uint16(const uint16_t (*tab)[2], int size, int a, int b);
 
+/**
+ * Releases the buffers the codec still holds and the reference of the
+ * context to the buffer pool of avcodec_default_get_buffer().
+ * avcodec_default_free_buffers() keeps the pool, so that buffers are reused
+ * after a resolution change; this is called when the context is closed.
+ */
+void ff_free_internal_buffer(AVCodecContext *s);
+
 #endif /* AVCODEC_INTERNAL_H */
@@ -62,6 +62,47 @@ static int build_vlc(VLC *vlc, const uint8_t *bits_table, const uint8_t *val_tab
     return init_vlc(vlc, 9, nb_codes, huff_size, 1, 1, huff_code, 2, 2, use_static);
 }
 
+/**
+ * Builds the lookup table that decodes run, size and value of the short
+ * AC codes at once. EOB is included, ZRL and the longer codes are left to
+ * the VLC.
+ */
+static void build_ac_lut(MJpegACLUT *lut, const uint8_t *bits_table,
+                         const uint8_t *val_table)
+{
+    uint8_t huff_size[256];
+    uint16_t huff_code[256];
+    int i, v, j, nb_codes = 0;
+
+    for(i=1;i<=16;i++)
+        nb_codes += bits_table[i];
+
+    memset(lut, 0, sizeof(*lut) << AC_LUT_BITS);
+    memset(huff_size, 0, sizeof(huff_size));
+    ff_mjpeg_build_huffman_codes(huff_size, huff_code, bits_table, val_table);
+
+    for(i=0;i<nb_codes;i++) {
+        int sym  = val_table[i];
+        int size = sym & 0xf;
+        int len  = huff_size[sym] + size;
+
+        if (len > AC_LUT_BITS || (!size && sym) ||
+            huff_code[sym] >> huff_size[sym]) /* invalid table */
+            continue;
+        for(v = 0; v < 1 << size; v++) {
+            int idx = (huff_code[sym] << size | v) << (AC_LUT_BITS - len);
+            int level = v;
+            if (size && v < 1 << (size - 1))
+                level = v - (1 << size) + 1;
+            for(j = 0; j < 1 << (AC_LUT_BITS - len); j++) {
+                lut[idx + j].level = level;
+                lut[idx + j].run   = (sym >> 4) + 1;
+                lut[idx + j].len   = len;
+            }
+        }
+    }
+}
+
 static void build_basic_mjpeg_vlc(MJpegDecodeContext * s) {
     build_vlc(&s->vlcs[0][0], ff_mjpeg_bits_dc_luminance,
               ff_mjpeg_val_dc, 12, 0, 0);
@@ -71,6 +112,10 @@ static void build_basic_mjpeg_vlc(MJpegDecodeContext * s) {
               ff_mjpeg_val_ac_luminance, 251, 0, 1);
     build_vlc(&s->vlcs[1][1], ff_mjpeg_bits_ac_chrominance,
               ff_mjpeg_val_ac_chrominance, 251, 0, 1);
+    build_ac_lut(s->ac_lut[0], ff_mjpeg_bits_ac_luminance,
+                 ff_mjpeg_val_ac_luminance);
+    build_ac_lut(s->ac_lut[1], ff_mjpeg_bits_ac_chrominance,
+                 ff_mjpeg_val_ac_chrominance);
 }
 
 av_cold int ff_mjpeg_decode_init(AVCodecContext *avctx)
@@ -108,6 +153,19 @@ av_cold int ff_mjpeg_decode_init(AVCodecContext *avctx)
     if (avctx->codec->id == CODEC_ID_AMV)
         s->flipped = 1;
 
+    if (avctx->thread_count > 1) {
+        int i;
+        s->thread_context = av_mallocz(avctx->thread_count * sizeof(*s->thread_context));
+        if (!s->thread_context)
+            return AVERROR(ENOMEM);
+        s->thread_context[0] = s;
+        for (i = 1; i < avctx->thread_count; i++) {
+            s->thread_context[i] = av_malloc(sizeof(MJpegDecodeContext));
+            if (!s->thread_context[i])
+                return AVERROR(ENOMEM);
+        }
+    }
+
     return 0;
 }
 
@@ -190,6 +248,8 @@ int ff_mjpeg_decode_dht(MJpegDecodeContext *s)
         if(build_vlc(&s->vlcs[class][index], bits_table, val_table, code_max + 1, 0, class > 0) < 0){
             return -1;
         }
+        if (class > 0)
+            build_ac_lut(s->ac_lut[index], bits_table, val_table);
     }
     return 0;
 }
@@ -392,6 +452,7 @@ static inline int mjpeg_decode_dc(MJpegDecodeContext *s, int dc_index)
 static int decode_block(MJpegDecodeContext *s, DCTELEM *block,
                         int component, int dc_index, int ac_index, int16_t *quant_matrix)
 {
+    const MJpegACLUT *ac_lut = s->ac_lut[ac_index];
     int code, i, j, level, val;
 
     /* DC coef */
@@ -407,14 +468,27 @@ static int decode_block(MJpegDecodeContext *s, DCTELEM *block,
     i = 0;
     {OPEN_READER(re, &s->gb)
     for(;;) {
+        const MJpegACLUT *e;
+
         UPDATE_CACHE(re, &s->gb);
-        GET_VLC(code, re, &s->gb, s->vlcs[1][ac_index].table, 9, 2)
+        e = &ac_lut[SHOW_UBITS(re, &s->gb, AC_LUT_BITS)];
+        if (e->len) {
+            /* short code, run and value in one lookup */
+            LAST_SKIP_BITS(re, &s->gb, e->len)
+            /* EOB */
+            if (!e->level)
+                break;
+            i += e->run;
+            level = e->level;
+        } else {
+            GET_VLC(code, re, &s->gb, s->vlcs[1][ac_index].table, 9, 2)
 
-        /* EOB */
-        if (code == 0x10)
-            break;
-        i += ((unsigned)code) >> 4;
-        if(code != 0x100){
+            /* EOB */
+            if (code == 0x10)
+                break;
+            i += ((unsigned)code) >> 4;
+            if(code == 0x100)
+                continue;
             code &= 0xf;
             if(code > MIN_CACHE_BITS - 16){
                 UPDATE_CACHE(re, &s->gb)
@@ -426,19 +500,19 @@ static int decode_block(MJpegDecodeContext *s, DCTELEM *block,
             }
 
             LAST_SKIP_BITS(re, &s->gb, code)
+        }
 
-            if (i >= 63) {
-                if(i == 63){
-                    j = s->scantable.permutated[63];
-                    block[j] = level * quant_matrix[j];
-                    break;
-                }
-                av_log(s->avctx, AV_LOG_ERROR, "error count: %d\n", i);
-                return -1;
+        if (i >= 63) {
+            if(i == 63){
+                j = s->scantable.permutated[63];
+                block[j] = level * quant_matrix[j];
+                break;
             }
-            j = s->scantable.permutated[i];
-            block[j] = level * quant_matrix[j];
+            av_log(s->avctx, AV_LOG_ERROR, "error count: %d\n", i);
+            return -1;
         }
+        j = s->scantable.permutated[i];
+        block[j] = level * quant_matrix[j];
     }
     CLOSE_READER(re, &s->gb)}
 
@@ -766,10 +840,154 @@ static int ljpeg_decode_yuv_scan(MJpegDecodeContext *s, int predictor, int point
     return 0;
 }
 
-static int mjpeg_decode_scan(MJpegDecodeContext *s, int nb_components, int Ah, int Al){
-    int i, mb_x, mb_y;
-    uint8_t* data[MAX_COMPONENTS];
+/**
+ * Decodes the MCUs mcu to mcu_end-1 of a sequential or progressive DC scan,
+ * skipping the restart markers between the restart intervals.
+ */
+static int decode_scan_mcus(MJpegDecodeContext *s, uint8_t **data, const int *linesize,
+                            int nb_components, int Ah, int Al, int mcu, int mcu_end){
+    int i;
+    int mb_x = mcu % s->mb_width;
+    int mb_y = mcu / s->mb_width;
+
+    for(; mcu < mcu_end; mcu++) {
+        if (s->restart_interval && !s->restart_count)
+            s->restart_count = s->restart_interval;
+
+        for(i=0;i<nb_components;i++) {
+            uint8_t *ptr;
+            int n, h, v, x, y, c, j;
+            n = s->nb_blocks[i];
+            c = s->comp_index[i];
+            h = s->h_scount[i];
+            v = s->v_scount[i];
+            x = 0;
+            y = 0;
+            for(j=0;j<n;j++) {
+                ptr = data[c] +
+                    (((linesize[c] * (v * mb_y + y) * 8) +
+                    (h * mb_x + x) * 8) >> s->avctx->lowres);
+                if(s->interlaced && s->bottom_field)
+                    ptr += linesize[c] >> 1;
+                if(!s->progressive) {
+                    s->dsp.clear_block(s->block);
+                    if(decode_block(s, s->block, i,
+                                 s->dc_index[i], s->ac_index[i],
+                                 s->quant_matrixes[ s->quant_index[c] ]) < 0) {
+                        av_log(s->avctx, AV_LOG_ERROR, "error y=%d x=%d\n", mb_y, mb_x);
+                        return -1;
+                    }
+                    s->dsp.idct_put(ptr, linesize[c], s->block);
+                } else {
+                    int block_idx = s->block_stride[c] * (v * mb_y + y) + (h * mb_x + x);
+                    DCTELEM *block = s->blocks[c][block_idx];
+                    if(Ah)
+                        block[0] += get_bits1(&s->gb) * s->quant_matrixes[ s->quant_index[c] ][0] << Al;
+                    else if(decode_dc_progressive(s, block, i, s->dc_index[i], s->quant_matrixes[ s->quant_index[c] ], Al) < 0) {
+                        av_log(s->avctx, AV_LOG_ERROR, "error y=%d x=%d\n", mb_y, mb_x);
+                        return -1;
+                    }
+                }
+//                    av_log(s->avctx, AV_LOG_DEBUG, "mb: %d %d processed\n", mb_y, mb_x);
+//av_log(NULL, AV_LOG_DEBUG, "%d %d %d %d %d %d %d %d \n", mb_x, mb_y, x, y, c, s->bottom_field, (v * mb_y + y) * 8, (h * mb_x + x) * 8);
+                if (++x == h) {
+                    x = 0;
+                    y++;
+                }
+            }
+        }
+
+        if (s->restart_interval && !--s->restart_count) {
+            align_get_bits(&s->gb);
+            skip_bits(&s->gb, 16); /* skip RSTn */
+            for (i=0; i<nb_components; i++) /* reset dc */
+                s->last_dc[i] = 1024;
+        }
+
+        if (++mb_x == s->mb_width) {
+            mb_x = 0;
+            mb_y++;
+        }
+    }
+    return 0;
+}
+
+typedef struct MJpegScanArgs {
+    uint8_t *data[MAX_COMPONENTS];
     int linesize[MAX_COMPONENTS];
+    int nb_components, Ah, Al;
+    int nb_intervals;
+    int error;                        ///< set if any interval failed to decode
+    GetBitContext start_gb;           ///< reader state at the start of the scan
+    GetBitContext gb;                 ///< reader state after the last interval
+} MJpegScanArgs;
+
+static int decode_scan_thread(AVCodecContext *avctx, void *arg, int jobnr, int threadnr)
+{
+    MJpegDecodeContext *s0 = avctx->priv_data;
+    MJpegDecodeContext *s  = s0->thread_context[threadnr];
+    MJpegScanArgs *a = arg;
+    int first = jobnr       * a->nb_intervals / avctx->thread_count;
+    int last  = (jobnr + 1) * a->nb_intervals / avctx->thread_count;
+    int mcu_end = FFMIN(last * s->restart_interval, s->mb_width * s->mb_height);
+    int i, ret;
+
+    if (first == last)
+        return 0;
+
+    if (first) {
+        int offset = s0->restart_offsets[first - 1];
+        init_get_bits(&s->gb, s0->buffer + offset,
+                      s0->gb.size_in_bits - offset * 8);
+    } else
+        s->gb = a->start_gb;
+    for (i = 0; i < a->nb_components; i++)
+        s->last_dc[i] = 1024;
+    s->restart_count = 0;
+
+    ret = decode_scan_mcus(s, a->data, a->linesize, a->nb_components, a->Ah, a->Al,
+                           first * s->restart_interval, mcu_end);
+    if (ret < 0)
+        a->error = ret;
+    if (last == a->nb_intervals)
+        a->gb = s->gb;
+    return ret;
+}
+
+/**
+ * Decodes groups of restart intervals in parallel when the positions of all
+ * restart markers of the scan are known.
+ * @return 1 if the scan was decoded, 0 if it has to be decoded serially,
+ *         a negative value on error
+ */
+static int decode_scan_threads(MJpegDecodeContext *s, MJpegScanArgs *a)
+{
+    AVCodecContext *avctx = s->avctx;
+    int i;
+
+    a->nb_intervals = (s->mb_width * s->mb_height + s->restart_interval - 1)
+                      / s->restart_interval;
+    if (!s->thread_context || a->nb_intervals < 2 || s->restart_count ||
+        s->gb.buffer != s->buffer || s->nb_restart_offsets < a->nb_intervals - 1)
+        return 0;
+    for (i = 0; i < a->nb_intervals - 1; i++)
+        if (s->buffer[s->restart_offsets[i] - 1] != RST0 + (i & 7))
+            return 0;
+
+    for (i = 1; i < avctx->thread_count; i++)
+        memcpy(s->thread_context[i], s, sizeof(*s));
+    a->error = 0;
+    a->start_gb = s->gb;
+    avctx->execute2(avctx, decode_scan_thread, a, NULL, avctx->thread_count);
+
+    s->gb = a->gb;
+    s->restart_count = 0;
+    return a->error < 0 ? a->error : 1;
+}
+
+static int mjpeg_decode_scan(MJpegDecodeContext *s, int nb_components, int Ah, int Al){
+    MJpegScanArgs a;
+    int i, ret;
 
     if(s->flipped && s->avctx->flags & CODEC_FLAG_EMU_EDGE) {
         av_log(s->avctx, AV_LOG_ERROR, "Can not flip image with CODEC_FLAG_EMU_EDGE set!\n");
@@ -777,73 +995,26 @@ static int mjpeg_decode_scan(MJpegDecodeContext *s, int nb_components, int Ah, i
     }
     for(i=0; i < nb_components; i++) {
         int c = s->comp_index[i];
-        data[c] = s->picture.data[c];
-        linesize[c]=s->linesize[c];
+        a.data[c] = s->picture.data[c];
+        a.linesize[c]=s->linesize[c];
         s->coefs_finished[c] |= 1;
         if(s->flipped) {
             //picture should be flipped upside-down for this codec
-            data[c] += (linesize[c] * (s->v_scount[i] * (8 * s->mb_height -((s->height/s->v_max)&7)) - 1 ));
-            linesize[c] *= -1;
+            a.data[c] += (a.linesize[c] * (s->v_scount[i] * (8 * s->mb_height -((s->height/s->v_max)&7)) - 1 ));
+            a.linesize[c] *= -1;
         }
     }
-
-    for(mb_y = 0; mb_y < s->mb_height; mb_y++) {
-        for(mb_x = 0; mb_x < s->mb_width; mb_x++) {
-            if (s->restart_interval && !s->restart_count)
-                s->restart_count = s->restart_interval;
-
-            for(i=0;i<nb_components;i++) {
-                uint8_t *ptr;
-                int n, h, v, x, y, c, j;
-                n = s->nb_blocks[i];
-                c = s->comp_index[i];
-                h = s->h_scount[i];
-                v = s->v_scount[i];
-                x = 0;
-                y = 0;
-                for(j=0;j<n;j++) {
-                    ptr = data[c] +
-                        (((linesize[c] * (v * mb_y + y) * 8) +
-                        (h * mb_x + x) * 8) >> s->avctx->lowres);
-                    if(s->interlaced && s->bottom_field)
-                        ptr += linesize[c] >> 1;
-                    if(!s->progressive) {
-                        s->dsp.clear_block(s->block);
-                        if(decode_block(s, s->block, i,
-                                     s->dc_index[i], s->ac_index[i],
-                                     s->quant_matrixes[ s->quant_index[c] ]) < 0) {
-                            av_log(s->avctx, AV_LOG_ERROR, "error y=%d x=%d\n", mb_y, mb_x);
-                            return -1;
-                        }
-                        s->dsp.idct_put(ptr, linesize[c], s->block);
-                    } else {
-                        int block_idx = s->block_stride[c] * (v * mb_y + y) + (h * mb_x + x);
-                        DCTELEM *block = s->blocks[c][block_idx];
-                        if(Ah)
-                            block[0] += get_bits1(&s->gb) * s->quant_matrixes[ s->quant_index[c] ][0] << Al;
-                        else if(decode_dc_progressive(s, block, i, s->dc_index[i], s->quant_matrixes[ s->quant_index[c] ], Al) < 0) {
-                            av_log(s->avctx, AV_LOG_ERROR, "error y=%d x=%d\n", mb_y, mb_x);
-                            return -1;
-                        }
-                    }
-//                    av_log(s->avctx, AV_LOG_DEBUG, "mb: %d %d processed\n", mb_y, mb_x);
-//av_log(NULL, AV_LOG_DEBUG, "%d %d %d %d %d %d %d %d \n", mb_x, mb_y, x, y, c, s->bottom_field, (v * mb_y + y) * 8, (h * mb_x + x) * 8);
-                    if (++x == h) {
-                        x = 0;
-                        y++;
-                    }
-                }
-            }
-
-            if (s->restart_interval && !--s->restart_count) {
-                align_get_bits(&s->gb);
-                skip_bits(&s->gb, 16); /* skip RSTn */
-                for (i=0; i<nb_components; i++) /* reset dc */
-                    s->last_dc[i] = 1024;
-            }
-        }
+    a.nb_components = nb_components;
+    a.Ah = Ah;
+    a.Al = Al;
+
+    if (s->restart_interval) {
+        ret = decode_scan_threads(s, &a);
+        if (ret)
+            return FFMIN(ret, 0);
     }
-    return 0;
+    return decode_scan_mcus(s, a.data, a.linesize, nb_components, Ah, Al,
+                            0, s->mb_width * s->mb_height);
 }
 
 static int mjpeg_decode_scan_progressive_ac(MJpegDecodeContext *s, int ss, int se, int Ah, int Al){
@@ -1222,7 +1393,7 @@ static int valid_marker_list[] =
 static int find_marker(const uint8_t **pbuf_ptr, const uint8_t *buf_end)
 {
     const uint8_t *buf_ptr;
-    unsigned int v, v2;
+    unsigned int v2;
     int val;
 #ifdef DEBUG
     int skipped=0;
@@ -1230,9 +1401,21 @@ static int find_marker(const uint8_t **pbuf_ptr, const uint8_t *buf_end)
 
     buf_ptr = *pbuf_ptr;
     while (buf_ptr < buf_end) {
-        v = *buf_ptr++;
+        /* only 0xff bytes can start a marker */
+        const uint8_t *ff = memchr(buf_ptr, 0xff, buf_end - buf_ptr);
+        if (!ff) {
+#ifdef DEBUG
+            skipped += buf_end - buf_ptr;
+#endif
+            buf_ptr = buf_end;
+            break;
+        }
+#ifdef DEBUG
+        skipped += ff - buf_ptr;
+#endif
+        buf_ptr = ff + 1;
         v2 = *buf_ptr;
-        if ((v == 0xff) && (v2 >= 0xc0) && (v2 <= 0xfe) && buf_ptr < buf_end) {
+        if ((v2 >= 0xc0) && (v2 <= 0xfe) && buf_ptr < buf_end) {
             val = *buf_ptr++;
             goto found;
         }
@@ -1255,6 +1438,7 @@ int ff_mjpeg_decode_frame(AVCodecContext *avctx,
     int buf_size = avpkt->size;
     MJpegDecodeContext *s = avctx->priv_data;
     const uint8_t *buf_end, *buf_ptr;
+    const uint8_t *scan_end = NULL;
     int start_code;
     AVFrame *picture = data;
 
@@ -1262,6 +1446,8 @@ int ff_mjpeg_decode_frame(AVCodecContext *avctx,
     buf_ptr = buf;
     buf_end = buf + buf_size;
     while (buf_ptr < buf_end) {
+        /* set if a scan is followed by a marker */
+        scan_end = NULL;
         /* find start next marker */
         start_code = find_marker(&buf_ptr, buf_end);
         {
@@ -1286,22 +1472,41 @@ int ff_mjpeg_decode_frame(AVCodecContext *avctx,
                     const uint8_t *src = buf_ptr;
                     uint8_t *dst = s->buffer;
 
+                    s->nb_restart_offsets = 0;
                     while (src<buf_end)
                     {
-                        uint8_t x = *(src++);
-
-                        *(dst++) = x;
-                        if (avctx->codec_id != CODEC_ID_THP)
-                        {
-                            if (x == 0xff) {
-                                while (src < buf_end && x == 0xff)
-                                    x = *(src++);
-
-                                if (x >= 0xd0 && x <= 0xd7)
-                                    *(dst++) = x;
-                                else if (x)
-                                    break;
+                        /* copy everything up to and including the next 0xff at once */
+                        const uint8_t *ff = avctx->codec_id != CODEC_ID_THP ?
+                                            memchr(src, 0xff, buf_end - src) : NULL;
+                        int n = (ff ? ff + 1 : buf_end) - src;
+                        uint8_t x = 0xff;
+
+                        memcpy(dst, src, n);
+                        dst += n;
+                        src += n;
+                        if (!ff)
+                            break;
+
+                        while (src < buf_end && x == 0xff)
+                            x = *(src++);
+
+                        if (x >= 0xd0 && x <= 0xd7) {
+                            *(dst++) = x;
+                            /* remember where the restart intervals start */
+                            if (s->thread_context) {
+                                int *offsets = av_fast_realloc(s->restart_offsets, &s->restart_offsets_size,
+                                                               (s->nb_restart_offsets + 1) * sizeof(*offsets));
+                                if (!offsets)
+                                    s->nb_restart_offsets = -1;
+                                else if (s->nb_restart_offsets >= 0) {
+                                    s->restart_offsets = offsets;
+                                    offsets[s->nb_restart_offsets++] = dst - s->buffer;
+                                }
                             }
+                        } else if (x) {
+                            /* the scan ends at the next marker */
+                            scan_end = src - 2;
+                            break;
                         }
                     }
                     init_get_bits(&s->gb, s->buffer, (dst - s->buffer)*8);
@@ -1482,6 +1687,9 @@ eoi_parser:
 not_the_end:
                 /* eof process start code */
                 buf_ptr += (get_bits_count(&s->gb)+7)/8;
+                /* continue directly at the marker that ended the scan */
+                if (scan_end && scan_end > buf_ptr)
+                    buf_ptr = scan_end;
                 av_log(avctx, AV_LOG_DEBUG, "marker parser used %d bytes (%d bits)\n",
                        (get_bits_count(&s->gb)+7)/8, get_bits_count(&s->gb));
             }
@@ -1520,6 +1728,12 @@ av_cold int ff_mjpeg_decode_end(AVCodecContext *avctx)
         av_freep(&s->blocks[i]);
         av_freep(&s->last_nnz[i]);
     }
+    av_freep(&s->restart_offsets);
+    if (s->thread_context) {
+        for (i = 1; i < avctx->thread_count; i++)
+            av_freep(&s->thread_context[i]);
+        av_freep(&s->thread_context);
+    }
     return 0;
 }
 
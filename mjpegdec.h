@@ -35,6 +35,19 @@
 
 #define MAX_COMPONENTS 4
 
+#define AC_LUT_BITS 9
+
+/**
+ * Entry of the combined AC lookup table, indexed by the next AC_LUT_BITS
+ * bits of the bitstream; covers the codes whose Huffman code and magnitude
+ * bits fit together in AC_LUT_BITS.
+ */
+typedef struct MJpegACLUT {
+    int16_t level;      ///< sign extended coefficient value, 0 for EOB
+    uint8_t run;        ///< zero run + 1
+    uint8_t len;        ///< Huffman code + magnitude bits, 0 if not in the table
+} MJpegACLUT;
+
 typedef struct MJpegDecodeContext {
     AVCodecContext *avctx;
     GetBitContext gb;
@@ -45,6 +58,7 @@ typedef struct MJpegDecodeContext {
 
     int16_t quant_matrixes[4][64];
     VLC vlcs[2][4];
+    MJpegACLUT ac_lut[4][1 << AC_LUT_BITS];
     int qscale[4];      ///< quantizer scale calculated from quant_matrixes
 
     int org_height;  /* size given at codec init */
@@ -105,6 +119,11 @@ typedef struct MJpegDecodeContext {
 
     uint16_t (*ljpeg_buffer)[4];
     unsigned int ljpeg_buffer_size;
+
+    int *restart_offsets;            ///< offsets in buffer of the data following each RSTn marker of the scan
+    unsigned int restart_offsets_size;
+    int nb_restart_offsets;
+    struct MJpegDecodeContext **thread_context; ///< restart interval thread contexts, [0] is this context
 } MJpegDecodeContext;
 
 int ff_mjpeg_decode_init(AVCodecContext *avctx);
@@ -1250,6 +1250,203 @@ int ff_pre_estimate_p_frame_motion(MpegEncContext * s,
     return dmin;
 }
 
+#define PYRAMID_RANGE 4 ///< full search range around the zero vector at the coarsest level
+
+/**
+ * Number of 8x8 blocks of a pyramid level along a side of mbs macroblocks,
+ * one block covers 2^(level-1) macroblocks.
+ */
+static inline int pyramid_blocks(int mbs, int level){
+    return (mbs + (1<<(level-1)) - 1) >> (level-1);
+}
+
+int ff_init_me_pyramid(MpegEncContext *s){
+    MotionEstContext * const c= &s->me;
+    int levels= FFMIN(s->avctx->me_pyramid_levels, ME_PYRAMID_MAX_LEVELS);
+    int level, i;
+
+    if(s->me_method == ME_ZERO)
+        return 0;
+
+    /* every level has to be at least one block large */
+    while(levels > 0 && (FFMIN(s->mb_width, s->mb_height)*16 >> levels) < 8)
+        levels--;
+
+    for(level=1; level<=levels; level++){
+        const int size  = ((s->mb_width*16)>>level) * ((s->mb_height*16)>>level);
+        const int blocks= pyramid_blocks(s->mb_width, level) * pyramid_blocks(s->mb_height, level);
+
+        for(i=0; i<2; i++)
+            FF_ALLOCZ_OR_GOTO(s->avctx, c->pyramid[i][level-1], size, fail)
+        FF_ALLOCZ_OR_GOTO(s->avctx, c->pyramid_mv[level-1], blocks * 2 * sizeof(int16_t), fail)
+    }
+    c->pyramid_levels= levels;
+
+    return 0;
+fail:
+    ff_free_me_pyramid(s);
+    return -1;
+}
+
+void ff_free_me_pyramid(MpegEncContext *s){
+    MotionEstContext * const c= &s->me;
+    int i;
+
+    for(i=0; i<ME_PYRAMID_MAX_LEVELS; i++){
+        av_freep(&c->pyramid[0][i]);
+        av_freep(&c->pyramid[1][i]);
+        av_freep(&c->pyramid_mv[i]);
+    }
+    c->pyramid_levels= 0;
+}
+
+/**
+ * Searches the 8x8 block (bx, by) of a pyramid level, starting from the
+ * zero vector and the given full pel candidates of that level.
+ * @param full_search nonzero to also test all vectors within PYRAMID_RANGE
+ */
+static void pyramid_search(MpegEncContext *s, int level, int bx, int by,
+                           int cand[][2], int nb_cand, int full_search, int16_t *best){
+    MotionEstContext * const c= &s->me;
+    me_cmp_func cmpf= s->dsp.me_pre_cmp[1];
+    const int w= (s->mb_width *16)>>level;
+    const int h= (s->mb_height*16)>>level;
+    const int x= FFMIN(8*bx, w-8);
+    const int y= FFMIN(8*by, h-8);
+    const int xmin= -x, xmax= w-8-x;
+    const int ymin= -y, ymax= h-8-y;
+    uint8_t * const src= c->pyramid[0][level-1] + y*w + x;
+    uint8_t * const ref= c->pyramid[1][level-1] + y*w + x;
+    int mx=0, my=0, dmin, i;
+
+#define CHECK_PYRAMID_MV(px, py)\
+    {\
+        const int ax= av_clip(px, xmin, xmax);\
+        const int ay= av_clip(py, ymin, ymax);\
+        const int d= cmpf(s, src, ref + ay*w + ax, w, 8);\
+        if(d < dmin){\
+            dmin= d;\
+            mx= ax;\
+            my= ay;\
+        }\
+    }
+
+    dmin= cmpf(s, src, ref, w, 8);
+
+    if(full_search){
+        int dx, dy;
+        for(dy=-PYRAMID_RANGE; dy<=PYRAMID_RANGE; dy++)
+            for(dx=-PYRAMID_RANGE; dx<=PYRAMID_RANGE; dx++)
+                CHECK_PYRAMID_MV(dx, dy)
+    }
+    for(i=0; i<nb_cand; i++)
+        CHECK_PYRAMID_MV(cand[i][0], cand[i][1])
+
+    /* small diamond refinement */
+    for(i=0; i<16; i++){
+        const int cx= mx, cy= my;
+        CHECK_PYRAMID_MV(cx-1, cy  )
+        CHECK_PYRAMID_MV(cx+1, cy  )
+        CHECK_PYRAMID_MV(cx  , cy-1)
+        CHECK_PYRAMID_MV(cx  , cy+1)
+        if(mx==cx && my==cy)
+            break;
+    }
+#undef CHECK_PYRAMID_MV
+
+    best[0]= mx;
+    best[1]= my;
+}
+
+/**
+ * Downscales the current and the reference picture and searches all levels
+ * of the pyramid but the finest, coarse to fine. Each level is seeded with
+ * the vectors of the level above it.
+ */
+void ff_build_me_pyramid(MpegEncContext *s){
+    MotionEstContext * const c= &s->me;
+    int level, bx, by;
+
+    for(level=1; level<=c->pyramid_levels; level++){
+        const int w= (s->mb_width *16)>>level;
+        const int h= (s->mb_height*16)>>level;
+
+        s->dsp.shrink[level](c->pyramid[0][level-1], w, s->new_picture .data[0], s->linesize, w, h);
+        s->dsp.shrink[level](c->pyramid[1][level-1], w, s->last_picture.data[0], s->linesize, w, h);
+    }
+
+    /* level 1 is searched per macroblock, see ff_pyramid_estimate_p_frame_motion() */
+    for(level=c->pyramid_levels; level>1; level--){
+        const int bw= pyramid_blocks(s->mb_width , level);
+        const int bh= pyramid_blocks(s->mb_height, level);
+        int16_t (*mv)[2]= c->pyramid_mv[level-1];
+
+        for(by=0; by<bh; by++){
+            for(bx=0; bx<bw; bx++){
+                int cand[3][2], n=0;
+
+                if(level < c->pyramid_levels){
+                    const int16_t *up= c->pyramid_mv[level][(by>>1)*pyramid_blocks(s->mb_width, level+1) + (bx>>1)];
+                    cand[n][0]= 2*up[0];
+                    cand[n][1]= 2*up[1];
+                    n++;
+                }
+                if(bx){
+                    cand[n][0]= mv[by*bw + bx-1][0];
+                    cand[n][1]= mv[by*bw + bx-1][1];
+                    n++;
+                }
+                if(by){
+                    cand[n][0]= mv[(by-1)*bw + bx][0];
+                    cand[n][1]= mv[(by-1)*bw + bx][1];
+                    n++;
+                }
+                pyramid_search(s, level, bx, by, cand, n, level == c->pyramid_levels, mv[by*bw + bx]);
+            }
+        }
+    }
+}
+
+/**
+ * Searches the half resolution level of the pyramid for one macroblock and
+ * stores the result in p_mv_table, where ff_estimate_p_frame_motion() and
+ * ff_pre_estimate_p_frame_motion() pick it up as a predictor.
+ * Only macroblocks of the same slice are used as predictors, so slices can
+ * be searched in parallel after ff_build_me_pyramid().
+ */
+void ff_pyramid_estimate_p_frame_motion(MpegEncContext * s, int mb_x, int mb_y){
+    MotionEstContext * const c= &s->me;
+    const int shift= 1+s->quarter_sample;
+    const int xy= mb_x + mb_y*s->mb_stride;
+    int16_t (*mv)[2]= c->pyramid_mv[0];
+    int cand[4][2], n=0;
+
+    /* vector of the previous frame */
+    cand[n][0]= s->p_mv_table[xy][0] >> (shift+1);
+    cand[n][1]= s->p_mv_table[xy][1] >> (shift+1);
+    n++;
+    if(c->pyramid_levels > 1){
+        const int16_t *up= c->pyramid_mv[1][(mb_y>>1)*pyramid_blocks(s->mb_width, 2) + (mb_x>>1)];
+        cand[n][0]= 2*up[0];
+        cand[n][1]= 2*up[1];
+        n++;
+    }
+    if(mb_x){
+        cand[n][0]= mv[mb_y*s->mb_width + mb_x-1][0];
+        cand[n][1]= mv[mb_y*s->mb_width + mb_x-1][1];
+        n++;
+    }
+    if(!s->first_slice_line){
+        cand[n][0]= mv[(mb_y-1)*s->mb_width + mb_x][0];
+        cand[n][1]= mv[(mb_y-1)*s->mb_width + mb_x][1];
+        n++;
+    }
+    pyramid_search(s, 1, mb_x, mb_y, cand, n, c->pyramid_levels == 1, mv[mb_y*s->mb_width + mb_x]);
+
+    s->p_mv_table[xy][0]= mv[mb_y*s->mb_width + mb_x][0] << (shift+1);
+    s->p_mv_table[xy][1]= mv[mb_y*s->mb_width + mb_x][1] << (shift+1);
+}
+
 static int ff_estimate_motion_b(MpegEncContext * s,
                        int mb_x, int mb_y, int16_t (*mv_table)[2], int ref_index, int f_code)
 {
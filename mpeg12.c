@@ -35,6 +35,7 @@
 #include "mpeg12data.h"
 #include "mpeg12decdata.h"
 #include "bytestream.h"
+#include "thread.h"
 #include "vdpau_internal.h"
 #include "xvmc_internal.h"
 
@@ -1164,12 +1165,25 @@ static inline int mpeg2_fast_decode_block_intra(MpegEncContext *s,
     return 0;
 }
 
+/**
+ * Rows of a picture decoded by one slice thread job, see slice_decode_thread().
+ */
+typedef struct MpegSliceJob {
+    const uint8_t *buf;              ///< data of the first slice, after its start code
+    int size;
+    int start_mb_y, end_mb_y;
+    int error_count;
+} MpegSliceJob;
+
 typedef struct Mpeg1Context {
     MpegEncContext mpeg_enc_ctx;
     int mpeg_enc_ctx_allocated; /* true if decoding context allocated */
     int repeat_field; /* true if we must repeat the field */
     AVPanScan pan_scan; /** some temporary storage for the panscan */
     int slice_count;
+    MpegSliceJob *slice_jobs;        ///< one per row with slices, if slice threads are used
+    unsigned int slice_jobs_size;
+    int row_pipeline; ///< slice threads conceal and draw finished rows in order
     int swap_uv;//indicate VCR2
     int save_aspect_info;
     int save_width, save_height, save_progressive_seq;
@@ -1795,7 +1809,9 @@ static int mpeg_decode_slice(Mpeg1Context *s1, int mb_y,
         if (++s->mb_x >= s->mb_width) {
             const int mb_size= 16>>s->avctx->lowres;
 
-            ff_draw_horiz_band(s, mb_size*(s->mb_y>>field_pic), mb_size);
+            /* slice threads draw finished rows in slice_decode_thread() */
+            if (avctx->thread_count <= 1)
+                ff_draw_horiz_band(s, mb_size*(s->mb_y>>field_pic), mb_size);
 
             s->mb_x = 0;
             s->mb_y += 1<<field_pic;
@@ -1881,19 +1897,62 @@ eos: // end of slice
     return 0;
 }
 
-static int slice_decode_thread(AVCodecContext *c, void *arg){
-    MpegEncContext *s= *(void**)arg;
-    const uint8_t *buf= s->gb.buffer;
-    int mb_y= s->start_mb_y;
+/**
+ * Passes the rows of a slice thread job from *done_row up to row on.
+ * Rows are counted within the picture, i.e. mb_y>>field_pic for field pictures.
+ * With the row pipeline, whichever thread finds rows complete in picture
+ * order conceals and draws them, once the row below is complete too, so
+ * that concealment can use it. Otherwise every thread draws its own rows.
+ */
+static void slice_rows_done(AVCodecContext *avctx, MpegEncContext *s, int *done_row, int row)
+{
+    Mpeg1Context *s1 = avctx->priv_data;
     const int field_pic= s->picture_structure != PICT_FRAME;
+    const int mb_size= 16>>avctx->lowres;
+    const int rows= (s->mb_height + field_pic) >> field_pic;
+    int first, n= 0;
+
+    if(!s1->row_pipeline){
+        for(; *done_row < row && *done_row < rows; (*done_row)++)
+            ff_draw_horiz_band(s, mb_size * *done_row, mb_size);
+        *done_row= FFMAX(*done_row, row);
+        return;
+    }
+
+    for(; *done_row < row; (*done_row)++)
+        ff_thread_report_row_progress(avctx, *done_row);
 
+    while((n= ff_thread_claim_rows(avctx, n, 1, &first)) > 0){
+        int y;
+
+        for(y= first; y < first + n; y++){
+            ff_er_conceal_row(s, y);
+            if(avctx->draw_horiz_band)
+                ff_draw_horiz_band(s, mb_size*y, mb_size);
+        }
+    }
+}
+
+static int slice_decode_thread(AVCodecContext *c, void *arg, int jobnr, int threadnr){
+    Mpeg1Context *s1= c->priv_data;
+    MpegEncContext *s= s1->mpeg_enc_ctx.thread_context[threadnr];
+    MpegSliceJob *job= &s1->slice_jobs[jobnr];
+    const uint8_t *buf= job->buf;
+    const uint8_t *buf_end= job->buf + job->size;
+    int mb_y= job->start_mb_y;
+    const int field_pic= s->picture_structure != PICT_FRAME;
+    int done_row= jobnr ? job->start_mb_y >> field_pic : 0; // the first job also passes any rows above it on
+    int res= 0;
+
+    s->start_mb_y= job->start_mb_y;
+    s->end_mb_y  = job->end_mb_y;
     s->error_count= (3*(s->end_mb_y - s->start_mb_y)*s->mb_width) >> field_pic;
 
     for(;;){
         uint32_t start_code;
         int ret;
 
-        ret= mpeg_decode_slice((Mpeg1Context*)s, mb_y, &buf, s->gb.buffer_end - buf);
+        ret= mpeg_decode_slice((Mpeg1Context*)s, mb_y, &buf, buf_end - buf);
         emms_c();
 //av_log(c, AV_LOG_DEBUG, "ret:%d resync:%d/%d mb:%d/%d ts:%d/%d ec:%d\n",
 //ret, s->resync_mb_x, s->resync_mb_y, s->mb_x, s->mb_y, s->start_mb_y, s->end_mb_y, s->error_count);
@@ -1905,16 +1964,25 @@ static int slice_decode_thread(AVCodecContext *c, void *arg){
         }
 
         if(s->mb_y == s->end_mb_y)
-            return 0;
+            break;
 
         start_code= -1;
-        buf = ff_find_start_code(buf, s->gb.buffer_end, &start_code);
-        mb_y= start_code - SLICE_MIN_START_CODE;
-        if(mb_y < 0 || mb_y >= s->end_mb_y)
-            return -1;
+        buf = ff_find_start_code(buf, buf_end, &start_code);
+        mb_y= (start_code - SLICE_MIN_START_CODE) << field_pic;
+        if(s->picture_structure == PICT_BOTTOM_FIELD)
+            mb_y++;
+        if(mb_y < 0 || mb_y >= s->end_mb_y){
+            res= -1;
+            break;
+        }
+        /* slices of a job are in order, so all rows above the next one are finished */
+        slice_rows_done(c, s, &done_row, mb_y >> field_pic);
     }
+    /* also pass damaged rows on, later rows must not wait for them forever */
+    slice_rows_done(c, s, &done_row, s->end_mb_y >> field_pic);
+    job->error_count= s->error_count;
 
-    return 0; //not reached
+    return res;
 }
 
 /**
@@ -2284,12 +2352,19 @@ static int decode_chunks(AVCodecContext *avctx,
         buf_ptr = ff_find_start_code(buf_ptr,buf_end, &start_code);
         if (start_code > 0x1ff){
             if(s2->pict_type != FF_B_TYPE || avctx->skip_frame <= AVDISCARD_DEFAULT){
-                if(avctx->thread_count > 1){
+                if(avctx->thread_count > 1 && s->slice_count){
+                    const int field_pic= s2->picture_structure != PICT_FRAME;
+                    int64_t error_count= (3*s->slice_jobs[0].start_mb_y*s2->mb_width) >> field_pic;
                     int i;
 
-                    avctx->execute(avctx, slice_decode_thread,  &s2->thread_context[0], NULL, s->slice_count, sizeof(void*));
+                    /* Rows are concealed and drawn in order as soon as they and
+                     * the row below are decoded, instead of after the picture. */
+                    s->row_pipeline= s->slice_count > 1 &&
+                                     ff_thread_init_row_progress(avctx, (s2->mb_height + field_pic) >> field_pic) >= 0;
+                    avctx->execute2(avctx, slice_decode_thread, NULL, NULL, s->slice_count);
                     for(i=0; i<s->slice_count; i++)
-                        s2->error_count += s2->thread_context[i]->error_count;
+                        error_count += s->slice_jobs[i].error_count;
+                    s2->error_count= FFMIN(error_count, INT_MAX);
                 }
 
                 if (CONFIG_MPEG_VDPAU_DECODER && avctx->codec->capabilities&CODEC_CAP_HWACCEL_VDPAU)
@@ -2447,17 +2522,26 @@ static int decode_chunks(AVCodecContext *avctx,
                 }
 
                 if(avctx->thread_count > 1){
-                    int threshold= (s2->mb_height*s->slice_count + avctx->thread_count/2) / avctx->thread_count;
-                    if(threshold <= mb_y){
-                        MpegEncContext *thread_context= s2->thread_context[s->slice_count];
-
-                        thread_context->start_mb_y= mb_y;
-                        thread_context->end_mb_y  = s2->mb_height;
-                        if(s->slice_count){
-                            s2->thread_context[s->slice_count-1]->end_mb_y= mb_y;
-                            ff_update_duplicate_context(thread_context, s2);
+                    /* one job per row, the slice threads share them out */
+                    if(!s->slice_count || mb_y > s->slice_jobs[s->slice_count-1].start_mb_y){
+                        MpegSliceJob *job;
+                        int i;
+
+                        job= av_fast_realloc(s->slice_jobs, &s->slice_jobs_size, (s->slice_count+1)*sizeof(MpegSliceJob));
+                        if(!job)
+                            return AVERROR(ENOMEM);
+                        s->slice_jobs= job;
+                        job+= s->slice_count;
+                        job->buf= buf_ptr;
+                        job->size= input_size;
+                        job->start_mb_y= mb_y;
+                        job->end_mb_y  = s2->mb_height;
+                        if(s->slice_count)
+                            job[-1].end_mb_y= mb_y;
+                        else{
+                            for(i=1; i<avctx->thread_count; i++)
+                                ff_update_duplicate_context(s2->thread_context[i], s2);
                         }
-                        init_get_bits(&thread_context->gb, buf_ptr, input_size*8);
                         s->slice_count++;
                     }
                     buf_ptr += 2; //FIXME add minimum number of bytes per slice
@@ -2492,6 +2576,7 @@ static int mpeg_decode_end(AVCodecContext *avctx)
 
     if (s->mpeg_enc_ctx_allocated)
         MPV_common_end(&s->mpeg_enc_ctx);
+    av_freep(&s->slice_jobs);
     return 0;
 }
 
@@ -123,6 +123,7 @@ typedef struct Picture{
     int ref_poc[2][2][16];      ///< h264 POCs of the frames used as reference (FIXME need per slice)
     int ref_count[2][2];        ///< number of entries in ref_poc              (FIXME need per slice)
     int mbaff;                  ///< h264 1 -> MBAFF frame 0-> not MBAFF
+    int field_picture;          ///< whether or not the picture was encoded in separate fields
 
     int mb_var_sum;             ///< sum of MB variance for current frame
     int mc_mb_var_sum;          ///< motion compensated MB variance for current frame
@@ -131,10 +132,28 @@ typedef struct Picture{
     uint8_t *mb_mean;           ///< Table for MB luminance
     int32_t *mb_cmp_score;      ///< Table for MB cmp scores, for mb decision FIXME remove
     int b_frame_score;          /* */
+    int lookahead_mb_var_sum;   ///< estimated mb_var_sum, for the rate control lookahead
+    int lookahead_mc_mb_var_sum;///< estimated mc_mb_var_sum without motion, for the rate control lookahead
+    int analysed;               ///< mb_var and mb_mean were filled by the input analysis of the pipelined mode
+    int analysis_mb_var_sum;    ///< mb_var_sum of the input analysis
+    int16_t (*pre_mv)[2];       ///< full pel vectors of the input analysis, see pre_mv_ref
+    int pre_mv_ref;             ///< display_picture_number of the input picture pre_mv points into, -1 if none
+    struct MpegEncContext *owner2; ///< pointer to the MpegEncContext that allocated this picture
 } Picture;
 
 struct MpegEncContext;
 
+/**
+ * Translates a Picture pointer of one context into the matching
+ * Picture of another, used when copying state between frame threads.
+ */
+#define REBASE_PICTURE(pic, new_ctx, old_ctx) ((pic) ? \
+    ((pic) >= (old_ctx)->picture && (pic) < (old_ctx)->picture+(old_ctx)->picture_count ?\
+        &(new_ctx)->picture[(pic) - (old_ctx)->picture] : (Picture*)((uint8_t*)(new_ctx) + ((uint8_t*)(pic) - (uint8_t*)(old_ctx))))\
+    : NULL)
+
+#define ME_PYRAMID_MAX_LEVELS 3
+
 /**
  * Motion estimation context.
  */
@@ -189,6 +208,11 @@ typedef struct MotionEstContext{
                                   int *mx_ptr, int *my_ptr, int dmin,
                                   int src_index, int ref_index,
                                   int size, int h);
+
+    /* hierarchical pre-pass, level n is downscaled by 2^n and stored at index n-1 */
+    int pyramid_levels;                ///< number of downscaled levels, 0 if disabled
+    uint8_t *pyramid[2][ME_PYRAMID_MAX_LEVELS]; ///< luma of the current and the reference picture
+    int16_t (*pyramid_mv[ME_PYRAMID_MAX_LEVELS])[2]; ///< full pel vector of each 8x8 block of a level
 }MotionEstContext;
 
 /**
@@ -244,9 +268,30 @@ typedef struct MpegEncContext {
     int linesize;              ///< line size, in bytes, may be different from width
     int uvlinesize;            ///< line size, for chroma in bytes, may be different from width
     Picture *picture;          ///< main picture buffer
+    int picture_count;         ///< number of allocated pictures (MAX_PICTURE_COUNT * avctx->thread_count)
+    int picture_range_start, picture_range_end; ///< the part of picture that this context can allocate in
     Picture **input_picture;   ///< next pictures on display order for encoding
     Picture **reordered_input_picture; ///< pointer to the next pictures in codedorder for encoding
 
+    /* b_frame_strategy 2 lookahead, kept alive between frames */
+    struct AVCodecContext *brd_ctx[FF_MAX_B_FRAMES+1]; ///< trial encoders, one per tested number of B-frames
+    AVFrame brd_input[FF_MAX_B_FRAMES+2];      ///< downscaled reference and input pictures
+    int brd_input_number[FF_MAX_B_FRAMES+2];   ///< display_picture_number brd_input was made from, -1 if none
+    uint8_t *brd_outbuf;                       ///< output buffers of the trial encoders
+
+    /* CODEC_FLAG2_PIPELINE */
+    struct AsyncContext *pipeline;             ///< thread encoding the queued pictures, NULL if not pipelined
+    int pipeline_busy;                         ///< a picture is being encoded by the pipeline thread
+    uint8_t *pipeline_buf;                     ///< output buffer of the pipeline thread
+    unsigned int pipeline_buf_size;
+    AVFrame pipeline_frame;                    ///< coded_frame, copy of the picture returned last
+    uint8_t *analysis_luma[2];                 ///< full macroblocks of the luma of the analysed and of the previous input picture
+    uint16_t *analysis_mb_var;                 ///< input analysis of the next picture, see analyse_input()
+    uint8_t *analysis_mb_mean;
+    int16_t (*analysis_mv)[2];
+    int analysis_mb_var_sum;
+    int analysis_prev;                         ///< display_picture_number of the picture in analysis_luma[1], -1 if none
+
     int start_mb_y;            ///< start mb_y of this thread (so current thread should process start_mb_y <= row < end_mb_y)
     int end_mb_y;              ///< end   mb_y of this thread (so current thread should process start_mb_y <= row < end_mb_y)
     struct MpegEncContext *thread_context[MAX_THREADS];
@@ -680,6 +725,7 @@ typedef struct MpegEncContext {
 void MPV_decode_defaults(MpegEncContext *s);
 int MPV_common_init(MpegEncContext *s);
 void MPV_common_end(MpegEncContext *s);
+int ff_mpeg_update_thread_context(AVCodecContext *dst, AVCodecContext *src);
 void MPV_decode_mb(MpegEncContext *s, DCTELEM block[12][64]);
 int MPV_frame_start(MpegEncContext *s, AVCodecContext *avctx);
 void MPV_frame_end(MpegEncContext *s);
@@ -704,6 +750,7 @@ const uint8_t *ff_find_start_code(const uint8_t *p, const uint8_t *end, uint32_t
 
 void ff_er_frame_start(MpegEncContext *s);
 void ff_er_frame_end(MpegEncContext *s);
+void ff_er_conceal_row(MpegEncContext *s, int mb_y);
 void ff_er_add_slice(MpegEncContext *s, int startx, int starty, int endx, int endy, int status);
 
 int ff_dct_common_init(MpegEncContext *s);
@@ -764,6 +811,10 @@ void ff_fix_long_mvs(MpegEncContext * s, uint8_t *field_select_table, int field_
                      int16_t (*mv_table)[2], int f_code, int type, int truncate);
 int ff_init_me(MpegEncContext *s);
 int ff_pre_estimate_p_frame_motion(MpegEncContext * s, int mb_x, int mb_y);
+int ff_init_me_pyramid(MpegEncContext *s);
+void ff_free_me_pyramid(MpegEncContext *s);
+void ff_build_me_pyramid(MpegEncContext *s);
+void ff_pyramid_estimate_p_frame_motion(MpegEncContext * s, int mb_x, int mb_y);
 int ff_epzs_motion_search(MpegEncContext * s, int *mx_ptr, int *my_ptr,
                              int P[10][2], int src_index, int ref_index, int16_t (*last_mv)[2],
                              int ref_mv_scale, int size, int h);
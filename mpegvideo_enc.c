@@ -39,6 +39,7 @@
 #include "flv.h"
 #include "mpeg4video.h"
 #include "internal.h"
+#include "thread.h"
 #include <limits.h>
 
 //#undef NDEBUG
@@ -47,6 +48,8 @@
 static int encode_picture(MpegEncContext *s, int picture_number);
 static int dct_quantize_refine(MpegEncContext *s, DCTELEM *block, int16_t *weight, DCTELEM *orig, int n, int qscale);
 static int sse_mb(MpegEncContext *s);
+static void brd_free(MpegEncContext *s);
+static int pipeline_job(AVCodecContext *avctx, void *arg);
 
 /* enable all paranoid tests for rounding, overflows, etc... */
 //#define PARANOID
@@ -332,6 +335,21 @@ av_cold int MPV_encode_init(AVCodecContext *avctx)
         return -1;
     }
 
+    if(avctx->rc_lookahead){
+        if(!avctx->rc_max_rate){
+            av_log(avctx, AV_LOG_ERROR, "the rate control lookahead needs a maximum bitrate and a vbv buffer size\n");
+            return -1;
+        }
+        if(!(avctx->codec->capabilities & CODEC_CAP_DELAY)){
+            av_log(avctx, AV_LOG_ERROR, "the rate control lookahead is not supported by this codec\n");
+            return -1;
+        }
+        if(avctx->rc_lookahead + 2*s->max_b_frames > MAX_PICTURE_COUNT - 8){
+            av_log(avctx, AV_LOG_ERROR, "too many frames in flight, reduce rc_lookahead or max_b_frames\n");
+            return -1;
+        }
+    }
+
     if(avctx->rc_min_rate && avctx->rc_max_rate != avctx->rc_min_rate){
         av_log(avctx, AV_LOG_INFO, "Warning min_rate > 0 but min_rate != max_rate isn't recommended!\n");
     }
@@ -692,6 +710,14 @@ av_cold int MPV_encode_init(AVCodecContext *avctx)
     if (MPV_common_init(s) < 0)
         return -1;
 
+    if (ff_init_me_pyramid(s) < 0)
+        return -1;
+
+    if (avctx->mb_stats && avctx->mb_stats_count < s->mb_num) {
+        av_log(avctx, AV_LOG_ERROR, "mb_stats must have at least %d entries\n", s->mb_num);
+        return -1;
+    }
+
     if(!s->dct_quantize)
         s->dct_quantize = dct_quantize_c;
     if(!s->denoise_dct)
@@ -750,6 +776,32 @@ av_cold int MPV_encode_init(AVCodecContext *avctx)
     if(ff_rate_control_init(s) < 0)
         return -1;
 
+    if(avctx->flags2 & CODEC_FLAG2_PIPELINE){
+        /* stats_out, the PSNR error sums and mb_stats are read by the user after each call */
+        if((s->flags & (CODEC_FLAG_PASS1|CODEC_FLAG_PSNR)) || avctx->mb_stats){
+            av_log(avctx, AV_LOG_WARNING, "pipelined encoding is incompatible with pass 1, PSNR and mb_stats, disabled\n");
+        }else if(!(avctx->codec->capabilities & CODEC_CAP_DELAY)){
+            /* the last packet can only be flushed out by a delay capable codec */
+            av_log(avctx, AV_LOG_WARNING, "pipelined encoding is not supported by this codec, disabled\n");
+        }else if(!(s->pipeline= ff_thread_async_init(avctx, pipeline_job, NULL))){
+            av_log(avctx, AV_LOG_WARNING, "pipelined encoding needs threads, disabled\n");
+        }else{
+            const int luma_size= (s->width>>4)*(s->height>>4)*256;
+            const int mb_array_size= s->mb_stride*s->mb_height;
+
+            avctx->coded_frame= &s->pipeline_frame;
+            s->analysis_prev= -1;
+            s->analysis_luma[0]= av_mallocz(luma_size);
+            s->analysis_luma[1]= av_mallocz(luma_size);
+            s->analysis_mb_var = av_mallocz(mb_array_size * sizeof(uint16_t));
+            s->analysis_mb_mean= av_mallocz(mb_array_size * sizeof(uint8_t));
+            s->analysis_mv     = av_mallocz(mb_array_size * 2 * sizeof(int16_t));
+            if(   !s->analysis_luma[0] || !s->analysis_luma[1] || !s->analysis_mb_var
+               || !s->analysis_mb_mean || !s->analysis_mv)
+                return AVERROR(ENOMEM);
+        }
+    }
+
     return 0;
 }
 
@@ -757,7 +809,16 @@ av_cold int MPV_encode_end(AVCodecContext *avctx)
 {
     MpegEncContext *s = avctx->priv_data;
 
+    ff_thread_async_free(&s->pipeline);
+    av_freep(&s->pipeline_buf);
+    av_freep(&s->analysis_luma[0]);
+    av_freep(&s->analysis_luma[1]);
+    av_freep(&s->analysis_mb_var);
+    av_freep(&s->analysis_mb_mean);
+    av_freep(&s->analysis_mv);
     ff_rate_control_uninit(s);
+    brd_free(s);
+    ff_free_me_pyramid(s);
 
     MPV_common_end(s);
     if ((CONFIG_MJPEG_ENCODER || CONFIG_LJPEG_ENCODER) && s->out_format == FMT_MJPEG)
@@ -801,12 +862,199 @@ static int get_intra_count(MpegEncContext *s, uint8_t *src, uint8_t *ref, int st
     return acc;
 }
 
+/**
+ * Estimates the spatial and the zero motion temporal complexity of an input
+ * picture in the units of mb_var_sum and mc_mb_var_sum, for the rate control
+ * lookahead.
+ */
+static void estimate_lookahead_var(MpegEncContext *s, Picture *p, Picture *prev){
+    int x, y, w, h;
+    const int stride= s->linesize;
+    int var_sum= 0, mc_var_sum= 0;
+
+    w= s->width &~15;
+    h= s->height&~15;
+
+    for(y=0; y<h; y+=16){
+        for(x=0; x<w; x+=16){
+            uint8_t *pix= p->data[0] + x + y*stride;
+            int sum = s->dsp.pix_sum(pix, stride);
+            int varc= (s->dsp.pix_norm1(pix, stride) - (((unsigned)(sum*sum))>>8) + 500 + 128)>>8;
+            int vard= varc;
+
+            if(prev)
+                vard= FFMIN(vard, (s->dsp.sse[0](NULL, pix, prev->data[0] + x + y*stride, stride, 16) + 128)>>8);
+
+            var_sum   += varc;
+            mc_var_sum+= vard;
+        }
+    }
+    emms_c();
+
+    p->lookahead_mb_var_sum   = var_sum;
+    p->lookahead_mc_mb_var_sum= mc_var_sum;
+}
+
+#define ANALYSIS_RANGE 64 ///< largest full pel vector component searched by the input analysis
+
+/**
+ * Full pel motion search of one macroblock of the input analysis, against
+ * the previous input picture, starting from the zero vector and the
+ * vectors of the neighbours searched before.
+ */
+static void analyse_mb_motion(MpegEncContext *s, uint8_t *cur, uint8_t *ref, int stride,
+                              int mb_x, int mb_y, int mb_w, int mb_h){
+    int16_t (*mv)[2]= s->analysis_mv;
+    const int xy= mb_x + mb_y*s->mb_stride;
+    const int xmin= FFMAX(-16*mb_x, -ANALYSIS_RANGE), xmax= FFMIN(16*(mb_w-1-mb_x), ANALYSIS_RANGE);
+    const int ymin= FFMAX(-16*mb_y, -ANALYSIS_RANGE), ymax= FFMIN(16*(mb_h-1-mb_y), ANALYSIS_RANGE);
+    int cand[3][2], n=0;
+    int mx=0, my=0, dmin, i;
+
+#define CHECK_ANALYSIS_MV(px, py)\
+    {\
+        const int ax= av_clip(px, xmin, xmax);\
+        const int ay= av_clip(py, ymin, ymax);\
+        const int d= s->dsp.sad[0](NULL, cur, ref + ax + ay*stride, stride, 16);\
+        if(d < dmin){\
+            dmin= d;\
+            mx= ax;\
+            my= ay;\
+        }\
+    }
+
+    if(mb_x){
+        cand[n][0]= mv[xy-1][0];
+        cand[n][1]= mv[xy-1][1];
+        n++;
+    }
+    if(mb_y){
+        cand[n][0]= mv[xy-s->mb_stride][0];
+        cand[n][1]= mv[xy-s->mb_stride][1];
+        n++;
+        if(mb_x+1 < mb_w){
+            cand[n][0]= mv[xy-s->mb_stride+1][0];
+            cand[n][1]= mv[xy-s->mb_stride+1][1];
+            n++;
+        }
+    }
+
+    dmin= s->dsp.sad[0](NULL, cur, ref, stride, 16);
+    for(i=0; i<n; i++)
+        CHECK_ANALYSIS_MV(cand[i][0], cand[i][1])
+    for(i=0; i<2*ANALYSIS_RANGE; i++){
+        const int cx= mx, cy= my;
+        CHECK_ANALYSIS_MV(cx-1, cy  )
+        CHECK_ANALYSIS_MV(cx+1, cy  )
+        CHECK_ANALYSIS_MV(cx  , cy-1)
+        CHECK_ANALYSIS_MV(cx  , cy+1)
+        if(mx==cx && my==cy)
+            break;
+    }
+#undef CHECK_ANALYSIS_MV
+
+    mv[xy][0]= mx;
+    mv[xy][1]= my;
+}
+
+/**
+ * Input analysis of the pipelined mode, run by the calling thread on the
+ * next input picture while the pipeline thread still encodes the previous
+ * one. It finds the spatial variance and mean of every macroblock, as
+ * mb_var_thread() does, and does a full pel motion search against the
+ * previous input picture, which seeds P-frame motion estimation in place of
+ * the pre-pass on the reconstructed reference.
+ * Only macroblocks completely inside the picture are analysed here, the
+ * others by finish_input_analysis() once the picture is queued.
+ * Nothing the pipeline thread uses may be touched.
+ */
+static void analyse_input(MpegEncContext *s, const AVFrame *pic_arg){
+    const int mb_w= s->width >>4;
+    const int mb_h= s->height>>4;
+    const int stride= 16*mb_w;
+    uint8_t *cur= s->analysis_luma[0];
+    uint8_t *ref= s->analysis_luma[1];
+    int mb_x, mb_y, y;
+
+    s->analysis_mb_var_sum= 0;
+    if(!mb_w || !mb_h)
+        return;
+
+    for(y=0; y<16*mb_h; y++)
+        memcpy(cur + y*stride, pic_arg->data[0] + y*pic_arg->linesize[0], stride);
+
+    for(mb_y=0; mb_y<mb_h; mb_y++){
+        for(mb_x=0; mb_x<mb_w; mb_x++){
+            const int xy= mb_x + mb_y*s->mb_stride;
+            uint8_t *pix= cur + 16*(mb_x + mb_y*stride);
+            int sum= s->dsp.pix_sum(pix, stride);
+            int varc= (s->dsp.pix_norm1(pix, stride) - (((unsigned)(sum*sum))>>8) + 500 + 128)>>8;
+
+            s->analysis_mb_var [xy]= varc;
+            s->analysis_mb_mean[xy]= (sum+128)>>8;
+            s->analysis_mb_var_sum+= varc;
+
+            if(s->analysis_prev >= 0)
+                analyse_mb_motion(s, pix, ref + 16*(mb_x + mb_y*stride), stride, mb_x, mb_y, mb_w, mb_h);
+        }
+    }
+    emms_c();
+}
+
+/**
+ * Completes the input analysis of the picture just queued by
+ * load_input_picture() and attaches it to the picture.
+ */
+static int finish_input_analysis(MpegEncContext *s, Picture *pic){
+    const int mb_w= s->width >>4;
+    const int mb_h= s->height>>4;
+    const int offset= s->avctx->rc_buffer_size ? 0 : INPLACE_OFFSET;
+    int mb_x, mb_y, var_sum= s->analysis_mb_var_sum;
+
+    if(!pic->pre_mv){
+        pic->pre_mv= av_malloc(s->mb_stride*s->mb_height*sizeof(*pic->pre_mv));
+        if(!pic->pre_mv)
+            return AVERROR(ENOMEM);
+    }
+
+    for(mb_y=0; mb_y<s->mb_height; mb_y++){
+        for(mb_x=0; mb_x<s->mb_width; mb_x++){
+            const int xy= mb_x + mb_y*s->mb_stride;
+
+            if(mb_x < mb_w && mb_y < mb_h){
+                pic->mb_var [xy]= s->analysis_mb_var [xy];
+                pic->mb_mean[xy]= s->analysis_mb_mean[xy];
+                pic->pre_mv[xy][0]= s->analysis_prev >= 0 ? s->analysis_mv[xy][0] : 0;
+                pic->pre_mv[xy][1]= s->analysis_prev >= 0 ? s->analysis_mv[xy][1] : 0;
+            }else{
+                uint8_t *pix= pic->data[0] + offset + 16*(mb_x + mb_y*s->linesize);
+                int sum= s->dsp.pix_sum(pix, s->linesize);
+                int varc= (s->dsp.pix_norm1(pix, s->linesize) - (((unsigned)(sum*sum))>>8) + 500 + 128)>>8;
+
+                pic->mb_var [xy]= varc;
+                pic->mb_mean[xy]= (sum+128)>>8;
+                var_sum+= varc;
+                pic->pre_mv[xy][0]= pic->pre_mv[xy][1]= 0;
+            }
+        }
+    }
+    emms_c();
+
+    pic->analysed= 1;
+    pic->analysis_mb_var_sum= var_sum;
+    pic->pre_mv_ref= s->analysis_prev;
+
+    FFSWAP(uint8_t*, s->analysis_luma[0], s->analysis_luma[1]);
+    s->analysis_prev= pic->display_picture_number;
+
+    return 0;
+}
 
 static int load_input_picture(MpegEncContext *s, AVFrame *pic_arg){
     AVFrame *pic=NULL;
     int64_t pts;
     int i;
-    const int encoding_delay= s->max_b_frames;
+    const int encoding_delay= s->max_b_frames + s->avctx->rc_lookahead;
     int direct=1;
 
     if(pic_arg){
@@ -837,6 +1085,8 @@ static int load_input_picture(MpegEncContext *s, AVFrame *pic_arg){
 
   if(pic_arg){
     if(encoding_delay && !(s->flags&CODEC_FLAG_INPUT_PRESERVED)) direct=0;
+    /* the pipeline thread still reads the picture after we return */
+    if(s->pipeline) direct=0;
     if(pic_arg->linesize[0] != s->linesize) direct=0;
     if(pic_arg->linesize[1] != s->uvlinesize) direct=0;
     if(pic_arg->linesize[2] != s->uvlinesize) direct=0;
@@ -897,6 +1147,11 @@ static int load_input_picture(MpegEncContext *s, AVFrame *pic_arg){
     }
     copy_picture_attributes(s, pic, pic_arg);
     pic->pts= pts; //we set this here to avoid modifiying pic_arg
+    ((Picture*)pic)->analysed= 0;
+
+    /* the previous input is still queued, as it is behind the max_b_frames+1 pictures select_input_picture() takes */
+    if(s->avctx->rc_lookahead)
+        estimate_lookahead_var(s, (Picture*)pic, s->input_picture[encoding_delay]);
   }
 
     /* shift buffer entries */
@@ -941,14 +1196,145 @@ static int skip_check(MpegEncContext *s, Picture *p, Picture *ref){
     return 0;
 }
 
-static int estimate_best_b_count(MpegEncContext *s){
+/**
+ * Opens the trial encoders and allocates the downscaled pictures of the
+ * b_frame_strategy 2 lookahead. This is done on the first use, as
+ * avcodec_open() cannot be nested in the init of this encoder.
+ */
+static int brd_init(MpegEncContext *s){
     AVCodec *codec= avcodec_find_encoder(s->avctx->codec_id);
-    AVCodecContext *c= avcodec_alloc_context();
+    const int scale= s->avctx->brd_scale;
+    const int width = s->width >> scale;
+    const int height= s->height>> scale;
+    const int ysize= width*height;
+    const int csize= (width/2)*(height/2);
+    int i;
+
+    for(i=0; i<s->max_b_frames+1; i++){
+        AVCodecContext *c= s->brd_ctx[i]= avcodec_alloc_context();
+
+        if(!c)
+            return -1;
+
+        c->width = width;
+        c->height= height;
+        c->flags= CODEC_FLAG_QSCALE | CODEC_FLAG_PSNR | CODEC_FLAG_INPUT_PRESERVED /*| CODEC_FLAG_EMU_EDGE*/;
+        c->flags|= s->avctx->flags & CODEC_FLAG_QPEL;
+        c->mb_decision= s->avctx->mb_decision;
+        c->me_cmp= s->avctx->me_cmp;
+        c->mb_cmp= s->avctx->mb_cmp;
+        c->me_sub_cmp= s->avctx->me_sub_cmp;
+        c->pix_fmt = PIX_FMT_YUV420P;
+        c->time_base= s->avctx->time_base;
+        c->max_b_frames= s->max_b_frames;
+
+        if (avcodec_open(c, codec) < 0)
+            return -1;
+    }
+
+    for(i=0; i<s->max_b_frames+2; i++){
+        AVFrame *input= &s->brd_input[i];
+
+        avcodec_get_frame_defaults(input);
+        input->data[0]= av_malloc(ysize + 2*csize);
+        if(!input->data[0])
+            return -1;
+        input->data[1]= input->data[0] + ysize;
+        input->data[2]= input->data[1] + csize;
+        input->linesize[0]= width;
+        input->linesize[1]=
+        input->linesize[2]= width/2;
+        s->brd_input_number[i]= -1;
+    }
+
+    s->brd_outbuf= av_malloc(s->width * s->height * (s->max_b_frames+1));
+    if(!s->brd_outbuf)
+        return -1;
+
+    return 0;
+}
+
+/**
+ * Frees the b_frame_strategy 2 lookahead. The trial encoders are closed
+ * directly, as avcodec_close() cannot be nested in the close of this encoder.
+ */
+static av_cold void brd_free(MpegEncContext *s){
+    int i;
+
+    for(i=0; i<FF_MAX_B_FRAMES+1; i++){
+        AVCodecContext *c= s->brd_ctx[i];
+
+        if(!c)
+            continue;
+        if(c->codec && c->codec->close)
+            c->codec->close(c);
+        ff_free_internal_buffer(c);
+        av_freep(&c->priv_data);
+        av_freep(&s->brd_ctx[i]);
+    }
+
+    for(i=0; i<FF_MAX_B_FRAMES+2; i++)
+        av_freep(&s->brd_input[i].data[0]);
+    av_freep(&s->brd_outbuf);
+}
+
+typedef struct BRDTrial{
+    int b_count;
+    int p_lambda, b_lambda, lambda2;
+    int64_t rd;
+} BRDTrial;
+
+/**
+ * Trial encodes the lookahead pictures with b_count B-frames between the
+ * P-frames, using the trial encoder reserved for this count.
+ */
+static int brd_trial(AVCodecContext *avctx, void *arg){
+    MpegEncContext *s= avctx->priv_data;
+    BRDTrial *t= arg;
+    const int j= t->b_count;
+    const int outbuf_size= s->width * s->height; //FIXME
+    AVCodecContext *c= s->brd_ctx[j];
+    uint8_t *outbuf= s->brd_outbuf + j*outbuf_size;
     AVFrame input[FF_MAX_B_FRAMES+2];
+    int64_t rd=0;
+    int i, out_size;
+
+    /* the picture data is shared by all trials, the frame parameters are not */
+    memcpy(input, s->brd_input, sizeof(AVFrame)*(s->max_b_frames+2));
+
+    c->error[0]= c->error[1]= c->error[2]= 0;
+
+    input[0].pict_type= FF_I_TYPE;
+    input[0].quality= 1 * FF_QP2LAMBDA;
+    out_size = avcodec_encode_video(c, outbuf, outbuf_size, &input[0]);
+//    rd += (out_size * lambda2) >> FF_LAMBDA_SHIFT;
+
+    for(i=0; i<s->max_b_frames+1; i++){
+        int is_p= i % (j+1) == j || i==s->max_b_frames;
+
+        input[i+1].pict_type= is_p ? FF_P_TYPE : FF_B_TYPE;
+        input[i+1].quality= is_p ? t->p_lambda : t->b_lambda;
+        out_size = avcodec_encode_video(c, outbuf, outbuf_size, &input[i+1]);
+        rd += (out_size * t->lambda2) >> (FF_LAMBDA_SHIFT - 3);
+    }
+
+    /* get the delayed frames */
+    while(out_size){
+        out_size = avcodec_encode_video(c, outbuf, outbuf_size, NULL);
+        rd += (out_size * t->lambda2) >> (FF_LAMBDA_SHIFT - 3);
+    }
+
+    rd += c->error[0] + c->error[1] + c->error[2];
+
+    t->rd= rd;
+
+    return 0;
+}
+
+static int estimate_best_b_count(MpegEncContext *s){
+    BRDTrial trial[FF_MAX_B_FRAMES+1];
     const int scale= s->avctx->brd_scale;
-    int i, j, out_size, p_lambda, b_lambda, lambda2;
-    int outbuf_size= s->width * s->height; //FIXME
-    uint8_t *outbuf= av_malloc(outbuf_size);
+    int i, j, k, p_lambda, b_lambda, lambda2;
     int64_t best_rd= INT64_MAX;
     int best_b_count= -1;
 
@@ -960,91 +1346,70 @@ static int estimate_best_b_count(MpegEncContext *s){
     if(!b_lambda) b_lambda= p_lambda; //FIXME we should do this somewhere else
     lambda2= (b_lambda*b_lambda + (1<<FF_LAMBDA_SHIFT)/2 ) >> FF_LAMBDA_SHIFT;
 
-    c->width = s->width >> scale;
-    c->height= s->height>> scale;
-    c->flags= CODEC_FLAG_QSCALE | CODEC_FLAG_PSNR | CODEC_FLAG_INPUT_PRESERVED /*| CODEC_FLAG_EMU_EDGE*/;
-    c->flags|= s->avctx->flags & CODEC_FLAG_QPEL;
-    c->mb_decision= s->avctx->mb_decision;
-    c->me_cmp= s->avctx->me_cmp;
-    c->mb_cmp= s->avctx->mb_cmp;
-    c->me_sub_cmp= s->avctx->me_sub_cmp;
-    c->pix_fmt = PIX_FMT_YUV420P;
-    c->time_base= s->avctx->time_base;
-    c->max_b_frames= s->max_b_frames;
-
-    if (avcodec_open(c, codec) < 0)
+    if(!s->brd_outbuf && brd_init(s) < 0){
+        brd_free(s);
         return -1;
+    }
 
     for(i=0; i<s->max_b_frames+2; i++){
-        int ysize= c->width*c->height;
-        int csize= (c->width/2)*(c->height/2);
+        const int width = s->brd_ctx[0]->width;
+        const int height= s->brd_ctx[0]->height;
         Picture pre_input, *pre_input_ptr= i ? s->input_picture[i-1] : s->next_picture_ptr;
-
-        avcodec_get_frame_defaults(&input[i]);
-        input[i].data[0]= av_malloc(ysize + 2*csize);
-        input[i].data[1]= input[i].data[0] + ysize;
-        input[i].data[2]= input[i].data[1] + csize;
-        input[i].linesize[0]= c->width;
-        input[i].linesize[1]=
-        input[i].linesize[2]= c->width/2;
-
-        if(pre_input_ptr && (!i || s->input_picture[i-1])) {
-            pre_input= *pre_input_ptr;
-
-            if(pre_input.type != FF_BUFFER_TYPE_SHARED && i) {
-                pre_input.data[0]+=INPLACE_OFFSET;
-                pre_input.data[1]+=INPLACE_OFFSET;
-                pre_input.data[2]+=INPLACE_OFFSET;
+        AVFrame *input;
+        int number= -1;
+
+        if(!pre_input_ptr || (i && !s->input_picture[i-1]))
+            continue;
+
+        /* input pictures which were already looked at in an earlier call
+         * are still around downscaled, the reference picture is the
+         * reconstructed one and always needs to be downscaled */
+        if(i){
+            number= pre_input_ptr->display_picture_number;
+            for(k=i; k<s->max_b_frames+2; k++){
+                if(s->brd_input_number[k] == number){
+                    FFSWAP(AVFrame, s->brd_input[i], s->brd_input[k]);
+                    FFSWAP(int, s->brd_input_number[i], s->brd_input_number[k]);
+                    break;
+                }
             }
+            if(k < s->max_b_frames+2)
+                continue;
+        }
 
-            s->dsp.shrink[scale](input[i].data[0], input[i].linesize[0], pre_input.data[0], pre_input.linesize[0], c->width, c->height);
-            s->dsp.shrink[scale](input[i].data[1], input[i].linesize[1], pre_input.data[1], pre_input.linesize[1], c->width>>1, c->height>>1);
-            s->dsp.shrink[scale](input[i].data[2], input[i].linesize[2], pre_input.data[2], pre_input.linesize[2], c->width>>1, c->height>>1);
+        input= &s->brd_input[i];
+        s->brd_input_number[i]= number;
+        pre_input= *pre_input_ptr;
+
+        if(pre_input.type != FF_BUFFER_TYPE_SHARED && i) {
+            pre_input.data[0]+=INPLACE_OFFSET;
+            pre_input.data[1]+=INPLACE_OFFSET;
+            pre_input.data[2]+=INPLACE_OFFSET;
         }
+
+        s->dsp.shrink[scale](input->data[0], input->linesize[0], pre_input.data[0], pre_input.linesize[0], width, height);
+        s->dsp.shrink[scale](input->data[1], input->linesize[1], pre_input.data[1], pre_input.linesize[1], width>>1, height>>1);
+        s->dsp.shrink[scale](input->data[2], input->linesize[2], pre_input.data[2], pre_input.linesize[2], width>>1, height>>1);
     }
 
     for(j=0; j<s->max_b_frames+1; j++){
-        int64_t rd=0;
-
         if(!s->input_picture[j])
             break;
 
-        c->error[0]= c->error[1]= c->error[2]= 0;
-
-        input[0].pict_type= FF_I_TYPE;
-        input[0].quality= 1 * FF_QP2LAMBDA;
-        out_size = avcodec_encode_video(c, outbuf, outbuf_size, &input[0]);
-//        rd += (out_size * lambda2) >> FF_LAMBDA_SHIFT;
-
-        for(i=0; i<s->max_b_frames+1; i++){
-            int is_p= i % (j+1) == j || i==s->max_b_frames;
-
-            input[i+1].pict_type= is_p ? FF_P_TYPE : FF_B_TYPE;
-            input[i+1].quality= is_p ? p_lambda : b_lambda;
-            out_size = avcodec_encode_video(c, outbuf, outbuf_size, &input[i+1]);
-            rd += (out_size * lambda2) >> (FF_LAMBDA_SHIFT - 3);
-        }
-
-        /* get the delayed frames */
-        while(out_size){
-            out_size = avcodec_encode_video(c, outbuf, outbuf_size, NULL);
-            rd += (out_size * lambda2) >> (FF_LAMBDA_SHIFT - 3);
-        }
-
-        rd += c->error[0] + c->error[1] + c->error[2];
-
-        if(rd < best_rd){
-            best_rd= rd;
-            best_b_count= j;
-        }
+        trial[j].b_count= j;
+        trial[j].p_lambda= p_lambda;
+        trial[j].b_lambda= b_lambda;
+        trial[j].lambda2= lambda2;
     }
 
-    av_freep(&outbuf);
-    avcodec_close(c);
-    av_freep(&c);
+    /* every tested number of B-frames has its own trial encoder */
+    s->avctx->execute(s->avctx, brd_trial, trial, NULL, j, sizeof(BRDTrial));
 
-    for(i=0; i<s->max_b_frames+2; i++){
-        av_freep(&input[i].data[0]);
+    for(i=0; i<j; i++){
+        if(trial[i].rd < best_rd){
+            best_rd= trial[i].rd;
+            best_b_count= i;
+        }
     }
 
     return best_b_count;
@@ -1196,6 +1561,19 @@ no_output_pic:
             s->reordered_input_picture[0]->type= 0;
 
             copy_picture_attributes(s, (AVFrame*)pic, (AVFrame*)s->reordered_input_picture[0]);
+            pic->lookahead_mb_var_sum   = s->reordered_input_picture[0]->lookahead_mb_var_sum;
+            pic->lookahead_mc_mb_var_sum= s->reordered_input_picture[0]->lookahead_mc_mb_var_sum;
+            pic->analysed= s->reordered_input_picture[0]->analysed;
+            if(pic->analysed){
+                /* the input analysis moves along with the data */
+                int16_t (*pre_mv)[2]= pic->pre_mv;
+                pic->pre_mv= s->reordered_input_picture[0]->pre_mv;
+                s->reordered_input_picture[0]->pre_mv= pre_mv;
+                FFSWAP(uint16_t*, pic->mb_var , s->reordered_input_picture[0]->mb_var);
+                FFSWAP(uint8_t* , pic->mb_mean, s->reordered_input_picture[0]->mb_mean);
+                pic->analysis_mb_var_sum= s->reordered_input_picture[0]->analysis_mb_var_sum;
+                pic->pre_mv_ref         = s->reordered_input_picture[0]->pre_mv_ref;
+            }
 
             s->current_picture_ptr= pic;
         }else{
@@ -1218,11 +1596,28 @@ no_output_pic:
     }
 }
 
-int MPV_encode_picture(AVCodecContext *avctx,
-                       unsigned char *buf, int buf_size, void *data)
+static void export_frame_stats(MpegEncContext *s)
 {
-    MpegEncContext *s = avctx->priv_data;
-    AVFrame *pic_arg = data;
+    AVCodecContext *avctx= s->avctx;
+
+    avctx->header_bits = s->header_bits;
+    avctx->mv_bits     = s->mv_bits;
+    avctx->misc_bits   = s->misc_bits;
+    avctx->i_tex_bits  = s->i_tex_bits;
+    avctx->p_tex_bits  = s->p_tex_bits;
+    avctx->i_count     = s->i_count;
+    avctx->p_count     = s->mb_num - s->i_count - s->skip_count; //FIXME f/b_count in avctx
+    avctx->skip_count  = s->skip_count;
+    avctx->frame_bits  = s->frame_bits;
+}
+
+/**
+ * Encodes the next picture of the input queue, if one is due.
+ * @return the number of bytes written to buf, or a negative value on error
+ */
+static int encode_queued_picture(MpegEncContext *s, unsigned char *buf, int buf_size)
+{
+    AVCodecContext *avctx= s->avctx;
     int i, stuffing_count;
 
     for(i=0; i<avctx->thread_count; i++){
@@ -1235,11 +1630,6 @@ int MPV_encode_picture(AVCodecContext *avctx,
         init_put_bits(&s->thread_context[i]->pb, start, end - start);
     }
 
-    s->picture_in_gop_number++;
-
-    if(load_input_picture(s, pic_arg) < 0)
-        return -1;
-
     select_input_picture(s);
 
     /* output? */
@@ -1252,15 +1642,6 @@ vbv_retry:
         if (encode_picture(s, s->picture_number) < 0)
             return -1;
 
-        avctx->header_bits = s->header_bits;
-        avctx->mv_bits     = s->mv_bits;
-        avctx->misc_bits   = s->misc_bits;
-        avctx->i_tex_bits  = s->i_tex_bits;
-        avctx->p_tex_bits  = s->p_tex_bits;
-        avctx->i_count     = s->i_count;
-        avctx->p_count     = s->mb_num - s->i_count - s->skip_count; //FIXME f/b_count in avctx
-        avctx->skip_count  = s->skip_count;
-
         MPV_frame_end(s);
 
         if (CONFIG_MJPEG_ENCODER && s->out_format == FMT_MJPEG)
@@ -1306,7 +1687,7 @@ vbv_retry:
         }
 
         if(s->flags&CODEC_FLAG_PASS1)
-            assert(avctx->header_bits + avctx->mv_bits + avctx->misc_bits + avctx->i_tex_bits + avctx->p_tex_bits == put_bits_count(&s->pb));
+            assert(s->header_bits + s->mv_bits + s->misc_bits + s->i_tex_bits + s->p_tex_bits == put_bits_count(&s->pb));
         flush_put_bits(&s->pb);
         s->frame_bits  = put_bits_count(&s->pb);
 
@@ -1366,7 +1747,8 @@ vbv_retry:
             s->vbv_delay_ptr[2] |= vbv_delay<<3;
         }
         s->total_bits += s->frame_bits;
-        avctx->frame_bits  = s->frame_bits;
+        if(!s->pipeline)
+            export_frame_stats(s);
     }else{
         assert((put_bits_ptr(&s->pb) == s->pb.buf));
         s->frame_bits=0;
@@ -1376,6 +1758,94 @@ vbv_retry:
     return s->frame_bits/8;
 }
 
+static int pipeline_job(AVCodecContext *avctx, void *arg)
+{
+    MpegEncContext *s = avctx->priv_data;
+
+    return encode_queued_picture(s, s->pipeline_buf, s->pipeline_buf_size);
+}
+
+/**
+ * Exports the picture the pipeline thread has just coded as coded_frame.
+ * Its data is not kept, the next picture may be coded into it.
+ */
+static void pipeline_export(MpegEncContext *s)
+{
+    s->pipeline_frame= *(AVFrame*)s->current_picture_ptr;
+    export_frame_stats(s);
+}
+
+/**
+ * Pipelined MPV_encode_picture(): the picture is queued in the calling
+ * thread and encoded in the pipeline thread while the caller goes on, the
+ * packet is returned by the next call.
+ */
+static int pipeline_encode_picture(MpegEncContext *s, unsigned char *buf, int buf_size, AVFrame *pic_arg)
+{
+    int ret= 0;
+
+    /* overlaps with the encoding of the previous picture */
+    if(pic_arg)
+        analyse_input(s, pic_arg);
+
+    if(s->pipeline_busy){
+        s->pipeline_busy= 0;
+        ret= ff_thread_async_wait(s->pipeline);
+        if(ret < 0)
+            return ret;
+        if(ret > buf_size){
+            av_log(s->avctx, AV_LOG_ERROR, "output buffer too small for the pipelined packet\n");
+            return -1;
+        }
+        if(ret){
+            memcpy(buf, s->pipeline_buf, ret);
+            pipeline_export(s);
+        }
+    }
+
+    s->picture_in_gop_number++;
+
+    if(load_input_picture(s, pic_arg) < 0)
+        return -1;
+    if(pic_arg && finish_input_analysis(s, s->input_picture[s->max_b_frames + s->avctx->rc_lookahead]) < 0)
+        return AVERROR(ENOMEM);
+
+    /* when flushing, 0 must only be returned once the queue is empty,
+     * which is known only after encoding synchronously */
+    if(!pic_arg && !ret){
+        ret= encode_queued_picture(s, buf, buf_size);
+        if(ret > 0)
+            pipeline_export(s);
+        return ret;
+    }
+
+    av_fast_malloc(&s->pipeline_buf, &s->pipeline_buf_size, buf_size);
+    if(!s->pipeline_buf)
+        return AVERROR(ENOMEM);
+
+    ff_thread_async_start(s->pipeline);
+    s->pipeline_busy= 1;
+
+    return ret;
+}
+
+int MPV_encode_picture(AVCodecContext *avctx,
+                       unsigned char *buf, int buf_size, void *data)
+{
+    MpegEncContext *s = avctx->priv_data;
+    AVFrame *pic_arg = data;
+
+    if(s->pipeline)
+        return pipeline_encode_picture(s, buf, buf_size, pic_arg);
+
+    s->picture_in_gop_number++;
+
+    if(load_input_picture(s, pic_arg) < 0)
+        return -1;
+
+    return encode_queued_picture(s, buf, buf_size);
+}
+
 static inline void dct_single_coeff_elimination(MpegEncContext *s, int n, int threshold)
 {
     static const char tab[64]=
@@ -1959,6 +2429,20 @@ static int pre_estimate_motion_thread(AVCodecContext *c, void *arg){
     return 0;
 }
 
+static int pyramid_estimate_motion_thread(AVCodecContext *c, void *arg){
+    MpegEncContext *s= *(void**)arg;
+
+    s->first_slice_line=1;
+    for(s->mb_y= s->start_mb_y; s->mb_y < s->end_mb_y; s->mb_y++) {
+        for(s->mb_x=0; s->mb_x < s->mb_width; s->mb_x++) {
+            ff_pyramid_estimate_p_frame_motion(s, s->mb_x, s->mb_y);
+        }
+        s->first_slice_line=0;
+    }
+
+    return 0;
+}
+
 static int estimate_motion_thread(AVCodecContext *c, void *arg){
     MpegEncContext *s= *(void**)arg;
 
@@ -2028,6 +2512,42 @@ static void write_slice_end(MpegEncContext *s){
         s->misc_bits+= get_bits_diff(s);
 }
 
+static inline int mb_bits_count(MpegEncContext *s){
+    int bits= put_bits_count(&s->pb);
+
+    if(s->data_partitioning)
+        bits+= put_bits_count(&s->pb2) + put_bits_count(&s->tex_pb);
+    return bits;
+}
+
+/**
+ * Exports the statistics of the macroblock just encoded to avctx->mb_stats.
+ */
+static void export_mb_stats(MpegEncContext *s, int start_bits, int skipped){
+    const int xy= s->mb_y*s->mb_stride + s->mb_x;
+    AVMBStats *st= &s->avctx->mb_stats[s->mb_y*s->mb_width + s->mb_x];
+    int mb_type;
+
+    if(s->mb_intra){
+        mb_type= MB_TYPE_INTRA4x4;
+    }else{
+        if     (s->mv_type == MV_TYPE_8X8)   mb_type= MB_TYPE_8x8;
+        else if(s->mv_type == MV_TYPE_FIELD) mb_type= MB_TYPE_16x8 | MB_TYPE_INTERLACED;
+        else                                 mb_type= MB_TYPE_16x16;
+        if(s->mv_dir & MV_DIR_FORWARD)  mb_type|= MB_TYPE_L0;
+        if(s->mv_dir & MV_DIR_BACKWARD) mb_type|= MB_TYPE_L1;
+        if(s->mv_dir & MV_DIRECT)       mb_type|= MB_TYPE_DIRECT2;
+        if(skipped)                     mb_type|= MB_TYPE_SKIP;
+    }
+
+    st->bits   = mb_bits_count(s) - start_bits;
+    st->mb_type= mb_type;
+    st->qscale = s->qscale;
+    st->var    = s->current_picture.mb_var   [xy];
+    st->mc_var = s->pict_type == FF_I_TYPE ? 0 : s->current_picture.mc_mb_var[xy];
+    st->mean   = s->current_picture.mb_mean  [xy];
+}
+
 static int encode_thread(AVCodecContext *c, void *arg){
     MpegEncContext *s= *(void**)arg;
     int mb_x, mb_y, pdif = 0;
@@ -2101,6 +2621,8 @@ static int encode_thread(AVCodecContext *c, void *arg){
 //            int d;
             int dmin= INT_MAX;
             int dir;
+            int start_bits= mb_bits_count(s);
+            int skip_count= s->skip_count;
 
             if(s->pb.buf_end - s->pb.buf - (put_bits_count(&s->pb)>>3) < MAX_MB_BYTES){
                 av_log(s->avctx, AV_LOG_ERROR, "encoded frame too large\n");
@@ -2632,6 +3154,9 @@ static int encode_thread(AVCodecContext *c, void *arg){
                     s, s->new_picture.data[2] + s->mb_x*8  + s->mb_y*s->uvlinesize*chr_h,
                     s->dest[2], w>>1, h>>s->chroma_y_shift, s->uvlinesize);
             }
+            if(s->avctx->mb_stats)
+                export_mb_stats(s, start_bits, s->skip_count != skip_count);
+
             if(s->loop_filter){
                 if(CONFIG_H263_ENCODER && s->out_format == FMT_H263)
                     ff_h263_loop_filter(s);
@@ -2804,8 +3329,22 @@ static int encode_picture(MpegEncContext *s, int picture_number)
         s->lambda = (s->lambda * s->avctx->me_penalty_compensation + 128)>>8;
         s->lambda2= (s->lambda2* (int64_t)s->avctx->me_penalty_compensation + 128)>>8;
         if(s->pict_type != FF_B_TYPE && s->avctx->me_threshold==0){
+            if(s->me.pyramid_levels){
+                ff_build_me_pyramid(s);
+                s->avctx->execute(s->avctx, pyramid_estimate_motion_thread, &s->thread_context[0], NULL, s->avctx->thread_count, sizeof(void*));
+            }
             if((s->avctx->pre_me && s->last_non_b_pict_type==FF_I_TYPE) || s->avctx->pre_me==2){
-                s->avctx->execute(s->avctx, pre_estimate_motion_thread, &s->thread_context[0], NULL, s->avctx->thread_count, sizeof(void*));
+                Picture *pic= s->current_picture_ptr;
+                if(pic->analysed && pic->pre_mv && s->last_picture_ptr
+                   && pic->pre_mv_ref == s->last_picture_ptr->display_picture_number){
+                    /* searched against the source of the reference by analyse_input() */
+                    const int shift= 1+s->quarter_sample;
+                    for(i=0; i<s->mb_stride*s->mb_height; i++){
+                        s->p_mv_table[i][0]= pic->pre_mv[i][0] << shift;
+                        s->p_mv_table[i][1]= pic->pre_mv[i][1] << shift;
+                    }
+                }else
+                    s->avctx->execute(s->avctx, pre_estimate_motion_thread, &s->thread_context[0], NULL, s->avctx->thread_count, sizeof(void*));
             }
         }
 
@@ -2817,7 +3356,10 @@ static int encode_picture(MpegEncContext *s, int picture_number)
 
         if(!s->fixed_qscale){
             /* finding spatial complexity for I-frame rate control */
-            s->avctx->execute(s->avctx, mb_var_thread, &s->thread_context[0], NULL, s->avctx->thread_count, sizeof(void*));
+            if(s->current_picture_ptr->analysed)
+                s->me.mb_var_sum_temp= s->current_picture_ptr->analysis_mb_var_sum;
+            else
+                s->avctx->execute(s->avctx, mb_var_thread, &s->thread_context[0], NULL, s->avctx->thread_count, sizeof(void*));
         }
     }
     for(i=1; i<s->avctx->thread_count; i++){
@@ -2827,6 +3369,13 @@ static int encode_picture(MpegEncContext *s, int picture_number)
     s->current_picture.   mb_var_sum= s->current_picture_ptr->   mb_var_sum= s->me.   mb_var_sum_temp;
     emms_c();
 
+    /* the spatial variance and mean exported to mb_stats are only computed
+     * by the P-frame motion estimation and for I-frame rate control */
+    if(s->avctx->mb_stats && (s->pict_type == FF_B_TYPE || (s->pict_type == FF_I_TYPE && s->fixed_qscale))){
+        s->avctx->execute(s->avctx, mb_var_thread, &s->thread_context[0], NULL, s->avctx->thread_count, sizeof(void*));
+        emms_c();
+    }
+
     if(s->me.scene_change_score > s->avctx->scenechange_threshold && s->pict_type == FF_P_TYPE){
         s->pict_type= FF_I_TYPE;
         for(i=0; i<s->mb_stride*s->mb_height; i++)
@@ -2989,12 +3538,17 @@ void  denoise_dct_c(MpegEncContext *s, DCTELEM *block){
     }
 }
 
-int dct_quantize_trellis_c(MpegEncContext *s,
+/**
+ * Trellis quantization, specialized for the H.263 and the MPEG-1 style
+ * run/level coding so that the per coefficient format checks disappear.
+ */
+static av_always_inline int dct_quantize_trellis_internal(MpegEncContext *s,
                         DCTELEM *block, int n,
-                        int qscale, int *overflow){
+                        int qscale, int *overflow, const int h263){
     const int *qmat;
     const uint8_t *scantable= s->intra_scantable.scantable;
     const uint8_t *perm_scantable= s->intra_scantable.permutated;
+    const uint16_t *matrix;
     int max=0;
     unsigned int threshold1, threshold2;
     int bias=0;
@@ -3009,11 +3563,16 @@ int dct_quantize_trellis_c(MpegEncContext *s,
     int last_i;
     int coeff[2][64];
     int coeff_count[64];
-    int qmul, qadd, start_i, last_non_zero, i, dc;
+    int qmul, qadd, start_i, last_non_zero, i, dc, prune_margin;
     const int esc_length= s->ac_esc_length;
     uint8_t * length;
     uint8_t * last_length;
     const int lambda= s->lambda2 >> (FF_LAMBDA_SHIFT - 6);
+    const int aan_scaled= s->dsp.fdct == fdct_ifast
+#ifndef FAAN_POSTSCALE
+                       || s->dsp.fdct == ff_faandct
+#endif
+                       ;
 
     s->dsp.fdct (block);
 
@@ -3041,6 +3600,7 @@ int dct_quantize_trellis_c(MpegEncContext *s,
         start_i = 1;
         last_non_zero = 0;
         qmat = s->q_intra_matrix[qscale];
+        matrix= s->intra_matrix;
         if(s->mpeg_quant || s->out_format == FMT_MPEG1)
             bias= 1<<(QMAT_SHIFT-1);
         length     = s->intra_ac_vlc_length;
@@ -3049,6 +3609,7 @@ int dct_quantize_trellis_c(MpegEncContext *s,
         start_i = 0;
         last_non_zero = -1;
         qmat = s->q_inter_matrix[qscale];
+        matrix= s->inter_matrix;
         length     = s->inter_ac_vlc_length;
         last_length= s->inter_ac_vlc_last_length;
     }
@@ -3067,6 +3628,13 @@ int dct_quantize_trellis_c(MpegEncContext *s,
         }
     }
 
+    /* all coefficients quantize to zero, there is nothing to search */
+    if(last_non_zero < start_i){
+        *overflow= 0;
+        memset(block + start_i, 0, (64-start_i)*sizeof(DCTELEM));
+        return last_non_zero;
+    }
+
     for(i=start_i; i<=last_non_zero; i++) {
         const int j = scantable[i];
         int level = block[j] * qmat[j];
@@ -3096,28 +3664,25 @@ int dct_quantize_trellis_c(MpegEncContext *s,
 
     *overflow= s->max_qcoeff < max; //overflow might have happened
 
-    if(last_non_zero < start_i){
-        memset(block + start_i, 0, (64-start_i)*sizeof(DCTELEM));
-        return last_non_zero;
-    }
-
     score_tab[start_i]= 0;
     survivor[0]= start_i;
     survivor_count= 1;
 
+    //Note: there is a vlc code in mpeg4 which is 1 bit shorter then another one with a shorter run and the same level
+    prune_margin= last_non_zero <= 27 ? 0 : lambda;
+
     for(i=start_i; i<=last_non_zero; i++){
-        int level_index, j, zero_distortion;
+        int level_index, j, zero_distortion, unquant_scale=0;
         int dct_coeff= FFABS(block[ scantable[i] ]);
         int best_score=256*256*256*120;
 
-        if (   s->dsp.fdct == fdct_ifast
-#ifndef FAAN_POSTSCALE
-            || s->dsp.fdct == ff_faandct
-#endif
-           )
+        if (aan_scaled)
             dct_coeff= (dct_coeff*ff_inv_aanscales[ scantable[i] ]) >> 12;
         zero_distortion= dct_coeff*dct_coeff;
 
+        if(!h263)
+            unquant_scale= qscale * matrix[ s->dsp.idct_permutation[ scantable[i] ] ];
+
         for(level_index=0; level_index < coeff_count[i]; level_index++){
             int distortion;
             int level= coeff[level_index][i];
@@ -3126,15 +3691,14 @@ int dct_quantize_trellis_c(MpegEncContext *s,
 
             assert(level);
 
-            if(s->out_format == FMT_H263){
+            if(h263){
                 unquant_coeff= alevel*qmul + qadd;
             }else{ //MPEG1
-                j= s->dsp.idct_permutation[ scantable[i] ]; //FIXME optimize
                 if(s->mb_intra){
-                        unquant_coeff = (int)(  alevel  * qscale * s->intra_matrix[j]) >> 3;
+                        unquant_coeff = (int)(  alevel  * unquant_scale) >> 3;
                         unquant_coeff =   (unquant_coeff - 1) | 1;
                 }else{
-                        unquant_coeff = (((  alevel  << 1) + 1) * qscale * ((int) s->inter_matrix[j])) >> 4;
+                        unquant_coeff = (((  alevel  << 1) + 1) * unquant_scale) >> 4;
                         unquant_coeff =   (unquant_coeff - 1) | 1;
                 }
                 unquant_coeff<<= 3;
@@ -3143,23 +3707,20 @@ int dct_quantize_trellis_c(MpegEncContext *s,
             distortion= (unquant_coeff - dct_coeff) * (unquant_coeff - dct_coeff) - zero_distortion;
             level+=64;
             if((level&(~127)) == 0){
+                /* the normal and the last run/level code of each survivor are
+                 * tried in one pass, the visiting order is unchanged */
                 for(j=survivor_count-1; j>=0; j--){
-                    int run= i - survivor[j];
-                    int score= distortion + length[UNI_AC_ENC_INDEX(run, level)]*lambda;
-                    score += score_tab[i-run];
+                    const int run= i - survivor[j];
+                    const int base= distortion + score_tab[survivor[j]];
+                    int score= base + length[UNI_AC_ENC_INDEX(run, level)]*lambda;
 
                     if(score < best_score){
                         best_score= score;
                         run_tab[i+1]= run;
                         level_tab[i+1]= level-64;
                     }
-                }
-
-                if(s->out_format == FMT_H263){
-                    for(j=survivor_count-1; j>=0; j--){
-                        int run= i - survivor[j];
-                        int score= distortion + last_length[UNI_AC_ENC_INDEX(run, level)]*lambda;
-                        score += score_tab[i-run];
+                    if(h263){
+                        score= base + last_length[UNI_AC_ENC_INDEX(run, level)]*lambda;
                         if(score < last_score){
                             last_score= score;
                             last_run= run;
@@ -3171,26 +3732,19 @@ int dct_quantize_trellis_c(MpegEncContext *s,
             }else{
                 distortion += esc_length*lambda;
                 for(j=survivor_count-1; j>=0; j--){
-                    int run= i - survivor[j];
-                    int score= distortion + score_tab[i-run];
+                    const int run= i - survivor[j];
+                    const int score= distortion + score_tab[survivor[j]];
 
                     if(score < best_score){
                         best_score= score;
                         run_tab[i+1]= run;
                         level_tab[i+1]= level-64;
                     }
-                }
-
-                if(s->out_format == FMT_H263){
-                  for(j=survivor_count-1; j>=0; j--){
-                        int run= i - survivor[j];
-                        int score= distortion + score_tab[i-run];
-                        if(score < last_score){
-                            last_score= score;
-                            last_run= run;
-                            last_level= level-64;
-                            last_i= i+1;
-                        }
+                    if(h263 && score < last_score){
+                        last_score= score;
+                        last_run= run;
+                        last_level= level-64;
+                        last_i= i+1;
                     }
                 }
             }
@@ -3198,23 +3752,15 @@ int dct_quantize_trellis_c(MpegEncContext *s,
 
         score_tab[i+1]= best_score;
 
-        //Note: there is a vlc code in mpeg4 which is 1 bit shorter then another one with a shorter run and the same level
-        if(last_non_zero <= 27){
-            for(; survivor_count; survivor_count--){
-                if(score_tab[ survivor[survivor_count-1] ] <= best_score)
-                    break;
-            }
-        }else{
-            for(; survivor_count; survivor_count--){
-                if(score_tab[ survivor[survivor_count-1] ] <= best_score + lambda)
-                    break;
-            }
+        for(; survivor_count; survivor_count--){
+            if(score_tab[ survivor[survivor_count-1] ] <= best_score + prune_margin)
+                break;
         }
 
         survivor[ survivor_count++ ]= i+1;
     }
 
-    if(s->out_format != FMT_H263){
+    if(!h263){
         last_score= 256*256*256*120;
         for(i= survivor[0]; i<=last_non_zero + 1; i++){
             int score= score_tab[i];
@@ -3247,7 +3793,7 @@ int dct_quantize_trellis_c(MpegEncContext *s,
             int alevel= FFABS(level);
             int unquant_coeff, score, distortion;
 
-            if(s->out_format == FMT_H263){
+            if(h263){
                     unquant_coeff= (alevel*qmul + qadd)>>3;
             }else{ //MPEG1
                     unquant_coeff = (((  alevel  << 1) + 1) * qscale * ((int) s->inter_matrix[0])) >> 4;
@@ -3285,6 +3831,15 @@ int dct_quantize_trellis_c(MpegEncContext *s,
     return last_non_zero;
 }
 
+int dct_quantize_trellis_c(MpegEncContext *s,
+                        DCTELEM *block, int n,
+                        int qscale, int *overflow){
+    if(s->out_format == FMT_H263)
+        return dct_quantize_trellis_internal(s, block, n, qscale, overflow, 1);
+    else
+        return dct_quantize_trellis_internal(s, block, n, qscale, overflow, 0);
+}
+
 //#define REFINE_STATS 1
 static int16_t basis[64][64];
 
@@ -160,11 +160,18 @@ void ff_add_png_paeth_prediction(uint8_t *dst, uint8_t *src, uint8_t *top, int w
     }
 }
 
+void ff_add_png_avg_prediction(uint8_t *dst, uint8_t *src, uint8_t *top, int w, int bpp)
+{
+    int i;
+    for(i = 0; i < w; i++)
+        dst[i] = ((dst[i - bpp] + top[i]) >> 1) + src[i];
+}
+
 #define UNROLL1(bpp, op) {\
-                 r = dst[0];\
-    if(bpp >= 2) g = dst[1];\
-    if(bpp >= 3) b = dst[2];\
-    if(bpp >= 4) a = dst[3];\
+                 r = dst[i-bpp+0];\
+    if(bpp >= 2) g = dst[i-bpp+1];\
+    if(bpp >= 3) b = dst[i-bpp+2];\
+    if(bpp >= 4) a = dst[i-bpp+3];\
     for(; i < size; i+=bpp) {\
         dst[i+0] = r = op(r, src[i+0], last[i+0]);\
         if(bpp == 1) continue;\
@@ -223,6 +230,12 @@ static void png_filter_row(DSPContext *dsp, uint8_t *dst, int filter_type,
             p = (last[i] >> 1);
             dst[i] = p + src[i];
         }
+        if((bpp == 3 || bpp == 4) && size > 4) {
+            // same end of row handling as for paeth
+            int w = bpp==4 ? size : size-3;
+            dsp->add_png_avg_prediction(dst+i, src+i, last+i, w-i, bpp);
+            i = w;
+        }
 #define OP_AVG(x,s,l) (((x + l) >> 1) + s) & 0xff
         UNROLL_FILTER(OP_AVG);
         break;
@@ -262,12 +275,17 @@ static av_always_inline void convert_to_rgb32_loco(uint8_t *dst, const uint8_t *
     }
 }
 
-static void convert_to_rgb32(uint8_t *dst, const uint8_t *src, int width, int loco)
+void ff_png_rgba_to_rgb32(uint8_t *dst, const uint8_t *src, int w)
+{
+    convert_to_rgb32_loco(dst, src, w, 0);
+}
+
+static void convert_to_rgb32(DSPContext *dsp, uint8_t *dst, const uint8_t *src, int width, int loco)
 {
     if(loco)
         convert_to_rgb32_loco(dst, src, width, 1);
     else
-        convert_to_rgb32_loco(dst, src, width, 0);
+        dsp->png_rgba_to_rgb32(dst, src, width);
 }
 
 static void deloco_rgb24(uint8_t *dst, int size)
@@ -292,7 +310,7 @@ static void png_handle_row(PNGDecContext *s)
         if (s->color_type == PNG_COLOR_TYPE_RGB_ALPHA) {
             png_filter_row(&s->dsp, s->tmp_row, s->crow_buf[0], s->crow_buf + 1,
                            s->last_row, s->row_size, s->bpp);
-            convert_to_rgb32(ptr, s->tmp_row, s->width, s->filter_type == PNG_FILTER_TYPE_LOCO);
+            convert_to_rgb32(&s->dsp, ptr, s->tmp_row, s->width, s->filter_type == PNG_FILTER_TYPE_LOCO);
             FFSWAP(uint8_t*, s->last_row, s->tmp_row);
         } else {
             /* in normal case, we avoid one copy */
@@ -667,3 +685,93 @@ AVCodec png_decoder = {
     NULL,
     .long_name = NULL_IF_CONFIG_SMALL("PNG image"),
 };
+
+#ifdef TEST
+#undef printf
+#undef fprintf
+#undef exit
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+static int64_t gettime(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv,NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/**
+ * Decodes each PNG file given on the command line repeatedly for about
+ * a second and prints the decode throughput of each file and of the
+ * whole set in MPixel/s.
+ */
+int main(int argc, char **argv)
+{
+    int64_t total_pixels = 0, total_time = 0;
+    int i;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s file.png [file.png ...]\n", argv[0]);
+        return 1;
+    }
+
+    for (i = 1; i < argc; i++) {
+        AVCodecContext *avctx = avcodec_alloc_context();
+        AVFrame *picture = avcodec_alloc_frame();
+        AVPacket pkt;
+        uint8_t *buf = NULL;
+        int64_t ti, pixels = 0;
+        int got_picture, size, it = 0;
+        FILE *f = fopen(argv[i], "rb");
+
+        if (!f || !avctx || !picture) {
+            fprintf(stderr, "cannot open %s\n", argv[i]);
+            exit(1);
+        }
+        fseek(f, 0, SEEK_END);
+        size = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        buf = av_mallocz(size + FF_INPUT_BUFFER_PADDING_SIZE);
+        if (!buf || fread(buf, 1, size, f) != size) {
+            fprintf(stderr, "cannot read %s\n", argv[i]);
+            exit(1);
+        }
+        fclose(f);
+
+        if (avcodec_open(avctx, &png_decoder) < 0) {
+            fprintf(stderr, "cannot open the decoder\n");
+            exit(1);
+        }
+        av_init_packet(&pkt);
+        pkt.data = buf;
+        pkt.size = size;
+
+        ti = gettime();
+        do {
+            if (avcodec_decode_video2(avctx, picture, &got_picture, &pkt) < 0 || !got_picture) {
+                fprintf(stderr, "%s: decoding failed\n", argv[i]);
+                break;
+            }
+            pixels += avctx->width * avctx->height;
+            it++;
+        } while (gettime() - ti < 1000000);
+        ti = gettime() - ti;
+
+        printf("%s: %dx%d %s, %d iterations, %0.1f MPixel/s\n", argv[i],
+               avctx->width, avctx->height, avcodec_get_pix_fmt_name(avctx->pix_fmt),
+               it, (double)pixels / ti);
+        total_pixels += pixels;
+        total_time   += ti;
+
+        avcodec_close(avctx);
+        av_free(avctx);
+        av_free(picture);
+        av_free(buf);
+    }
+
+    if (total_time)
+        printf("total: %0.1f MPixel/s\n", (double)total_pixels / total_time);
+    return 0;
+}
+#endif
@@ -33,6 +33,20 @@
 
 #define IOBUF_SIZE 4096
 
+/**
+ * Band of rows that is filtered and deflated on its own when encoding
+ * with threads.
+ */
+typedef struct PNGEncSlice {
+    int start_y, end_y;
+    uint8_t *crow_base;
+    uint8_t *rgba_buf;
+    uint8_t *top_buf;
+    uint8_t *out;               ///< raw deflate data, after 2 bytes reserved for the zlib header
+    int out_len;
+    uLong adler;                ///< adler32 of the filtered rows
+} PNGEncSlice;
+
 typedef struct PNGEncContext {
     DSPContext dsp;
 
@@ -45,6 +59,14 @@ typedef struct PNGEncContext {
 
     z_stream zstream;
     uint8_t buf[IOBUF_SIZE];
+
+    int row_size;
+    int bits_per_pixel;
+    int color_type;
+    int compression_level;
+    uint8_t *filtered;          ///< filtered rows of the whole image, each with its filter byte
+    PNGEncSlice *slices;
+    int nb_slices;
 } PNGEncContext;
 
 static void png_get_interlaced_row(uint8_t *dst, int row_size,
@@ -85,7 +107,7 @@ static void png_get_interlaced_row(uint8_t *dst, int row_size,
     }
 }
 
-static void sub_png_paeth_prediction(uint8_t *dst, uint8_t *src, uint8_t *top, int w, int bpp)
+void ff_sub_png_paeth_prediction(uint8_t *dst, uint8_t *src, uint8_t *top, int w, int bpp)
 {
     int i;
     for(i = 0; i < w; i++) {
@@ -112,6 +134,13 @@ static void sub_png_paeth_prediction(uint8_t *dst, uint8_t *src, uint8_t *top, i
     }
 }
 
+void ff_sub_png_avg_prediction(uint8_t *dst, uint8_t *src, uint8_t *top, int w, int bpp)
+{
+    int i;
+    for(i = 0; i < w; i++)
+        dst[i] = src[i] - ((src[i-bpp] + top[i]) >> 1);
+}
+
 static void png_filter_row(DSPContext *dsp, uint8_t *dst, int filter_type,
                            uint8_t *src, uint8_t *top, int size, int bpp)
 {
@@ -131,13 +160,12 @@ static void png_filter_row(DSPContext *dsp, uint8_t *dst, int filter_type,
     case PNG_FILTER_VALUE_AVG:
         for(i = 0; i < bpp; i++)
             dst[i] = src[i] - (top[i] >> 1);
-        for(; i < size; i++)
-            dst[i] = src[i] - ((src[i-bpp] + top[i]) >> 1);
+        dsp->sub_png_avg_prediction(dst+i, src+i, top+i, size-i, bpp);
         break;
     case PNG_FILTER_VALUE_PAETH:
         for(i = 0; i < bpp; i++)
             dst[i] = src[i] - top[i];
-        sub_png_paeth_prediction(dst+i, src+i, top+i, size-i, bpp);
+        dsp->sub_png_paeth_prediction(dst+i, src+i, top+i, size-i, bpp);
         break;
     }
 }
@@ -150,15 +178,12 @@ static uint8_t *png_choose_filter(PNGEncContext *s, uint8_t *dst,
     if(!top && pred)
         pred = PNG_FILTER_VALUE_SUB;
     if(pred == PNG_FILTER_VALUE_MIXED) {
-        int i;
         int cost, bcost = INT_MAX;
         uint8_t *buf1 = dst, *buf2 = dst + size + 16;
         for(pred=0; pred<5; pred++) {
             png_filter_row(&s->dsp, buf1+1, pred, src, top, size, bpp);
             buf1[0] = pred;
-            cost = 0;
-            for(i=0; i<=size; i++)
-                cost += abs((int8_t)buf1[i]);
+            cost = s->dsp.sum_abs_int8(buf1, size + 1);
             if(cost < bcost) {
                 bcost = cost;
                 FFSWAP(uint8_t*, buf1, buf2);
@@ -229,6 +254,173 @@ static int png_write_row(PNGEncContext *s, const uint8_t *data, int size)
     return 0;
 }
 
+static int png_filter_slice(AVCodecContext *avctx, void *arg, int jobnr, int threadnr)
+{
+    PNGEncContext *s = avctx->priv_data;
+    PNGEncSlice *sl = &s->slices[jobnr];
+    AVFrame * const p = &s->picture;
+    uint8_t *crow_buf = sl->crow_base + 15;
+    uint8_t *ptr, *top = NULL, *crow;
+    int y;
+
+    if (sl->start_y > 0) {
+        top = p->data[0] + (sl->start_y - 1) * p->linesize[0];
+        if (s->color_type == PNG_COLOR_TYPE_RGB_ALPHA) {
+            convert_from_rgb32(sl->rgba_buf, top, avctx->width);
+            top = sl->rgba_buf;
+        }
+    }
+    for(y = sl->start_y; y < sl->end_y; y++) {
+        ptr = p->data[0] + y * p->linesize[0];
+        if (s->color_type == PNG_COLOR_TYPE_RGB_ALPHA) {
+            FFSWAP(uint8_t*, sl->rgba_buf, sl->top_buf);
+            convert_from_rgb32(sl->rgba_buf, ptr, avctx->width);
+            ptr = sl->rgba_buf;
+        }
+        crow = png_choose_filter(s, crow_buf, ptr, top, s->row_size, s->bits_per_pixel>>3);
+        memcpy(s->filtered + y * (s->row_size + 1), crow, s->row_size + 1);
+        top = ptr;
+    }
+    return 0;
+}
+
+/**
+ * Deflates the filtered rows of one slice as raw deflate data. All but the
+ * last slice end with a sync flush so that the slices can be concatenated;
+ * the 32kB of filtered data before the slice are used as dictionary.
+ */
+static int png_deflate_slice(AVCodecContext *avctx, void *arg, int jobnr, int threadnr)
+{
+    PNGEncContext *s = avctx->priv_data;
+    PNGEncSlice *sl = &s->slices[jobnr];
+    uint8_t *in = s->filtered + sl->start_y * (s->row_size + 1);
+    int len = (sl->end_y - sl->start_y) * (s->row_size + 1);
+    int last = jobnr == s->nb_slices - 1;
+    int out_size, ret;
+    z_stream zs;
+
+    zs.zalloc = ff_png_zalloc;
+    zs.zfree  = ff_png_zfree;
+    zs.opaque = NULL;
+    if (deflateInit2(&zs, s->compression_level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return -1;
+    if (jobnr > 0) {
+        int dict_len = FFMIN(in - s->filtered, 32768);
+        deflateSetDictionary(&zs, in - dict_len, dict_len);
+    }
+
+    /* the bound covers the zlib wrapper, add some room for the sync flush */
+    out_size = deflateBound(&zs, len) + 16;
+    /* 2 bytes in front for the zlib header, 4 behind for the adler32 */
+    sl->out = av_malloc(out_size + 6);
+    if (!sl->out) {
+        deflateEnd(&zs);
+        return -1;
+    }
+    zs.next_in   = in;
+    zs.avail_in  = len;
+    zs.next_out  = sl->out + 2;
+    zs.avail_out = out_size;
+    ret = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+    sl->out_len = zs.total_out;
+    deflateEnd(&zs);
+    if (last ? ret != Z_STREAM_END : (ret != Z_OK || zs.avail_in || !zs.avail_out))
+        return -1;
+
+    sl->adler = adler32(adler32(0, Z_NULL, 0), in, len);
+    return 0;
+}
+
+/**
+ * Filters and deflates bands of rows with avctx->execute2() and writes them
+ * as one zlib stream. The output is a standard PNG file, but its IDAT data
+ * differs from the one of the single threaded path.
+ */
+static int png_write_rows_threaded(AVCodecContext *avctx)
+{
+    PNGEncContext *s = avctx->priv_data;
+    int flevel, i, ret = -1;
+    int *rets;
+    uLong adler;
+    uint8_t *f;
+
+    s->filtered = av_malloc(avctx->height * (s->row_size + 1));
+    s->slices = av_mallocz(s->nb_slices * sizeof(*s->slices));
+    rets = av_malloc(s->nb_slices * sizeof(*rets));
+    if (!s->filtered || !s->slices || !rets)
+        goto fail;
+    for(i = 0; i < s->nb_slices; i++) {
+        PNGEncSlice *sl = &s->slices[i];
+        sl->start_y =  i      * avctx->height / s->nb_slices;
+        sl->end_y   = (i + 1) * avctx->height / s->nb_slices;
+        sl->crow_base = av_malloc((s->row_size + 32) << (s->filter_type == PNG_FILTER_VALUE_MIXED));
+        if (!sl->crow_base)
+            goto fail;
+        if (s->color_type == PNG_COLOR_TYPE_RGB_ALPHA) {
+            sl->rgba_buf = av_malloc(s->row_size + 1);
+            sl->top_buf  = av_malloc(s->row_size + 1);
+            if (!sl->rgba_buf || !sl->top_buf)
+                goto fail;
+        }
+    }
+
+    avctx->execute2(avctx, png_filter_slice, NULL, NULL, s->nb_slices);
+    avctx->execute2(avctx, png_deflate_slice, NULL, rets, s->nb_slices);
+    for(i = 0; i < s->nb_slices; i++)
+        if (rets[i] < 0)
+            goto fail;
+
+    /* zlib header: deflate with 32kB window, FLEVEL as zlib would set it */
+    if (s->compression_level == Z_DEFAULT_COMPRESSION)
+        flevel = 2;
+    else
+        flevel = s->compression_level < 2 ? 0 :
+                 s->compression_level < 6 ? 1 :
+                 s->compression_level == 6 ? 2 : 3;
+    f = s->slices[0].out;
+    f[0] = 0x78;
+    f[1] = flevel << 6;
+    f[1] += 31 - ((f[0] << 8 | f[1]) % 31);
+
+    adler = s->slices[0].adler;
+    for(i = 1; i < s->nb_slices; i++) {
+        PNGEncSlice *sl = &s->slices[i];
+        adler = adler32_combine(adler, sl->adler, (sl->end_y - sl->start_y) * (s->row_size + 1));
+    }
+
+    for(i = 0; i < s->nb_slices; i++) {
+        PNGEncSlice *sl = &s->slices[i];
+        uint8_t *start = sl->out + 2;
+        int len = sl->out_len;
+        if (i == 0) {
+            start -= 2;
+            len   += 2;
+        }
+        if (i == s->nb_slices - 1) {
+            AV_WB32(sl->out + 2 + sl->out_len, adler);
+            len += 4;
+        }
+        if (s->bytestream_end - s->bytestream < len + 100)
+            goto fail;
+        png_write_chunk(&s->bytestream, MKTAG('I', 'D', 'A', 'T'), start, len);
+    }
+    ret = 0;
+
+ fail:
+    if (s->slices) {
+        for(i = 0; i < s->nb_slices; i++) {
+            av_free(s->slices[i].crow_base);
+            av_free(s->slices[i].rgba_buf);
+            av_free(s->slices[i].top_buf);
+            av_free(s->slices[i].out);
+        }
+    }
+    av_freep(&s->slices);
+    av_freep(&s->filtered);
+    av_free(rets);
+    return ret;
+}
+
 static int encode_frame(AVCodecContext *avctx, unsigned char *buf, int buf_size, void *data){
     PNGEncContext *s = avctx->priv_data;
     AVFrame *pict = data;
@@ -277,6 +469,11 @@ static int encode_frame(AVCodecContext *avctx, unsigned char *buf, int buf_size,
     }
     bits_per_pixel = ff_png_get_nb_channels(color_type) * bit_depth;
     row_size = (avctx->width * bits_per_pixel + 7) >> 3;
+    s->row_size       = row_size;
+    s->bits_per_pixel = bits_per_pixel;
+    s->color_type     = color_type;
+    /* every thread gets a band of at least 16 rows */
+    s->nb_slices = is_progressive ? 1 : FFMIN(avctx->thread_count, avctx->height / 16);
 
     s->zstream.zalloc = ff_png_zalloc;
     s->zstream.zfree = ff_png_zfree;
@@ -284,6 +481,7 @@ static int encode_frame(AVCodecContext *avctx, unsigned char *buf, int buf_size,
     compression_level = avctx->compression_level == FF_COMPRESSION_DEFAULT ?
                             Z_DEFAULT_COMPRESSION :
                             av_clip(avctx->compression_level, 0, 9);
+    s->compression_level = compression_level;
     ret = deflateInit2(&s->zstream, compression_level,
                        Z_DEFLATED, 15, 8, Z_DEFAULT_STRATEGY);
     if (ret != Z_OK)
@@ -347,64 +545,69 @@ static int encode_frame(AVCodecContext *avctx, unsigned char *buf, int buf_size,
         }
     }
 
-    /* now put each row */
-    s->zstream.avail_out = IOBUF_SIZE;
-    s->zstream.next_out = s->buf;
-    if (is_progressive) {
-        int pass;
-
-        for(pass = 0; pass < NB_PASSES; pass++) {
-            /* NOTE: a pass is completely omited if no pixels would be
-               output */
-            pass_row_size = ff_png_pass_row_size(pass, bits_per_pixel, avctx->width);
-            if (pass_row_size > 0) {
-                top = NULL;
-                for(y = 0; y < avctx->height; y++) {
-                    if ((ff_png_pass_ymask[pass] << (y & 7)) & 0x80) {
-                        ptr = p->data[0] + y * p->linesize[0];
-                        FFSWAP(uint8_t*, progressive_buf, top_buf);
-                        if (color_type == PNG_COLOR_TYPE_RGB_ALPHA) {
-                            convert_from_rgb32(rgba_buf, ptr, avctx->width);
-                            ptr = rgba_buf;
+    if (s->nb_slices > 1) {
+        if (png_write_rows_threaded(avctx) < 0)
+            goto fail;
+    } else {
+        /* now put each row */
+        s->zstream.avail_out = IOBUF_SIZE;
+        s->zstream.next_out = s->buf;
+        if (is_progressive) {
+            int pass;
+
+            for(pass = 0; pass < NB_PASSES; pass++) {
+                /* NOTE: a pass is completely omited if no pixels would be
+                   output */
+                pass_row_size = ff_png_pass_row_size(pass, bits_per_pixel, avctx->width);
+                if (pass_row_size > 0) {
+                    top = NULL;
+                    for(y = 0; y < avctx->height; y++) {
+                        if ((ff_png_pass_ymask[pass] << (y & 7)) & 0x80) {
+                            ptr = p->data[0] + y * p->linesize[0];
+                            FFSWAP(uint8_t*, progressive_buf, top_buf);
+                            if (color_type == PNG_COLOR_TYPE_RGB_ALPHA) {
+                                convert_from_rgb32(rgba_buf, ptr, avctx->width);
+                                ptr = rgba_buf;
+                            }
+                            png_get_interlaced_row(progressive_buf, pass_row_size,
+                                                   bits_per_pixel, pass,
+                                                   ptr, avctx->width);
+                            crow = png_choose_filter(s, crow_buf, progressive_buf, top, pass_row_size, bits_per_pixel>>3);
+                            png_write_row(s, crow, pass_row_size + 1);
+                            top = progressive_buf;
                         }
-                        png_get_interlaced_row(progressive_buf, pass_row_size,
-                                               bits_per_pixel, pass,
-                                               ptr, avctx->width);
-                        crow = png_choose_filter(s, crow_buf, progressive_buf, top, pass_row_size, bits_per_pixel>>3);
-                        png_write_row(s, crow, pass_row_size + 1);
-                        top = progressive_buf;
                     }
                 }
             }
-        }
-    } else {
-        top = NULL;
-        for(y = 0; y < avctx->height; y++) {
-            ptr = p->data[0] + y * p->linesize[0];
-            if (color_type == PNG_COLOR_TYPE_RGB_ALPHA) {
-                FFSWAP(uint8_t*, rgba_buf, top_buf);
-                convert_from_rgb32(rgba_buf, ptr, avctx->width);
-                ptr = rgba_buf;
+        } else {
+            top = NULL;
+            for(y = 0; y < avctx->height; y++) {
+                ptr = p->data[0] + y * p->linesize[0];
+                if (color_type == PNG_COLOR_TYPE_RGB_ALPHA) {
+                    FFSWAP(uint8_t*, rgba_buf, top_buf);
+                    convert_from_rgb32(rgba_buf, ptr, avctx->width);
+                    ptr = rgba_buf;
+                }
+                crow = png_choose_filter(s, crow_buf, ptr, top, row_size, bits_per_pixel>>3);
+                png_write_row(s, crow, row_size + 1);
+                top = ptr;
             }
-            crow = png_choose_filter(s, crow_buf, ptr, top, row_size, bits_per_pixel>>3);
-            png_write_row(s, crow, row_size + 1);
-            top = ptr;
         }
-    }
-    /* compress last bytes */
-    for(;;) {
-        ret = deflate(&s->zstream, Z_FINISH);
-        if (ret == Z_OK || ret == Z_STREAM_END) {
-            len = IOBUF_SIZE - s->zstream.avail_out;
-            if (len > 0 && s->bytestream_end - s->bytestream > len + 100) {
-                png_write_chunk(&s->bytestream, MKTAG('I', 'D', 'A', 'T'), s->buf, len);
+        /* compress last bytes */
+        for(;;) {
+            ret = deflate(&s->zstream, Z_FINISH);
+            if (ret == Z_OK || ret == Z_STREAM_END) {
+                len = IOBUF_SIZE - s->zstream.avail_out;
+                if (len > 0 && s->bytestream_end - s->bytestream > len + 100) {
+                    png_write_chunk(&s->bytestream, MKTAG('I', 'D', 'A', 'T'), s->buf, len);
+                }
+                s->zstream.avail_out = IOBUF_SIZE;
+                s->zstream.next_out = s->buf;
+                if (ret == Z_STREAM_END)
+                    break;
+            } else {
+                goto fail;
             }
-            s->zstream.avail_out = IOBUF_SIZE;
-            s->zstream.next_out = s->buf;
-            if (ret == Z_STREAM_END)
-                break;
-        } else {
-            goto fail;
         }
     }
     png_write_chunk(&s->bytestream, MKTAG('I', 'E', 'N', 'D'), NULL, 0);
@@ -24,12 +24,25 @@
 #include <pthread.h>
 
 #include "avcodec.h"
+#include "thread.h"
+#include "internal.h"
 
 typedef int (action_func)(AVCodecContext *c, void *arg);
 typedef int (action_func2)(AVCodecContext *c, void *arg, int jobnr, int threadnr);
 
+/**
+ * Range of jobs owned by one participant of avcodec_thread_execute().
+ * The owner takes jobs from the front, idle threads steal from the back.
+ */
+typedef struct JobQueue {
+    pthread_mutex_t lock;
+    int next;                       ///< first job not claimed yet
+    int end;                        ///< one past the last job of the queue
+} JobQueue;
+
 typedef struct ThreadContext {
     pthread_t *workers;
+    JobQueue *queues;               ///< one per thread, index 0 is the calling thread
     action_func *func;
     action_func2 *func2;
     void *args;
@@ -37,69 +50,402 @@ typedef struct ThreadContext {
     int rets_count;
     int job_count;
     int job_size;
+    int batch;                      ///< number of jobs an owner claims from its queue at once
 
     pthread_cond_t last_job_cond;
     pthread_cond_t current_job_cond;
     pthread_mutex_t current_job_lock;
-    int current_job;
+    int current_job;                ///< number of started workers, used to hand out ids
+    unsigned execute_count;         ///< incremented for every avcodec_thread_execute() call
+    int finished;                   ///< workers done with the current execute call
     int done;
+
+    int pooled;                     ///< jobs are run by the shared thread pool
+    int *pool_ids;                  ///< thread numbers free for pool workers, see PoolTask
+
+    int *rows;                      ///< per-row done flags, see ff_thread_init_row_progress()
+    int nb_rows;
+    int row_count;                  ///< rows of the current execute call
+    int next_claim;                 ///< first row not handed out by ff_thread_claim_rows() yet
+    int rows_held;                  ///< a thread is processing rows handed out by ff_thread_claim_rows()
+    pthread_mutex_t progress_mutex;
+    pthread_cond_t progress_cond;
 } ThreadContext;
 
+/**
+ * An avcodec_thread_execute() call of a context using the shared pool.
+ */
+typedef struct PoolTask {
+    AVCodecContext *avctx;
+    int next_job;                   ///< first job not handed out yet
+    int job_count;
+    int batch;                      ///< number of jobs handed out at once
+    int priority;                   ///< copy of avctx->thread_priority
+    int running;                    ///< pool workers currently running jobs of this task
+    int *free_ids;                  ///< thread numbers not in use, bounds the workers per task
+    int nb_free_ids;
+    struct PoolTask *next;
+} PoolTask;
+
+/**
+ * Thread pool shared by all contexts, see avcodec_thread_pool_init().
+ */
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;       ///< signaled when a task is queued or the pool is freed
+    pthread_cond_t done_cond;       ///< signaled when the last worker leaves a task
+    pthread_t *workers;
+    int nb_workers;
+    PoolTask *tasks;                ///< queued tasks, highest priority first
+    int die;
+} pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+/// Max number of frame buffers that can be allocated when using frame threads.
+#define MAX_BUFFERS (32+1)
+
+/**
+ * Context used by codec threads and stored in their AVCodecContext thread_opaque.
+ */
+typedef struct PerThreadContext {
+    struct FrameThreadContext *parent;
+
+    pthread_t      thread;
+    pthread_cond_t input_cond;      ///< Used to wait for a new packet from the main thread.
+    pthread_cond_t progress_cond;   ///< Used by child threads to wait for progress to change.
+    pthread_cond_t output_cond;     ///< Used by the main thread to wait for frames to finish.
+
+    pthread_mutex_t mutex;          ///< Mutex used to protect the contents of the PerThreadContext.
+    pthread_mutex_t progress_mutex; ///< Mutex used to protect frame progress values and progress_cond.
+
+    AVCodecContext *avctx;          ///< Context used to decode packets passed to this thread.
+
+    AVPacket       avpkt;           ///< Input packet, copied from the one passed by the user.
+    unsigned int   allocated_buf_size; ///< Size allocated for avpkt.data
+
+    AVFrame frame;                  ///< Output frame.
+    int     got_frame;              ///< The output of got_picture_ptr from the last avcodec_decode_video() call.
+    int     result;                 ///< The result of the last codec decode() call.
+
+    enum {
+        STATE_INPUT_READY,          ///< Set when the thread is awaiting a packet.
+        STATE_SETTING_UP,           ///< Set before the codec has called ff_thread_finish_setup().
+        STATE_GET_BUFFER,           /**<
+                                     * Set when the codec calls get_buffer().
+                                     * State is returned to STATE_SETTING_UP afterwards.
+                                     */
+        STATE_SETUP_FINISHED        ///< Set after the codec has called ff_thread_finish_setup().
+    } state;
+
+    /**
+     * Array of frames passed to ff_thread_release_buffer().
+     * Frames are released after all threads referencing them are finished.
+     */
+    AVFrame released_buffers[MAX_BUFFERS];
+    int     num_released_buffers;
+
+    /**
+     * Array of progress values used by ff_thread_await_progress().
+     */
+    int     progress[MAX_BUFFERS][2];
+    uint8_t progress_used[MAX_BUFFERS];
+
+    AVFrame *requested_frame;       ///< AVFrame the codec passed to get_buffer()
+} PerThreadContext;
+
+/**
+ * Context stored in the client AVCodecContext thread_opaque.
+ */
+typedef struct FrameThreadContext {
+    PerThreadContext *threads;     ///< The contexts for each thread.
+    PerThreadContext *prev_thread; ///< The last thread submit_packet() was called on.
+
+    pthread_mutex_t buffer_mutex;  ///< Mutex used to protect get/release_buffer().
+
+    int next_decoding;             ///< The next context to submit a packet to.
+    int next_finished;             ///< The next context to return output from.
+
+    int delaying;                  /**<
+                                    * Set for the first N packets, where N is the number of threads.
+                                    * While it is set, ff_thread_decode_frame won't return any results.
+                                    */
+
+    int die;                       ///< Set when threads should exit.
+} FrameThreadContext;
+
+/**
+ * Number of jobs a thread claims at once, AVCodecContext.execute_batch if
+ * set, otherwise a quarter of the share of each thread.
+ */
+static int job_batch(AVCodecContext *avctx, int job_count)
+{
+    if (avctx->execute_batch > 0)
+        return avctx->execute_batch;
+    return FFMAX(1, job_count / (4 * avctx->thread_count));
+}
+
+/**
+ * Takes up to max jobs from the front of a queue.
+ * @return the number of jobs taken, the first one is stored in *first
+ */
+static int claim_jobs(JobQueue *q, int max, int *first)
+{
+    int n;
+
+    pthread_mutex_lock(&q->lock);
+    n = FFMIN(max, q->end - q->next);
+    *first = q->next;
+    if (n > 0)
+        q->next += n;
+    pthread_mutex_unlock(&q->lock);
+
+    return FFMAX(n, 0);
+}
+
+/**
+ * Moves the back half of the jobs of another thread into our own queue.
+ * @return 0 if no jobs were left anywhere
+ */
+static int steal_jobs(ThreadContext *c, int self_id, int thread_count)
+{
+    int i;
+
+    for (i = 1; i < thread_count; i++) {
+        JobQueue *victim = &c->queues[(self_id + i) % thread_count];
+        int n, first;
+
+        pthread_mutex_lock(&victim->lock);
+        n = victim->end - victim->next;
+        if (n > 0) {
+            /* steal whole batches so that jobs meant to run together do */
+            n = FFMIN(n, ((n + 1) / 2 + c->batch - 1) / c->batch * c->batch);
+            victim->end -= n;
+        }
+        first = victim->end;
+        pthread_mutex_unlock(&victim->lock);
+
+        if (n > 0) {
+            JobQueue *q = &c->queues[self_id];
+            pthread_mutex_lock(&q->lock);
+            q->next = first;
+            q->end  = first + n;
+            pthread_mutex_unlock(&q->lock);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Runs jobs of the current execute call until none are left, first from our
+ * own queue and then from the others.
+ */
+static void run_jobs(AVCodecContext *avctx, ThreadContext *c, int self_id)
+{
+    int thread_count = avctx->thread_count;
+
+    do {
+        int first, n;
+
+        while ((n = claim_jobs(&c->queues[self_id], c->batch, &first)) > 0) {
+            int job;
+            for (job = first; job < first + n; job++)
+                c->rets[job%c->rets_count] = c->func ? c->func(avctx, (char*)c->args + job*c->job_size):
+                                                       c->func2(avctx, c->args, job, self_id);
+        }
+    } while (steal_jobs(c, self_id, thread_count));
+}
+
 static void* attribute_align_arg worker(void *v)
 {
     AVCodecContext *avctx = v;
     ThreadContext *c = avctx->thread_opaque;
-    int our_job = c->job_count;
-    int thread_count = avctx->thread_count;
+    unsigned last_execute = 0;
     int self_id;
 
     pthread_mutex_lock(&c->current_job_lock);
-    self_id = c->current_job++;
+    self_id = ++c->current_job;
     for (;;){
-        while (our_job >= c->job_count) {
-            if (c->current_job == thread_count + c->job_count)
-                pthread_cond_signal(&c->last_job_cond);
-
+        while (last_execute == c->execute_count && !c->done)
             pthread_cond_wait(&c->current_job_cond, &c->current_job_lock);
-            our_job = self_id;
 
-            if (c->done) {
-                pthread_mutex_unlock(&c->current_job_lock);
-                return NULL;
-            }
+        if (c->done) {
+            pthread_mutex_unlock(&c->current_job_lock);
+            return NULL;
         }
+        last_execute = c->execute_count;
         pthread_mutex_unlock(&c->current_job_lock);
 
-        c->rets[our_job%c->rets_count] = c->func ? c->func(avctx, (char*)c->args + our_job*c->job_size):
-                                                   c->func2(avctx, c->args, our_job, self_id);
+        run_jobs(avctx, c, self_id);
 
         pthread_mutex_lock(&c->current_job_lock);
-        our_job = c->current_job++;
+        if (++c->finished == avctx->thread_count - 1)
+            pthread_cond_signal(&c->last_job_cond);
     }
 }
 
-static av_always_inline void avcodec_thread_park_workers(ThreadContext *c, int thread_count)
+static void run_pool_jobs(PoolTask *t, int first, int n, int threadnr)
 {
-    pthread_cond_wait(&c->last_job_cond, &c->current_job_lock);
-    pthread_mutex_unlock(&c->current_job_lock);
+    AVCodecContext *avctx = t->avctx;
+    ThreadContext *c = avctx->thread_opaque;
+    int job;
+
+    for (job = first; job < first + n; job++)
+        c->rets[job%c->rets_count] = c->func ? c->func(avctx, (char*)c->args + job*c->job_size):
+                                               c->func2(avctx, c->args, job, threadnr);
 }
 
-void avcodec_thread_free(AVCodecContext *avctx)
+static void* attribute_align_arg pool_worker(void *v)
+{
+    pthread_mutex_lock(&pool.lock);
+    for (;;) {
+        PoolTask *t;
+        int first, n, id;
+
+        for (t = pool.tasks; t; t = t->next)
+            if (t->next_job < t->job_count && t->nb_free_ids)
+                break;
+
+        if (!t) {
+            if (pool.die)
+                break;
+            pthread_cond_wait(&pool.work_cond, &pool.lock);
+            continue;
+        }
+
+        first = t->next_job;
+        n = FFMIN(t->batch, t->job_count - first);
+        t->next_job += n;
+        id = t->free_ids[--t->nb_free_ids];
+        t->running++;
+        pthread_mutex_unlock(&pool.lock);
+
+        run_pool_jobs(t, first, n, id);
+
+        pthread_mutex_lock(&pool.lock);
+        t->free_ids[t->nb_free_ids++] = id;
+        if (!--t->running)
+            pthread_cond_broadcast(&pool.done_cond);
+    }
+    pthread_mutex_unlock(&pool.lock);
+
+    return NULL;
+}
+
+/**
+ * Queues the jobs in the shared pool and works on them until all are done.
+ * At most thread_count - 1 pool workers help at the same time.
+ */
+static int pool_execute(AVCodecContext *avctx)
 {
     ThreadContext *c = avctx->thread_opaque;
+    PoolTask task = { 0 }, **p;
     int i;
 
+    task.avctx       = avctx;
+    task.job_count   = c->job_count;
+    task.batch       = job_batch(avctx, c->job_count);
+    task.priority    = avctx->thread_priority;
+    task.free_ids    = c->pool_ids;
+    task.nb_free_ids = avctx->thread_count - 1;
+    for (i = 0; i < task.nb_free_ids; i++)
+        task.free_ids[i] = i + 1;
+
+    pthread_mutex_lock(&pool.lock);
+    for (p = &pool.tasks; *p && (*p)->priority >= task.priority; p = &(*p)->next);
+    task.next = *p;
+    *p = &task;
+    pthread_cond_broadcast(&pool.work_cond);
+
+    while (task.next_job < task.job_count) {
+        int first = task.next_job;
+        int n = FFMIN(task.batch, task.job_count - first);
+        task.next_job += n;
+        pthread_mutex_unlock(&pool.lock);
+
+        run_pool_jobs(&task, first, n, 0);
+
+        pthread_mutex_lock(&pool.lock);
+    }
+
+    for (p = &pool.tasks; *p != &task; p = &(*p)->next);
+    *p = task.next;
+
+    while (task.running)
+        pthread_cond_wait(&pool.done_cond, &pool.lock);
+    pthread_mutex_unlock(&pool.lock);
+
+    return 0;
+}
+
+int avcodec_thread_pool_init(int thread_count)
+{
+    int i;
+
+    if (pool.nb_workers || thread_count <= 0)
+        return -1;
+
+    pool.workers = av_mallocz(sizeof(pthread_t)*thread_count);
+    if (!pool.workers)
+        return AVERROR(ENOMEM);
+
+    pool.die = 0;
+    for (i = 0; i < thread_count; i++) {
+        if (pthread_create(&pool.workers[i], NULL, pool_worker, NULL)) {
+            pool.nb_workers = i;
+            avcodec_thread_pool_free();
+            return -1;
+        }
+    }
+    pool.nb_workers = thread_count;
+
+    return 0;
+}
+
+void avcodec_thread_pool_free(void)
+{
+    int i;
+
+    pthread_mutex_lock(&pool.lock);
+    pool.die = 1;
+    pthread_cond_broadcast(&pool.work_cond);
+    pthread_mutex_unlock(&pool.lock);
+
+    for (i = 0; i < pool.nb_workers; i++)
+        pthread_join(pool.workers[i], NULL);
+
+    av_freep(&pool.workers);
+    pool.nb_workers = 0;
+}
+
+static void thread_free(AVCodecContext *avctx)
+{
+    ThreadContext *c = avctx->thread_opaque;
+    int i;
+
+    pthread_mutex_destroy(&c->progress_mutex);
+    pthread_cond_destroy(&c->progress_cond);
+    av_freep(&c->rows);
+
+    if (c->pooled) {
+        av_free(c->pool_ids);
+        av_freep(&avctx->thread_opaque);
+        return;
+    }
+
     pthread_mutex_lock(&c->current_job_lock);
     c->done = 1;
     pthread_cond_broadcast(&c->current_job_cond);
     pthread_mutex_unlock(&c->current_job_lock);
 
-    for (i=0; i<avctx->thread_count; i++)
+    for (i=0; i<avctx->thread_count-1; i++)
          pthread_join(c->workers[i], NULL);
 
+    for (i=0; i<avctx->thread_count; i++)
+        pthread_mutex_destroy(&c->queues[i].lock);
     pthread_mutex_destroy(&c->current_job_lock);
     pthread_cond_destroy(&c->current_job_cond);
     pthread_cond_destroy(&c->last_job_cond);
+    av_free(c->queues);
     av_free(c->workers);
     av_freep(&avctx->thread_opaque);
 }
@@ -107,14 +453,13 @@ void avcodec_thread_free(AVCodecContext *avctx)
 int avcodec_thread_execute(AVCodecContext *avctx, action_func* func, void *arg, int *ret, int job_count, int job_size)
 {
     ThreadContext *c= avctx->thread_opaque;
+    int thread_count = avctx->thread_count;
     int dummy_ret;
+    int i;
 
     if (job_count <= 0)
         return 0;
 
-    pthread_mutex_lock(&c->current_job_lock);
-
-    c->current_job = avctx->thread_count;
     c->job_count = job_count;
     c->job_size = job_size;
     c->args = arg;
@@ -126,9 +471,33 @@ int avcodec_thread_execute(AVCodecContext *avctx, action_func* func, void *arg,
         c->rets = &dummy_ret;
         c->rets_count = 1;
     }
+
+    if (c->pooled)
+        return pool_execute(avctx);
+
+    /* Give every thread a contiguous share of the jobs. Owners take a
+     * quarter of their share at a time, or execute_batch jobs, so that many
+     * small jobs, e.g. one per macroblock row, do not cost a lock each, while
+     * the rest remains available to threads running out of work. */
+    for (i = 0; i < thread_count; i++) {
+        c->queues[i].next = (int64_t)job_count *  i      / thread_count;
+        c->queues[i].end  = (int64_t)job_count * (i + 1) / thread_count;
+    }
+    c->batch = job_batch(avctx, job_count);
+
+    pthread_mutex_lock(&c->current_job_lock);
+    c->finished = 0;
+    c->execute_count++;
     pthread_cond_broadcast(&c->current_job_cond);
+    pthread_mutex_unlock(&c->current_job_lock);
 
-    avcodec_thread_park_workers(c, avctx->thread_count);
+    /* the calling thread works on the jobs as well instead of just waiting */
+    run_jobs(avctx, c, 0);
+
+    pthread_mutex_lock(&c->current_job_lock);
+    while (c->finished < thread_count - 1)
+        pthread_cond_wait(&c->last_job_cond, &c->current_job_lock);
+    pthread_mutex_unlock(&c->current_job_lock);
 
     return 0;
 }
@@ -140,12 +509,190 @@ int avcodec_thread_execute2(AVCodecContext *avctx, action_func2* func2, void *ar
     return avcodec_thread_execute(avctx, NULL, arg, ret, job_count, 0);
 }
 
-int avcodec_thread_init(AVCodecContext *avctx, int thread_count)
+int ff_thread_init_row_progress(AVCodecContext *avctx, int rows)
+{
+    ThreadContext *c = avctx->thread_opaque;
+
+    if (!(avctx->active_thread_type&FF_THREAD_SLICE) || !c)
+        return -1;
+
+    if (c->nb_rows < rows) {
+        av_freep(&c->rows);
+        c->nb_rows = 0;
+        c->rows = av_malloc(sizeof(int)*rows);
+        if (!c->rows)
+            return AVERROR(ENOMEM);
+        c->nb_rows = rows;
+    }
+    memset(c->rows, 0, sizeof(int)*c->nb_rows);
+    c->row_count  = rows;
+    c->next_claim = 0;
+    c->rows_held  = 0;
+
+    return 0;
+}
+
+void ff_thread_report_row_progress(AVCodecContext *avctx, int row)
+{
+    ThreadContext *c = avctx->thread_opaque;
+
+    if (row < 0 || row >= c->nb_rows)
+        return;
+
+    pthread_mutex_lock(&c->progress_mutex);
+    c->rows[row] = 1;
+    pthread_cond_broadcast(&c->progress_cond);
+    pthread_mutex_unlock(&c->progress_mutex);
+}
+
+void ff_thread_await_row_progress(AVCodecContext *avctx, int row)
+{
+    ThreadContext *c = avctx->thread_opaque;
+
+    if (row < 0 || row >= c->nb_rows)
+        return;
+
+    pthread_mutex_lock(&c->progress_mutex);
+    while (!c->rows[row])
+        pthread_cond_wait(&c->progress_cond, &c->progress_mutex);
+    pthread_mutex_unlock(&c->progress_mutex);
+}
+
+int ff_thread_claim_rows(AVCodecContext *avctx, int held, int delay, int *first)
+{
+    ThreadContext *c = avctx->thread_opaque;
+    int end, n = 0;
+
+    pthread_mutex_lock(&c->progress_mutex);
+    if (held)
+        c->rows_held = 0;
+    if (!c->rows_held) {
+        for (end = c->next_claim; end < c->row_count && c->rows[end]; end++);
+        if (end < c->row_count)
+            end = FFMAX(end - delay, c->next_claim);
+        n = end - c->next_claim;
+        *first = c->next_claim;
+        c->next_claim = end;
+        c->rows_held  = n > 0;
+    }
+    pthread_mutex_unlock(&c->progress_mutex);
+
+    return n;
+}
+
+/**
+ * Context of ff_thread_async_init(), a single job run again and again by one thread.
+ */
+struct AsyncContext {
+    AVCodecContext *avctx;
+    int (*func)(AVCodecContext *c, void *arg);
+    void *arg;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;            ///< signaled when a job is started, finished or the thread should exit
+    int pending;                    ///< set from ff_thread_async_start() until the job is finished
+    int ret;                        ///< return value of the last finished job
+    int die;
+};
+
+static void* attribute_align_arg async_worker(void *v)
+{
+    AsyncContext *a = v;
+
+    pthread_mutex_lock(&a->lock);
+    for (;;) {
+        int ret;
+
+        while (!a->pending && !a->die)
+            pthread_cond_wait(&a->cond, &a->lock);
+        if (a->die)
+            break;
+        pthread_mutex_unlock(&a->lock);
+
+        ret = a->func(a->avctx, a->arg);
+
+        pthread_mutex_lock(&a->lock);
+        a->ret     = ret;
+        a->pending = 0;
+        pthread_cond_broadcast(&a->cond);
+    }
+    pthread_mutex_unlock(&a->lock);
+
+    return NULL;
+}
+
+AsyncContext *ff_thread_async_init(AVCodecContext *avctx,
+                                   int (*func)(AVCodecContext *c, void *arg), void *arg)
+{
+    AsyncContext *a = av_mallocz(sizeof(AsyncContext));
+
+    if (!a)
+        return NULL;
+
+    a->avctx = avctx;
+    a->func  = func;
+    a->arg   = arg;
+    pthread_mutex_init(&a->lock, NULL);
+    pthread_cond_init(&a->cond, NULL);
+
+    if (pthread_create(&a->thread, NULL, async_worker, a)) {
+        pthread_mutex_destroy(&a->lock);
+        pthread_cond_destroy(&a->cond);
+        av_free(a);
+        return NULL;
+    }
+
+    return a;
+}
+
+void ff_thread_async_start(AsyncContext *a)
+{
+    pthread_mutex_lock(&a->lock);
+    a->pending = 1;
+    pthread_cond_broadcast(&a->cond);
+    pthread_mutex_unlock(&a->lock);
+}
+
+int ff_thread_async_wait(AsyncContext *a)
+{
+    int ret;
+
+    pthread_mutex_lock(&a->lock);
+    while (a->pending)
+        pthread_cond_wait(&a->cond, &a->lock);
+    ret    = a->ret;
+    a->ret = 0;
+    pthread_mutex_unlock(&a->lock);
+
+    return ret;
+}
+
+void ff_thread_async_free(AsyncContext **ap)
+{
+    AsyncContext *a = *ap;
+
+    if (!a)
+        return;
+
+    pthread_mutex_lock(&a->lock);
+    while (a->pending)
+        pthread_cond_wait(&a->cond, &a->lock);
+    a->die = 1;
+    pthread_cond_broadcast(&a->cond);
+    pthread_mutex_unlock(&a->lock);
+
+    pthread_join(a->thread, NULL);
+    pthread_mutex_destroy(&a->lock);
+    pthread_cond_destroy(&a->cond);
+    av_freep(ap);
+}
+
+static int thread_init(AVCodecContext *avctx)
 {
     int i;
     ThreadContext *c;
-
-    avctx->thread_count = thread_count;
+    int thread_count = avctx->thread_count;
 
     if (thread_count <= 1)
         return 0;
@@ -154,33 +701,739 @@ int avcodec_thread_init(AVCodecContext *avctx, int thread_count)
     if (!c)
         return -1;
 
-    c->workers = av_mallocz(sizeof(pthread_t)*thread_count);
-    if (!c->workers) {
+    pthread_mutex_init(&c->progress_mutex, NULL);
+    pthread_cond_init(&c->progress_cond, NULL);
+
+    if (pool.nb_workers) {
+        c->pooled   = 1;
+        c->pool_ids = av_malloc(sizeof(int)*(thread_count-1));
+        if (!c->pool_ids) {
+            pthread_mutex_destroy(&c->progress_mutex);
+            pthread_cond_destroy(&c->progress_cond);
+            av_free(c);
+            return -1;
+        }
+        avctx->thread_opaque = c;
+        avctx->execute = avcodec_thread_execute;
+        avctx->execute2 = avcodec_thread_execute2;
+        return 0;
+    }
+
+    c->workers = av_mallocz(sizeof(pthread_t)*(thread_count-1));
+    c->queues  = av_mallocz(sizeof(JobQueue)*thread_count);
+    if (!c->workers || !c->queues) {
+        pthread_mutex_destroy(&c->progress_mutex);
+        pthread_cond_destroy(&c->progress_cond);
+        av_free(c->workers);
+        av_free(c->queues);
         av_free(c);
         return -1;
     }
 
     avctx->thread_opaque = c;
     c->current_job = 0;
+    c->execute_count = 0;
     c->job_count = 0;
     c->job_size = 0;
     c->done = 0;
+    for (i=0; i<thread_count; i++)
+        pthread_mutex_init(&c->queues[i].lock, NULL);
     pthread_cond_init(&c->current_job_cond, NULL);
     pthread_cond_init(&c->last_job_cond, NULL);
     pthread_mutex_init(&c->current_job_lock, NULL);
-    pthread_mutex_lock(&c->current_job_lock);
-    for (i=0; i<thread_count; i++) {
+    /* the calling thread is participant 0, so one thread less is started */
+    for (i=0; i<thread_count-1; i++) {
         if(pthread_create(&c->workers[i], NULL, worker, avctx)) {
-           avctx->thread_count = i;
-           pthread_mutex_unlock(&c->current_job_lock);
-           avcodec_thread_free(avctx);
+           avctx->thread_count = i+1;
+           thread_free(avctx);
            return -1;
         }
     }
 
-    avcodec_thread_park_workers(c, thread_count);
-
     avctx->execute = avcodec_thread_execute;
     avctx->execute2 = avcodec_thread_execute2;
     return 0;
 }
+
+/**
+ * Codec worker thread.
+ *
+ * Automatically calls ff_thread_finish_setup() if the codec does
+ * not provide an update_thread_context method, or if the codec returns
+ * before calling it.
+ */
+static attribute_align_arg void *frame_worker_thread(void *arg)
+{
+    PerThreadContext *p = arg;
+    FrameThreadContext *fctx = p->parent;
+    AVCodecContext *avctx = p->avctx;
+    AVCodec *codec = avctx->codec;
+
+    for (;;) {
+        if (p->state == STATE_INPUT_READY && !fctx->die) {
+            pthread_mutex_lock(&p->mutex);
+            while (p->state == STATE_INPUT_READY && !fctx->die)
+                pthread_cond_wait(&p->input_cond, &p->mutex);
+            pthread_mutex_unlock(&p->mutex);
+        }
+
+        if (fctx->die) break;
+
+        if (!codec->update_thread_context && avctx->thread_safe_callbacks)
+            ff_thread_finish_setup(avctx);
+
+        pthread_mutex_lock(&p->mutex);
+        avcodec_get_frame_defaults(&p->frame);
+        p->got_frame = 0;
+        p->result = codec->decode(avctx, &p->frame, &p->got_frame, &p->avpkt);
+
+        if (p->state == STATE_SETTING_UP) ff_thread_finish_setup(avctx);
+
+        p->state = STATE_INPUT_READY;
+
+        pthread_mutex_lock(&p->progress_mutex);
+        pthread_cond_signal(&p->output_cond);
+        pthread_mutex_unlock(&p->progress_mutex);
+
+        pthread_mutex_unlock(&p->mutex);
+    }
+
+    return NULL;
+}
+
+/**
+ * Updates the next thread's AVCodecContext with values from the reference thread's context.
+ *
+ * @param dst The destination context.
+ * @param src The source context.
+ * @param for_user 0 if the destination is a codec thread, 1 if the destination is the user's thread
+ */
+static int update_context_from_thread(AVCodecContext *dst, AVCodecContext *src, int for_user)
+{
+    int err = 0;
+
+    if (dst != src) {
+        dst->sub_id    = src->sub_id;
+        dst->time_base = src->time_base;
+        dst->width     = src->width;
+        dst->height    = src->height;
+        dst->pix_fmt   = src->pix_fmt;
+
+        dst->coded_width  = src->coded_width;
+        dst->coded_height = src->coded_height;
+
+        dst->has_b_frames = src->has_b_frames;
+        dst->idct_algo    = src->idct_algo;
+        dst->slice_count  = src->slice_count;
+
+        dst->bits_per_coded_sample = src->bits_per_coded_sample;
+        dst->sample_aspect_ratio   = src->sample_aspect_ratio;
+        dst->dtg_active_format     = src->dtg_active_format;
+
+        dst->profile = src->profile;
+        dst->level   = src->level;
+
+        dst->bits_per_raw_sample = src->bits_per_raw_sample;
+        dst->ticks_per_frame     = src->ticks_per_frame;
+        dst->color_primaries     = src->color_primaries;
+
+        dst->color_trc   = src->color_trc;
+        dst->colorspace  = src->colorspace;
+        dst->color_range = src->color_range;
+        dst->chroma_sample_location = src->chroma_sample_location;
+    }
+
+    if (for_user) {
+        dst->coded_frame   = src->coded_frame;
+        dst->has_b_frames += src->thread_count - 1;
+    } else {
+        if (dst->codec->update_thread_context)
+            err = dst->codec->update_thread_context(dst, src);
+    }
+
+    return err;
+}
+
+/**
+ * Updates the next thread's AVCodecContext with values set by the user.
+ *
+ * @param dst The destination context.
+ * @param src The source context.
+ */
+static void update_context_from_user(AVCodecContext *dst, AVCodecContext *src)
+{
+    dst->flags          = src->flags;
+
+    dst->draw_horiz_band= src->draw_horiz_band;
+    dst->get_buffer     = src->get_buffer;
+    dst->release_buffer = src->release_buffer;
+
+    dst->opaque   = src->opaque;
+    dst->hurry_up = src->hurry_up;
+    dst->dsp_mask = src->dsp_mask;
+    dst->debug    = src->debug;
+    dst->debug_mv = src->debug_mv;
+
+    dst->slice_flags = src->slice_flags;
+    dst->flags2      = src->flags2;
+
+    dst->skip_loop_filter = src->skip_loop_filter;
+    dst->skip_idct        = src->skip_idct;
+    dst->skip_frame       = src->skip_frame;
+
+    dst->frame_number     = src->frame_number;
+    dst->reordered_opaque = src->reordered_opaque;
+}
+
+static void free_progress(AVFrame *f)
+{
+    PerThreadContext *p = f->owner->thread_opaque;
+    int *progress = f->thread_opaque;
+
+    p->progress_used[(progress - p->progress[0]) / 2] = 0;
+}
+
+/// Releases the buffers that this decoding thread was the last user of.
+static void release_delayed_buffers(PerThreadContext *p)
+{
+    FrameThreadContext *fctx = p->parent;
+
+    while (p->num_released_buffers > 0) {
+        AVFrame *f;
+
+        pthread_mutex_lock(&fctx->buffer_mutex);
+        f = &p->released_buffers[--p->num_released_buffers];
+        free_progress(f);
+        f->thread_opaque = NULL;
+
+        f->owner->release_buffer(f->owner, f);
+        pthread_mutex_unlock(&fctx->buffer_mutex);
+    }
+}
+
+static int submit_packet(PerThreadContext *p, AVPacket *avpkt)
+{
+    FrameThreadContext *fctx = p->parent;
+    PerThreadContext *prev_thread = fctx->prev_thread;
+    AVCodec *codec = p->avctx->codec;
+    uint8_t *buf = p->avpkt.data;
+
+    if (!avpkt->size && !(codec->capabilities & CODEC_CAP_DELAY)) return 0;
+
+    pthread_mutex_lock(&p->mutex);
+
+    release_delayed_buffers(p);
+
+    if (prev_thread) {
+        int err;
+        if (prev_thread->state == STATE_SETTING_UP) {
+            pthread_mutex_lock(&prev_thread->progress_mutex);
+            while (prev_thread->state == STATE_SETTING_UP)
+                pthread_cond_wait(&prev_thread->progress_cond, &prev_thread->progress_mutex);
+            pthread_mutex_unlock(&prev_thread->progress_mutex);
+        }
+
+        err = update_context_from_thread(p->avctx, prev_thread->avctx, 0);
+        if (err) {
+            pthread_mutex_unlock(&p->mutex);
+            return err;
+        }
+    }
+
+    av_fast_malloc(&buf, &p->allocated_buf_size, avpkt->size + FF_INPUT_BUFFER_PADDING_SIZE);
+    p->avpkt = *avpkt;
+    p->avpkt.data = buf;
+    memcpy(buf, avpkt->data, avpkt->size);
+    memset(buf + avpkt->size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+
+    p->state = STATE_SETTING_UP;
+    pthread_cond_signal(&p->input_cond);
+    pthread_mutex_unlock(&p->mutex);
+
+    /*
+     * If the client doesn't have a thread-safe get_buffer(),
+     * then decoding threads call back to the main thread,
+     * and it calls back to the client here.
+     */
+
+    if (!p->avctx->thread_safe_callbacks &&
+         p->avctx->get_buffer != avcodec_default_get_buffer) {
+        while (p->state != STATE_SETUP_FINISHED && p->state != STATE_INPUT_READY) {
+            pthread_mutex_lock(&p->progress_mutex);
+            while (p->state == STATE_SETTING_UP)
+                pthread_cond_wait(&p->progress_cond, &p->progress_mutex);
+
+            if (p->state == STATE_GET_BUFFER) {
+                p->result = p->avctx->get_buffer(p->avctx, p->requested_frame);
+                p->state  = STATE_SETTING_UP;
+                pthread_cond_signal(&p->progress_cond);
+            }
+            pthread_mutex_unlock(&p->progress_mutex);
+        }
+    }
+
+    fctx->prev_thread = p;
+    fctx->next_decoding++;
+
+    return 0;
+}
+
+int ff_thread_decode_frame(AVCodecContext *avctx,
+                           AVFrame *picture, int *got_picture_ptr,
+                           AVPacket *avpkt)
+{
+    FrameThreadContext *fctx = avctx->thread_opaque;
+    int finished = fctx->next_finished;
+    PerThreadContext *p;
+    int err;
+
+    /*
+     * Submit a packet to the next decoding thread.
+     */
+
+    p = &fctx->threads[fctx->next_decoding];
+    update_context_from_user(p->avctx, avctx);
+    err = submit_packet(p, avpkt);
+    if (err) return err;
+
+    /*
+     * If we're still receiving the initial packets, don't return a frame.
+     */
+
+    if (fctx->delaying && avpkt->size) {
+        if (fctx->next_decoding >= (avctx->thread_count-1)) fctx->delaying = 0;
+
+        *got_picture_ptr=0;
+        return avpkt->size;
+    }
+
+    /*
+     * Return the next available frame from the oldest thread.
+     * If we're at the end of the stream, then we have to skip threads that
+     * didn't output a frame, because we don't want to accidentally signal
+     * EOF (avpkt->size == 0 && *got_picture_ptr == 0).
+     */
+
+    do {
+        p = &fctx->threads[finished++];
+
+        if (p->state != STATE_INPUT_READY) {
+            pthread_mutex_lock(&p->progress_mutex);
+            while (p->state != STATE_INPUT_READY)
+                pthread_cond_wait(&p->output_cond, &p->progress_mutex);
+            pthread_mutex_unlock(&p->progress_mutex);
+        }
+
+        *picture = p->frame;
+        *got_picture_ptr = p->got_frame;
+
+        /*
+         * A later call with avkpt->size == 0 may loop over all threads,
+         * including this one, searching for a frame to return before being
+         * stopped by the "finished != fctx->next_finished" condition.
+         * Make sure we don't mistakenly return the same frame again.
+         */
+        p->got_frame = 0;
+
+        if (finished >= avctx->thread_count) finished = 0;
+    } while (!avpkt->size && !*got_picture_ptr && finished != fctx->next_finished);
+
+    update_context_from_thread(avctx, p->avctx, 1);
+
+    if (fctx->next_decoding >= avctx->thread_count) fctx->next_decoding = 0;
+
+    fctx->next_finished = finished;
+
+    /* return the size of the consumed packet if no error occurred */
+    return (p->result >= 0) ? avpkt->size : p->result;
+}
+
+void ff_thread_report_progress(AVFrame *f, int n, int field)
+{
+    PerThreadContext *p;
+    int *progress = f->thread_opaque;
+
+    if (!progress || progress[field] >= n) return;
+
+    p = f->owner->thread_opaque;
+
+    if (f->owner->debug&FF_DEBUG_THREADS)
+        av_log(f->owner, AV_LOG_DEBUG, "%p finished %d field %d\n", progress, n, field);
+
+    pthread_mutex_lock(&p->progress_mutex);
+    progress[field] = n;
+    pthread_cond_broadcast(&p->progress_cond);
+    pthread_mutex_unlock(&p->progress_mutex);
+}
+
+void ff_thread_await_progress(AVFrame *f, int n, int field)
+{
+    PerThreadContext *p;
+    int *progress = f->thread_opaque;
+
+    if (!progress || progress[field] >= n) return;
+
+    p = f->owner->thread_opaque;
+
+    if (f->owner->debug&FF_DEBUG_THREADS)
+        av_log(f->owner, AV_LOG_DEBUG, "thread awaiting %d field %d from %p\n", n, field, progress);
+
+    pthread_mutex_lock(&p->progress_mutex);
+    while (progress[field] < n)
+        pthread_cond_wait(&p->progress_cond, &p->progress_mutex);
+    pthread_mutex_unlock(&p->progress_mutex);
+}
+
+void ff_thread_finish_setup(AVCodecContext *avctx)
+{
+    PerThreadContext *p = avctx->thread_opaque;
+
+    if (!(avctx->active_thread_type&FF_THREAD_FRAME)) return;
+
+    pthread_mutex_lock(&p->progress_mutex);
+    p->state = STATE_SETUP_FINISHED;
+    pthread_cond_broadcast(&p->progress_cond);
+    pthread_mutex_unlock(&p->progress_mutex);
+}
+
+/// Waits for all threads to finish.
+static void park_frame_worker_threads(FrameThreadContext *fctx, int thread_count)
+{
+    int i;
+
+    for (i = 0; i < thread_count; i++) {
+        PerThreadContext *p = &fctx->threads[i];
+
+        if (p->state != STATE_INPUT_READY) {
+            pthread_mutex_lock(&p->progress_mutex);
+            while (p->state != STATE_INPUT_READY)
+                pthread_cond_wait(&p->output_cond, &p->progress_mutex);
+            pthread_mutex_unlock(&p->progress_mutex);
+        }
+    }
+}
+
+static void frame_thread_free(AVCodecContext *avctx, int thread_count)
+{
+    FrameThreadContext *fctx = avctx->thread_opaque;
+    AVCodec *codec = avctx->codec;
+    int i;
+
+    park_frame_worker_threads(fctx, thread_count);
+
+    if (fctx->prev_thread && fctx->prev_thread != fctx->threads)
+        update_context_from_thread(fctx->threads->avctx, fctx->prev_thread->avctx, 0);
+
+    fctx->die = 1;
+
+    for (i = 0; i < thread_count; i++) {
+        PerThreadContext *p = &fctx->threads[i];
+
+        pthread_mutex_lock(&p->mutex);
+        pthread_cond_signal(&p->input_cond);
+        pthread_mutex_unlock(&p->mutex);
+
+        if (p->thread)
+            pthread_join(p->thread, NULL);
+
+        if (codec->close)
+            codec->close(p->avctx);
+
+        avctx->codec = NULL;
+
+        release_delayed_buffers(p);
+    }
+
+    for (i = 0; i < thread_count; i++) {
+        PerThreadContext *p = &fctx->threads[i];
+
+        ff_free_internal_buffer(p->avctx);
+
+        pthread_mutex_destroy(&p->mutex);
+        pthread_mutex_destroy(&p->progress_mutex);
+        pthread_cond_destroy(&p->input_cond);
+        pthread_cond_destroy(&p->progress_cond);
+        pthread_cond_destroy(&p->output_cond);
+        av_freep(&p->avpkt.data);
+
+        if (i)
+            av_freep(&p->avctx->priv_data);
+
+        av_freep(&p->avctx);
+    }
+
+    av_freep(&fctx->threads);
+    pthread_mutex_destroy(&fctx->buffer_mutex);
+    av_freep(&avctx->thread_opaque);
+}
+
+static int frame_thread_init(AVCodecContext *avctx)
+{
+    int thread_count = avctx->thread_count;
+    AVCodec *codec = avctx->codec;
+    AVCodecContext *src = avctx;
+    FrameThreadContext *fctx;
+    int i, err = 0;
+
+    avctx->thread_opaque = fctx = av_mallocz(sizeof(FrameThreadContext));
+    if (!fctx)
+        return AVERROR(ENOMEM);
+
+    fctx->threads = av_mallocz(sizeof(PerThreadContext) * thread_count);
+    if (!fctx->threads) {
+        av_freep(&avctx->thread_opaque);
+        return AVERROR(ENOMEM);
+    }
+    pthread_mutex_init(&fctx->buffer_mutex, NULL);
+    fctx->delaying = 1;
+
+    for (i = 0; i < thread_count; i++) {
+        AVCodecContext *copy = av_malloc(sizeof(AVCodecContext));
+        PerThreadContext *p  = &fctx->threads[i];
+
+        pthread_mutex_init(&p->mutex, NULL);
+        pthread_mutex_init(&p->progress_mutex, NULL);
+        pthread_cond_init(&p->input_cond, NULL);
+        pthread_cond_init(&p->progress_cond, NULL);
+        pthread_cond_init(&p->output_cond, NULL);
+
+        p->parent = fctx;
+        p->avctx  = copy;
+
+        if (!copy) {
+            err = AVERROR(ENOMEM);
+            goto error;
+        }
+
+        *copy = *src;
+        copy->thread_opaque = p;
+
+        if (!i) {
+            src = copy;
+
+            if (codec->init)
+                err = codec->init(copy);
+
+            update_context_from_thread(avctx, copy, 1);
+        } else {
+            copy->is_copy   = i;
+            copy->priv_data = av_malloc(codec->priv_data_size);
+            if (!copy->priv_data) {
+                err = AVERROR(ENOMEM);
+                goto error;
+            }
+            memcpy(copy->priv_data, src->priv_data, codec->priv_data_size);
+
+            if (codec->init_thread_copy)
+                err = codec->init_thread_copy(copy);
+        }
+
+        if (err) goto error;
+
+        if (pthread_create(&p->thread, NULL, frame_worker_thread, p)) {
+            err = -1;
+            goto error;
+        }
+    }
+
+    return 0;
+
+error:
+    frame_thread_free(avctx, i+1);
+
+    return err;
+}
+
+void ff_thread_flush(AVCodecContext *avctx)
+{
+    FrameThreadContext *fctx = avctx->thread_opaque;
+    int i;
+
+    if (!avctx->thread_opaque) return;
+
+    park_frame_worker_threads(fctx, avctx->thread_count);
+    if (fctx->prev_thread) {
+        if (fctx->prev_thread != &fctx->threads[0])
+            update_context_from_thread(fctx->threads[0].avctx, fctx->prev_thread->avctx, 0);
+        if (avctx->codec->flush)
+            avctx->codec->flush(fctx->threads[0].avctx);
+    }
+
+    fctx->next_decoding = fctx->next_finished = 0;
+    fctx->delaying = 1;
+    fctx->prev_thread = NULL;
+    /* make sure flushing calls with size 0 won't return old frames */
+    for (i = 0; i < avctx->thread_count; i++)
+        fctx->threads[i].got_frame = 0;
+}
+
+static int *allocate_progress(PerThreadContext *p)
+{
+    int i;
+
+    for (i = 0; i < MAX_BUFFERS; i++)
+        if (!p->progress_used[i]) break;
+
+    if (i == MAX_BUFFERS) {
+        av_log(p->avctx, AV_LOG_ERROR, "allocate_progress() overflow\n");
+        return NULL;
+    }
+
+    p->progress_used[i] = 1;
+
+    return p->progress[i];
+}
+
+int ff_thread_get_buffer(AVCodecContext *avctx, AVFrame *f)
+{
+    PerThreadContext *p = avctx->thread_opaque;
+    int *progress, err;
+
+    f->owner = avctx;
+
+    if (!(avctx->active_thread_type&FF_THREAD_FRAME)) {
+        f->thread_opaque = NULL;
+        return avctx->get_buffer(avctx, f);
+    }
+
+    if (p->state != STATE_SETTING_UP &&
+        (avctx->codec->update_thread_context || !avctx->thread_safe_callbacks)) {
+        av_log(avctx, AV_LOG_ERROR, "get_buffer() cannot be called after ff_thread_finish_setup()\n");
+        return -1;
+    }
+
+    pthread_mutex_lock(&p->parent->buffer_mutex);
+    f->thread_opaque = progress = allocate_progress(p);
+
+    if (!progress) {
+        pthread_mutex_unlock(&p->parent->buffer_mutex);
+        return -1;
+    }
+
+    progress[0] =
+    progress[1] = -1;
+
+    if (avctx->thread_safe_callbacks ||
+        avctx->get_buffer == avcodec_default_get_buffer) {
+        err = avctx->get_buffer(avctx, f);
+    } else {
+        p->requested_frame = f;
+        p->state = STATE_GET_BUFFER;
+        pthread_mutex_lock(&p->progress_mutex);
+        pthread_cond_broadcast(&p->progress_cond);
+
+        while (p->state != STATE_SETTING_UP)
+            pthread_cond_wait(&p->progress_cond, &p->progress_mutex);
+
+        err = p->result;
+
+        pthread_mutex_unlock(&p->progress_mutex);
+
+        if (!avctx->codec->update_thread_context)
+            ff_thread_finish_setup(avctx);
+    }
+
+    if (err)
+        free_progress(f);
+
+    pthread_mutex_unlock(&p->parent->buffer_mutex);
+
+    return err;
+}
+
+void ff_thread_release_buffer(AVCodecContext *avctx, AVFrame *f)
+{
+    PerThreadContext *p = avctx->thread_opaque;
+    FrameThreadContext *fctx;
+
+    if (!(avctx->active_thread_type&FF_THREAD_FRAME)) {
+        avctx->release_buffer(avctx, f);
+        return;
+    }
+
+    if (p->num_released_buffers >= MAX_BUFFERS) {
+        av_log(p->avctx, AV_LOG_ERROR, "too many thread_release_buffer calls!\n");
+        return;
+    }
+
+    if (avctx->debug & FF_DEBUG_BUFFERS)
+        av_log(avctx, AV_LOG_DEBUG, "thread_release_buffer called on pic %p, %d buffers used\n",
+                                    f, f->owner->internal_buffer_count);
+
+    fctx = p->parent;
+    pthread_mutex_lock(&fctx->buffer_mutex);
+    p->released_buffers[p->num_released_buffers++] = *f;
+    pthread_mutex_unlock(&fctx->buffer_mutex);
+    memset(f->data, 0, sizeof(f->data));
+}
+
+/**
+ * Sets the threading algorithms used.
+ *
+ * Threading requires more than one thread.
+ * Frame threading requires entire frames to be passed to the codec,
+ * and introduces extra decoding delay, so is incompatible with low_delay.
+ *
+ * @param avctx The context.
+ */
+static void validate_thread_parameters(AVCodecContext *avctx)
+{
+    int frame_threading_supported = (avctx->codec->capabilities & CODEC_CAP_FRAME_THREADS)
+                                && !(avctx->flags & CODEC_FLAG_TRUNCATED)
+                                && !(avctx->flags & CODEC_FLAG_LOW_DELAY)
+                                && !(avctx->flags2 & CODEC_FLAG2_CHUNKS)
+                                && !avctx->hwaccel;
+    if (avctx->thread_count <= 1) {
+        avctx->active_thread_type = 0;
+    } else if (frame_threading_supported && (avctx->thread_type & FF_THREAD_FRAME)) {
+        avctx->active_thread_type = FF_THREAD_FRAME;
+    } else {
+        avctx->active_thread_type = FF_THREAD_SLICE;
+    }
+}
+
+int ff_thread_init(AVCodecContext *avctx)
+{
+    if (avctx->thread_opaque) {
+        av_log(avctx, AV_LOG_ERROR, "avcodec_thread_init is ignored after avcodec_open\n");
+        return -1;
+    }
+
+    if (avctx->codec) {
+        validate_thread_parameters(avctx);
+
+        if (avctx->active_thread_type&FF_THREAD_SLICE)
+            return thread_init(avctx);
+        else if (avctx->active_thread_type&FF_THREAD_FRAME)
+            return frame_thread_init(avctx);
+    }
+
+    return 0;
+}
+
+void ff_thread_free(AVCodecContext *avctx)
+{
+    if (avctx->active_thread_type&FF_THREAD_FRAME)
+        frame_thread_free(avctx, avctx->thread_count);
+    else
+        thread_free(avctx);
+}
+
+void avcodec_thread_free(AVCodecContext *avctx)
+{
+    ff_thread_free(avctx);
+}
+
+int avcodec_thread_init(AVCodecContext *avctx, int thread_count)
+{
+    avctx->thread_count = thread_count;
+
+    /* If the codec is already open only slice threading can be started,
+     * otherwise the threads are created by avcodec_open(). */
+    if (avctx->codec && !avctx->thread_opaque && thread_count > 1) {
+        avctx->active_thread_type = FF_THREAD_SLICE;
+        return thread_init(avctx);
+    }
+
+    return 0;
+}
@@ -123,6 +123,7 @@ int ff_rate_control_init(MpegEncContext *s)
         rcc->qscale_sum [i]=
         rcc->frame_count[i]= 1; // 1 is better because of 1/0 and such
         rcc->last_qscale_for[i]=FF_QP2LAMBDA * 5;
+        rcc->lookahead_ratio[i]= 1.0;
     }
     rcc->buffer_index= s->avctx->rc_initial_buffer_occupancy;
 
@@ -641,6 +642,146 @@ static void adaptive_quantization(MpegEncContext *s, double q){
     }
 }
 
+/**
+ * converts the qscale of pict_type to the one of a P frame, the inverse of
+ * the I and B frame factors of get_qminmax()
+ */
+static double qscale_to_p(MpegEncContext *s, int pict_type, double q){
+    if(pict_type==FF_B_TYPE && s->avctx->b_quant_factor)
+        q= (q - s->avctx->b_quant_offset)/FFABS(s->avctx->b_quant_factor);
+    else if(pict_type==FF_I_TYPE && s->avctx->i_quant_factor)
+        q= (q - s->avctx->i_quant_offset)/FFABS(s->avctx->i_quant_factor);
+    return FFMAX(q, 1);
+}
+
+static double qscale_from_p(MpegEncContext *s, int pict_type, double q){
+    if(pict_type==FF_B_TYPE)
+        q= q*FFABS(s->avctx->b_quant_factor) + s->avctx->b_quant_offset;
+    else if(pict_type==FF_I_TYPE)
+        q= q*FFABS(s->avctx->i_quant_factor) + s->avctx->i_quant_offset;
+    return FFMAX(q, 1);
+}
+
+/**
+ * simulates the vbv buffer over the current and the lookahead pictures,
+ * with the current one coded at q and the others at the matching qscale
+ * of their type
+ * @param stuffing set to the number of bits which would be stuffed
+ * @return the lowest fullness after removing a picture from the buffer
+ */
+static double predict_vbv(MpegEncContext *s, int n, const int *type, const double *cplx,
+                          double q, double *stuffing){
+    RateControlContext *rcc= &s->rc_context;
+    const double buffer_size= s->avctx->rc_buffer_size;
+    const double fps= 1/av_q2d(s->avctx->time_base);
+    const double min_rate= s->avctx->rc_min_rate / fps;
+    const double max_rate= s->avctx->rc_max_rate / fps;
+    const double p_q= qscale_to_p(s, type[0], q);
+    double buffer= rcc->buffer_index;
+    double lowest= buffer_size;
+    int i;
+
+    *stuffing= 0;
+    for(i=0; i<n; i++){
+        double left;
+
+        buffer-= predict_size(&rcc->pred[type[i]], i ? qscale_from_p(s, type[i], p_q) : q, cplx[i]);
+        lowest= FFMIN(lowest, buffer);
+        if(buffer < 0)
+            buffer= 0;
+
+        /* same as ff_vbv_update() */
+        left= buffer_size - buffer - 1;
+        buffer+= left < min_rate ? min_rate : left > max_rate ? max_rate : left;
+        if(buffer > buffer_size){
+            *stuffing+= buffer - buffer_size;
+            buffer= buffer_size;
+        }
+    }
+    return lowest;
+}
+
+/**
+ * adjusts the qscale of the current picture so that, with the following
+ * pictures coded alike, the vbv buffer does not underflow within the
+ * lookahead, and, for cbr, so that no bits need to be stuffed.
+ * The types of the pictures which are not selected yet are guessed from
+ * max_b_frames and gop_size, their complexity from the estimates of
+ * load_input_picture() scaled to what the motion estimation measured.
+ */
+static double lookahead_qscale(MpegEncContext *s, double q, int var){
+    RateControlContext *rcc= &s->rc_context;
+    AVCodecContext *a= s->avctx;
+    const double margin= a->rc_buffer_size * 0.1; // the predictions are rough
+    const int depth= FFMIN(a->rc_lookahead, MAX_PICTURE_COUNT - 1);
+    int type[MAX_PICTURE_COUNT];
+    double cplx[MAX_PICTURE_COUNT];
+    int i, n, qmin, qmax, last_display, gop_pos, fresh;
+    double lowest, stuffing, q_org= q;
+
+    get_qminmax(&qmin, &qmax, s, s->pict_type);
+
+    type[0]= s->pict_type;
+    cplx[0]= sqrt(var);
+    n= 1;
+    gop_pos= s->picture_in_gop_number;
+    last_display= s->reordered_input_picture[0]->display_picture_number;
+
+    /* pictures coded next, in coding order, then the ones not selected yet */
+    for(i=1; i<MAX_PICTURE_COUNT && s->reordered_input_picture[i] && n<=depth; i++){
+        Picture *p= s->reordered_input_picture[i];
+        const double est= p->pict_type == FF_I_TYPE ? p->lookahead_mb_var_sum : p->lookahead_mc_mb_var_sum;
+
+        type[n]= p->pict_type;
+        cplx[n]= sqrt(est*rcc->lookahead_ratio[p->pict_type]);
+        last_display= FFMAX(last_display, p->display_picture_number);
+        gop_pos++;
+        n++;
+    }
+    fresh= 0;
+    for(i=0; i<MAX_PICTURE_COUNT && s->input_picture[i] && n<=depth; i++){
+        Picture *p= s->input_picture[i];
+        double est;
+
+        if(p->display_picture_number <= last_display)
+            continue;
+
+        if(p->pict_type == FF_I_TYPE || s->intra_only || ++gop_pos >= s->gop_size){
+            type[n]= FF_I_TYPE;
+            gop_pos= 0;
+        }else
+            type[n]= ++fresh % (s->max_b_frames+1) ? FF_B_TYPE : FF_P_TYPE;
+
+        est= type[n] == FF_I_TYPE ? p->lookahead_mb_var_sum : p->lookahead_mc_mb_var_sum;
+        cplx[n]= sqrt(est*rcc->lookahead_ratio[type[n]]);
+        n++;
+    }
+
+    lowest= predict_vbv(s, n, type, cplx, q, &stuffing);
+    if(lowest < margin){
+        for(i=0; i<32 && lowest < margin && q < qmax; i++){
+            q= FFMIN(q*1.1, qmax);
+            lowest= predict_vbv(s, n, type, cplx, q, &stuffing);
+        }
+    }else if(a->rc_min_rate){
+        for(i=0; i<32 && stuffing > 0 && q > qmin; i++){
+            double new_stuffing, new_q= FFMAX(q/1.1, qmin);
+
+            if(predict_vbv(s, n, type, cplx, new_q, &new_stuffing) < margin)
+                break;
+            q= new_q;
+            stuffing= new_stuffing;
+        }
+    }
+
+    if(a->debug&FF_DEBUG_RC){
+        av_log(a, AV_LOG_DEBUG, "lookahead %d pictures, qp %2.1f -> %2.1f, lowest buffer fullness %d\n",
+               n, q_org, q, (int)lowest);
+    }
+
+    return q;
+}
+
 void ff_get_2pass_fcode(MpegEncContext *s){
     RateControlContext *rcc= &s->rc_context;
     int picture_number= s->picture_number;
@@ -781,6 +922,9 @@ float ff_rate_estimate_qscale(MpegEncContext *s, int dry_run)
 
         q= modify_qscale(s, rce, q, picture_number);
 
+        if(a->rc_lookahead)
+            q= lookahead_qscale(s, q, var);
+
         rcc->pass1_wanted_bits+= s->bit_rate/fps;
 
         assert(q>0.0);
@@ -805,6 +949,13 @@ float ff_rate_estimate_qscale(MpegEncContext *s, int dry_run)
         rcc->last_qscale= q;
         rcc->last_mc_mb_var_sum= pic->mc_mb_var_sum;
         rcc->last_mb_var_sum= pic->mb_var_sum;
+
+        if(a->rc_lookahead){
+            /* calibrate the estimates of load_input_picture() against the motion estimation */
+            const int est= pict_type == FF_I_TYPE ? pic->lookahead_mb_var_sum : pic->lookahead_mc_mb_var_sum;
+            if(est > 0)
+                rcc->lookahead_ratio[pict_type]= 0.5*rcc->lookahead_ratio[pict_type] + 0.5*var/est;
+        }
     }
 #if 0
 {
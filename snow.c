@@ -380,6 +380,7 @@ typedef struct BlockNode{
 #define BLOCK_INTRA   1
 #define BLOCK_OPT     2
 //#define TYPE_NOCOLOR  4
+#define BLOCK_CHANGED 4 ///< changed by a concurrent iterative_me() job, its neighbors are updated afterwards
     uint8_t level; //FIXME merge into type?
 }BlockNode;
 
@@ -422,6 +423,8 @@ typedef struct Plane{
     int width;
     int height;
     SubBand band[MAX_DECOMPOSITIONS][4];
+    DWTELEM *dwt_buffer;        ///< spatial buffers of the encoder for this plane, the decoder uses the shared ones
+    IDWTELEM *idwt_buffer;
 
     int htaps;
     int8_t hcoeff[HTAPS_MAX/2];
@@ -485,11 +488,15 @@ typedef struct SnowContext{
 #define ME_CACHE_SIZE 1024
     int me_cache[ME_CACHE_SIZE];
     int me_cache_generation;
-    slice_buffer sb;
+    slice_buffer sb[MAX_PLANES];  ///< one per plane, so that the decoder can reconstruct the planes concurrently
 
     MpegEncContext m; // needed for motion estimation, should not be used for anything else, the idea is to eventually make the motion estimation independent of MpegEncContext, so this will be removed then (FIXME/XXX)
 
     uint8_t *scratchbuf;
+    uint8_t *plane_scratchbuf[MAX_PLANES]; ///< scratchbuf of each plane reconstruction job
+    struct SnowContext **thread_context;   ///< copies for the iterative motion estimation jobs, [0] is this context
+    int me_phase;                          ///< set of blocks searched by the current iterative_me_thread() jobs
+    int me_pass;
 }SnowContext;
 
 typedef struct {
@@ -1916,7 +1923,7 @@ void ff_snow_inner_add_yblock(const uint8_t *obmc, const int obmc_stride, uint8_
 }
 
 //FIXME name cleanup (b_w, block_w, b_width stuff)
-static av_always_inline void add_yblock(SnowContext *s, int sliced, slice_buffer *sb, IDWTELEM *dst, uint8_t *dst8, const uint8_t *obmc, int src_x, int src_y, int b_w, int b_h, int w, int h, int dst_stride, int src_stride, int obmc_stride, int b_x, int b_y, int add, int offset_dst, int plane_index){
+static av_always_inline void add_yblock(SnowContext *s, int sliced, slice_buffer *sb, uint8_t *tmp, IDWTELEM *dst, uint8_t *dst8, const uint8_t *obmc, int src_x, int src_y, int b_w, int b_h, int w, int h, int dst_stride, int src_stride, int obmc_stride, int b_x, int b_y, int add, int offset_dst, int plane_index){
     const int b_width = s->b_width  << s->block_max_depth;
     const int b_height= s->b_height << s->block_max_depth;
     const int b_stride= b_width;
@@ -1926,7 +1933,6 @@ static av_always_inline void add_yblock(SnowContext *s, int sliced, slice_buffer
     BlockNode *rb= lb+1;
     uint8_t *block[4];
     int tmp_step= src_stride >= 7*MB_SIZE ? MB_SIZE : MB_SIZE*src_stride;
-    uint8_t *tmp = s->scratchbuf;
     uint8_t *ptmp;
     int x,y;
 
@@ -2073,7 +2079,7 @@ static av_always_inline void add_yblock(SnowContext *s, int sliced, slice_buffer
 #endif /* 0 */
 }
 
-static av_always_inline void predict_slice_buffered(SnowContext *s, slice_buffer * sb, IDWTELEM * old_buffer, int plane_index, int add, int mb_y){
+static av_always_inline void predict_slice_buffered(SnowContext *s, slice_buffer * sb, uint8_t *tmp, IDWTELEM * old_buffer, int plane_index, int add, int mb_y){
     Plane *p= &s->plane[plane_index];
     const int mb_w= s->b_width  << s->block_max_depth;
     const int mb_h= s->b_height << s->block_max_depth;
@@ -2118,7 +2124,7 @@ static av_always_inline void predict_slice_buffered(SnowContext *s, slice_buffer
     }
 
     for(mb_x=0; mb_x<=mb_w; mb_x++){
-        add_yblock(s, 1, sb, old_buffer, dst8, obmc,
+        add_yblock(s, 1, sb, tmp, old_buffer, dst8, obmc,
                    block_w*mb_x - block_w/2,
                    block_w*mb_y - block_w/2,
                    block_w, block_w,
@@ -2129,7 +2135,7 @@ static av_always_inline void predict_slice_buffered(SnowContext *s, slice_buffer
     }
 }
 
-static av_always_inline void predict_slice(SnowContext *s, IDWTELEM *buf, int plane_index, int add, int mb_y){
+static av_always_inline void predict_slice(SnowContext *s, uint8_t *tmp, IDWTELEM *buf, int plane_index, int add, int mb_y){
     Plane *p= &s->plane[plane_index];
     const int mb_w= s->b_width  << s->block_max_depth;
     const int mb_h= s->b_height << s->block_max_depth;
@@ -2168,7 +2174,7 @@ static av_always_inline void predict_slice(SnowContext *s, IDWTELEM *buf, int pl
     }
 
     for(mb_x=0; mb_x<=mb_w; mb_x++){
-        add_yblock(s, 0, NULL, buf, dst8, obmc,
+        add_yblock(s, 0, NULL, tmp, buf, dst8, obmc,
                    block_w*mb_x - block_w/2,
                    block_w*mb_y - block_w/2,
                    block_w, block_w,
@@ -2179,11 +2185,11 @@ static av_always_inline void predict_slice(SnowContext *s, IDWTELEM *buf, int pl
     }
 }
 
-static av_always_inline void predict_plane(SnowContext *s, IDWTELEM *buf, int plane_index, int add){
+static av_always_inline void predict_plane(SnowContext *s, uint8_t *tmp, IDWTELEM *buf, int plane_index, int add){
     const int mb_h= s->b_height << s->block_max_depth;
     int mb_y;
     for(mb_y=0; mb_y<=mb_h; mb_y++)
-        predict_slice(s, buf, plane_index, add, mb_y);
+        predict_slice(s, tmp, buf, plane_index, add, mb_y);
 }
 
 static void dequantize_slice_buffered(SnowContext *s, slice_buffer * sb, SubBand *b, IDWTELEM *src, int stride, int start_y, int end_y){
@@ -2431,6 +2437,8 @@ static int common_init_after_header(AVCodecContext *avctx){
     for(plane_index=0; plane_index<3; plane_index++){
         int w= s->avctx->width;
         int h= s->avctx->height;
+        DWTELEM  *dwt_buffer = s->plane[plane_index]. dwt_buffer ? s->plane[plane_index]. dwt_buffer : s->spatial_dwt_buffer;
+        IDWTELEM *idwt_buffer= s->plane[plane_index].idwt_buffer ? s->plane[plane_index].idwt_buffer : s->spatial_idwt_buffer;
 
         if(plane_index){
             w>>= s->chroma_h_shift;
@@ -2443,7 +2451,7 @@ static int common_init_after_header(AVCodecContext *avctx){
             for(orientation=level ? 1 : 0; orientation<4; orientation++){
                 SubBand *b= &s->plane[plane_index].band[level][orientation];
 
-                b->buf= s->spatial_dwt_buffer;
+                b->buf= dwt_buffer;
                 b->level= level;
                 b->stride= s->plane[plane_index].width << (s->spatial_decomposition_count - level);
                 b->width = (w + !(orientation&1))>>1;
@@ -2461,7 +2469,7 @@ static int common_init_after_header(AVCodecContext *avctx){
                     b->buf += b->stride>>1;
                     b->buf_y_offset = b->stride_line >> 1;
                 }
-                b->ibuf= s->spatial_idwt_buffer + (b->buf - s->spatial_dwt_buffer);
+                b->ibuf= idwt_buffer + (b->buf - dwt_buffer);
 
                 if(level)
                     b->parent= &s->plane[plane_index].band[level-1][orientation];
@@ -2516,7 +2524,7 @@ static void dequantize_all(SnowContext *s, Plane *p, IDWTELEM *buffer, int width
     for(level=0; level<s->spatial_decomposition_count; level++){
         for(orientation=level ? 1 : 0; orientation<4; orientation++){
             SubBand *b= &p->band[level][orientation];
-            IDWTELEM *dst= buffer + (b->ibuf - s->spatial_idwt_buffer);
+            IDWTELEM *dst= buffer + (b->ibuf - p->idwt_buffer);
 
             dequantize(s, b, dst, b->stride);
         }
@@ -2540,8 +2548,8 @@ static void dwt_quantize(SnowContext *s, Plane *p, DWTELEM *buffer, int width, i
     for(level=0; level<s->spatial_decomposition_count; level++){
         for(orientation=level ? 1 : 0; orientation<4; orientation++){
             SubBand *b= &p->band[level][orientation];
-            IDWTELEM *dst= best_dequant + (b->ibuf - s->spatial_idwt_buffer);
-             DWTELEM *src=       buffer + (b-> buf - s->spatial_dwt_buffer);
+            IDWTELEM *dst= best_dequant + (b->ibuf - p->idwt_buffer);
+             DWTELEM *src=       buffer + (b-> buf - p->dwt_buffer);
             assert(src == b->buf); // code does not depend on this but it is true currently
 
             quantize(s, b, dst, src, b->stride, s->qbias);
@@ -2553,15 +2561,15 @@ static void dwt_quantize(SnowContext *s, Plane *p, DWTELEM *buffer, int width, i
         for(level=0; level<s->spatial_decomposition_count; level++){
             for(orientation=level ? 1 : 0; orientation<4; orientation++){
                 SubBand *b= &p->band[level][orientation];
-                IDWTELEM *dst= idwt2_buffer + (b->ibuf - s->spatial_idwt_buffer);
-                IDWTELEM *best_dst= best_dequant + (b->ibuf - s->spatial_idwt_buffer);
+                IDWTELEM *dst= idwt2_buffer + (b->ibuf - p->idwt_buffer);
+                IDWTELEM *best_dst= best_dequant + (b->ibuf - p->idwt_buffer);
 
                 for(ys= 0; ys<Q2_STEP; ys++){
                     for(xs= 0; xs<Q2_STEP; xs++){
                         memcpy(idwt2_buffer, best_dequant, height * stride * sizeof(IDWTELEM));
                         dequantize_all(s, p, idwt2_buffer, width, height);
                         ff_spatial_idwt(idwt2_buffer, width, height, stride, type, s->spatial_decomposition_count);
-                        find_sse(s, p, best_score, score_stride, idwt2_buffer, s->spatial_idwt_buffer, level, orientation);
+                        find_sse(s, p, best_score, score_stride, idwt2_buffer, p->idwt_buffer, level, orientation);
                         memcpy(idwt2_buffer, best_dequant, height * stride * sizeof(IDWTELEM));
                         for(y=ys; y<b->height; y+= Q2_STEP){
                             for(x=xs; x<b->width; x+= Q2_STEP){
@@ -2572,7 +2580,7 @@ static void dwt_quantize(SnowContext *s, Plane *p, DWTELEM *buffer, int width, i
                         }
                         dequantize_all(s, p, idwt2_buffer, width, height);
                         ff_spatial_idwt(idwt2_buffer, width, height, stride, type, s->spatial_decomposition_count);
-                        find_sse(s, p, score, score_stride, idwt2_buffer, s->spatial_idwt_buffer, level, orientation);
+                        find_sse(s, p, score, score_stride, idwt2_buffer, p->idwt_buffer, level, orientation);
                         for(y=ys; y<b->height; y+= Q2_STEP){
                             for(x=xs; x<b->width; x+= Q2_STEP){
                                 int score_idx= x/Q2_STEP + (y/Q2_STEP)*score_stride;
@@ -2589,7 +2597,7 @@ static void dwt_quantize(SnowContext *s, Plane *p, DWTELEM *buffer, int width, i
             }
         }
     }
-    memcpy(s->spatial_idwt_buffer, best_dequant, height * stride * sizeof(IDWTELEM)); //FIXME work with that directly instead of copy at the end
+    memcpy(p->idwt_buffer, best_dequant, height * stride * sizeof(IDWTELEM)); //FIXME work with that directly instead of copy at the end
 }
 
 #endif /* QUANTIZE2==1 */
@@ -2737,10 +2745,112 @@ static av_cold void common_end(SnowContext *s){
 
 static av_cold int decode_init(AVCodecContext *avctx)
 {
+    SnowContext *s = avctx->priv_data;
+    int plane_index;
+
     avctx->pix_fmt= PIX_FMT_YUV420P;
 
     common_init(avctx);
 
+    for(plane_index=0; plane_index<3; plane_index++){
+        s->plane_scratchbuf[plane_index]= av_malloc(s->mconly_picture.linesize[0]*7*MB_SIZE);
+        if(!s->plane_scratchbuf[plane_index])
+            return AVERROR(ENOMEM);
+    }
+
+    return 0;
+}
+
+/**
+ * Reconstructs one plane from its unpacked coefficients: dequantization,
+ * inverse DWT and OBMC prediction, stripe by stripe. Each plane has its own
+ * slice buffer and scratch buffer, so the planes can be done concurrently.
+ */
+static int decode_plane_thread(AVCodecContext *avctx, void *arg, int plane_index, int threadnr){
+    SnowContext *s = avctx->priv_data;
+    Plane *p= &s->plane[plane_index];
+    slice_buffer *sb= &s->sb[plane_index];
+    int w= p->width;
+    int h= p->height;
+    int x;
+    int level, orientation;
+    int decode_state[MAX_DECOMPOSITIONS][4][1]; /* Stored state info for unpack_coeffs. 1 variable per instance. */
+    const int mb_h= s->b_height << s->block_max_depth;
+    const int block_size = MB_SIZE >> s->block_max_depth;
+    const int block_w    = plane_index ? block_size/2 : block_size;
+    int mb_y;
+    DWTCompose cs[MAX_DECOMPOSITIONS];
+    int yd=0, yq=0;
+    int y;
+    int end_y;
+
+    ff_spatial_idwt_buffered_init(cs, sb, w, h, 1, s->spatial_decomposition_type, s->spatial_decomposition_count);
+    for(mb_y=0; mb_y<=mb_h; mb_y++){
+
+        int slice_starty = block_w*mb_y;
+        int slice_h = block_w*(mb_y+1);
+        if (!(s->keyframe || s->avctx->debug&512)){
+            slice_starty = FFMAX(0, slice_starty - (block_w >> 1));
+            slice_h -= (block_w >> 1);
+        }
+
+        for(level=0; level<s->spatial_decomposition_count; level++){
+            for(orientation=level ? 1 : 0; orientation<4; orientation++){
+                SubBand *b= &p->band[level][orientation];
+                int start_y;
+                int end_y;
+                int our_mb_start = mb_y;
+                int our_mb_end = (mb_y + 1);
+                const int extra= 3;
+                start_y = (mb_y ? ((block_w * our_mb_start) >> (s->spatial_decomposition_count - level)) + s->spatial_decomposition_count - level + extra: 0);
+                end_y = (((block_w * our_mb_end) >> (s->spatial_decomposition_count - level)) + s->spatial_decomposition_count - level + extra);
+                if (!(s->keyframe || s->avctx->debug&512)){
+                    start_y = FFMAX(0, start_y - (block_w >> (1+s->spatial_decomposition_count - level)));
+                    end_y = FFMAX(0, end_y - (block_w >> (1+s->spatial_decomposition_count - level)));
+                }
+                start_y = FFMIN(b->height, start_y);
+                end_y = FFMIN(b->height, end_y);
+
+                if (start_y != end_y){
+                    if (orientation == 0){
+                        SubBand * correlate_band = &p->band[0][0];
+                        int correlate_end_y = FFMIN(b->height, end_y + 1);
+                        int correlate_start_y = FFMIN(b->height, (start_y ? start_y + 1 : 0));
+                        decode_subband_slice_buffered(s, correlate_band, sb, correlate_start_y, correlate_end_y, decode_state[0][0]);
+                        correlate_slice_buffered(s, sb, correlate_band, correlate_band->ibuf, correlate_band->stride, 1, 0, correlate_start_y, correlate_end_y);
+                        dequantize_slice_buffered(s, sb, correlate_band, correlate_band->ibuf, correlate_band->stride, start_y, end_y);
+                    }
+                    else
+                        decode_subband_slice_buffered(s, b, sb, start_y, end_y, decode_state[level][orientation]);
+                }
+            }
+        }
+
+        for(; yd<slice_h; yd+=4){
+            ff_spatial_idwt_buffered_slice(&s->dsp, cs, sb, w, h, 1, s->spatial_decomposition_type, s->spatial_decomposition_count, yd);
+        }
+
+        if(s->qlog == LOSSLESS_QLOG){
+            for(; yq<slice_h && yq<h; yq++){
+                IDWTELEM * line = slice_buffer_get_line(sb, yq);
+                for(x=0; x<w; x++){
+                    line[x] <<= FRAC_BITS;
+                }
+            }
+        }
+
+        predict_slice_buffered(s, sb, s->plane_scratchbuf[plane_index], s->spatial_idwt_buffer, plane_index, 1, mb_y);
+
+        y = FFMIN(p->height, slice_starty);
+        end_y = FFMIN(p->height, slice_h);
+        while(y < end_y)
+            slice_buffer_release(sb, y++);
+    }
+
+    slice_buffer_flush(sb);
+
+    emms_c();
+
     return 0;
 }
 
@@ -2761,12 +2871,13 @@ static int decode_frame(AVCodecContext *avctx, void *data, int *data_size, AVPac
         return -1;
     common_init_after_header(avctx);
 
-    // realloc slice buffer for the case that spatial_decomposition_count changed
-    slice_buffer_destroy(&s->sb);
-    slice_buffer_init(&s->sb, s->plane[0].height, (MB_SIZE >> s->block_max_depth) + s->spatial_decomposition_count * 8 + 1, s->plane[0].width, s->spatial_idwt_buffer);
-
     for(plane_index=0; plane_index<3; plane_index++){
         Plane *p= &s->plane[plane_index];
+
+        // realloc slice buffer for the case that spatial_decomposition_count changed
+        slice_buffer_destroy(&s->sb[plane_index]);
+        slice_buffer_init(&s->sb[plane_index], s->plane[0].height, (MB_SIZE >> s->block_max_depth) + s->spatial_decomposition_count * 8 + 1, s->plane[0].width, s->spatial_idwt_buffer);
+
         p->fast_mc= p->diag_mc && p->htaps==6 && p->hcoeff[0]==40
                                               && p->hcoeff[1]==-10
                                               && p->hcoeff[2]==2;
@@ -2787,11 +2898,10 @@ static int decode_frame(AVCodecContext *avctx, void *data, int *data_size, AVPac
         int w= p->width;
         int h= p->height;
         int x, y;
-        int decode_state[MAX_DECOMPOSITIONS][4][1]; /* Stored state info for unpack_coeffs. 1 variable per instance. */
 
         if(s->avctx->debug&2048){
             memset(s->spatial_dwt_buffer, 0, sizeof(DWTELEM)*w*h);
-            predict_plane(s, s->spatial_idwt_buffer, plane_index, 1);
+            predict_plane(s, s->scratchbuf, s->spatial_idwt_buffer, plane_index, 1);
 
             for(y=0; y<h; y++){
                 for(x=0; x<w; x++){
@@ -2801,93 +2911,17 @@ static int decode_frame(AVCodecContext *avctx, void *data, int *data_size, AVPac
             }
         }
 
-        {
         for(level=0; level<s->spatial_decomposition_count; level++){
             for(orientation=level ? 1 : 0; orientation<4; orientation++){
                 SubBand *b= &p->band[level][orientation];
                 unpack_coeffs(s, b, b->parent, orientation);
             }
         }
-        }
-
-        {
-        const int mb_h= s->b_height << s->block_max_depth;
-        const int block_size = MB_SIZE >> s->block_max_depth;
-        const int block_w    = plane_index ? block_size/2 : block_size;
-        int mb_y;
-        DWTCompose cs[MAX_DECOMPOSITIONS];
-        int yd=0, yq=0;
-        int y;
-        int end_y;
-
-        ff_spatial_idwt_buffered_init(cs, &s->sb, w, h, 1, s->spatial_decomposition_type, s->spatial_decomposition_count);
-        for(mb_y=0; mb_y<=mb_h; mb_y++){
-
-            int slice_starty = block_w*mb_y;
-            int slice_h = block_w*(mb_y+1);
-            if (!(s->keyframe || s->avctx->debug&512)){
-                slice_starty = FFMAX(0, slice_starty - (block_w >> 1));
-                slice_h -= (block_w >> 1);
-            }
-
-            for(level=0; level<s->spatial_decomposition_count; level++){
-                for(orientation=level ? 1 : 0; orientation<4; orientation++){
-                    SubBand *b= &p->band[level][orientation];
-                    int start_y;
-                    int end_y;
-                    int our_mb_start = mb_y;
-                    int our_mb_end = (mb_y + 1);
-                    const int extra= 3;
-                    start_y = (mb_y ? ((block_w * our_mb_start) >> (s->spatial_decomposition_count - level)) + s->spatial_decomposition_count - level + extra: 0);
-                    end_y = (((block_w * our_mb_end) >> (s->spatial_decomposition_count - level)) + s->spatial_decomposition_count - level + extra);
-                    if (!(s->keyframe || s->avctx->debug&512)){
-                        start_y = FFMAX(0, start_y - (block_w >> (1+s->spatial_decomposition_count - level)));
-                        end_y = FFMAX(0, end_y - (block_w >> (1+s->spatial_decomposition_count - level)));
-                    }
-                    start_y = FFMIN(b->height, start_y);
-                    end_y = FFMIN(b->height, end_y);
-
-                    if (start_y != end_y){
-                        if (orientation == 0){
-                            SubBand * correlate_band = &p->band[0][0];
-                            int correlate_end_y = FFMIN(b->height, end_y + 1);
-                            int correlate_start_y = FFMIN(b->height, (start_y ? start_y + 1 : 0));
-                            decode_subband_slice_buffered(s, correlate_band, &s->sb, correlate_start_y, correlate_end_y, decode_state[0][0]);
-                            correlate_slice_buffered(s, &s->sb, correlate_band, correlate_band->ibuf, correlate_band->stride, 1, 0, correlate_start_y, correlate_end_y);
-                            dequantize_slice_buffered(s, &s->sb, correlate_band, correlate_band->ibuf, correlate_band->stride, start_y, end_y);
-                        }
-                        else
-                            decode_subband_slice_buffered(s, b, &s->sb, start_y, end_y, decode_state[level][orientation]);
-                    }
-                }
-            }
-
-            for(; yd<slice_h; yd+=4){
-                ff_spatial_idwt_buffered_slice(&s->dsp, cs, &s->sb, w, h, 1, s->spatial_decomposition_type, s->spatial_decomposition_count, yd);
-            }
-
-            if(s->qlog == LOSSLESS_QLOG){
-                for(; yq<slice_h && yq<h; yq++){
-                    IDWTELEM * line = slice_buffer_get_line(&s->sb, yq);
-                    for(x=0; x<w; x++){
-                        line[x] <<= FRAC_BITS;
-                    }
-                }
-            }
-
-            predict_slice_buffered(s, &s->sb, s->spatial_idwt_buffer, plane_index, 1, mb_y);
-
-            y = FFMIN(p->height, slice_starty);
-            end_y = FFMIN(p->height, slice_h);
-            while(y < end_y)
-                slice_buffer_release(&s->sb, y++);
-        }
-
-        slice_buffer_flush(&s->sb);
-        }
-
     }
 
+    /* the range coder is done, the planes are independent from here on */
+    avctx->execute2(avctx, decode_plane_thread, NULL, NULL, 3);
+
     emms_c();
 
     release_buffer(avctx);
@@ -2908,8 +2942,12 @@ static int decode_frame(AVCodecContext *avctx, void *data, int *data_size, AVPac
 static av_cold int decode_end(AVCodecContext *avctx)
 {
     SnowContext *s = avctx->priv_data;
+    int plane_index;
 
-    slice_buffer_destroy(&s->sb);
+    for(plane_index=0; plane_index<3; plane_index++){
+        slice_buffer_destroy(&s->sb[plane_index]);
+        av_freep(&s->plane_scratchbuf[plane_index]);
+    }
 
     common_end(s);
 
@@ -3024,6 +3062,39 @@ static av_cold int encode_init(AVCodecContext *avctx)
             s->ref_mvs[i]= av_mallocz(size*sizeof(int16_t[2]));
             s->ref_scores[i]= av_mallocz(size*sizeof(uint32_t));
         }
+
+        if(avctx->thread_count > 1){
+            s->thread_context= av_mallocz(avctx->thread_count*sizeof(SnowContext*));
+            if(!s->thread_context)
+                return AVERROR(ENOMEM);
+            s->thread_context[0]= s;
+            for(i=1; i<avctx->thread_count; i++){
+                SnowContext *t= av_mallocz(sizeof(SnowContext));
+                if(!t)
+                    return AVERROR(ENOMEM);
+                s->thread_context[i]= t;
+                t->scratchbuf= av_malloc(s->mconly_picture.linesize[0]*7*MB_SIZE);
+                t->m.obmc_scratchpad= av_mallocz(MB_SIZE*MB_SIZE*12*sizeof(uint32_t));
+                if(!t->scratchbuf || !t->m.obmc_scratchpad)
+                    return AVERROR(ENOMEM);
+            }
+        }
+    }
+
+    /* each plane gets its own wavelet buffers so that the planes can be coded concurrently */
+    s->plane[0]. dwt_buffer= s->spatial_dwt_buffer;
+    s->plane[0].idwt_buffer= s->spatial_idwt_buffer;
+    for(plane_index=1; plane_index<3; plane_index++){
+        int size= (avctx->width >> s->chroma_h_shift) * (avctx->height >> s->chroma_v_shift);
+        s->plane[plane_index]. dwt_buffer= av_mallocz(size*sizeof(DWTELEM));
+        s->plane[plane_index].idwt_buffer= av_mallocz(size*sizeof(IDWTELEM));
+        if(!s->plane[plane_index].dwt_buffer || !s->plane[plane_index].idwt_buffer)
+            return AVERROR(ENOMEM);
+    }
+    for(plane_index=0; plane_index<3; plane_index++){
+        s->plane_scratchbuf[plane_index]= av_malloc(s->mconly_picture.linesize[0]*7*MB_SIZE);
+        if(!s->plane_scratchbuf[plane_index])
+            return AVERROR(ENOMEM);
     }
 
     return 0;
@@ -3377,7 +3448,7 @@ static int get_dc(SnowContext *s, int mb_x, int mb_y, int plane_index){
         int x= block_w*mb_x2 + block_w/2;
         int y= block_w*mb_y2 + block_w/2;
 
-        add_yblock(s, 0, NULL, dst + ((i&1)+(i>>1)*obmc_stride)*block_w, NULL, obmc,
+        add_yblock(s, 0, NULL, s->scratchbuf, dst + ((i&1)+(i>>1)*obmc_stride)*block_w, NULL, obmc,
                     x, y, block_w, block_w, w, h, obmc_stride, ref_stride, obmc_stride, mb_x2, mb_y2, 0, 0, plane_index);
 
         for(y2= FFMAX(y, 0); y2<FFMIN(h, y+block_w); y2++){
@@ -3565,7 +3636,7 @@ static int get_4block_rd(SnowContext *s, int mb_x, int mb_y, int plane_index){
         int x= block_w*mb_x2 + block_w/2;
         int y= block_w*mb_y2 + block_w/2;
 
-        add_yblock(s, 0, NULL, zero_dst, dst, obmc,
+        add_yblock(s, 0, NULL, s->scratchbuf, zero_dst, dst, obmc,
                    x, y, block_w, block_w, w, h, /*dst_stride*/0, ref_stride, obmc_stride, mb_x2, mb_y2, 1, 1, plane_index);
 
         //FIXME find a cleaner/simpler way to skip the outside stuff
@@ -3849,12 +3920,180 @@ static av_always_inline int check_4block_inter(SnowContext *s, int mb_x, int mb_
     }
 }
 
-static void iterative_me(SnowContext *s){
-    int pass, mb_x, mb_y;
+/**
+ * Searches the best prediction of one block, given the current predictions of its neighbors.
+ * Only the block itself is changed, so blocks at least 3 apart horizontally or 2
+ * vertically can be searched concurrently; their neighbors are updated by the caller.
+ */
+static void iterative_me_block(SnowContext *s, int mb_x, int mb_y, int pass){
     const int b_width = s->b_width  << s->block_max_depth;
     const int b_height= s->b_height << s->block_max_depth;
     const int b_stride= b_width;
     int color[3];
+    int dia_change, i, j, ref;
+    int best_rd= INT_MAX, ref_rd;
+    BlockNode backup, ref_b;
+    const int index= mb_x + mb_y * b_stride;
+    BlockNode *block= &s->block[index];
+    BlockNode *tb =                   mb_y            ? &s->block[index-b_stride  ] : NULL;
+    BlockNode *lb = mb_x                              ? &s->block[index         -1] : NULL;
+    BlockNode *rb = mb_x+1<b_width                    ? &s->block[index         +1] : NULL;
+    BlockNode *bb =                   mb_y+1<b_height ? &s->block[index+b_stride  ] : NULL;
+    const int b_w= (MB_SIZE >> s->block_max_depth);
+    uint8_t obmc_edged[b_w*2][b_w*2];
+
+    if(pass && (block->type & BLOCK_OPT))
+        return;
+    block->type |= BLOCK_OPT;
+
+    backup= *block;
+
+    if(!s->me_cache_generation)
+        memset(s->me_cache, 0, sizeof(s->me_cache));
+    s->me_cache_generation += 1<<22;
+
+    //FIXME precalculate
+    {
+        int x, y;
+        memcpy(obmc_edged, obmc_tab[s->block_max_depth], b_w*b_w*4);
+        if(mb_x==0)
+            for(y=0; y<b_w*2; y++)
+                memset(obmc_edged[y], obmc_edged[y][0] + obmc_edged[y][b_w-1], b_w);
+        if(mb_x==b_stride-1)
+            for(y=0; y<b_w*2; y++)
+                memset(obmc_edged[y]+b_w, obmc_edged[y][b_w] + obmc_edged[y][b_w*2-1], b_w);
+        if(mb_y==0){
+            for(x=0; x<b_w*2; x++)
+                obmc_edged[0][x] += obmc_edged[b_w-1][x];
+            for(y=1; y<b_w; y++)
+                memcpy(obmc_edged[y], obmc_edged[0], b_w*2);
+        }
+        if(mb_y==b_height-1){
+            for(x=0; x<b_w*2; x++)
+                obmc_edged[b_w*2-1][x] += obmc_edged[b_w][x];
+            for(y=b_w; y<b_w*2-1; y++)
+                memcpy(obmc_edged[y], obmc_edged[b_w*2-1], b_w*2);
+        }
+    }
+
+    //skip stuff outside the picture
+    if(mb_x==0 || mb_y==0 || mb_x==b_width-1 || mb_y==b_height-1){
+        uint8_t *src= s->  input_picture.data[0];
+        uint8_t *dst= s->current_picture.data[0];
+        const int stride= s->current_picture.linesize[0];
+        const int block_w= MB_SIZE >> s->block_max_depth;
+        const int sx= block_w*mb_x - block_w/2;
+        const int sy= block_w*mb_y - block_w/2;
+        const int w= s->plane[0].width;
+        const int h= s->plane[0].height;
+        int y;
+
+        for(y=sy; y<0; y++)
+            memcpy(dst + sx + y*stride, src + sx + y*stride, block_w*2);
+        for(y=h; y<sy+block_w*2; y++)
+            memcpy(dst + sx + y*stride, src + sx + y*stride, block_w*2);
+        if(sx<0){
+            for(y=sy; y<sy+block_w*2; y++)
+                memcpy(dst + sx + y*stride, src + sx + y*stride, -sx);
+        }
+        if(sx+block_w*2 > w){
+            for(y=sy; y<sy+block_w*2; y++)
+                memcpy(dst + w + y*stride, src + w + y*stride, sx+block_w*2 - w);
+        }
+    }
+
+    // intra(black) = neighbors' contribution to the current block
+    for(i=0; i<3; i++)
+        color[i]= get_dc(s, mb_x, mb_y, i);
+
+    // get previous score (cannot be cached due to OBMC)
+    if(pass > 0 && (block->type&BLOCK_INTRA)){
+        int color0[3]= {block->color[0], block->color[1], block->color[2]};
+        check_block(s, mb_x, mb_y, color0, 1, *obmc_edged, &best_rd);
+    }else
+        check_block_inter(s, mb_x, mb_y, block->mx, block->my, *obmc_edged, &best_rd);
+
+    ref_b= *block;
+    ref_rd= best_rd;
+    for(ref=0; ref < s->ref_frames; ref++){
+        int16_t (*mvr)[2]= &s->ref_mvs[ref][index];
+        if(s->ref_scores[ref][index] > s->ref_scores[ref_b.ref][index]*3/2) //FIXME tune threshold
+            continue;
+        block->ref= ref;
+        best_rd= INT_MAX;
+
+        check_block_inter(s, mb_x, mb_y, mvr[0][0], mvr[0][1], *obmc_edged, &best_rd);
+        check_block_inter(s, mb_x, mb_y, 0, 0, *obmc_edged, &best_rd);
+        if(tb)
+            check_block_inter(s, mb_x, mb_y, mvr[-b_stride][0], mvr[-b_stride][1], *obmc_edged, &best_rd);
+        if(lb)
+            check_block_inter(s, mb_x, mb_y, mvr[-1][0], mvr[-1][1], *obmc_edged, &best_rd);
+        if(rb)
+            check_block_inter(s, mb_x, mb_y, mvr[1][0], mvr[1][1], *obmc_edged, &best_rd);
+        if(bb)
+            check_block_inter(s, mb_x, mb_y, mvr[b_stride][0], mvr[b_stride][1], *obmc_edged, &best_rd);
+
+        /* fullpel ME */
+        //FIXME avoid subpel interpolation / round to nearest integer
+        do{
+            dia_change=0;
+            for(i=0; i<FFMAX(s->avctx->dia_size, 1); i++){
+                for(j=0; j<i; j++){
+                    dia_change |= check_block_inter(s, mb_x, mb_y, block->mx+4*(i-j), block->my+(4*j), *obmc_edged, &best_rd);
+                    dia_change |= check_block_inter(s, mb_x, mb_y, block->mx-4*(i-j), block->my-(4*j), *obmc_edged, &best_rd);
+                    dia_change |= check_block_inter(s, mb_x, mb_y, block->mx+4*(i-j), block->my-(4*j), *obmc_edged, &best_rd);
+                    dia_change |= check_block_inter(s, mb_x, mb_y, block->mx-4*(i-j), block->my+(4*j), *obmc_edged, &best_rd);
+                }
+            }
+        }while(dia_change);
+        /* subpel ME */
+        do{
+            static const int square[8][2]= {{+1, 0},{-1, 0},{ 0,+1},{ 0,-1},{+1,+1},{-1,-1},{+1,-1},{-1,+1},};
+            dia_change=0;
+            for(i=0; i<8; i++)
+                dia_change |= check_block_inter(s, mb_x, mb_y, block->mx+square[i][0], block->my+square[i][1], *obmc_edged, &best_rd);
+        }while(dia_change);
+        //FIXME or try the standard 2 pass qpel or similar
+
+        mvr[0][0]= block->mx;
+        mvr[0][1]= block->my;
+        if(ref_rd > best_rd){
+            ref_rd= best_rd;
+            ref_b= *block;
+        }
+    }
+    best_rd= ref_rd;
+    *block= ref_b;
+#if 1
+    check_block(s, mb_x, mb_y, color, 1, *obmc_edged, &best_rd);
+    //FIXME RD style color selection
+#endif
+    if(!same_block(block, &backup))
+        block->type |= BLOCK_CHANGED;
+}
+
+static int iterative_me_thread(AVCodecContext *avctx, void *arg, int jobnr, int threadnr){
+    SnowContext *f= avctx->priv_data;
+    SnowContext *s= f->thread_context ? f->thread_context[threadnr] : f;
+    const int b_width= s->b_width << s->block_max_depth;
+    const int mb_y= 2*jobnr + f->me_phase/3;
+    int mb_x;
+
+    /* start every row with an empty cache so the result does not depend on
+     * which rows the thread searched before */
+    memset(s->me_cache, 0, sizeof(s->me_cache));
+    s->me_cache_generation= 0;
+
+    for(mb_x= f->me_phase%3; mb_x<b_width; mb_x+=3)
+        iterative_me_block(s, mb_x, mb_y, f->me_pass);
+    return 0;
+}
+
+static void iterative_me(SnowContext *s){
+    int pass, mb_x, mb_y, i;
+    const int b_width = s->b_width  << s->block_max_depth;
+    const int b_height= s->b_height << s->block_max_depth;
+    const int b_stride= b_width;
 
     {
         RangeCoder r = s->c;
@@ -3867,164 +4106,51 @@ static void iterative_me(SnowContext *s){
         memcpy(s->block_state, state, sizeof(s->block_state));
     }
 
+    if(s->thread_context){
+        for(i=1; i<s->avctx->thread_count; i++){
+            SnowContext *t= s->thread_context[i];
+            uint8_t *scratchbuf= t->scratchbuf;
+            uint8_t *obmc_scratchpad= t->m.obmc_scratchpad;
+            memcpy(t, s, sizeof(SnowContext));
+            t->scratchbuf= scratchbuf;
+            t->m.obmc_scratchpad= obmc_scratchpad;
+        }
+    }
+
     for(pass=0; pass<25; pass++){
         int change= 0;
 
-        for(mb_y= 0; mb_y<b_height; mb_y++){
-            for(mb_x= 0; mb_x<b_width; mb_x++){
-                int dia_change, i, j, ref;
-                int best_rd= INT_MAX, ref_rd;
-                BlockNode backup, ref_b;
-                const int index= mb_x + mb_y * b_stride;
-                BlockNode *block= &s->block[index];
-                BlockNode *tb =                   mb_y            ? &s->block[index-b_stride  ] : NULL;
-                BlockNode *lb = mb_x                              ? &s->block[index         -1] : NULL;
-                BlockNode *rb = mb_x+1<b_width                    ? &s->block[index         +1] : NULL;
-                BlockNode *bb =                   mb_y+1<b_height ? &s->block[index+b_stride  ] : NULL;
-                BlockNode *tlb= mb_x           && mb_y            ? &s->block[index-b_stride-1] : NULL;
-                BlockNode *trb= mb_x+1<b_width && mb_y            ? &s->block[index-b_stride+1] : NULL;
-                BlockNode *blb= mb_x           && mb_y+1<b_height ? &s->block[index+b_stride-1] : NULL;
-                BlockNode *brb= mb_x+1<b_width && mb_y+1<b_height ? &s->block[index+b_stride+1] : NULL;
-                const int b_w= (MB_SIZE >> s->block_max_depth);
-                uint8_t obmc_edged[b_w*2][b_w*2];
-
-                if(pass && (block->type & BLOCK_OPT))
-                    continue;
-                block->type |= BLOCK_OPT;
-
-                backup= *block;
-
-                if(!s->me_cache_generation)
-                    memset(s->me_cache, 0, sizeof(s->me_cache));
-                s->me_cache_generation += 1<<22;
-
-                //FIXME precalculate
-                {
-                    int x, y;
-                    memcpy(obmc_edged, obmc_tab[s->block_max_depth], b_w*b_w*4);
-                    if(mb_x==0)
-                        for(y=0; y<b_w*2; y++)
-                            memset(obmc_edged[y], obmc_edged[y][0] + obmc_edged[y][b_w-1], b_w);
-                    if(mb_x==b_stride-1)
-                        for(y=0; y<b_w*2; y++)
-                            memset(obmc_edged[y]+b_w, obmc_edged[y][b_w] + obmc_edged[y][b_w*2-1], b_w);
-                    if(mb_y==0){
-                        for(x=0; x<b_w*2; x++)
-                            obmc_edged[0][x] += obmc_edged[b_w-1][x];
-                        for(y=1; y<b_w; y++)
-                            memcpy(obmc_edged[y], obmc_edged[0], b_w*2);
-                    }
-                    if(mb_y==b_height-1){
-                        for(x=0; x<b_w*2; x++)
-                            obmc_edged[b_w*2-1][x] += obmc_edged[b_w][x];
-                        for(y=b_w; y<b_w*2-1; y++)
-                            memcpy(obmc_edged[y], obmc_edged[b_w*2-1], b_w*2);
-                    }
-                }
-
-                //skip stuff outside the picture
-                if(mb_x==0 || mb_y==0 || mb_x==b_width-1 || mb_y==b_height-1){
-                    uint8_t *src= s->  input_picture.data[0];
-                    uint8_t *dst= s->current_picture.data[0];
-                    const int stride= s->current_picture.linesize[0];
-                    const int block_w= MB_SIZE >> s->block_max_depth;
-                    const int sx= block_w*mb_x - block_w/2;
-                    const int sy= block_w*mb_y - block_w/2;
-                    const int w= s->plane[0].width;
-                    const int h= s->plane[0].height;
-                    int y;
-
-                    for(y=sy; y<0; y++)
-                        memcpy(dst + sx + y*stride, src + sx + y*stride, block_w*2);
-                    for(y=h; y<sy+block_w*2; y++)
-                        memcpy(dst + sx + y*stride, src + sx + y*stride, block_w*2);
-                    if(sx<0){
-                        for(y=sy; y<sy+block_w*2; y++)
-                            memcpy(dst + sx + y*stride, src + sx + y*stride, -sx);
-                    }
-                    if(sx+block_w*2 > w){
-                        for(y=sy; y<sy+block_w*2; y++)
-                            memcpy(dst + w + y*stride, src + w + y*stride, sx+block_w*2 - w);
-                    }
-                }
-
-                // intra(black) = neighbors' contribution to the current block
-                for(i=0; i<3; i++)
-                    color[i]= get_dc(s, mb_x, mb_y, i);
-
-                // get previous score (cannot be cached due to OBMC)
-                if(pass > 0 && (block->type&BLOCK_INTRA)){
-                    int color0[3]= {block->color[0], block->color[1], block->color[2]};
-                    check_block(s, mb_x, mb_y, color0, 1, *obmc_edged, &best_rd);
-                }else
-                    check_block_inter(s, mb_x, mb_y, block->mx, block->my, *obmc_edged, &best_rd);
-
-                ref_b= *block;
-                ref_rd= best_rd;
-                for(ref=0; ref < s->ref_frames; ref++){
-                    int16_t (*mvr)[2]= &s->ref_mvs[ref][index];
-                    if(s->ref_scores[ref][index] > s->ref_scores[ref_b.ref][index]*3/2) //FIXME tune threshold
-                        continue;
-                    block->ref= ref;
-                    best_rd= INT_MAX;
-
-                    check_block_inter(s, mb_x, mb_y, mvr[0][0], mvr[0][1], *obmc_edged, &best_rd);
-                    check_block_inter(s, mb_x, mb_y, 0, 0, *obmc_edged, &best_rd);
-                    if(tb)
-                        check_block_inter(s, mb_x, mb_y, mvr[-b_stride][0], mvr[-b_stride][1], *obmc_edged, &best_rd);
-                    if(lb)
-                        check_block_inter(s, mb_x, mb_y, mvr[-1][0], mvr[-1][1], *obmc_edged, &best_rd);
-                    if(rb)
-                        check_block_inter(s, mb_x, mb_y, mvr[1][0], mvr[1][1], *obmc_edged, &best_rd);
-                    if(bb)
-                        check_block_inter(s, mb_x, mb_y, mvr[b_stride][0], mvr[b_stride][1], *obmc_edged, &best_rd);
-
-                    /* fullpel ME */
-                    //FIXME avoid subpel interpolation / round to nearest integer
-                    do{
-                        dia_change=0;
-                        for(i=0; i<FFMAX(s->avctx->dia_size, 1); i++){
-                            for(j=0; j<i; j++){
-                                dia_change |= check_block_inter(s, mb_x, mb_y, block->mx+4*(i-j), block->my+(4*j), *obmc_edged, &best_rd);
-                                dia_change |= check_block_inter(s, mb_x, mb_y, block->mx-4*(i-j), block->my-(4*j), *obmc_edged, &best_rd);
-                                dia_change |= check_block_inter(s, mb_x, mb_y, block->mx+4*(i-j), block->my-(4*j), *obmc_edged, &best_rd);
-                                dia_change |= check_block_inter(s, mb_x, mb_y, block->mx-4*(i-j), block->my+(4*j), *obmc_edged, &best_rd);
-                            }
+        /* 6 sets of blocks, each one searched in parallel, see iterative_me_block() */
+        s->me_pass= pass;
+        for(s->me_phase=0; s->me_phase<6; s->me_phase++){
+            s->avctx->execute2(s->avctx, iterative_me_thread, NULL, NULL, (b_height - s->me_phase/3 + 1)>>1);
+
+            for(mb_y= s->me_phase/3; mb_y<b_height; mb_y+=2){
+                for(mb_x= s->me_phase%3; mb_x<b_width; mb_x+=3){
+                    const int index= mb_x + mb_y * b_stride;
+                    BlockNode *block= &s->block[index];
+
+                    if(block->type & BLOCK_CHANGED){
+                        block->type &= ~BLOCK_CHANGED;
+                        if(mb_y){
+                            if(mb_x)
+                                s->block[index-b_stride-1].type &= ~BLOCK_OPT;
+                            s->block[index-b_stride].type &= ~BLOCK_OPT;
+                            if(mb_x+1<b_width)
+                                s->block[index-b_stride+1].type &= ~BLOCK_OPT;
+                        }
+                        if(mb_x           ) s->block[index         -1].type &= ~BLOCK_OPT;
+                        if(mb_x+1<b_width ) s->block[index         +1].type &= ~BLOCK_OPT;
+                        if(mb_y+1<b_height){
+                            if(mb_x)
+                                s->block[index+b_stride-1].type &= ~BLOCK_OPT;
+                            s->block[index+b_stride].type &= ~BLOCK_OPT;
+                            if(mb_x+1<b_width)
+                                s->block[index+b_stride+1].type &= ~BLOCK_OPT;
                         }
-                    }while(dia_change);
-                    /* subpel ME */
-                    do{
-                        static const int square[8][2]= {{+1, 0},{-1, 0},{ 0,+1},{ 0,-1},{+1,+1},{-1,-1},{+1,-1},{-1,+1},};
-                        dia_change=0;
-                        for(i=0; i<8; i++)
-                            dia_change |= check_block_inter(s, mb_x, mb_y, block->mx+square[i][0], block->my+square[i][1], *obmc_edged, &best_rd);
-                    }while(dia_change);
-                    //FIXME or try the standard 2 pass qpel or similar
-
-                    mvr[0][0]= block->mx;
-                    mvr[0][1]= block->my;
-                    if(ref_rd > best_rd){
-                        ref_rd= best_rd;
-                        ref_b= *block;
+                        change ++;
                     }
                 }
-                best_rd= ref_rd;
-                *block= ref_b;
-#if 1
-                check_block(s, mb_x, mb_y, color, 1, *obmc_edged, &best_rd);
-                //FIXME RD style color selection
-#endif
-                if(!same_block(block, &backup)){
-                    if(tb ) tb ->type &= ~BLOCK_OPT;
-                    if(lb ) lb ->type &= ~BLOCK_OPT;
-                    if(rb ) rb ->type &= ~BLOCK_OPT;
-                    if(bb ) bb ->type &= ~BLOCK_OPT;
-                    if(tlb) tlb->type &= ~BLOCK_OPT;
-                    if(trb) trb->type &= ~BLOCK_OPT;
-                    if(blb) blb->type &= ~BLOCK_OPT;
-                    if(brb) brb->type &= ~BLOCK_OPT;
-                    change ++;
-                }
             }
         }
         av_log(s->avctx, AV_LOG_ERROR, "pass:%d changed:%d\n", pass, change);
@@ -4034,6 +4160,8 @@ static void iterative_me(SnowContext *s){
 
     if(s->block_max_depth == 1){
         int change= 0;
+        memset(s->me_cache, 0, sizeof(s->me_cache));
+        s->me_cache_generation= 0;
         for(mb_y= 0; mb_y<b_height; mb_y+=2){
             for(mb_x= 0; mb_x<b_width; mb_x+=2){
                 int i;
@@ -4398,12 +4526,12 @@ static void calculate_visual_weight(SnowContext *s, Plane *p){
             IDWTELEM *ibuf= b->ibuf;
             int64_t error=0;
 
-            memset(s->spatial_idwt_buffer, 0, sizeof(*s->spatial_idwt_buffer)*width*height);
+            memset(p->idwt_buffer, 0, sizeof(*p->idwt_buffer)*width*height);
             ibuf[b->width/2 + b->height/2*b->stride]= 256*16;
-            ff_spatial_idwt(s->spatial_idwt_buffer, width, height, width, s->spatial_decomposition_type, s->spatial_decomposition_count);
+            ff_spatial_idwt(p->idwt_buffer, width, height, width, s->spatial_decomposition_type, s->spatial_decomposition_count);
             for(y=0; y<height; y++){
                 for(x=0; x<width; x++){
-                    int64_t d= s->spatial_idwt_buffer[x + y*width]*16;
+                    int64_t d= p->idwt_buffer[x + y*width]*16;
                     error += d*d;
                 }
             }
@@ -4413,6 +4541,113 @@ static void calculate_visual_weight(SnowContext *s, Plane *p){
     }
 }
 
+/**
+ * Computes the prediction residual of one plane and its wavelet transform.
+ */
+static int encode_plane_dwt_thread(AVCodecContext *avctx, void *arg, int plane_index, int threadnr){
+    SnowContext *s= avctx->priv_data;
+    AVFrame *pict= arg;
+    Plane *p= &s->plane[plane_index];
+    int w= p->width;
+    int h= p->height;
+    int x, y;
+
+    //FIXME optimize
+    if(pict->data[plane_index]) //FIXME gray hack
+        for(y=0; y<h; y++){
+            for(x=0; x<w; x++){
+                p->idwt_buffer[y*w + x]= pict->data[plane_index][y*pict->linesize[plane_index] + x]<<FRAC_BITS;
+            }
+        }
+    predict_plane(s, s->plane_scratchbuf[plane_index], p->idwt_buffer, plane_index, 0);
+
+    if(s->qlog == LOSSLESS_QLOG){
+        for(y=0; y<h; y++){
+            for(x=0; x<w; x++){
+                p->dwt_buffer[y*w + x]= (p->idwt_buffer[y*w + x] + (1<<(FRAC_BITS-1))-1)>>FRAC_BITS;
+            }
+        }
+    }else{
+        for(y=0; y<h; y++){
+            for(x=0; x<w; x++){
+                p->dwt_buffer[y*w + x]=p->idwt_buffer[y*w + x]<<ENCODER_EXTRA_BITS;
+            }
+        }
+    }
+
+    /*  if(QUANTIZE2)
+        dwt_quantize(s, p, p->dwt_buffer, w, h, w, s->spatial_decomposition_type);
+    else*/
+        ff_spatial_dwt(p->dwt_buffer, w, h, w, s->spatial_decomposition_type, s->spatial_decomposition_count);
+    return 0;
+}
+
+static int encode_plane_quantize_thread(AVCodecContext *avctx, void *arg, int plane_index, int threadnr){
+    SnowContext *s= avctx->priv_data;
+    AVFrame *pict= arg;
+    Plane *p= &s->plane[plane_index];
+    int level, orientation;
+
+    for(level=0; level<s->spatial_decomposition_count; level++){
+        for(orientation=level ? 1 : 0; orientation<4; orientation++){
+            SubBand *b= &p->band[level][orientation];
+
+            if(!QUANTIZE2)
+                quantize(s, b, b->ibuf, b->buf, b->stride, s->qbias);
+            if(orientation==0)
+                decorrelate(s, b, b->ibuf, b->stride, pict->pict_type == FF_P_TYPE, 0);
+        }
+    }
+    return 0;
+}
+
+/**
+ * Reconstructs one plane from its quantized coefficients, like the decoder does.
+ */
+static int encode_plane_reconstruct_thread(AVCodecContext *avctx, void *arg, int plane_index, int threadnr){
+    SnowContext *s= avctx->priv_data;
+    AVFrame *pict= arg;
+    Plane *p= &s->plane[plane_index];
+    int w= p->width;
+    int h= p->height;
+    int level, orientation, x, y;
+
+    correlate(s, &p->band[0][0], p->band[0][0].ibuf, p->band[0][0].stride, 1, 0);
+
+    for(level=0; level<s->spatial_decomposition_count; level++){
+        for(orientation=level ? 1 : 0; orientation<4; orientation++){
+            SubBand *b= &p->band[level][orientation];
+
+            dequantize(s, b, b->ibuf, b->stride);
+        }
+    }
+
+    ff_spatial_idwt(p->idwt_buffer, w, h, w, s->spatial_decomposition_type, s->spatial_decomposition_count);
+    if(s->qlog == LOSSLESS_QLOG){
+        for(y=0; y<h; y++){
+            for(x=0; x<w; x++){
+                p->idwt_buffer[y*w + x]<<=FRAC_BITS;
+            }
+        }
+    }
+    predict_plane(s, s->plane_scratchbuf[plane_index], p->idwt_buffer, plane_index, 1);
+
+    if(s->avctx->flags&CODEC_FLAG_PSNR){
+        int64_t error= 0;
+
+        if(pict->data[plane_index]) //FIXME gray hack
+            for(y=0; y<h; y++){
+                for(x=0; x<w; x++){
+                    int d= s->current_picture.data[plane_index][y*s->current_picture.linesize[plane_index] + x] - pict->data[plane_index][y*pict->linesize[plane_index] + x];
+                    error += d*d;
+                }
+            }
+        s->avctx->error[plane_index] += error;
+        s->current_picture.error[plane_index] = error;
+    }
+    return 0;
+}
+
 static int encode_frame(AVCodecContext *avctx, unsigned char *buf, int buf_size, void *data){
     SnowContext *s = avctx->priv_data;
     RangeCoder * const c= &s->c;
@@ -4537,101 +4772,63 @@ redo_frame:
     encode_blocks(s, 1);
     s->m.mv_bits = 8*(s->c.bytestream - s->c.bytestream_start) - s->m.misc_bits;
 
-    for(plane_index=0; plane_index<3; plane_index++){
-        Plane *p= &s->plane[plane_index];
-        int w= p->width;
-        int h= p->height;
-        int x, y;
-//        int bits= put_bits_count(&s->c.pb);
+    if(!(avctx->flags2 & CODEC_FLAG2_MEMC_ONLY)){
+        if(   pict->pict_type == FF_P_TYPE
+           && !(avctx->flags&CODEC_FLAG_PASS2)
+           && s->m.me.scene_change_score > s->avctx->scenechange_threshold){
+            ff_init_range_encoder(c, buf, buf_size);
+            ff_build_rac_states(c, 0.05*(1LL<<32), 256-8);
+            pict->pict_type= FF_I_TYPE;
+            s->keyframe=1;
+            s->current_picture.key_frame=1;
+            goto redo_frame;
+        }
 
-        if(!(avctx->flags2 & CODEC_FLAG2_MEMC_ONLY)){
-            //FIXME optimize
-            if(pict->data[plane_index]) //FIXME gray hack
-                for(y=0; y<h; y++){
-                    for(x=0; x<w; x++){
-                        s->spatial_idwt_buffer[y*w + x]= pict->data[plane_index][y*pict->linesize[plane_index] + x]<<FRAC_BITS;
-                    }
-                }
-            predict_plane(s, s->spatial_idwt_buffer, plane_index, 0);
+        /* the planes are transformed, quantized and reconstructed concurrently,
+         * only the coefficient coding and the rate control are serial */
+        avctx->execute2(avctx, encode_plane_dwt_thread, pict, NULL, 3);
 
-            if(   plane_index==0
-               && pict->pict_type == FF_P_TYPE
-               && !(avctx->flags&CODEC_FLAG_PASS2)
-               && s->m.me.scene_change_score > s->avctx->scenechange_threshold){
+        if(s->pass1_rc){
+            int delta_qlog = ratecontrol_1pass(s, pict);
+            if (delta_qlog <= INT_MIN)
+                return -1;
+            if(delta_qlog){
+                //reordering qlog in the bitstream would eliminate this reset
                 ff_init_range_encoder(c, buf, buf_size);
-                ff_build_rac_states(c, 0.05*(1LL<<32), 256-8);
-                pict->pict_type= FF_I_TYPE;
-                s->keyframe=1;
-                s->current_picture.key_frame=1;
-                goto redo_frame;
-            }
-
-            if(s->qlog == LOSSLESS_QLOG){
-                for(y=0; y<h; y++){
-                    for(x=0; x<w; x++){
-                        s->spatial_dwt_buffer[y*w + x]= (s->spatial_idwt_buffer[y*w + x] + (1<<(FRAC_BITS-1))-1)>>FRAC_BITS;
-                    }
-                }
-            }else{
-                for(y=0; y<h; y++){
-                    for(x=0; x<w; x++){
-                        s->spatial_dwt_buffer[y*w + x]=s->spatial_idwt_buffer[y*w + x]<<ENCODER_EXTRA_BITS;
-                    }
-                }
+                memcpy(s->header_state, rc_header_bak, sizeof(s->header_state));
+                memcpy(s->block_state, rc_block_bak, sizeof(s->block_state));
+                encode_header(s);
+                encode_blocks(s, 0);
+                /* the chroma planes were transformed with the old qlog */
+                if((s->qlog == LOSSLESS_QLOG) != (s->qlog - delta_qlog == LOSSLESS_QLOG))
+                    for(plane_index=1; plane_index<3; plane_index++)
+                        encode_plane_dwt_thread(avctx, pict, plane_index, 0);
             }
+        }
 
-            /*  if(QUANTIZE2)
-                dwt_quantize(s, p, s->spatial_dwt_buffer, w, h, w, s->spatial_decomposition_type);
-            else*/
-                ff_spatial_dwt(s->spatial_dwt_buffer, w, h, w, s->spatial_decomposition_type, s->spatial_decomposition_count);
+        avctx->execute2(avctx, encode_plane_quantize_thread, pict, NULL, 3);
 
-            if(s->pass1_rc && plane_index==0){
-                int delta_qlog = ratecontrol_1pass(s, pict);
-                if (delta_qlog <= INT_MIN)
-                    return -1;
-                if(delta_qlog){
-                    //reordering qlog in the bitstream would eliminate this reset
-                    ff_init_range_encoder(c, buf, buf_size);
-                    memcpy(s->header_state, rc_header_bak, sizeof(s->header_state));
-                    memcpy(s->block_state, rc_block_bak, sizeof(s->block_state));
-                    encode_header(s);
-                    encode_blocks(s, 0);
-                }
-            }
+        for(plane_index=0; plane_index<3; plane_index++){
+            Plane *p= &s->plane[plane_index];
 
             for(level=0; level<s->spatial_decomposition_count; level++){
                 for(orientation=level ? 1 : 0; orientation<4; orientation++){
                     SubBand *b= &p->band[level][orientation];
 
-                    if(!QUANTIZE2)
-                        quantize(s, b, b->ibuf, b->buf, b->stride, s->qbias);
-                    if(orientation==0)
-                        decorrelate(s, b, b->ibuf, b->stride, pict->pict_type == FF_P_TYPE, 0);
                     encode_subband(s, b, b->ibuf, b->parent ? b->parent->ibuf : NULL, b->stride, orientation);
                     assert(b->parent==NULL || b->parent->stride == b->stride*2);
-                    if(orientation==0)
-                        correlate(s, b, b->ibuf, b->stride, 1, 0);
                 }
             }
+        }
 
-            for(level=0; level<s->spatial_decomposition_count; level++){
-                for(orientation=level ? 1 : 0; orientation<4; orientation++){
-                    SubBand *b= &p->band[level][orientation];
-
-                    dequantize(s, b, b->ibuf, b->stride);
-                }
-            }
+        avctx->execute2(avctx, encode_plane_reconstruct_thread, pict, NULL, 3);
+    }else{
+        for(plane_index=0; plane_index<3; plane_index++){
+            Plane *p= &s->plane[plane_index];
+            int w= p->width;
+            int h= p->height;
+            int x, y;
 
-            ff_spatial_idwt(s->spatial_idwt_buffer, w, h, w, s->spatial_decomposition_type, s->spatial_decomposition_count);
-            if(s->qlog == LOSSLESS_QLOG){
-                for(y=0; y<h; y++){
-                    for(x=0; x<w; x++){
-                        s->spatial_idwt_buffer[y*w + x]<<=FRAC_BITS;
-                    }
-                }
-            }
-            predict_plane(s, s->spatial_idwt_buffer, plane_index, 1);
-        }else{
             //ME/MC only
             if(pict->pict_type == FF_I_TYPE){
                 for(y=0; y<h; y++){
@@ -4641,24 +4838,23 @@ redo_frame:
                     }
                 }
             }else{
-                memset(s->spatial_idwt_buffer, 0, sizeof(IDWTELEM)*w*h);
-                predict_plane(s, s->spatial_idwt_buffer, plane_index, 1);
+                memset(p->idwt_buffer, 0, sizeof(IDWTELEM)*w*h);
+                predict_plane(s, s->scratchbuf, p->idwt_buffer, plane_index, 1);
             }
-        }
-        if(s->avctx->flags&CODEC_FLAG_PSNR){
-            int64_t error= 0;
-
-            if(pict->data[plane_index]) //FIXME gray hack
-                for(y=0; y<h; y++){
-                    for(x=0; x<w; x++){
-                        int d= s->current_picture.data[plane_index][y*s->current_picture.linesize[plane_index] + x] - pict->data[plane_index][y*pict->linesize[plane_index] + x];
-                        error += d*d;
+            if(s->avctx->flags&CODEC_FLAG_PSNR){
+                int64_t error= 0;
+
+                if(pict->data[plane_index]) //FIXME gray hack
+                    for(y=0; y<h; y++){
+                        for(x=0; x<w; x++){
+                            int d= s->current_picture.data[plane_index][y*s->current_picture.linesize[plane_index] + x] - pict->data[plane_index][y*pict->linesize[plane_index] + x];
+                            error += d*d;
+                        }
                     }
-                }
-            s->avctx->error[plane_index] += error;
-            s->current_picture.error[plane_index] = error;
+                s->avctx->error[plane_index] += error;
+                s->current_picture.error[plane_index] = error;
+            }
         }
-
     }
 
     update_last_header_values(s);
@@ -4693,6 +4889,25 @@ redo_frame:
 static av_cold int encode_end(AVCodecContext *avctx)
 {
     SnowContext *s = avctx->priv_data;
+    int plane_index, i;
+
+    if(s->thread_context){
+        for(i=1; i<avctx->thread_count; i++){
+            if(s->thread_context[i]){
+                av_freep(&s->thread_context[i]->scratchbuf);
+                av_freep(&s->thread_context[i]->m.obmc_scratchpad);
+                av_freep(&s->thread_context[i]);
+            }
+        }
+        av_freep(&s->thread_context);
+    }
+    for(plane_index=0; plane_index<3; plane_index++){
+        if(plane_index){
+            av_freep(&s->plane[plane_index]. dwt_buffer);
+            av_freep(&s->plane[plane_index].idwt_buffer);
+        }
+        av_freep(&s->plane_scratchbuf[plane_index]);
+    }
 
     common_end(s);
     if (s->input_picture.data[0])
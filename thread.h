@@ -0,0 +1,189 @@
+/*
+ * Multithreading support
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file libavcodec/thread.h
+ * Multithreading support functions
+ */
+
+#ifndef AVCODEC_THREAD_H
+#define AVCODEC_THREAD_H
+
+#include "config.h"
+#include "avcodec.h"
+
+/**
+ * Starts the threads selected by avctx->thread_type and avctx->thread_count.
+ * Called by avcodec_open() before the codec init() function; when frame
+ * threading is chosen, init() is run from here on the per-thread contexts.
+ *
+ * @return 0 on success, a negative value on failure
+ */
+int ff_thread_init(AVCodecContext *avctx);
+
+/**
+ * Stops all threads and frees the context created by ff_thread_init().
+ */
+void ff_thread_free(AVCodecContext *avctx);
+
+/**
+ * Waits for decoding threads to finish and resets internal
+ * state. Called by avcodec_flush_buffers().
+ *
+ * @param avctx The context.
+ */
+void ff_thread_flush(AVCodecContext *avctx);
+
+/**
+ * Submits a new frame to a decoding thread.
+ * Returns the next available frame in picture. *got_picture_ptr
+ * will be 0 if none is available.
+ *
+ * Parameters are the same as avcodec_decode_video2().
+ */
+int ff_thread_decode_frame(AVCodecContext *avctx, AVFrame *picture,
+                           int *got_picture_ptr, AVPacket *avpkt);
+
+/**
+ * If the codec defines update_thread_context(), call this
+ * when they are ready for the next thread to start decoding
+ * the next frame. After calling it, do not change any variables
+ * read by the update_thread_context() method, or call ff_thread_get_buffer().
+ *
+ * @param avctx The context.
+ */
+void ff_thread_finish_setup(AVCodecContext *avctx);
+
+/**
+ * Notifies later decoding threads when part of their reference picture is ready.
+ * Call this when some part of the picture is finished decoding.
+ * Later calls with lower values of progress have no effect.
+ *
+ * @param f The picture being decoded.
+ * @param progress Value, in arbitrary units, of how much of the picture has decoded.
+ * @param field The field being decoded, for field-picture codecs.
+ * 0 for top field or frame pictures, 1 for bottom field.
+ */
+void ff_thread_report_progress(AVFrame *f, int progress, int field);
+
+/**
+ * Waits for earlier decoding threads to finish reference pictures.
+ * Call this before accessing some part of a picture, with a given
+ * value for progress, and it will return after the responsible decoding
+ * thread calls ff_thread_report_progress() with the same or
+ * higher value for progress.
+ *
+ * @param f The picture being referenced.
+ * @param progress Value, in arbitrary units, to wait for.
+ * @param field The field being referenced, for field-picture codecs.
+ * 0 for top field or frame pictures, 1 for bottom field.
+ */
+void ff_thread_await_progress(AVFrame *f, int progress, int field);
+
+/**
+ * Wrapper around get_buffer() for frame-multithreaded codecs.
+ * Call this function instead of avctx->get_buffer(f).
+ * Cannot be called after the codec has called ff_thread_finish_setup().
+ *
+ * @param avctx The current context.
+ * @param f The frame to write into.
+ */
+int ff_thread_get_buffer(AVCodecContext *avctx, AVFrame *f);
+
+/**
+ * Wrapper around release_buffer() for frame-multithreaded codecs.
+ * Call this function instead of avctx->release_buffer(f).
+ * The AVFrame will be copied and the actual release_buffer() call
+ * will be performed later. The contents of data pointed to by the
+ * AVFrame should not be changed until ff_thread_get_buffer() is called
+ * on it.
+ *
+ * @param avctx The current context.
+ * @param f The picture being released.
+ */
+void ff_thread_release_buffer(AVCodecContext *avctx, AVFrame *f);
+
+/**
+ * Prepares row progress tracking for the next avctx->execute() call of
+ * a slice-threaded codec, with all rows marked as not decoded.
+ * Only the first job may wait for rows, all other jobs must run to completion
+ * without waiting, so that they are guaranteed to be started.
+ *
+ * @param rows number of rows, e.g. macroblock rows, of the picture
+ * @return 0 on success, a negative value if slice threading is not active
+ *         or row progress is not supported
+ */
+int ff_thread_init_row_progress(AVCodecContext *avctx, int rows);
+
+/**
+ * Marks a row as decoded, waking threads waiting for it.
+ */
+void ff_thread_report_row_progress(AVCodecContext *avctx, int row);
+
+/**
+ * Waits until a row has been marked as decoded by ff_thread_report_row_progress().
+ */
+void ff_thread_await_row_progress(AVCodecContext *avctx, int row);
+
+/**
+ * Hands out decoded rows in order, so that they can be processed further,
+ * e.g. concealed and drawn, without waiting for the rows still decoding.
+ * Rows are handed out to one thread at a time. After processing them, the
+ * thread must call this function again, passing their number, until it
+ * returns 0; any thread may then get the following rows.
+ *
+ * @param held  number of rows returned by the previous call of this thread, 0 if none
+ * @param delay number of decoded rows which must follow a row before it is
+ *              handed out, unless they are the last rows of the picture
+ * @param first set to the first row handed out
+ * @return the number of rows handed out
+ */
+int ff_thread_claim_rows(AVCodecContext *avctx, int held, int delay, int *first);
+
+typedef struct AsyncContext AsyncContext;
+
+/**
+ * Creates a thread that runs func(avctx, arg) once for every
+ * ff_thread_async_start() call, so that a codec can keep working on one
+ * job while its caller goes on.
+ *
+ * @return the new context, or NULL if threads are not available
+ */
+AsyncContext *ff_thread_async_init(AVCodecContext *avctx,
+                                   int (*func)(AVCodecContext *c, void *arg), void *arg);
+
+/**
+ * Starts the job in the thread. The previous job must have been waited for.
+ */
+void ff_thread_async_start(AsyncContext *a);
+
+/**
+ * Waits until the job started last is finished.
+ *
+ * @return the return value of func, 0 if no job was started
+ */
+int ff_thread_async_wait(AsyncContext *a);
+
+/**
+ * Waits for the running job, stops the thread and frees the context.
+ */
+void ff_thread_async_free(AsyncContext **a);
+
+#endif /* AVCODEC_THREAD_H */
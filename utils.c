@@ -37,6 +37,7 @@
 #include "imgconvert.h"
 #include "audioconvert.h"
 #include "internal.h"
+#include "thread.h"
 #include <stdlib.h>
 #include <stdarg.h>
 #include <limits.h>
@@ -106,17 +107,257 @@ void avcodec_set_dimensions(AVCodecContext *s, int width, int height){
     s->height= -((-height)>>s->lowres);
 }
 
-typedef struct InternalBuffer{
-    int last_pic_num;
+/**
+ * Memory layout of a picture, buffers with the same layout are interchangeable.
+ */
+typedef struct BufferLayout{
+    int linesize[4];
+    int size[4];
+    int offset[4];              ///< offset of data[i] from base[i]
+    enum PixelFormat pix_fmt;
+}BufferLayout;
+
+typedef struct PoolBuffer{
     uint8_t *base[4];
     uint8_t *data[4];
     int linesize[4];
-    int width, height;
-    enum PixelFormat pix_fmt;
+    int refcount;               ///< codec and user references
+    int holder;                 ///< id of the context whose codec holds the buffer, 0 if none
+    int last_user;              ///< id of the context which used the buffer last
+    int last_pic_num;
+    struct BufferBucket *bucket;
+    struct PoolBuffer *next;    ///< next free buffer of the bucket or next used buffer of the pool
+    struct PoolBuffer **prev;   ///< link pointing to this buffer in the used list
+}PoolBuffer;
+
+typedef struct BufferBucket{
+    BufferLayout layout;
+    struct AVCodecBufferPool *pool;
+    PoolBuffer *free;
+    int nb_used;
+    int64_t last_use;           ///< value of AVCodecBufferPool.nb_gets when last used
+    struct BufferBucket *next;
+}BufferBucket;
+
+struct AVCodecBufferPool{
+    void *mutex;
+    BufferBucket *buckets;
+    PoolBuffer *used;
+    int refs;                   ///< users and buffers in use
+    int nb_users;               ///< for handing out user ids, ids are never reused
+    int64_t nb_gets;
+    int64_t hits, misses;
+    int threaded;               ///< used by frame threads, references need the lock manager
+};
+
+/**
+ * Per-context state of the default get_buffer(), kept in
+ * AVCodecContext.internal_buffer.
+ */
+typedef struct InternalBuffer{
+    AVCodecBufferPool *pool;
+    int id;
+    int picture_number;
 }InternalBuffer;
 
 #define INTERNAL_BUFFER_SIZE 32
 
+/**
+ * Buckets without used buffers are freed after this many get_buffer() calls
+ * for other layouts.
+ */
+#define BUCKET_MAX_IDLE 256
+
+static void pool_lock(AVCodecBufferPool *pool){
+    if(pool->mutex && ff_lockmgr_cb)
+        ff_lockmgr_cb(&pool->mutex, AV_LOCK_OBTAIN);
+}
+
+static void pool_unlock(AVCodecBufferPool *pool){
+    if(pool->mutex && ff_lockmgr_cb)
+        ff_lockmgr_cb(&pool->mutex, AV_LOCK_RELEASE);
+}
+
+static void free_bucket(BufferBucket *bucket){
+    while(bucket->free){
+        PoolBuffer *buf= bucket->free;
+        int i;
+
+        bucket->free= buf->next;
+        for(i=0; i<4; i++)
+            av_free(buf->base[i]);
+        av_free(buf);
+    }
+    av_free(bucket);
+}
+
+/**
+ * Unlocks the pool, freeing it if no references are left.
+ */
+static void pool_unlock_or_free(AVCodecBufferPool *pool){
+    if(pool->refs){
+        pool_unlock(pool);
+        return;
+    }
+
+    while(pool->buckets){
+        BufferBucket *bucket= pool->buckets;
+        pool->buckets= bucket->next;
+        free_bucket(bucket);
+    }
+    pool_unlock(pool);
+    if(pool->mutex && ff_lockmgr_cb)
+        ff_lockmgr_cb(&pool->mutex, AV_LOCK_DESTROY);
+    av_free(pool);
+}
+
+AVCodecBufferPool *avcodec_buffer_pool_alloc(void){
+    AVCodecBufferPool *pool= av_mallocz(sizeof(AVCodecBufferPool));
+
+    if(!pool)
+        return NULL;
+    if(ff_lockmgr_cb && ff_lockmgr_cb(&pool->mutex, AV_LOCK_CREATE)){
+        av_free(pool);
+        return NULL;
+    }
+    pool->refs= 1;
+
+    return pool;
+}
+
+void avcodec_buffer_pool_free(AVCodecBufferPool **pool){
+    if(!*pool)
+        return;
+    pool_lock(*pool);
+    (*pool)->refs--;
+    pool_unlock_or_free(*pool);
+    *pool= NULL;
+}
+
+void avcodec_buffer_pool_get_stats(AVCodecBufferPool *pool, int64_t *hits, int64_t *misses){
+    pool_lock(pool);
+    *hits  = pool->hits;
+    *misses= pool->misses;
+    pool_unlock(pool);
+}
+
+/**
+ * Drops one reference to a used buffer, putting it back into its bucket
+ * with the last one. Must be called with the pool locked.
+ */
+static void buffer_unref(AVCodecBufferPool *pool, PoolBuffer *buf){
+    if(--buf->refcount)
+        return;
+
+    *buf->prev= buf->next;
+    if(buf->next)
+        buf->next->prev= buf->prev;
+
+    buf->next= buf->bucket->free;
+    buf->bucket->free= buf;
+    buf->bucket->nb_used--;
+    pool->refs--;
+}
+
+/**
+ * Computes the layout of the pictures get_buffer() returns for the
+ * current dimensions and pixel format of the context.
+ */
+static int get_buffer_layout(AVCodecContext *s, BufferLayout *layout){
+    int w= s->width;
+    int h= s->height;
+    int h_chroma_shift, v_chroma_shift;
+    int tmpsize;
+    int unaligned;
+    AVPicture picture;
+    int stride_align[4];
+    int i;
+
+    memset(layout, 0, sizeof(*layout));
+
+    avcodec_get_chroma_sub_sample(s->pix_fmt, &h_chroma_shift, &v_chroma_shift);
+
+    avcodec_align_dimensions(s, &w, &h);
+
+    if(!(s->flags&CODEC_FLAG_EMU_EDGE)){
+        w+= EDGE_WIDTH*2;
+        h+= EDGE_WIDTH*2;
+    }
+
+    do {
+        // NOTE: do not align linesizes individually, this breaks e.g. assumptions
+        // that linesize[0] == 2*linesize[1] in the MPEG-encoder for 4:2:2
+        ff_fill_linesize(&picture, s->pix_fmt, w);
+        // increase alignment of w for next try (rhs gives the lowest bit set in w)
+        w += w & ~(w-1);
+
+        unaligned = 0;
+        for (i=0; i<4; i++){
+//STRIDE_ALIGN is 8 for SSE* but this does not work for SVQ1 chroma planes
+//we could change STRIDE_ALIGN to 16 for x86/sse but it would increase the
+//picture size unneccessarily in some cases. The solution here is not
+//pretty and better ideas are welcome!
+#if HAVE_MMX
+            if(s->codec_id == CODEC_ID_SVQ1)
+                stride_align[i]= 16;
+            else
+#endif
+            stride_align[i] = STRIDE_ALIGN;
+            unaligned |= picture.linesize[i] % stride_align[i];
+        }
+    } while (unaligned);
+
+    tmpsize = ff_fill_pointer(&picture, NULL, s->pix_fmt, h);
+    if (tmpsize < 0)
+        return -1;
+
+    for (i=0; i<3 && picture.data[i+1]; i++)
+        layout->size[i] = picture.data[i+1] - picture.data[i];
+    layout->size[i] = tmpsize - (picture.data[i] - picture.data[0]);
+
+    for(i=0; i<4 && layout->size[i]; i++){
+        const int h_shift= i==0 ? 0 : h_chroma_shift;
+        const int v_shift= i==0 ? 0 : v_chroma_shift;
+
+        layout->linesize[i]= picture.linesize[i];
+
+        // no edge if EDEG EMU or not planar YUV
+        if(!(s->flags&CODEC_FLAG_EMU_EDGE) && layout->size[2])
+            layout->offset[i]= FFALIGN((picture.linesize[i]*EDGE_WIDTH>>v_shift) + (EDGE_WIDTH>>h_shift), stride_align[i]);
+    }
+    layout->pix_fmt= s->pix_fmt;
+
+    return 0;
+}
+
+static PoolBuffer *alloc_pool_buffer(BufferBucket *bucket){
+    const BufferLayout *layout= &bucket->layout;
+    PoolBuffer *buf= av_mallocz(sizeof(PoolBuffer));
+    int i;
+
+    if(!buf)
+        return NULL;
+
+    for(i=0; i<4 && layout->size[i]; i++){
+        buf->base[i]= av_malloc(layout->size[i]+16); //FIXME 16
+        if(buf->base[i]==NULL){
+            while(i--)
+                av_free(buf->base[i]);
+            av_free(buf);
+            return NULL;
+        }
+        memset(buf->base[i], 128, layout->size[i]);
+
+        buf->data[i]= buf->base[i] + layout->offset[i];
+        buf->linesize[i]= layout->linesize[i];
+    }
+    if(layout->size[1] && !layout->size[2])
+        ff_set_systematic_pal((uint32_t*)buf->data[1], layout->pix_fmt);
+    buf->bucket= bucket;
+
+    return buf;
+}
+
 void avcodec_align_dimensions(AVCodecContext *s, int *width, int *height){
     int w_align= 1;
     int h_align= 1;
@@ -192,10 +433,11 @@ int avcodec_check_dimensions(void *av_log_ctx, unsigned int w, unsigned int h){
 
 int avcodec_default_get_buffer(AVCodecContext *s, AVFrame *pic){
     int i;
-    int w= s->width;
-    int h= s->height;
-    InternalBuffer *buf;
-    int *picture_number;
+    InternalBuffer *ib;
+    AVCodecBufferPool *pool;
+    BufferLayout layout;
+    BufferBucket *bucket, **p;
+    PoolBuffer *buf;
 
     if(pic->data[0]!=NULL) {
         av_log(s, AV_LOG_ERROR, "pic->data[0]!=NULL in avcodec_default_get_buffer\n");
@@ -206,110 +448,101 @@ int avcodec_default_get_buffer(AVCodecContext *s, AVFrame *pic){
         return -1;
     }
 
-    if(avcodec_check_dimensions(s,w,h))
+    if(avcodec_check_dimensions(s,s->width,s->height))
         return -1;
 
     if(s->internal_buffer==NULL){
-        s->internal_buffer= av_mallocz((INTERNAL_BUFFER_SIZE+1)*sizeof(InternalBuffer));
-    }
-#if 0
-    s->internal_buffer= av_fast_realloc(
-        s->internal_buffer,
-        &s->internal_buffer_size,
-        sizeof(InternalBuffer)*FFMAX(99,  s->internal_buffer_count+1)/*FIXME*/
-        );
-#endif
-
-    buf= &((InternalBuffer*)s->internal_buffer)[s->internal_buffer_count];
-    picture_number= &(((InternalBuffer*)s->internal_buffer)[INTERNAL_BUFFER_SIZE]).last_pic_num; //FIXME ugly hack
-    (*picture_number)++;
-
-    if(buf->base[0] && (buf->width != w || buf->height != h || buf->pix_fmt != s->pix_fmt)){
-        for(i=0; i<4; i++){
-            av_freep(&buf->base[i]);
-            buf->data[i]= NULL;
+        ib= av_mallocz(sizeof(InternalBuffer));
+        if(!ib)
+            return -1;
+        if(s->buffer_pool){
+            ib->pool= s->buffer_pool;
+            pool_lock(ib->pool);
+            ib->pool->refs++;
+        }else{
+            ib->pool= avcodec_buffer_pool_alloc();
+            if(!ib->pool){
+                av_free(ib);
+                return -1;
+            }
+            pool_lock(ib->pool);
         }
+        ib->id= ++ib->pool->nb_users;
+        if(s->active_thread_type&FF_THREAD_FRAME)
+            ib->pool->threaded= 1;
+        pool_unlock(ib->pool);
+        s->internal_buffer= ib;
     }
+    ib= s->internal_buffer;
+    pool= ib->pool;
+    ib->picture_number++;
 
-    if(buf->base[0]){
-        pic->age= *picture_number - buf->last_pic_num;
-        buf->last_pic_num= *picture_number;
-    }else{
-        int h_chroma_shift, v_chroma_shift;
-        int size[4] = {0};
-        int tmpsize;
-        int unaligned;
-        AVPicture picture;
-        int stride_align[4];
-
-        avcodec_get_chroma_sub_sample(s->pix_fmt, &h_chroma_shift, &v_chroma_shift);
+    if(get_buffer_layout(s, &layout) < 0)
+        return -1;
 
-        avcodec_align_dimensions(s, &w, &h);
+    pool_lock(pool);
+    pool->nb_gets++;
 
-        if(!(s->flags&CODEC_FLAG_EMU_EDGE)){
-            w+= EDGE_WIDTH*2;
-            h+= EDGE_WIDTH*2;
+    for(bucket= pool->buckets; bucket; bucket= bucket->next)
+        if(!memcmp(&bucket->layout, &layout, sizeof(layout)))
+            break;
+    if(!bucket){
+        bucket= av_mallocz(sizeof(BufferBucket));
+        if(!bucket){
+            pool_unlock(pool);
+            return -1;
         }
+        bucket->layout= layout;
+        bucket->pool= pool;
+        bucket->next= pool->buckets;
+        pool->buckets= bucket;
+    }
+    bucket->last_use= pool->nb_gets;
+
+    /* free the buffers of layouts no longer in use, e.g. after a resolution switch */
+    for(p= &pool->buckets; *p;){
+        BufferBucket *b= *p;
+        if(!b->nb_used && pool->nb_gets - b->last_use > BUCKET_MAX_IDLE){
+            *p= b->next;
+            free_bucket(b);
+        }else
+            p= &b->next;
+    }
 
-        do {
-            // NOTE: do not align linesizes individually, this breaks e.g. assumptions
-            // that linesize[0] == 2*linesize[1] in the MPEG-encoder for 4:2:2
-            ff_fill_linesize(&picture, s->pix_fmt, w);
-            // increase alignment of w for next try (rhs gives the lowest bit set in w)
-            w += w & ~(w-1);
-
-            unaligned = 0;
-            for (i=0; i<4; i++){
-//STRIDE_ALIGN is 8 for SSE* but this does not work for SVQ1 chroma planes
-//we could change STRIDE_ALIGN to 16 for x86/sse but it would increase the
-//picture size unneccessarily in some cases. The solution here is not
-//pretty and better ideas are welcome!
-#if HAVE_MMX
-                if(s->codec_id == CODEC_ID_SVQ1)
-                    stride_align[i]= 16;
-                else
-#endif
-                stride_align[i] = STRIDE_ALIGN;
-                unaligned |= picture.linesize[i] % stride_align[i];
-            }
-        } while (unaligned);
-
-        tmpsize = ff_fill_pointer(&picture, NULL, s->pix_fmt, h);
-        if (tmpsize < 0)
+    buf= bucket->free;
+    if(buf){
+        bucket->free= buf->next;
+        pool->hits++;
+    }else{
+        buf= alloc_pool_buffer(bucket);
+        if(!buf){
+            pool_unlock(pool);
             return -1;
-
-        for (i=0; i<3 && picture.data[i+1]; i++)
-            size[i] = picture.data[i+1] - picture.data[i];
-        size[i] = tmpsize - (picture.data[i] - picture.data[0]);
-
-        buf->last_pic_num= -256*256*256*64;
-        memset(buf->base, 0, sizeof(buf->base));
-        memset(buf->data, 0, sizeof(buf->data));
-
-        for(i=0; i<4 && size[i]; i++){
-            const int h_shift= i==0 ? 0 : h_chroma_shift;
-            const int v_shift= i==0 ? 0 : v_chroma_shift;
-
-            buf->linesize[i]= picture.linesize[i];
-
-            buf->base[i]= av_malloc(size[i]+16); //FIXME 16
-            if(buf->base[i]==NULL) return -1;
-            memset(buf->base[i], 128, size[i]);
-
-            // no edge if EDEG EMU or not planar YUV
-            if((s->flags&CODEC_FLAG_EMU_EDGE) || !size[2])
-                buf->data[i] = buf->base[i];
-            else
-                buf->data[i] = buf->base[i] + FFALIGN((buf->linesize[i]*EDGE_WIDTH>>v_shift) + (EDGE_WIDTH>>h_shift), stride_align[i]);
         }
-        if(size[1] && !size[2])
-            ff_set_systematic_pal((uint32_t*)buf->data[1], s->pix_fmt);
-        buf->width  = s->width;
-        buf->height = s->height;
-        buf->pix_fmt= s->pix_fmt;
-        pic->age= 256*256*256*64;
+        buf->last_pic_num= -256*256*256*64;
+        pool->misses++;
     }
+    bucket->nb_used++;
+    buf->refcount= 1;
+    buf->holder= ib->id;
+    buf->next= pool->used;
+    buf->prev= &pool->used;
+    if(buf->next)
+        buf->next->prev= &buf->next;
+    pool->used= buf;
+    pool->refs++;
+
+    /* the contents are only known if this context used the buffer last */
+    if(buf->last_user == ib->id)
+        pic->age= ib->picture_number - buf->last_pic_num;
+    else
+        pic->age= 256*256*256*64;
+    buf->last_user= ib->id;
+    buf->last_pic_num= ib->picture_number;
+    pool_unlock(pool);
+
     pic->type= FF_BUFFER_TYPE_INTERNAL;
+    pic->pool_buffer= buf;
 
     for(i=0; i<4; i++){
         pic->base[i]= buf->base[i];
@@ -328,22 +561,19 @@ int avcodec_default_get_buffer(AVCodecContext *s, AVFrame *pic){
 
 void avcodec_default_release_buffer(AVCodecContext *s, AVFrame *pic){
     int i;
-    InternalBuffer *buf, *last;
+    InternalBuffer *ib= s->internal_buffer;
+    PoolBuffer *buf= pic->pool_buffer;
 
     assert(pic->type==FF_BUFFER_TYPE_INTERNAL);
     assert(s->internal_buffer_count);
+    assert(buf && buf->data[0] == pic->data[0] && buf->holder == ib->id);
 
-    buf = NULL; /* avoids warning */
-    for(i=0; i<s->internal_buffer_count; i++){ //just 3-5 checks so is not worth to optimize
-        buf= &((InternalBuffer*)s->internal_buffer)[i];
-        if(buf->data[0] == pic->data[0])
-            break;
-    }
-    assert(i < s->internal_buffer_count);
     s->internal_buffer_count--;
-    last = &((InternalBuffer*)s->internal_buffer)[s->internal_buffer_count];
 
-    FFSWAP(InternalBuffer, *buf, *last);
+    pool_lock(ib->pool);
+    buf->holder= 0;
+    buffer_unref(ib->pool, buf);
+    pool_unlock(ib->pool);
 
     for(i=0; i<4; i++){
         pic->data[i]=NULL;
@@ -355,6 +585,40 @@ void avcodec_default_release_buffer(AVCodecContext *s, AVFrame *pic){
         av_log(s, AV_LOG_DEBUG, "default_release_buffer called on pic %p, %d buffers used\n", pic, s->internal_buffer_count);
 }
 
+int avcodec_default_ref_buffer(AVFrame *pic){
+    PoolBuffer *buf= pic->pool_buffer;
+    AVCodecBufferPool *pool;
+
+    if(pic->type != FF_BUFFER_TYPE_INTERNAL || !buf || !pic->data[0] || buf->data[0] != pic->data[0])
+        return -1;
+
+    pool= buf->bucket->pool;
+    /* the codec gets and releases buffers in other threads, without a lock
+     * manager the reference count cannot be updated safely */
+    if(pool->threaded && !pool->mutex){
+        av_log(NULL, AV_LOG_ERROR, "avcodec_default_ref_buffer() with frame threads needs a lock manager\n");
+        return -1;
+    }
+    pool_lock(pool);
+    buf->refcount++;
+    pool_unlock(pool);
+
+    return 0;
+}
+
+void avcodec_default_unref_buffer(AVFrame *pic){
+    PoolBuffer *buf= pic->pool_buffer;
+    AVCodecBufferPool *pool= buf->bucket->pool;
+    int i;
+
+    pool_lock(pool);
+    buffer_unref(pool, buf);
+    pool_unlock_or_free(pool);
+
+    for(i=0; i<4; i++)
+        pic->data[i]= NULL;
+}
+
 int avcodec_default_reget_buffer(AVCodecContext *s, AVFrame *pic){
     AVFrame temp_pic;
     int i;
@@ -485,7 +749,15 @@ int attribute_align_arg avcodec_open(AVCodecContext *avctx, AVCodec *codec)
         goto free_and_end;
     }
     avctx->frame_number = 0;
-    if(avctx->codec->init){
+
+    if (HAVE_PTHREADS && !avctx->thread_opaque) {
+        ret = ff_thread_init(avctx);
+        if (ret < 0) {
+            goto free_and_end;
+        }
+    }
+
+    if(avctx->codec->init && !(avctx->active_thread_type&FF_THREAD_FRAME)){
         ret = avctx->codec->init(avctx);
         if (ret < 0) {
             goto free_and_end;
@@ -580,9 +852,13 @@ int attribute_align_arg avcodec_decode_video2(AVCodecContext *avctx, AVFrame *pi
     *got_picture_ptr= 0;
     if((avctx->coded_width||avctx->coded_height) && avcodec_check_dimensions(avctx,avctx->coded_width,avctx->coded_height))
         return -1;
-    if((avctx->codec->capabilities & CODEC_CAP_DELAY) || avpkt->size){
-        ret = avctx->codec->decode(avctx, picture, got_picture_ptr,
-                                avpkt);
+    if((avctx->codec->capabilities & CODEC_CAP_DELAY) || avpkt->size || (avctx->active_thread_type&FF_THREAD_FRAME)){
+        if (HAVE_PTHREADS && avctx->active_thread_type&FF_THREAD_FRAME)
+            ret = ff_thread_decode_frame(avctx, picture, got_picture_ptr,
+                                         avpkt);
+        else
+            ret = avctx->codec->decode(avctx, picture, got_picture_ptr,
+                                       avpkt);
 
         emms_c(); //needed to avoid an emms_c() call before every return;
 
@@ -681,7 +957,7 @@ av_cold int avcodec_close(AVCodecContext *avctx)
         avcodec_thread_free(avctx);
     if (avctx->codec && avctx->codec->close)
         avctx->codec->close(avctx);
-    avcodec_default_free_buffers(avctx);
+    ff_free_internal_buffer(avctx);
     av_freep(&avctx->priv_data);
     avctx->codec = NULL;
     entangled_thread_counter--;
@@ -919,29 +1195,49 @@ void avcodec_init(void)
 
 void avcodec_flush_buffers(AVCodecContext *avctx)
 {
-    if(avctx->codec->flush)
+    if(HAVE_PTHREADS && avctx->active_thread_type&FF_THREAD_FRAME)
+        ff_thread_flush(avctx);
+    else if(avctx->codec->flush)
         avctx->codec->flush(avctx);
 }
 
 void avcodec_default_free_buffers(AVCodecContext *s){
-    int i, j;
+    InternalBuffer *ib= s->internal_buffer;
+    AVCodecBufferPool *pool;
+    PoolBuffer *buf, *next;
 
-    if(s->internal_buffer==NULL) return;
+    if(ib==NULL) return;
 
-    if (s->internal_buffer_count)
+    pool= ib->pool;
+    if (s->internal_buffer_count) {
         av_log(s, AV_LOG_WARNING, "Found %i unreleased buffers!\n", s->internal_buffer_count);
-    for(i=0; i<INTERNAL_BUFFER_SIZE; i++){
-        InternalBuffer *buf= &((InternalBuffer*)s->internal_buffer)[i];
-        for(j=0; j<4; j++){
-            av_freep(&buf->base[j]);
-            buf->data[j]= NULL;
+        pool_lock(pool);
+        /* drop the references of the codec, those of the user stay valid */
+        for(buf= pool->used; buf; buf= next){
+            next= buf->next;
+            if(buf->holder == ib->id){
+                buf->holder= 0;
+                buffer_unref(pool, buf);
+            }
         }
+        pool_unlock(pool);
     }
-    av_freep(&s->internal_buffer);
 
     s->internal_buffer_count=0;
 }
 
+void ff_free_internal_buffer(AVCodecContext *s){
+    InternalBuffer *ib= s->internal_buffer;
+
+    if(ib==NULL) return;
+
+    avcodec_default_free_buffers(s);
+    pool_lock(ib->pool);
+    ib->pool->refs--;
+    pool_unlock_or_free(ib->pool);
+    av_freep(&s->internal_buffer);
+}
+
 char av_get_pict_type_char(int pict_type){
     switch(pict_type){
     case FF_I_TYPE: return 'I';
@@ -1023,6 +1319,77 @@ int avcodec_thread_init(AVCodecContext *s, int thread_count){
 }
 #endif
 
+#if !HAVE_PTHREADS
+int avcodec_thread_pool_init(int thread_count)
+{
+    return -1;
+}
+
+void avcodec_thread_pool_free(void)
+{
+}
+
+int ff_thread_get_buffer(AVCodecContext *avctx, AVFrame *f)
+{
+    f->owner = avctx;
+    return avctx->get_buffer(avctx, f);
+}
+
+void ff_thread_release_buffer(AVCodecContext *avctx, AVFrame *f)
+{
+    f->owner->release_buffer(f->owner, f);
+}
+
+void ff_thread_finish_setup(AVCodecContext *avctx)
+{
+}
+
+void ff_thread_report_progress(AVFrame *f, int progress, int field)
+{
+}
+
+void ff_thread_await_progress(AVFrame *f, int progress, int field)
+{
+}
+
+int ff_thread_init_row_progress(AVCodecContext *avctx, int rows)
+{
+    return -1;
+}
+
+void ff_thread_report_row_progress(AVCodecContext *avctx, int row)
+{
+}
+
+void ff_thread_await_row_progress(AVCodecContext *avctx, int row)
+{
+}
+
+int ff_thread_claim_rows(AVCodecContext *avctx, int held, int delay, int *first)
+{
+    return 0;
+}
+
+AsyncContext *ff_thread_async_init(AVCodecContext *avctx,
+                                   int (*func)(AVCodecContext *c, void *arg), void *arg)
+{
+    return NULL;
+}
+
+void ff_thread_async_start(AsyncContext *a)
+{
+}
+
+int ff_thread_async_wait(AsyncContext *a)
+{
+    return 0;
+}
+
+void ff_thread_async_free(AsyncContext **a)
+{
+}
+#endif
+
 unsigned int av_xiphlacing(unsigned char *s, unsigned int v)
 {
     unsigned int n = 0;
@@ -152,6 +152,17 @@ enum COTypes {
  * @todo Change size wherever another size is more efficient
  * Many members are only used for Advanced Profile
  */
+/**
+ * Part of an Advanced Profile picture, the picture layer data up to the first
+ * slice is the first one.
+ */
+typedef struct VC1Slice {
+    GetBitContext gb;   ///< slice data after the slice header
+    int bits;           ///< size of the slice data in bits
+    int start_mb_y;     ///< first macroblock row of the slice
+    int end_mb_y;       ///< macroblock row after the slice
+} VC1Slice;
+
 typedef struct VC1Context{
     MpegEncContext s;
     IntraX8Context x8;
@@ -314,6 +325,17 @@ typedef struct VC1Context{
     int parse_only;             ///< Context is used within parser
 
     int warn_interlaced;
+
+    VC1Slice *slices;           ///< slices of the current picture, allocated for one per macroblock row
+    int slice_count;
+    struct VC1Context *thread_context[MAX_THREADS]; ///< slice thread contexts, [0] is this context
+
+    /**
+     * overlap smoothing and loop filter of the current I or B picture run
+     * in a separate slice thread behind decoding, see CODEC_FLAG2_DEFER_DEBLOCK
+     */
+    int filter_deferred;
+    int filter_mb_end;          ///< number of macroblocks decoded, in raster order, for the deferred filter
 } VC1Context;
 
 /** Find VC-1 marker in buffer
@@ -37,6 +37,7 @@
 #include "simple_idct.h"
 #include "mathops.h"
 #include "vdpau_internal.h"
+#include "thread.h"
 
 #undef NDEBUG
 #include <assert.h>
@@ -175,6 +176,71 @@ static void vc1_loop_filter_iblk(MpegEncContext *s, int pq)
     }
 }
 
+/** Apply overlap smoothing and the loop filter to an intra macroblock
+ * of an I or B picture after it has been put onto the picture
+ * @param overlap whether overlap smoothing is used for the macroblock
+ */
+static void vc1_filter_iblk(VC1Context *v, int overlap)
+{
+    MpegEncContext *s = &v->s;
+
+    if(overlap) {
+        if(s->mb_x) {
+            s->dsp.vc1_h_overlap(s->dest[0], s->linesize);
+            s->dsp.vc1_h_overlap(s->dest[0] + 8 * s->linesize, s->linesize);
+            if(!(s->flags & CODEC_FLAG_GRAY)) {
+                s->dsp.vc1_h_overlap(s->dest[1], s->uvlinesize);
+                s->dsp.vc1_h_overlap(s->dest[2], s->uvlinesize);
+            }
+        }
+        s->dsp.vc1_h_overlap(s->dest[0] + 8, s->linesize);
+        s->dsp.vc1_h_overlap(s->dest[0] + 8 * s->linesize + 8, s->linesize);
+        if(!s->first_slice_line) {
+            s->dsp.vc1_v_overlap(s->dest[0], s->linesize);
+            s->dsp.vc1_v_overlap(s->dest[0] + 8, s->linesize);
+            if(!(s->flags & CODEC_FLAG_GRAY)) {
+                s->dsp.vc1_v_overlap(s->dest[1], s->uvlinesize);
+                s->dsp.vc1_v_overlap(s->dest[2], s->uvlinesize);
+            }
+        }
+        s->dsp.vc1_v_overlap(s->dest[0] + 8 * s->linesize, s->linesize);
+        s->dsp.vc1_v_overlap(s->dest[0] + 8 * s->linesize + 8, s->linesize);
+    }
+    if(v->s.loop_filter) vc1_loop_filter_iblk(s, v->pq);
+}
+
+/** Tell whether overlap smoothing is used for the current macroblock
+ * of an I or B picture
+ */
+static int vc1_mb_overlap(VC1Context *v)
+{
+    MpegEncContext *s = &v->s;
+
+    if(s->pict_type == FF_B_TYPE && !v->bi_type)
+        return 0;
+    if(v->profile == PROFILE_ADVANCED) {
+        if(v->condover == CONDOVER_SELECT)
+            return v->over_flags_plane[s->mb_x + s->mb_y * s->mb_stride];
+        return v->condover == CONDOVER_ALL;
+    }
+    return v->pq >= 9 && v->overlap;
+}
+
+/** Called after a macroblock row of an I or B picture has been decoded
+ * @param mb_count number of macroblocks of the row which were decoded and
+ *                 should be filtered, less than mb_width if decoding stopped
+ */
+static void vc1_finish_row(VC1Context *v, int mb_count)
+{
+    MpegEncContext *s = &v->s;
+
+    if(v->filter_deferred) {
+        v->filter_mb_end = s->mb_y * s->mb_width + mb_count;
+        ff_thread_report_row_progress(s->avctx, s->mb_y);
+    } else if(mb_count == s->mb_width)
+        ff_draw_horiz_band(s, s->mb_y * 16, 16);
+}
+
 /** Put block onto picture
  */
 static void vc1_put_block(VC1Context *v, DCTELEM block[6][64])
@@ -1333,6 +1399,9 @@ static inline int vc1_coded_block_pred(MpegEncContext * s, int n, uint8_t **code
     a = s->coded_block[xy - 1       ];
     b = s->coded_block[xy - 1 - wrap];
     c = s->coded_block[xy     - wrap];
+    /* the row above belongs to another slice */
+    if (s->first_slice_line && n < 2)
+        b = c = 0;
 
     if (b == c) {
         pred = a;
@@ -2609,10 +2678,10 @@ static void vc1_decode_i_blocks(VC1Context *v)
     s->c_dc_scale = s->c_dc_scale_table[v->pq];
 
     //do frame decode
-    s->mb_x = s->mb_y = 0;
+    s->mb_x = 0;
     s->mb_intra = 1;
     s->first_slice_line = 1;
-    for(s->mb_y = 0; s->mb_y < s->mb_height; s->mb_y++) {
+    for(s->mb_y = s->start_mb_y; s->mb_y < s->end_mb_y; s->mb_y++) {
         s->mb_x = 0;
         ff_init_block_index(s);
         for(; s->mb_x < s->mb_width; s->mb_x++) {
@@ -2647,40 +2716,20 @@ static void vc1_decode_i_blocks(VC1Context *v)
             }
 
             vc1_put_block(v, s->block);
-            if(v->pq >= 9 && v->overlap) {
-                if(s->mb_x) {
-                    s->dsp.vc1_h_overlap(s->dest[0], s->linesize);
-                    s->dsp.vc1_h_overlap(s->dest[0] + 8 * s->linesize, s->linesize);
-                    if(!(s->flags & CODEC_FLAG_GRAY)) {
-                        s->dsp.vc1_h_overlap(s->dest[1], s->uvlinesize);
-                        s->dsp.vc1_h_overlap(s->dest[2], s->uvlinesize);
-                    }
-                }
-                s->dsp.vc1_h_overlap(s->dest[0] + 8, s->linesize);
-                s->dsp.vc1_h_overlap(s->dest[0] + 8 * s->linesize + 8, s->linesize);
-                if(!s->first_slice_line) {
-                    s->dsp.vc1_v_overlap(s->dest[0], s->linesize);
-                    s->dsp.vc1_v_overlap(s->dest[0] + 8, s->linesize);
-                    if(!(s->flags & CODEC_FLAG_GRAY)) {
-                        s->dsp.vc1_v_overlap(s->dest[1], s->uvlinesize);
-                        s->dsp.vc1_v_overlap(s->dest[2], s->uvlinesize);
-                    }
-                }
-                s->dsp.vc1_v_overlap(s->dest[0] + 8 * s->linesize, s->linesize);
-                s->dsp.vc1_v_overlap(s->dest[0] + 8 * s->linesize + 8, s->linesize);
-            }
-            if(v->s.loop_filter) vc1_loop_filter_iblk(s, v->pq);
+            if(!v->filter_deferred)
+                vc1_filter_iblk(v, v->pq >= 9 && v->overlap);
 
             if(get_bits_count(&s->gb) > v->bits) {
-                ff_er_add_slice(s, 0, 0, s->mb_x, s->mb_y, (AC_END|DC_END|MV_END));
+                ff_er_add_slice(s, 0, s->start_mb_y, s->mb_x, s->mb_y, (AC_END|DC_END|MV_END));
                 av_log(s->avctx, AV_LOG_ERROR, "Bits overconsumption: %i > %i\n", get_bits_count(&s->gb), v->bits);
+                vc1_finish_row(v, s->mb_x + 1);
                 return;
             }
         }
-        ff_draw_horiz_band(s, s->mb_y * 16, 16);
+        vc1_finish_row(v, s->mb_width);
         s->first_slice_line = 0;
     }
-    ff_er_add_slice(s, 0, 0, s->mb_width - 1, s->mb_height - 1, (AC_END|DC_END|MV_END));
+    ff_er_add_slice(s, 0, s->start_mb_y, s->mb_width - 1, s->end_mb_y - 1, (AC_END|DC_END|MV_END));
 }
 
 /** Decode blocks of I-frame for advanced profile
@@ -2723,10 +2772,10 @@ static void vc1_decode_i_blocks_adv(VC1Context *v)
     }
 
     //do frame decode
-    s->mb_x = s->mb_y = 0;
+    s->mb_x = 0;
     s->mb_intra = 1;
     s->first_slice_line = 1;
-    for(s->mb_y = 0; s->mb_y < s->mb_height; s->mb_y++) {
+    for(s->mb_y = s->start_mb_y; s->mb_y < s->end_mb_y; s->mb_y++) {
         s->mb_x = 0;
         ff_init_block_index(s);
         for(;s->mb_x < s->mb_width; s->mb_x++) {
@@ -2745,10 +2794,10 @@ static void vc1_decode_i_blocks_adv(VC1Context *v)
                 v->s.ac_pred = v->acpred_plane[mb_pos];
 
             if(v->condover == CONDOVER_SELECT) {
+                /* the plane also keeps raw flags for the deferred filter */
                 if(v->overflg_is_raw)
-                    overlap = get_bits1(&v->s.gb);
-                else
-                    overlap = v->over_flags_plane[mb_pos];
+                    v->over_flags_plane[mb_pos] = get_bits1(&v->s.gb);
+                overlap = v->over_flags_plane[mb_pos];
             } else
                 overlap = (v->condover == CONDOVER_ALL);
 
@@ -2779,40 +2828,20 @@ static void vc1_decode_i_blocks_adv(VC1Context *v)
             }
 
             vc1_put_block(v, s->block);
-            if(overlap) {
-                if(s->mb_x) {
-                    s->dsp.vc1_h_overlap(s->dest[0], s->linesize);
-                    s->dsp.vc1_h_overlap(s->dest[0] + 8 * s->linesize, s->linesize);
-                    if(!(s->flags & CODEC_FLAG_GRAY)) {
-                        s->dsp.vc1_h_overlap(s->dest[1], s->uvlinesize);
-                        s->dsp.vc1_h_overlap(s->dest[2], s->uvlinesize);
-                    }
-                }
-                s->dsp.vc1_h_overlap(s->dest[0] + 8, s->linesize);
-                s->dsp.vc1_h_overlap(s->dest[0] + 8 * s->linesize + 8, s->linesize);
-                if(!s->first_slice_line) {
-                    s->dsp.vc1_v_overlap(s->dest[0], s->linesize);
-                    s->dsp.vc1_v_overlap(s->dest[0] + 8, s->linesize);
-                    if(!(s->flags & CODEC_FLAG_GRAY)) {
-                        s->dsp.vc1_v_overlap(s->dest[1], s->uvlinesize);
-                        s->dsp.vc1_v_overlap(s->dest[2], s->uvlinesize);
-                    }
-                }
-                s->dsp.vc1_v_overlap(s->dest[0] + 8 * s->linesize, s->linesize);
-                s->dsp.vc1_v_overlap(s->dest[0] + 8 * s->linesize + 8, s->linesize);
-            }
-            if(v->s.loop_filter) vc1_loop_filter_iblk(s, v->pq);
+            if(!v->filter_deferred)
+                vc1_filter_iblk(v, overlap);
 
             if(get_bits_count(&s->gb) > v->bits) {
-                ff_er_add_slice(s, 0, 0, s->mb_x, s->mb_y, (AC_END|DC_END|MV_END));
+                ff_er_add_slice(s, 0, s->start_mb_y, s->mb_x, s->mb_y, (AC_END|DC_END|MV_END));
                 av_log(s->avctx, AV_LOG_ERROR, "Bits overconsumption: %i > %i\n", get_bits_count(&s->gb), v->bits);
+                vc1_finish_row(v, s->mb_x + 1);
                 return;
             }
         }
-        ff_draw_horiz_band(s, s->mb_y * 16, 16);
+        vc1_finish_row(v, s->mb_width);
         s->first_slice_line = 0;
     }
-    ff_er_add_slice(s, 0, 0, s->mb_width - 1, s->mb_height - 1, (AC_END|DC_END|MV_END));
+    ff_er_add_slice(s, 0, s->start_mb_y, s->mb_width - 1, s->end_mb_y - 1, (AC_END|DC_END|MV_END));
 }
 
 static void vc1_decode_p_blocks(VC1Context *v)
@@ -2846,7 +2875,7 @@ static void vc1_decode_p_blocks(VC1Context *v)
 
     s->first_slice_line = 1;
     memset(v->cbp_base, 0, sizeof(v->cbp_base[0])*2*s->mb_stride);
-    for(s->mb_y = 0; s->mb_y < s->mb_height; s->mb_y++) {
+    for(s->mb_y = s->start_mb_y; s->mb_y < s->end_mb_y; s->mb_y++) {
         s->mb_x = 0;
         ff_init_block_index(s);
         for(; s->mb_x < s->mb_width; s->mb_x++) {
@@ -2854,7 +2883,7 @@ static void vc1_decode_p_blocks(VC1Context *v)
 
             vc1_decode_p_mb(v);
             if(get_bits_count(&s->gb) > v->bits || get_bits_count(&s->gb) < 0) {
-                ff_er_add_slice(s, 0, 0, s->mb_x, s->mb_y, (AC_END|DC_END|MV_END));
+                ff_er_add_slice(s, 0, s->start_mb_y, s->mb_x, s->mb_y, (AC_END|DC_END|MV_END));
                 av_log(s->avctx, AV_LOG_ERROR, "Bits overconsumption: %i > %i at %ix%i\n", get_bits_count(&s->gb), v->bits,s->mb_x,s->mb_y);
                 return;
             }
@@ -2863,7 +2892,7 @@ static void vc1_decode_p_blocks(VC1Context *v)
         ff_draw_horiz_band(s, s->mb_y * 16, 16);
         s->first_slice_line = 0;
     }
-    ff_er_add_slice(s, 0, 0, s->mb_width - 1, s->mb_height - 1, (AC_END|DC_END|MV_END));
+    ff_er_add_slice(s, 0, s->start_mb_y, s->mb_width - 1, s->end_mb_y - 1, (AC_END|DC_END|MV_END));
 }
 
 static void vc1_decode_b_blocks(VC1Context *v)
@@ -2896,7 +2925,7 @@ static void vc1_decode_b_blocks(VC1Context *v)
     }
 
     s->first_slice_line = 1;
-    for(s->mb_y = 0; s->mb_y < s->mb_height; s->mb_y++) {
+    for(s->mb_y = s->start_mb_y; s->mb_y < s->end_mb_y; s->mb_y++) {
         s->mb_x = 0;
         ff_init_block_index(s);
         for(; s->mb_x < s->mb_width; s->mb_x++) {
@@ -2904,16 +2933,18 @@ static void vc1_decode_b_blocks(VC1Context *v)
 
             vc1_decode_b_mb(v);
             if(get_bits_count(&s->gb) > v->bits || get_bits_count(&s->gb) < 0) {
-                ff_er_add_slice(s, 0, 0, s->mb_x, s->mb_y, (AC_END|DC_END|MV_END));
+                ff_er_add_slice(s, 0, s->start_mb_y, s->mb_x, s->mb_y, (AC_END|DC_END|MV_END));
                 av_log(s->avctx, AV_LOG_ERROR, "Bits overconsumption: %i > %i at %ix%i\n", get_bits_count(&s->gb), v->bits,s->mb_x,s->mb_y);
+                vc1_finish_row(v, s->mb_x);
                 return;
             }
-            if(v->s.loop_filter) vc1_loop_filter_iblk(s, v->pq);
+            if(!v->filter_deferred)
+                vc1_filter_iblk(v, 0);
         }
-        ff_draw_horiz_band(s, s->mb_y * 16, 16);
+        vc1_finish_row(v, s->mb_width);
         s->first_slice_line = 0;
     }
-    ff_er_add_slice(s, 0, 0, s->mb_width - 1, s->mb_height - 1, (AC_END|DC_END|MV_END));
+    ff_er_add_slice(s, 0, s->start_mb_y, s->mb_width - 1, s->end_mb_y - 1, (AC_END|DC_END|MV_END));
 }
 
 static void vc1_decode_skip_blocks(VC1Context *v)
@@ -2969,6 +3000,244 @@ static void vc1_decode_blocks(VC1Context *v)
     }
 }
 
+/** Check that a picture header repeated in a slice header matches the
+ * current picture
+ * The header is parsed into a copy of the context with bitplanes of its
+ * own, the current picture has been started already and must not change.
+ * @param gb reader positioned at the header, moved past it on success
+ * @return 0 if the header matches, -1 otherwise
+ */
+static int vc1_check_slice_picture_header(VC1Context *v, GetBitContext *gb)
+{
+    MpegEncContext *s = &v->s;
+    int plane_size = s->mb_stride * s->mb_height;
+    VC1Context *h = av_malloc(sizeof(VC1Context));
+    uint8_t *planes = av_malloc(5 * plane_size);
+    int ret = -1;
+
+    if(!h || !planes)
+        goto end;
+    memcpy(h, v, sizeof(VC1Context));
+    h->acpred_plane     = planes;
+    h->over_flags_plane = planes +     plane_size;
+    h->mv_type_mb_plane = planes + 2 * plane_size;
+    h->direct_mb_plane  = planes + 3 * plane_size;
+    h->s.mbskip_table   = planes + 4 * plane_size;
+    h->s.gb = *gb;
+    if(vc1_parse_frame_header_adv(h, &h->s.gb) == -1)
+        goto end;
+
+    if(h->s.pict_type != s->pict_type || h->p_frame_skipped != v->p_frame_skipped
+       || h->bi_type != v->bi_type || h->pq != v->pq || h->halfpq != v->halfpq
+       || h->pquantizer != v->pquantizer || h->rnd != v->rnd
+       || h->c_ac_table_index != v->c_ac_table_index || h->y_ac_table_index != v->y_ac_table_index
+       || h->s.dc_table_index != s->dc_table_index
+       || h->dquantfrm != v->dquantfrm || h->dqprofile != v->dqprofile
+       || h->dqsbedge != v->dqsbedge || h->dqbilevel != v->dqbilevel || h->altpq != v->altpq)
+        goto end;
+    switch(s->pict_type) {
+    case FF_I_TYPE:
+        if(h->condover != v->condover)
+            goto end;
+        if(h->acpred_is_raw != v->acpred_is_raw
+           || (!v->acpred_is_raw && memcmp(h->acpred_plane, v->acpred_plane, plane_size)))
+            goto end;
+        if(v->condover == CONDOVER_SELECT && (h->overflg_is_raw != v->overflg_is_raw
+           || (!v->overflg_is_raw && memcmp(h->over_flags_plane, v->over_flags_plane, plane_size))))
+            goto end;
+        break;
+    case FF_P_TYPE:
+        if(v->p_frame_skipped)
+            break;
+        if(h->mvrange != v->mvrange || h->mv_mode != v->mv_mode || h->mv_mode2 != v->mv_mode2
+           || h->use_ic != v->use_ic || (v->use_ic && (h->lumscale != v->lumscale || h->lumshift != v->lumshift))
+           || h->s.mv_table_index != s->mv_table_index || h->cbpcy_vlc != v->cbpcy_vlc
+           || h->ttmbf != v->ttmbf || h->ttfrm != v->ttfrm)
+            goto end;
+        if(h->mv_type_is_raw != v->mv_type_is_raw
+           || (!v->mv_type_is_raw && memcmp(h->mv_type_mb_plane, v->mv_type_mb_plane, plane_size)))
+            goto end;
+        if(h->skip_is_raw != v->skip_is_raw
+           || (!v->skip_is_raw && memcmp(h->s.mbskip_table, s->mbskip_table, plane_size)))
+            goto end;
+        break;
+    case FF_B_TYPE:
+        if(v->bi_type) {
+            if(h->acpred_is_raw != v->acpred_is_raw
+               || (!v->acpred_is_raw && memcmp(h->acpred_plane, v->acpred_plane, plane_size)))
+                goto end;
+            break;
+        }
+        if(h->mvrange != v->mvrange || h->mv_mode != v->mv_mode || h->bfraction != v->bfraction
+           || h->s.mv_table_index != s->mv_table_index || h->cbpcy_vlc != v->cbpcy_vlc
+           || h->ttmbf != v->ttmbf || h->ttfrm != v->ttfrm)
+            goto end;
+        if(h->dmb_is_raw != v->dmb_is_raw
+           || (!v->dmb_is_raw && memcmp(h->direct_mb_plane, v->direct_mb_plane, plane_size)))
+            goto end;
+        if(h->skip_is_raw != v->skip_is_raw
+           || (!v->skip_is_raw && memcmp(h->s.mbskip_table, s->mbskip_table, plane_size)))
+            goto end;
+        break;
+    }
+    *gb = h->s.gb;
+    ret = 0;
+end:
+    av_free(planes);
+    av_free(h);
+    return ret;
+}
+
+/** Read the slice headers of the current picture
+ * Slices with an invalid address or a picture header not matching the
+ * current one are merged into the preceding slice, which will end with an
+ * error.
+ */
+static void vc1_parse_slice_headers(VC1Context *v)
+{
+    MpegEncContext *s = &v->s;
+    int i, n = 1;
+
+    for(i = 1; i < v->slice_count; i++) {
+        VC1Slice *slice = &v->slices[i];
+        GetBitContext gb = slice->gb;
+        int mb_y;
+
+        mb_y = get_bits(&gb, 9);
+        if(mb_y <= v->slices[n - 1].start_mb_y || mb_y >= s->mb_height) {
+            av_log(s->avctx, AV_LOG_ERROR, "Invalid slice address %d\n", mb_y);
+            continue;
+        }
+        if(get_bits1(&gb) && vc1_check_slice_picture_header(v, &gb) < 0) {
+            av_log(s->avctx, AV_LOG_ERROR, "Invalid picture header in slice %d\n", mb_y);
+            continue;
+        }
+        v->slices[n - 1].end_mb_y = mb_y;
+        v->slices[n] = *slice;
+        v->slices[n].gb = gb;
+        v->slices[n].start_mb_y = mb_y;
+        n++;
+    }
+    v->slices[n - 1].end_mb_y = s->mb_height;
+    v->slice_count = n;
+}
+
+/** Prepare the slice thread context i for decoding a part of the current picture
+ */
+static void vc1_update_thread_context(VC1Context *v, int i)
+{
+    MpegEncContext *s = &v->s;
+    VC1Context *vx = v->thread_context[i];
+    uint32_t *cbp_base = vx->cbp_base;
+
+    ff_update_duplicate_context(s->thread_context[i], s);
+    memcpy(vx, v, sizeof(*vx));
+    vx->s = *s->thread_context[i];
+    vx->s.error_count = 0;
+    vx->cbp_base = cbp_base;
+    vx->cbp = cbp_base + s->mb_stride;
+}
+
+static int vc1_decode_slice_thread(AVCodecContext *avctx, void *arg, int jobnr, int threadnr)
+{
+    VC1Context *v0 = avctx->priv_data;
+    VC1Context *v = v0->thread_context[threadnr];
+    const VC1Slice *slice = &v0->slices[jobnr];
+
+    v->s.gb = slice->gb;
+    v->bits = slice->bits;
+    v->s.start_mb_y = slice->start_mb_y;
+    v->s.end_mb_y = slice->end_mb_y;
+    vc1_decode_blocks(v);
+    return 0;
+}
+
+/** Decode the slices of the current picture in parallel
+ * Predictions and filters do not cross the top of a slice, so that the
+ * slices are independent of each other.
+ */
+static void vc1_decode_slices(VC1Context *v)
+{
+    MpegEncContext *s = &v->s;
+    AVCodecContext *avctx = s->avctx;
+    int i;
+
+    for(i = 1; i < avctx->thread_count; i++)
+        vc1_update_thread_context(v, i);
+
+    avctx->execute2(avctx, vc1_decode_slice_thread, NULL, NULL, v->slice_count);
+
+    for(i = 1; i < avctx->thread_count; i++) {
+        int error_count = v->thread_context[i]->s.error_count;
+        if(error_count == INT_MAX || s->error_count == INT_MAX)
+            s->error_count = INT_MAX;
+        else
+            s->error_count += error_count;
+    }
+}
+
+/** Apply overlap smoothing and the loop filter to the rows decoded so far,
+ * waiting for the decoding job to finish them
+ * @param v the filter context, see vc1_decode_deferred()
+ */
+static int vc1_filter_deferred_rows(VC1Context *v)
+{
+    VC1Context *v0 = v->s.avctx->priv_data;
+    MpegEncContext *s = &v->s;
+    int end;
+
+    for(s->mb_y = 0; s->mb_y < s->mb_height; s->mb_y++) {
+        ff_thread_await_row_progress(s->avctx, s->mb_y);
+        end = FFMIN(v0->filter_mb_end - s->mb_y * s->mb_width, s->mb_width);
+        if(end <= 0)
+            break;
+
+        s->first_slice_line = !s->mb_y;
+        s->mb_x = 0;
+        ff_init_block_index(s);
+        for(; s->mb_x < end; s->mb_x++) {
+            ff_update_block_index(s);
+            vc1_filter_iblk(v, vc1_mb_overlap(v));
+        }
+        if(end < s->mb_width)
+            break;
+        ff_draw_horiz_band(s, s->mb_y * 16, 16);
+    }
+    return 0;
+}
+
+static int vc1_decode_deferred_job(AVCodecContext *avctx, void *arg, int jobnr, int threadnr)
+{
+    VC1Context *v = avctx->priv_data;
+    int row;
+
+    if(!jobnr)
+        return vc1_filter_deferred_rows(v->thread_context[1]);
+
+    vc1_decode_blocks(v);
+
+    /* wake up the filter job, filter_mb_end tells it where to stop */
+    for(row = 0; row < v->s.mb_height; row++)
+        ff_thread_report_row_progress(avctx, row);
+    return 0;
+}
+
+/** Decode a single slice I or B picture while a second slice thread applies
+ * overlap smoothing and the loop filter to the decoded rows. Intra prediction
+ * works on coefficients and B pictures only read the reference pictures, so
+ * the filter can lag behind decoding.
+ */
+static void vc1_decode_deferred(VC1Context *v)
+{
+    AVCodecContext *avctx = v->s.avctx;
+
+    v->filter_mb_end = 0;
+    vc1_update_thread_context(v, 1);
+
+    /* only the first job may wait for row progress */
+    avctx->execute2(avctx, vc1_decode_deferred_job, NULL, NULL, 2);
+}
+
 /** Initialize a VC1/WMV3 decoder
  * @todo TODO: Handle VC-1 IDUs (Transport level?)
  * @todo TODO: Decypher remaining bits in extra_data
@@ -2978,6 +3247,7 @@ static av_cold int vc1_decode_init(AVCodecContext *avctx)
     VC1Context *v = avctx->priv_data;
     MpegEncContext *s = &v->s;
     GetBitContext gb;
+    int i;
 
     if (!avctx->extradata_size || !avctx->extradata) return -1;
     if (!(avctx->flags & CODEC_FLAG_GRAY))
@@ -3100,6 +3370,21 @@ static av_cold int vc1_decode_init(AVCodecContext *avctx)
 //            return -1;
     }
 
+    v->slices = av_malloc(sizeof(v->slices[0]) * (s->mb_height + 1));
+    if (!v->slices)
+        return -1;
+
+    /* the slice thread contexts share everything but the per thread buffers */
+    v->thread_context[0] = v;
+    for (i = 1; i < avctx->thread_count; i++) {
+        v->thread_context[i] = av_mallocz(sizeof(VC1Context));
+        if (!v->thread_context[i])
+            return -1;
+        v->thread_context[i]->cbp_base = av_malloc(sizeof(v->cbp_base[0]) * 2 * s->mb_stride);
+        if (!v->thread_context[i]->cbp_base)
+            return -1;
+    }
+
     ff_intrax8_common_init(&v->x8,s);
     return 0;
 }
@@ -3119,6 +3404,7 @@ static int vc1_decode_frame(AVCodecContext *avctx,
     AVFrame *pict = data;
     uint8_t *buf2 = NULL;
     const uint8_t *buf_start = buf;
+    int buf_size2 = 0;
 
     /* no supplementary picture */
     if (buf_size == 0) {
@@ -3147,14 +3433,15 @@ static int vc1_decode_frame(AVCodecContext *avctx,
             avctx->pix_fmt = PIX_FMT_VDPAU_VC1;
     }
 
+    v->slice_count = 1;
+
     //for advanced profile we may need to parse and unescape data
     if (avctx->codec_id == CODEC_ID_VC1) {
-        int buf_size2 = 0;
         buf2 = av_mallocz(buf_size + FF_INPUT_BUFFER_PADDING_SIZE);
 
         if(IS_MARKER(AV_RB32(buf))){ /* frame starts with marker and needs to be parsed */
             const uint8_t *start, *end, *next;
-            int size;
+            int size, slice_pos = 0;
 
             next = buf;
             for(start = buf, end = buf + buf_size; next < end; start = next){
@@ -3167,16 +3454,29 @@ static int vc1_decode_frame(AVCodecContext *avctx,
                         s->avctx->codec->capabilities&CODEC_CAP_HWACCEL_VDPAU)
                         buf_start = start;
                     buf_size2 = vc1_unescape_buffer(start + 4, size, buf2);
+                    slice_pos = buf_size2;
                     break;
                 case VC1_CODE_ENTRYPOINT: /* it should be before frame data */
                     buf_size2 = vc1_unescape_buffer(start + 4, size, buf2);
                     init_get_bits(&s->gb, buf2, buf_size2*8);
                     vc1_decode_entry_point(avctx, v, &s->gb);
                     break;
-                case VC1_CODE_SLICE:
-                    av_log(avctx, AV_LOG_ERROR, "Sliced decoding is not implemented (yet)\n");
-                    av_free(buf2);
-                    return -1;
+                case VC1_CODE_SLICE: {
+                    /* slices follow the frame data in buf2, their headers are read later */
+                    VC1Slice *slice = &v->slices[v->slice_count];
+                    int slice_size;
+
+                    if(v->slice_count > s->mb_height) {
+                        av_log(avctx, AV_LOG_ERROR, "Too many slices\n");
+                        break;
+                    }
+                    slice_size = vc1_unescape_buffer(start + 4, size, buf2 + slice_pos);
+                    init_get_bits(&slice->gb, buf2 + slice_pos, slice_size*8);
+                    slice->bits = slice_size*8;
+                    slice_pos += slice_size;
+                    v->slice_count++;
+                    break;
+                }
                 }
             }
         }else if(v->interlace && ((buf[0] & 0xC0) == 0xC0)){ /* WVC1 interlaced stores both fields divided by marker */
@@ -3269,8 +3569,30 @@ static int vc1_decode_frame(AVCodecContext *avctx,
     } else {
         ff_er_frame_start(s);
 
-        v->bits = buf_size * 8;
-        vc1_decode_blocks(v);
+        v->slices[0].gb = s->gb;
+        v->slices[0].bits = v->slice_count > 1 ? buf_size2 * 8 : buf_size * 8;
+        v->slices[0].start_mb_y = 0;
+        if(v->x8_type || v->p_frame_skipped)
+            v->slice_count = 1;
+        vc1_parse_slice_headers(v);
+
+        if(v->slice_count > 1) {
+            v->filter_deferred = 0;
+            vc1_decode_slices(v);
+        } else {
+            s->gb = v->slices[0].gb;
+            v->bits = v->slices[0].bits;
+            s->start_mb_y = 0;
+            s->end_mb_y = s->mb_height;
+            v->filter_deferred = (avctx->flags2 & CODEC_FLAG2_DEFER_DEBLOCK) && avctx->thread_count > 1
+                                 && (s->pict_type == FF_I_TYPE || s->pict_type == FF_B_TYPE) && !v->x8_type
+                                 && (s->loop_filter || v->overlap)
+                                 && ff_thread_init_row_progress(avctx, s->mb_height) >= 0;
+            if(v->filter_deferred)
+                vc1_decode_deferred(v);
+            else
+                vc1_decode_blocks(v);
+        }
 //av_log(s->avctx, AV_LOG_INFO, "Consumed %i/%i bits\n", get_bits_count(&s->gb), buf_size*8);
 //  if(get_bits_count(&s->gb) > buf_size * 8)
 //      return -1;
@@ -3303,7 +3625,15 @@ assert(s->current_picture.pict_type == s->pict_type);
 static av_cold int vc1_decode_end(AVCodecContext *avctx)
 {
     VC1Context *v = avctx->priv_data;
+    int i;
 
+    for (i = 1; i < MAX_THREADS; i++) {
+        if (v->thread_context[i]) {
+            av_freep(&v->thread_context[i]->cbp_base);
+            av_freep(&v->thread_context[i]);
+        }
+    }
+    av_freep(&v->slices);
     av_freep(&v->hrd_rate);
     av_freep(&v->hrd_buffer);
     MPV_common_end(&v->s);
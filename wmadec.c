@@ -790,14 +790,22 @@ static int wma_decode_frame(WMACodecContext *s, int16_t *samples)
     /* convert frame to integer */
     n = s->frame_len;
     incr = s->nb_channels;
-    for(ch = 0; ch < s->nb_channels; ch++) {
-        ptr = samples + ch;
-        iptr = s->frame_out[ch];
+    /* the C version expects biased input, the SIMD ones convert directly */
+    if (s->dsp.float_to_int16_interleave != ff_float_to_int16_interleave_c) {
+        const float *output[MAX_CHANNELS] = { s->frame_out[0], s->frame_out[1] };
+        s->dsp.float_to_int16_interleave(samples, output, n, incr);
+    } else {
+        for(ch = 0; ch < s->nb_channels; ch++) {
+            ptr = samples + ch;
+            iptr = s->frame_out[ch];
 
-        for(i=0;i<n;i++) {
-            *ptr = av_clip_int16(lrintf(*iptr++));
-            ptr += incr;
+            for(i=0;i<n;i++) {
+                *ptr = av_clip_int16(lrintf(*iptr++));
+                ptr += incr;
+            }
         }
+    }
+    for(ch = 0; ch < s->nb_channels; ch++) {
         /* prepare for next block */
         memmove(&s->frame_out[ch][0], &s->frame_out[ch][s->frame_len],
                 s->frame_len * sizeof(float));
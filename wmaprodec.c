@@ -103,6 +103,7 @@
 #define WMAPRO_BLOCK_MAX_BITS 12                                           ///< log2 of max block size
 #define WMAPRO_BLOCK_MAX_SIZE (1 << WMAPRO_BLOCK_MAX_BITS)                 ///< maximum block size
 #define WMAPRO_BLOCK_SIZES    (WMAPRO_BLOCK_MAX_BITS - BLOCK_MIN_BITS + 1) ///< possible block sizes
+#define WMAPRO_CT_BLOCK_SIZE  64                                           ///< samples per channel transform block
 
 
 #define VLCBITS            9
@@ -950,6 +951,42 @@ static int decode_scale_factors(WMAProDecodeCtx* s)
     return 0;
 }
 
+/**
+ *@brief Multiply a band of samples with the decorrelation matrix.
+ *The samples are processed in blocks that are small enough to be copied
+ *to the stack, so that every output channel can be computed with vector
+ *operations from the unmodified input channels.
+ *@param dsp DSP functions
+ *@param ch_data channel data of the channel group
+ *@param num_channels number of channels in the group
+ *@param mat num_channels * num_channels decorrelation matrix
+ *@param start first sample of the band, multiple of 4
+ *@param end end of the band, multiple of 4
+ */
+static void decorrelate_band(DSPContext *dsp, float **ch_data,
+                             int num_channels, const float *mat,
+                             int start, int end)
+{
+    DECLARE_ALIGNED_16(float, data)[WMAPRO_MAX_CHANNELS][WMAPRO_CT_BLOCK_SIZE];
+    int y;
+
+    for (y = start; y < end; y += WMAPRO_CT_BLOCK_SIZE) {
+        const int len = FFMIN(end - y, WMAPRO_CT_BLOCK_SIZE);
+        const float* m = mat;
+        int c, k;
+
+        for (c = 0; c < num_channels; c++)
+            memcpy(data[c], ch_data[c] + y, len * sizeof(**data));
+
+        for (c = 0; c < num_channels; c++) {
+            float* dst = ch_data[c] + y;
+            dsp->vector_fmul_scalar(dst, data[0], *m++, len);
+            for (k = 1; k < num_channels; k++)
+                dsp->vector_fmac_scalar(dst, data[k], *m++, len);
+        }
+    }
+}
+
 /**
  *@brief Reconstruct the individual channel data.
  *@param s codec context
@@ -960,37 +997,19 @@ static void inverse_channel_transform(WMAProDecodeCtx *s)
 
     for (i = 0; i < s->num_chgroups; i++) {
         if (s->chgroup[i].transform) {
-            float data[WMAPRO_MAX_CHANNELS];
             const int num_channels = s->chgroup[i].num_channels;
             float** ch_data = s->chgroup[i].channel_data;
-            float** ch_end = ch_data + num_channels;
             const int8_t* tb = s->chgroup[i].transform_band;
             int16_t* sfb;
 
             /** multichannel decorrelation */
             for (sfb = s->cur_sfb_offsets;
                  sfb < s->cur_sfb_offsets + s->num_bands; sfb++) {
-                int y;
                 if (*tb++ == 1) {
                     /** multiply values with the decorrelation_matrix */
-                    for (y = sfb[0]; y < FFMIN(sfb[1], s->subframe_len); y++) {
-                        const float* mat = s->chgroup[i].decorrelation_matrix;
-                        const float* data_end = data + num_channels;
-                        float* data_ptr = data;
-                        float** ch;
-
-                        for (ch = ch_data; ch < ch_end; ch++)
-                            *data_ptr++ = (*ch)[y];
-
-                        for (ch = ch_data; ch < ch_end; ch++) {
-                            float sum = 0;
-                            data_ptr = data;
-                            while (data_ptr < data_end)
-                                sum += *data_ptr++ * *mat++;
-
-                            (*ch)[y] = sum;
-                        }
-                    }
+                    decorrelate_band(&s->dsp, ch_data, num_channels,
+                                     s->chgroup[i].decorrelation_matrix,
+                                     sfb[0], FFMIN(sfb[1], s->subframe_len));
                 } else if (s->num_channels == 2) {
                     int len = FFMIN(sfb[1], s->subframe_len) - sfb[0];
                     s->dsp.vector_fmul_scalar(ch_data[0] + sfb[0],
@@ -1350,8 +1369,10 @@ static int decode_frame(WMAProDecodeCtx *s)
 
         ptr = s->samples + i;
 
+        s->dsp.vector_clipf(iptr, iptr, -1.0, 32767.0 / 32768.0,
+                            s->samples_per_frame);
         for (x = 0; x < s->samples_per_frame; x++) {
-            *ptr = av_clipf(*iptr++, -1.0, 32767.0 / 32768.0);
+            *ptr = *iptr++;
             ptr += incr;
         }
 
@@ -1575,3 +1596,92 @@ AVCodec wmapro_decoder = {
     .flush= flush,
     .long_name = NULL_IF_CONFIG_SMALL("Windows Media Audio 9 Professional"),
 };
+
+#ifdef TEST
+#undef printf
+#undef random
+#include <stdio.h>
+#include "libavutil/lfg.h"
+
+#define FRAME_LEN 2048
+#define CHANNELS  6
+#define FRAMES    1000
+
+/**
+ * Scalar multichannel decorrelation, as done before the transform
+ * was vectorized; serves as reference and for the speed comparison.
+ */
+static void decorrelate_band_ref(float **ch_data, int num_channels,
+                                 const float *matrix, int start, int end)
+{
+    float data[WMAPRO_MAX_CHANNELS];
+    int y, c, k;
+
+    for (y = start; y < end; y++) {
+        const float* mat = matrix;
+        for (c = 0; c < num_channels; c++)
+            data[c] = ch_data[c][y];
+        for (c = 0; c < num_channels; c++) {
+            float sum = 0;
+            for (k = 0; k < num_channels; k++)
+                sum += data[k] * *mat++;
+            ch_data[c][y] = sum;
+        }
+    }
+}
+
+/**
+ * Checks the vectorized channel transform against the scalar one on
+ * random 5.1 frames and prints the cost of both per frame.
+ */
+int main(void)
+{
+    static DECLARE_ALIGNED_16(float, ref)[CHANNELS][FRAME_LEN];
+    static DECLARE_ALIGNED_16(float, opt)[CHANNELS][FRAME_LEN];
+    float matrix[CHANNELS * CHANNELS];
+    float *ref_data[CHANNELS], *opt_data[CHANNELS];
+    AVCodecContext avctx;
+    DSPContext dsp;
+    AVLFG prng;
+    int i, c, ret = 0;
+
+    memset(&avctx, 0, sizeof(avctx));
+    dsputil_init(&dsp, &avctx);
+    av_lfg_init(&prng, 1);
+
+    for (i = 0; i < CHANNELS * CHANNELS; i++)
+        matrix[i] = (av_lfg_get(&prng) & 0xFFFF) / 32768.0 - 1.0;
+    for (c = 0; c < CHANNELS; c++) {
+        ref_data[c] = ref[c];
+        opt_data[c] = opt[c];
+    }
+
+    for (i = 0; i < FRAMES && !ret; i++) {
+        int y;
+        for (c = 0; c < CHANNELS; c++)
+            for (y = 0; y < FRAME_LEN; y++)
+                ref[c][y] = opt[c][y] = (int)av_lfg_get(&prng) / 65536.0;
+
+        {
+            START_TIMER
+            decorrelate_band_ref(ref_data, CHANNELS, matrix, 0, FRAME_LEN);
+            STOP_TIMER("channel transform scalar");
+        }
+        {
+            START_TIMER
+            decorrelate_band(&dsp, opt_data, CHANNELS, matrix, 0, FRAME_LEN);
+            STOP_TIMER("channel transform vector");
+        }
+
+        for (c = 0; c < CHANNELS; c++)
+            for (y = 0; y < FRAME_LEN; y++)
+                if (fabs(ref[c][y] - opt[c][y]) > 1e-3 * (fabs(ref[c][y]) + 1)) {
+                    printf("mismatch in channel %d at sample %d: %f %f\n",
+                           c, y, ref[c][y], opt[c][y]);
+                    ret = 1;
+                    break;
+                }
+    }
+    return ret;
+}
+#endif /* TEST */
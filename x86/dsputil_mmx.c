@@ -966,6 +966,101 @@ PAETH(mmx2, ABS3_MMX2)
 PAETH(ssse3, ABS3_SSSE3)
 #endif
 
+/* PNG average unfilter for bpp 3 and 4, one pixel per iteration since each
+ * pixel depends on the previous one; (a + b) >> 1 is pavgb minus the
+ * rounding bit. This might write to dst[w]. */
+static void add_png_avg_prediction_mmx2(uint8_t *dst, uint8_t *src, uint8_t *top, int w, int bpp)
+{
+    x86_reg i = -bpp;
+    x86_reg end = w-3;
+    __asm__ volatile(
+        "movd    (%1,%0), %%mm0 \n"
+        "movq      %6,    %%mm7 \n"
+        "add       %4, %0 \n"
+        "1: \n"
+        "movd    (%2,%0), %%mm1 \n"
+        "movq      %%mm0, %%mm2 \n"
+        "pxor      %%mm1, %%mm2 \n"
+        "pavgb     %%mm1, %%mm0 \n"
+        "pand      %%mm7, %%mm2 \n"
+        "movd    (%3,%0), %%mm1 \n"
+        "psubb     %%mm2, %%mm0 \n"
+        "paddb     %%mm1, %%mm0 \n"
+        "movd      %%mm0, (%1,%0) \n"
+        "add       %4, %0 \n"
+        "cmp       %5, %0 \n"
+        "jle 1b \n"
+        :"+r"(i)
+        :"r"(dst), "r"(top), "r"(src), "r"((x86_reg)bpp), "g"(end),
+         "m"(ff_pb_1)
+        :"memory"
+    );
+}
+
+void ff_png_rgba_to_rgb32(uint8_t *dst, const uint8_t *src, int w);
+
+DECLARE_ALIGNED_16(static const uint64_t, png_rgba_ga_mask)[2] =
+{0xFF00FF00FF00FF00ULL, 0xFF00FF00FF00FF00ULL};
+
+/* swaps R and B of 4 pixels at a time, the rest is done in C */
+static void png_rgba_to_rgb32_sse2(uint8_t *dst, const uint8_t *src, int w)
+{
+    x86_reg i = 0;
+    x86_reg end = (w & ~3) * 4;
+    if (end) {
+        __asm__ volatile(
+            "movdqa    %4, %%xmm7 \n"
+            "1: \n"
+            "movdqu  (%2,%0), %%xmm0 \n"
+            "movdqa    %%xmm0, %%xmm1 \n"
+            "pand      %%xmm7, %%xmm0 \n"
+            "psllw     $8, %%xmm1 \n"
+            "psrlw     $8, %%xmm1 \n"
+            "pshuflw   $0xB1, %%xmm1, %%xmm1 \n"
+            "pshufhw   $0xB1, %%xmm1, %%xmm1 \n"
+            "por       %%xmm1, %%xmm0 \n"
+            "movdqu    %%xmm0, (%1,%0) \n"
+            "add       $16, %0 \n"
+            "cmp       %3, %0 \n"
+            "jl 1b \n"
+            :"+r"(i)
+            :"r"(dst), "r"(src), "r"(end), "m"(*png_rgba_ga_mask)
+            :"memory"
+        );
+    }
+    ff_png_rgba_to_rgb32(dst + i, src + i, w & 3);
+}
+
+#if HAVE_SSSE3
+DECLARE_ALIGNED_16(static const uint8_t, png_rgba_shuf)[16] =
+{2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15};
+
+static void png_rgba_to_rgb32_ssse3(uint8_t *dst, const uint8_t *src, int w)
+{
+    x86_reg i = 0;
+    x86_reg end = (w & ~7) * 4;
+    if (end) {
+        __asm__ volatile(
+            "movdqa    %4, %%xmm7 \n"
+            "1: \n"
+            "movdqu  (%2,%0), %%xmm0 \n"
+            "movdqu 16(%2,%0), %%xmm1 \n"
+            "pshufb    %%xmm7, %%xmm0 \n"
+            "pshufb    %%xmm7, %%xmm1 \n"
+            "movdqu    %%xmm0, (%1,%0) \n"
+            "movdqu    %%xmm1, 16(%1,%0) \n"
+            "add       $32, %0 \n"
+            "cmp       %3, %0 \n"
+            "jl 1b \n"
+            :"+r"(i)
+            :"r"(dst), "r"(src), "r"(end), "m"(*png_rgba_shuf)
+            :"memory"
+        );
+    }
+    ff_png_rgba_to_rgb32(dst + i, src + i, w & 7);
+}
+#endif
+
 #define QPEL_V_LOW(m3,m4,m5,m6, pw_20, pw_3, rnd, in0, in1, in2, in7, out, OP)\
         "paddw " #m4 ", " #m3 "           \n\t" /* x1 */\
         "movq "MANGLE(ff_pw_20)", %%mm4   \n\t" /* 20 */\
@@ -2281,6 +2376,45 @@ static void int32_to_float_fmul_scalar_sse2(float *dst, const int *src, float mu
     );
 }
 
+static void vector_fmul_scalar_sse(float *dst, const float *src, float mul,
+                                  int len)
+{
+    x86_reg i = (len-4)*4;
+    __asm__ volatile(
+        "movss  %3, %%xmm2 \n\t"
+        "shufps $0, %%xmm2, %%xmm2 \n\t"
+        "1: \n\t"
+        "movaps    (%2,%0), %%xmm0 \n\t"
+        "mulps      %%xmm2, %%xmm0 \n\t"
+        "movaps  %%xmm0,   (%1,%0) \n\t"
+        "sub  $16, %0 \n\t"
+        "jge 1b \n\t"
+        :"+&r"(i)
+        :"r"(dst), "r"(src), "m"(mul)
+        :"memory"
+    );
+}
+
+static void vector_fmac_scalar_sse(float *dst, const float *src, float mul,
+                                   int len)
+{
+    x86_reg i = (len-4)*4;
+    __asm__ volatile(
+        "movss  %3, %%xmm2 \n\t"
+        "shufps $0, %%xmm2, %%xmm2 \n\t"
+        "1: \n\t"
+        "movaps    (%2,%0), %%xmm0 \n\t"
+        "mulps      %%xmm2, %%xmm0 \n\t"
+        "addps     (%1,%0), %%xmm0 \n\t"
+        "movaps  %%xmm0,   (%1,%0) \n\t"
+        "sub  $16, %0 \n\t"
+        "jge 1b \n\t"
+        :"+&r"(i)
+        :"r"(dst), "r"(src), "m"(mul)
+        :"memory"
+    );
+}
+
 static void vector_clipf_sse(float *dst, const float *src, float min, float max,
                              int len)
 {
@@ -2777,6 +2911,7 @@ void dsputil_init_mmx(DSPContext* c, AVCodecContext *avctx)
                 ff_vc1dsp_init_mmx(c, avctx);
 
             c->add_png_paeth_prediction= add_png_paeth_prediction_mmx2;
+            c->add_png_avg_prediction= add_png_avg_prediction_mmx2;
         } else if (mm_flags & FF_MM_3DNOW) {
             c->prefetch = prefetch_3dnow;
 
@@ -2866,6 +3001,7 @@ void dsputil_init_mmx(DSPContext* c, AVCodecContext *avctx)
             if (CONFIG_VP6_DECODER) {
                 c->vp6_filter_diag4 = ff_vp6_filter_diag4_sse2;
             }
+            c->png_rgba_to_rgb32= png_rgba_to_rgb32_sse2;
         }
 #if HAVE_SSSE3
         if(mm_flags & FF_MM_SSSE3){
@@ -2888,6 +3024,7 @@ void dsputil_init_mmx(DSPContext* c, AVCodecContext *avctx)
             c->put_h264_chroma_pixels_tab[1]= put_h264_chroma_mc4_ssse3;
             c->avg_h264_chroma_pixels_tab[1]= avg_h264_chroma_mc4_ssse3;
             c->add_png_paeth_prediction= add_png_paeth_prediction_ssse3;
+            c->png_rgba_to_rgb32= png_rgba_to_rgb32_ssse3;
 #if HAVE_YASM
             c->add_hfyu_left_prediction = ff_add_hfyu_left_prediction_ssse3;
             if (mm_flags & FF_MM_SSE4) // not really sse4, just slow on Conroe
@@ -2964,6 +3101,8 @@ void dsputil_init_mmx(DSPContext* c, AVCodecContext *avctx)
             c->vector_fmul_add = vector_fmul_add_sse;
             c->vector_fmul_window = vector_fmul_window_sse;
             c->int32_to_float_fmul_scalar = int32_to_float_fmul_scalar_sse;
+            c->vector_fmul_scalar = vector_fmul_scalar_sse;
+            c->vector_fmac_scalar = vector_fmac_scalar_sse;
             c->vector_clipf = vector_clipf_sse;
             c->float_to_int16 = float_to_int16_sse;
             c->float_to_int16_interleave = float_to_int16_interleave_sse;
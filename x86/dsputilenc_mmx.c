@@ -745,6 +745,38 @@ static int vsad_intra16_mmx2(void *v, uint8_t * pix, uint8_t * dummy, int line_s
 }
 #undef SUM
 
+static int vsad_intra8_mmx2(void *v, uint8_t * pix, uint8_t * dummy, int line_size, int h) {
+    int tmp;
+
+#define SUM(in0, out0) \
+      "movq (%0), " #out0 "\n"\
+      "add %2,%0\n"\
+      "psadbw " #out0 ", " #in0 "\n"\
+      "paddw " #in0 ", %%mm6\n"
+
+  __asm__ volatile (
+      "movl %3,%%ecx\n"
+      "pxor %%mm6,%%mm6\n"
+      "movq (%0),%%mm0\n"
+      "add %2,%0\n"
+      "jmp 2f\n"
+      "1:\n"
+
+      SUM(%%mm4, %%mm0)
+      "2:\n"
+      SUM(%%mm0, %%mm4)
+
+      "subl $2, %%ecx\n"
+      "jnz 1b\n"
+
+      "movd %%mm6,%1\n"
+      : "+r" (pix), "=r"(tmp)
+      : "r" ((x86_reg)line_size) , "m" (h)
+      : "%ecx");
+    return tmp;
+}
+#undef SUM
+
 static int vsad16_mmx(void *v, uint8_t * pix1, uint8_t * pix2, int line_size, int h) {
     int tmp;
 
@@ -902,6 +934,133 @@ static void diff_bytes_mmx(uint8_t *dst, uint8_t *src1, uint8_t *src2, int w){
         dst[i+0] = src1[i+0]-src2[i+0];
 }
 
+#if CONFIG_PNG_ENCODER
+void ff_sub_png_paeth_prediction(uint8_t *dst, uint8_t *src, uint8_t *top, int w, int bpp);
+
+/* the prediction only depends on the unfiltered rows, so 8 pixels are
+ * predicted at once with the add_png_paeth_prediction selection logic */
+static void sub_png_paeth_prediction_sse2(uint8_t *dst, uint8_t *src, uint8_t *top, int w, int bpp)
+{
+    x86_reg i = 0;
+    x86_reg j = -bpp;
+
+    if (w >= 8) {
+        __asm__ volatile(
+            "pxor      %%xmm7, %%xmm7 \n\t"
+            "1:                       \n\t"
+            "movq    (%3,%1), %%xmm0  \n\t" /* a = src[i-bpp] */
+            "movq    (%4,%0), %%xmm1  \n\t" /* b = top[i] */
+            "movq    (%4,%1), %%xmm2  \n\t" /* c = top[i-bpp] */
+            "punpcklbw %%xmm7, %%xmm0 \n\t"
+            "punpcklbw %%xmm7, %%xmm1 \n\t"
+            "punpcklbw %%xmm7, %%xmm2 \n\t"
+            "movdqa    %%xmm1, %%xmm3 \n\t"
+            "movdqa    %%xmm0, %%xmm4 \n\t"
+            "psubw     %%xmm2, %%xmm3 \n\t" /* p  = b - c */
+            "psubw     %%xmm2, %%xmm4 \n\t" /* pc = a - c */
+            "movdqa    %%xmm3, %%xmm5 \n\t"
+            "paddw     %%xmm4, %%xmm5 \n\t"
+            "pxor      %%xmm6, %%xmm6 \n\t"
+            "psubw     %%xmm3, %%xmm6 \n\t"
+            "pmaxsw    %%xmm6, %%xmm3 \n\t" /* pa */
+            "pxor      %%xmm6, %%xmm6 \n\t"
+            "psubw     %%xmm4, %%xmm6 \n\t"
+            "pmaxsw    %%xmm6, %%xmm4 \n\t" /* pb */
+            "pxor      %%xmm6, %%xmm6 \n\t"
+            "psubw     %%xmm5, %%xmm6 \n\t"
+            "pmaxsw    %%xmm6, %%xmm5 \n\t" /* pc */
+            "movdqa    %%xmm4, %%xmm6 \n\t"
+            "pminsw    %%xmm5, %%xmm6 \n\t"
+            "pcmpgtw   %%xmm6, %%xmm3 \n\t" /* not a: pa > pb || pa > pc */
+            "pcmpgtw   %%xmm5, %%xmm4 \n\t" /* c rather than b: pb > pc */
+            "pand      %%xmm4, %%xmm2 \n\t"
+            "pandn     %%xmm1, %%xmm4 \n\t"
+            "por       %%xmm4, %%xmm2 \n\t"
+            "pand      %%xmm3, %%xmm2 \n\t"
+            "pandn     %%xmm0, %%xmm3 \n\t"
+            "por       %%xmm3, %%xmm2 \n\t"
+            "packuswb  %%xmm2, %%xmm2 \n\t"
+            "movq    (%3,%0), %%xmm0  \n\t"
+            "psubb     %%xmm2, %%xmm0 \n\t"
+            "movq      %%xmm0, (%2,%0)\n\t"
+            "add       $8, %0         \n\t"
+            "add       $8, %1         \n\t"
+            "cmp       %5, %0         \n\t"
+            "jle 1b                   \n\t"
+            : "+r"(i), "+r"(j)
+            : "r"(dst), "r"(src), "r"(top), "g"((x86_reg)w - 8)
+            : "memory"
+        );
+    }
+    if (i < w)
+        ff_sub_png_paeth_prediction(dst + i, src + i, top + i, w - i, bpp);
+}
+
+static void sub_png_avg_prediction_sse2(uint8_t *dst, uint8_t *src, uint8_t *top, int w, int bpp)
+{
+    x86_reg i = 0;
+
+    if (w >= 16) {
+        __asm__ volatile(
+            "movq      %6, %%xmm7     \n\t"
+            "punpcklqdq %%xmm7, %%xmm7\n\t"
+            "1:                       \n\t"
+            "movdqu  (%3,%0), %%xmm0  \n\t" /* src[i-bpp] */
+            "movdqu  (%4,%0), %%xmm1  \n\t" /* top[i] */
+            "movdqa    %%xmm0, %%xmm2 \n\t"
+            "pxor      %%xmm1, %%xmm2 \n\t"
+            "pavgb     %%xmm1, %%xmm0 \n\t"
+            "pand      %%xmm7, %%xmm2 \n\t"
+            "psubb     %%xmm2, %%xmm0 \n\t" /* (a + b) >> 1 */
+            "movdqu  (%2,%0), %%xmm1  \n\t"
+            "psubb     %%xmm0, %%xmm1 \n\t"
+            "movdqu    %%xmm1, (%1,%0)\n\t"
+            "add       $16, %0        \n\t"
+            "cmp       %5, %0         \n\t"
+            "jle 1b                   \n\t"
+            : "+r"(i)
+            : "r"(dst), "r"(src), "r"(src - bpp), "r"(top), "g"((x86_reg)w - 16),
+              "m"(ff_pb_1)
+            : "memory"
+        );
+    }
+    for (; i < w; i++)
+        dst[i] = src[i] - ((src[i - bpp] + top[i]) >> 1);
+}
+#endif /* CONFIG_PNG_ENCODER */
+
+static int sum_abs_int8_sse2(const uint8_t *src, int w)
+{
+    x86_reg i = 0;
+    int sum = 0;
+
+    if (w >= 16) {
+        __asm__ volatile(
+            "pxor      %%xmm6, %%xmm6 \n\t" /* sums */
+            "pxor      %%xmm7, %%xmm7 \n\t"
+            "1:                       \n\t"
+            "movdqu  (%2,%0), %%xmm0  \n\t"
+            "pxor      %%xmm1, %%xmm1 \n\t"
+            "pcmpgtb   %%xmm0, %%xmm1 \n\t" /* sign */
+            "pxor      %%xmm1, %%xmm0 \n\t"
+            "psubb     %%xmm1, %%xmm0 \n\t" /* abs, -128 becomes 128 unsigned */
+            "psadbw    %%xmm7, %%xmm0 \n\t"
+            "paddd     %%xmm0, %%xmm6 \n\t"
+            "add       $16, %0        \n\t"
+            "cmp       %3, %0         \n\t"
+            "jle 1b                   \n\t"
+            "movhlps   %%xmm6, %%xmm0 \n\t"
+            "paddd     %%xmm0, %%xmm6 \n\t"
+            "movd      %%xmm6, %1     \n\t"
+            : "+r"(i), "=r"(sum)
+            : "r"(src), "g"((x86_reg)w - 16)
+        );
+    }
+    for (; i < w; i++)
+        sum += abs((int8_t)src[i]);
+    return sum;
+}
+
 static void sub_hfyu_median_prediction_mmx2(uint8_t *dst, const uint8_t *src1, const uint8_t *src2, int w, int *left, int *left_top){
     x86_reg i=0;
     uint8_t l, lt;
@@ -1400,6 +1559,7 @@ void dsputilenc_init_mmx(DSPContext* c, AVCodecContext *avctx)
             c->hadamard8_diff[0]= hadamard8_diff16_mmx2;
             c->hadamard8_diff[1]= hadamard8_diff_mmx2;
             c->vsad[4]= vsad_intra16_mmx2;
+            c->vsad[5]= vsad_intra8_mmx2;
 
             if(!(avctx->flags & CODEC_FLAG_BITEXACT)){
                 c->vsad[0] = vsad16_mmx2;
@@ -1410,6 +1570,11 @@ void dsputilenc_init_mmx(DSPContext* c, AVCodecContext *avctx)
 
         if(mm_flags & FF_MM_SSE2){
             c->get_pixels = get_pixels_sse2;
+#if CONFIG_PNG_ENCODER
+            c->sub_png_paeth_prediction= sub_png_paeth_prediction_sse2;
+            c->sub_png_avg_prediction= sub_png_avg_prediction_sse2;
+#endif
+            c->sum_abs_int8= sum_abs_int8_sse2;
             c->sum_abs_dctelem= sum_abs_dctelem_sse2;
             c->hadamard8_diff[0]= hadamard8_diff16_sse2;
             c->hadamard8_diff[1]= hadamard8_diff_sse2;
@@ -0,0 +1,1144 @@
+/*
+ * SSE2/SSSE3 optimized H.264 intra prediction
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file libavcodec/x86/h264pred_sse2.c
+ * SSE2/SSSE3 optimized H.264 intra prediction.
+ *
+ * The directional 4x4 and 8x8 luma modes are computed on the whole
+ * (filtered) edge at once: every row of such a block is a byte-shifted
+ * copy of one or two edge vectors, so a block costs a few shifts and
+ * one store per row.
+ */
+
+#include "libavutil/x86_cpu.h"
+#include "libavcodec/h264pred.h"
+#include "dsputil_mmx.h"
+
+DECLARE_ASM_CONST(16, xmm_reg, pb_1) = {0x0101010101010101ULL, 0x0101010101010101ULL};
+DECLARE_ASM_CONST(16, int16_t, pw_0to7)[8] = {0, 1, 2, 3, 4, 5, 6, 7};
+
+#ifdef __SSE__
+#define XMM_CLOBBERS(...) __VA_ARGS__,
+#else
+#define XMM_CLOBBERS(...)
+#endif
+
+/**
+ * a = (a + 2*b + c + 2) >> 2 for unsigned bytes, t is clobbered.
+ * Needs pb_1 in xmm7.
+ */
+#define LOWPASS(a, b, c, t)                \
+    "movdqa    "#a", "#t"             \n\t"\
+    "pxor      "#c", "#t"             \n\t"\
+    "pavgb     "#c", "#a"             \n\t"\
+    "pand   %%xmm7 , "#t"             \n\t"\
+    "psubusb   "#t", "#a"             \n\t"\
+    "pavgb     "#b", "#a"             \n\t"
+
+/** d = bytes n..n+15 of the 32 byte vector hi:lo, t is clobbered */
+#define WINDOW(lo, hi, n, d, t)            \
+    "movdqa   "#lo", "#d"             \n\t"\
+    "movdqa   "#hi", "#t"             \n\t"\
+    "psrldq  $"#n" , "#d"             \n\t"\
+    "pslldq  $16-"#n", "#t"           \n\t"\
+    "por       "#t", "#d"             \n\t"
+
+/** keep only the low n bytes of a */
+#define LOW_BYTES(a, n)                    \
+    "pslldq  $16-"#n", "#a"           \n\t"\
+    "psrldq  $16-"#n", "#a"           \n\t"
+
+/** broadcast the 16 bit word in the low bits of a to all of a */
+#define SPLATW(a)                          \
+    "pshuflw $0, "#a", "#a"           \n\t"\
+    "punpcklqdq "#a", "#a"            \n\t"
+
+/** stores the low 8 bytes of a to 8 rows starting at %0, stride %1 */
+#define STORE8_ROWS(a)                     \
+    "movq  "#a", (%0)                 \n\t"\
+    "movq  "#a", (%0,%1)              \n\t"\
+    "lea   (%0,%1,2), %0              \n\t"\
+    "movq  "#a", (%0)                 \n\t"\
+    "movq  "#a", (%0,%1)              \n\t"\
+    "lea   (%0,%1,2), %0              \n\t"\
+    "movq  "#a", (%0)                 \n\t"\
+    "movq  "#a", (%0,%1)              \n\t"\
+    "lea   (%0,%1,2), %0              \n\t"\
+    "movq  "#a", (%0)                 \n\t"\
+    "movq  "#a", (%0,%1)              \n\t"
+
+/** stores a to a row and shifts it by n bytes for the next one */
+#define STORE8_SHIFT(a, n, dst)            \
+    "movq      "#a", "dst"            \n\t"\
+    "psrldq  $"#n" , "#a"             \n\t"
+
+/**
+ * stores a to the 8 rows from %0 down, shifting it by n bytes
+ * for each row
+ */
+#define STORE8_ROWS_SHIFT(a, n)            \
+    STORE8_SHIFT(a, n, "(%0)")             \
+    STORE8_SHIFT(a, n, "(%0,%1)")          \
+    "lea   (%0,%1,2), %0              \n\t"\
+    STORE8_SHIFT(a, n, "(%0)")             \
+    STORE8_SHIFT(a, n, "(%0,%1)")          \
+    "lea   (%0,%1,2), %0              \n\t"\
+    STORE8_SHIFT(a, n, "(%0)")             \
+    STORE8_SHIFT(a, n, "(%0,%1)")          \
+    "lea   (%0,%1,2), %0              \n\t"\
+    STORE8_SHIFT(a, n, "(%0)")             \
+    "movq      "#a", (%0,%1)          \n\t"
+
+/**
+ * stores a and b, alternating, to the 8 rows from %0 + 8 * %1 up,
+ * shifting each by n bytes after it was stored
+ */
+#define STORE8_ROWS_UP_SHIFT(a, b, n)      \
+    "lea   (%0,%1,8), %0              \n\t"\
+    "sub   %1, %0                     \n\t"\
+    STORE8_SHIFT(a, n, "(%0)")             \
+    "sub   %1, %0                     \n\t"\
+    STORE8_SHIFT(b, n, "(%0)")             \
+    "sub   %1, %0                     \n\t"\
+    STORE8_SHIFT(a, n, "(%0)")             \
+    "sub   %1, %0                     \n\t"\
+    STORE8_SHIFT(b, n, "(%0)")             \
+    "sub   %1, %0                     \n\t"\
+    STORE8_SHIFT(a, n, "(%0)")             \
+    "sub   %1, %0                     \n\t"\
+    STORE8_SHIFT(b, n, "(%0)")             \
+    "sub   %1, %0                     \n\t"\
+    STORE8_SHIFT(a, n, "(%0)")             \
+    "sub   %1, %0                     \n\t"\
+    "movq      "#b", (%0)             \n\t"
+
+static av_always_inline uint64_t load_left8(const uint8_t *src, int stride)
+{
+    uint64_t l = 0;
+    int i;
+    for (i = 7; i >= 0; i--)
+        l = l << 8 | src[-1 + i*stride];
+    return l;
+}
+
+/* 16x16 */
+
+#define STORE16_ROWS                       \
+    "1:                               \n\t"\
+    "movdqu %%xmm0, (%0,%2)           \n\t"\
+    "movdqu %%xmm0, (%0,%2,2)         \n\t"\
+    "lea    (%0,%2,2), %0             \n\t"\
+    "movdqu %%xmm0, (%0,%2)           \n\t"\
+    "movdqu %%xmm0, (%0,%2,2)         \n\t"\
+    "lea    (%0,%2,2), %0             \n\t"\
+    "decl   %1                        \n\t"\
+    "jnz    1b                        \n\t"
+
+static void pred16x16_vertical_sse2(uint8_t *src, int stride)
+{
+    int h = 4;
+    src -= stride;
+    __asm__ volatile(
+        "movdqu (%0), %%xmm0              \n\t"
+        STORE16_ROWS
+        : "+r"(src), "+r"(h)
+        : "r"((x86_reg)stride)
+        : XMM_CLOBBERS("%xmm0") "memory");
+}
+
+static av_always_inline void pred16x16_fill_sse2(uint8_t *src, int stride, int dc)
+{
+    int h = 4;
+    src -= stride;
+    __asm__ volatile(
+        "movd       %3, %%xmm0            \n\t"
+        "pshufd $0, %%xmm0, %%xmm0        \n\t"
+        STORE16_ROWS
+        : "+r"(src), "+r"(h)
+        : "r"((x86_reg)stride), "r"(dc * 0x01010101)
+        : XMM_CLOBBERS("%xmm0") "memory");
+}
+
+static void pred16x16_horizontal_sse2(uint8_t *src, int stride)
+{
+    int h = 8;
+    __asm__ volatile(
+        "1:                               \n\t"
+        "movd    -1(%0), %%xmm0           \n\t"
+        "movd -1(%0,%2), %%xmm1           \n\t"
+        "punpcklbw %%xmm0, %%xmm0         \n\t"
+        "punpcklbw %%xmm1, %%xmm1         \n\t"
+        SPLATW(%%xmm0)
+        SPLATW(%%xmm1)
+        "movdqu %%xmm0, (%0)              \n\t"
+        "movdqu %%xmm1, (%0,%2)           \n\t"
+        "lea    (%0,%2,2), %0             \n\t"
+        "decl   %1                        \n\t"
+        "jnz    1b                        \n\t"
+        : "+r"(src), "+r"(h)
+        : "r"((x86_reg)stride)
+        : XMM_CLOBBERS("%xmm0", "%xmm1") "memory");
+}
+
+static void pred16x16_horizontal_ssse3(uint8_t *src, int stride)
+{
+    int h = 8;
+    __asm__ volatile(
+        "pxor   %%xmm7, %%xmm7            \n\t"
+        "1:                               \n\t"
+        "movd    -1(%0), %%xmm0           \n\t"
+        "movd -1(%0,%2), %%xmm1           \n\t"
+        "pshufb %%xmm7, %%xmm0            \n\t"
+        "pshufb %%xmm7, %%xmm1            \n\t"
+        "movdqu %%xmm0, (%0)              \n\t"
+        "movdqu %%xmm1, (%0,%2)           \n\t"
+        "lea    (%0,%2,2), %0             \n\t"
+        "decl   %1                        \n\t"
+        "jnz    1b                        \n\t"
+        : "+r"(src), "+r"(h)
+        : "r"((x86_reg)stride)
+        : XMM_CLOBBERS("%xmm0", "%xmm1", "%xmm7") "memory");
+}
+
+static av_always_inline int sum_top16_sse2(const uint8_t *src, int stride)
+{
+    int sum;
+    __asm__ volatile(
+        "movdqu   (%1), %%xmm0            \n\t"
+        "pxor   %%xmm1, %%xmm1            \n\t"
+        "psadbw %%xmm1, %%xmm0            \n\t"
+        "movhlps %%xmm0, %%xmm1           \n\t"
+        "paddw  %%xmm1, %%xmm0            \n\t"
+        "movd   %%xmm0, %0                \n\t"
+        : "=r"(sum)
+        : "r"(src - stride)
+        : XMM_CLOBBERS("%xmm0", "%xmm1") "memory");
+    return sum;
+}
+
+static av_always_inline int sum_left16(const uint8_t *src, int stride)
+{
+    int i, sum = 0;
+    for (i = 0; i < 16; i++)
+        sum += src[-1 + i*stride];
+    return sum;
+}
+
+static void pred16x16_dc_sse2(uint8_t *src, int stride)
+{
+    pred16x16_fill_sse2(src, stride, (sum_left16(src, stride) +
+                                      sum_top16_sse2(src, stride) + 16) >> 5);
+}
+
+static void pred16x16_left_dc_sse2(uint8_t *src, int stride)
+{
+    pred16x16_fill_sse2(src, stride, (sum_left16(src, stride) + 8) >> 4);
+}
+
+static void pred16x16_top_dc_sse2(uint8_t *src, int stride)
+{
+    pred16x16_fill_sse2(src, stride, (sum_top16_sse2(src, stride) + 8) >> 4);
+}
+
+static void pred16x16_128_dc_sse2(uint8_t *src, int stride)
+{
+    pred16x16_fill_sse2(src, stride, 128);
+}
+
+/**
+ * The gradients are computed as in C; a + x*H + y*V fits in 16 bits for
+ * x, y < 16 with all three rounding variants, and the saturating row
+ * increment keeps the final clipping correct.
+ */
+static av_always_inline void pred16x16_plane_compat_sse2(uint8_t *src, int stride,
+                                                         const int svq3, const int rv40)
+{
+    int i, k, a, h = 16;
+    const uint8_t * const src0 = src+7-stride;
+    const uint8_t *src1 = src+8*stride-1;
+    const uint8_t *src2 = src1-2*stride;
+    int H = src0[1] - src0[-1];
+    int V = src1[0] - src2[ 0];
+    for (k = 2; k <= 8; ++k) {
+        src1 += stride; src2 -= stride;
+        H += k*(src0[k] - src0[-k]);
+        V += k*(src1[0] - src2[ 0]);
+    }
+    if (svq3) {
+        H = ( 5*(H/4) ) / 16;
+        V = ( 5*(V/4) ) / 16;
+
+        /* required for 100% accuracy */
+        i = H; H = V; V = i;
+    } else if (rv40) {
+        H = ( H + (H>>2) ) >> 4;
+        V = ( V + (V>>2) ) >> 4;
+    } else {
+        H = ( 5*H+32 ) >> 6;
+        V = ( 5*V+32 ) >> 6;
+    }
+    a = 16*(src1[0] + src2[16] + 1) - 7*(V+H);
+
+    __asm__ volatile(
+        "movd       %3, %%xmm0            \n\t"
+        "movd       %4, %%xmm1            \n\t"
+        "movd       %5, %%xmm2            \n\t"
+        SPLATW(%%xmm0)
+        SPLATW(%%xmm1)
+        SPLATW(%%xmm2)
+        "movdqa     %6, %%xmm3            \n\t"
+        "pmullw %%xmm1, %%xmm3            \n\t"
+        "paddw  %%xmm3, %%xmm0            \n\t" /* a + x*H */
+        "psllw      $3, %%xmm1            \n\t"
+        "paddw  %%xmm0, %%xmm1            \n\t" /* a + (x+8)*H */
+        "1:                               \n\t"
+        "movdqa %%xmm0, %%xmm3            \n\t"
+        "movdqa %%xmm1, %%xmm4            \n\t"
+        "psraw      $5, %%xmm3            \n\t"
+        "psraw      $5, %%xmm4            \n\t"
+        "packuswb %%xmm4, %%xmm3          \n\t"
+        "movdqu %%xmm3, (%0)              \n\t"
+        "paddsw %%xmm2, %%xmm0            \n\t"
+        "paddsw %%xmm2, %%xmm1            \n\t"
+        "add        %2, %0                \n\t"
+        "decl       %1                    \n\t"
+        "jnz        1b                    \n\t"
+        : "+r"(src), "+r"(h)
+        : "r"((x86_reg)stride), "rm"(a), "rm"(H), "rm"(V), "m"(*pw_0to7)
+        : XMM_CLOBBERS("%xmm0", "%xmm1", "%xmm2", "%xmm3", "%xmm4") "memory");
+}
+
+static void pred16x16_plane_sse2(uint8_t *src, int stride)
+{
+    pred16x16_plane_compat_sse2(src, stride, 0, 0);
+}
+
+static void pred16x16_plane_svq3_sse2(uint8_t *src, int stride)
+{
+    pred16x16_plane_compat_sse2(src, stride, 1, 0);
+}
+
+static void pred16x16_plane_rv40_sse2(uint8_t *src, int stride)
+{
+    pred16x16_plane_compat_sse2(src, stride, 0, 1);
+}
+
+/* 8x8 chroma */
+
+static void pred8x8_vertical_sse2(uint8_t *src, int stride)
+{
+    __asm__ volatile(
+        "movq   (%2), %%xmm0              \n\t"
+        STORE8_ROWS(%%xmm0)
+        : "+r"(src)
+        : "r"((x86_reg)stride), "r"(src - stride)
+        : XMM_CLOBBERS("%xmm0") "memory");
+}
+
+static void pred8x8_horizontal_sse2(uint8_t *src, int stride)
+{
+    int h = 4;
+    __asm__ volatile(
+        "1:                               \n\t"
+        "movd    -1(%0), %%xmm0           \n\t"
+        "movd -1(%0,%2), %%xmm1           \n\t"
+        "punpcklbw %%xmm0, %%xmm0         \n\t"
+        "punpcklbw %%xmm1, %%xmm1         \n\t"
+        "pshuflw $0, %%xmm0, %%xmm0       \n\t"
+        "pshuflw $0, %%xmm1, %%xmm1       \n\t"
+        "movq   %%xmm0, (%0)              \n\t"
+        "movq   %%xmm1, (%0,%2)           \n\t"
+        "lea    (%0,%2,2), %0             \n\t"
+        "decl   %1                        \n\t"
+        "jnz    1b                        \n\t"
+        : "+r"(src), "+r"(h)
+        : "r"((x86_reg)stride)
+        : XMM_CLOBBERS("%xmm0", "%xmm1") "memory");
+}
+
+static void pred8x8_horizontal_ssse3(uint8_t *src, int stride)
+{
+    int h = 4;
+    __asm__ volatile(
+        "pxor   %%xmm7, %%xmm7            \n\t"
+        "1:                               \n\t"
+        "movd    -1(%0), %%xmm0           \n\t"
+        "movd -1(%0,%2), %%xmm1           \n\t"
+        "pshufb %%xmm7, %%xmm0            \n\t"
+        "pshufb %%xmm7, %%xmm1            \n\t"
+        "movq   %%xmm0, (%0)              \n\t"
+        "movq   %%xmm1, (%0,%2)           \n\t"
+        "lea    (%0,%2,2), %0             \n\t"
+        "decl   %1                        \n\t"
+        "jnz    1b                        \n\t"
+        : "+r"(src), "+r"(h)
+        : "r"((x86_reg)stride)
+        : XMM_CLOBBERS("%xmm0", "%xmm1", "%xmm7") "memory");
+}
+
+/**
+ * Fills the upper and lower half of an 8x8 block with the
+ * dc values dc0 | dc1 and dc2 | dc3.
+ */
+static av_always_inline void pred8x8_fill_sse2(uint8_t *src, int stride,
+                                               int dc0, int dc1, int dc2, int dc3)
+{
+    __asm__ volatile(
+        "movd       %2, %%xmm0            \n\t"
+        "movd       %3, %%xmm1            \n\t"
+        "movd       %4, %%xmm2            \n\t"
+        "movd       %5, %%xmm3            \n\t"
+        "punpckldq %%xmm1, %%xmm0         \n\t"
+        "punpckldq %%xmm3, %%xmm2         \n\t"
+        "movq   %%xmm0, (%0)              \n\t"
+        "movq   %%xmm0, (%0,%1)           \n\t"
+        "lea    (%0,%1,2), %0             \n\t"
+        "movq   %%xmm0, (%0)              \n\t"
+        "movq   %%xmm0, (%0,%1)           \n\t"
+        "lea    (%0,%1,2), %0             \n\t"
+        "movq   %%xmm2, (%0)              \n\t"
+        "movq   %%xmm2, (%0,%1)           \n\t"
+        "lea    (%0,%1,2), %0             \n\t"
+        "movq   %%xmm2, (%0)              \n\t"
+        "movq   %%xmm2, (%0,%1)           \n\t"
+        : "+r"(src)
+        : "r"((x86_reg)stride),
+          "rm"(dc0 * 0x01010101), "rm"(dc1 * 0x01010101),
+          "rm"(dc2 * 0x01010101), "rm"(dc3 * 0x01010101)
+        : XMM_CLOBBERS("%xmm0", "%xmm1", "%xmm2", "%xmm3") "memory");
+}
+
+#define SUM4(p, s) ((p)[0] + (p)[s] + (p)[2*(s)] + (p)[3*(s)])
+
+static void pred8x8_dc_sse2(uint8_t *src, int stride)
+{
+    const int t0 = SUM4(src - stride    , 1);
+    const int t1 = SUM4(src - stride + 4, 1);
+    const int l0 = SUM4(src - 1             , stride);
+    const int l1 = SUM4(src - 1 + 4*stride, stride);
+    pred8x8_fill_sse2(src, stride, (t0 + l0 + 4) >> 3, (t1 + 2) >> 2,
+                                   (l1 + 2) >> 2, (t1 + l1 + 4) >> 3);
+}
+
+static void pred8x8_left_dc_sse2(uint8_t *src, int stride)
+{
+    const int l0 = (SUM4(src - 1             , stride) + 2) >> 2;
+    const int l1 = (SUM4(src - 1 + 4*stride, stride) + 2) >> 2;
+    pred8x8_fill_sse2(src, stride, l0, l0, l1, l1);
+}
+
+static void pred8x8_top_dc_sse2(uint8_t *src, int stride)
+{
+    const int t0 = (SUM4(src - stride    , 1) + 2) >> 2;
+    const int t1 = (SUM4(src - stride + 4, 1) + 2) >> 2;
+    pred8x8_fill_sse2(src, stride, t0, t1, t0, t1);
+}
+
+static void pred8x8_dc_rv40_sse2(uint8_t *src, int stride)
+{
+    const int dc = (SUM4(src - stride, 1) + SUM4(src - stride + 4, 1) +
+                    SUM4(src - 1, stride) + SUM4(src - 1 + 4*stride, stride) + 8) >> 4;
+    pred8x8_fill_sse2(src, stride, dc, dc, dc, dc);
+}
+
+static void pred8x8_left_dc_rv40_sse2(uint8_t *src, int stride)
+{
+    const int dc = (SUM4(src - 1, stride) + SUM4(src - 1 + 4*stride, stride) + 4) >> 3;
+    pred8x8_fill_sse2(src, stride, dc, dc, dc, dc);
+}
+
+static void pred8x8_top_dc_rv40_sse2(uint8_t *src, int stride)
+{
+    const int dc = (SUM4(src - stride, 1) + SUM4(src - stride + 4, 1) + 4) >> 3;
+    pred8x8_fill_sse2(src, stride, dc, dc, dc, dc);
+}
+
+static void pred8x8_128_dc_sse2(uint8_t *src, int stride)
+{
+    pred8x8_fill_sse2(src, stride, 128, 128, 128, 128);
+}
+
+static void pred8x8_plane_sse2(uint8_t *src, int stride)
+{
+    int k, a, h = 8;
+    const uint8_t * const src0 = src+3-stride;
+    const uint8_t *src1 = src+4*stride-1;
+    const uint8_t *src2 = src1-2*stride;
+    int H = src0[1] - src0[-1];
+    int V = src1[0] - src2[ 0];
+    for (k = 2; k <= 4; ++k) {
+        src1 += stride; src2 -= stride;
+        H += k*(src0[k] - src0[-k]);
+        V += k*(src1[0] - src2[ 0]);
+    }
+    H = ( 17*H+16 ) >> 5;
+    V = ( 17*V+16 ) >> 5;
+    a = 16*(src1[0] + src2[8] + 1) - 3*(V+H);
+
+    __asm__ volatile(
+        "movd       %3, %%xmm0            \n\t"
+        "movd       %4, %%xmm1            \n\t"
+        "movd       %5, %%xmm2            \n\t"
+        SPLATW(%%xmm0)
+        SPLATW(%%xmm1)
+        SPLATW(%%xmm2)
+        "pmullw     %6, %%xmm1            \n\t"
+        "paddw  %%xmm1, %%xmm0            \n\t" /* a + x*H */
+        "1:                               \n\t"
+        "movdqa %%xmm0, %%xmm3            \n\t"
+        "psraw      $5, %%xmm3            \n\t"
+        "packuswb %%xmm3, %%xmm3          \n\t"
+        "movq   %%xmm3, (%0)              \n\t"
+        "paddsw %%xmm2, %%xmm0            \n\t"
+        "add        %2, %0                \n\t"
+        "decl       %1                    \n\t"
+        "jnz        1b                    \n\t"
+        : "+r"(src), "+r"(h)
+        : "r"((x86_reg)stride), "rm"(a), "rm"(H), "rm"(V), "m"(*pw_0to7)
+        : XMM_CLOBBERS("%xmm0", "%xmm1", "%xmm2", "%xmm3") "memory");
+}
+
+/* 8x8 luma */
+
+/**
+ * Filtered top edge t0..t15 of an 8x8 luma block into xmm0,
+ * clobbers xmm1-xmm3. Uses the operands %[top] = src - stride,
+ * %[tl] and %[tr] (see PRED8x8L_TOP_ARGS) and needs pb_1 in xmm7.
+ */
+#define PRED8x8L_TOP                       \
+    "movq      (%[top]), %%xmm1       \n\t"\
+    "cmpl       $0, %[trok]           \n\t"\
+    "je         2f                    \n\t"\
+    "movhps   8(%[top]), %%xmm1       \n\t"\
+    "jmp        3f                    \n\t"\
+    "2:                               \n\t"\
+    "movdqa     %%xmm1, %%xmm2        \n\t"\
+    "punpcklbw  %%xmm2, %%xmm2        \n\t"\
+    "pshufhw $0xff, %%xmm2, %%xmm2    \n\t"\
+    "movsd      %%xmm1, %%xmm2        \n\t"\
+    "movdqa     %%xmm2, %%xmm1        \n\t"\
+    "3:                               \n\t"\
+    "movdqa     %%xmm1, %%xmm0        \n\t"\
+    "movdqa     %%xmm1, %%xmm2        \n\t"\
+    "pslldq     $1, %%xmm0            \n\t"\
+    "psrldq     $1, %%xmm2            \n\t"\
+    "pinsrw     $0, %[tl], %%xmm0     \n\t"\
+    "pinsrw     $7, %[tr], %%xmm2     \n\t"\
+    LOWPASS(%%xmm0, %%xmm1, %%xmm2, %%xmm3)
+
+#define PRED8x8L_TOP_ARGS                                           \
+    [top]  "r"(src - stride),                                       \
+    [trok] "rm"(has_topright),                                      \
+    [tl]   "rm"((has_topleft ? src[-1-stride] : src[-stride]) |     \
+               src[-stride] << 8),                                  \
+    [tr]   "rm"(src[(has_topright ? 15 : 7) - stride] * 0x101)
+
+/**
+ * Filtered left edge l0..l7 of an 8x8 luma block into the low half of
+ * xmm4, clobbers xmm5, xmm6 and xmm3. Uses the operands %[left],
+ * %[ltl] and %[bl] (see PRED8x8L_LEFT_ARGS) and needs pb_1 in xmm7.
+ */
+#define PRED8x8L_LEFT                      \
+    "movq      %[left], %%xmm5        \n\t"\
+    "movdqa     %%xmm5, %%xmm4        \n\t"\
+    "movdqa     %%xmm5, %%xmm6        \n\t"\
+    "pslldq     $1, %%xmm4            \n\t"\
+    "psrldq     $1, %%xmm6            \n\t"\
+    "pinsrw     $0, %[ltl], %%xmm4    \n\t"\
+    "pinsrw     $3, %[bl], %%xmm6     \n\t"\
+    LOWPASS(%%xmm4, %%xmm5, %%xmm6, %%xmm3)
+
+#define PRED8x8L_LEFT_ARGS                                          \
+    [left] "m"(left),                                               \
+    [ltl]  "rm"((has_topleft ? src[-1-stride] : src[-1]) |          \
+               src[-1] << 8),                                       \
+    [bl]   "rm"(src[-1+7*stride] * 0x101)
+
+/** extends the l7 byte of xmm4 over its upper half */
+#define PRED8x8L_LEFT_PAD                  \
+    "movdqa     %%xmm4, %%xmm5        \n\t"\
+    "punpcklbw  %%xmm5, %%xmm5        \n\t"\
+    "pshufhw $0xff, %%xmm5, %%xmm5    \n\t"\
+    "movsd      %%xmm4, %%xmm5        \n\t"\
+    "movdqa     %%xmm5, %%xmm4        \n\t"
+
+#define PRED8x8L_CLOBBERS \
+    XMM_CLOBBERS("%xmm0", "%xmm1", "%xmm2", "%xmm3", \
+                 "%xmm4", "%xmm5", "%xmm6", "%xmm7") "memory"
+
+static void pred8x8l_vertical_sse2(uint8_t *src, int has_topleft, int has_topright, int stride)
+{
+    __asm__ volatile(
+        "movdqa %[pb_1], %%xmm7           \n\t"
+        PRED8x8L_TOP
+        STORE8_ROWS(%%xmm0)
+        : "+&r"(src)
+        : "r"((x86_reg)stride), [pb_1] "m"(pb_1), PRED8x8L_TOP_ARGS
+        : PRED8x8L_CLOBBERS);
+}
+
+static void pred8x8l_horizontal_sse2(uint8_t *src, int has_topleft, int has_topright, int stride)
+{
+    const uint64_t left = load_left8(src, stride);
+    __asm__ volatile(
+        "movdqa %[pb_1], %%xmm7           \n\t"
+        PRED8x8L_LEFT
+        "punpcklbw %%xmm4, %%xmm4         \n\t"
+        "pshuflw $0x00, %%xmm4, %%xmm0    \n\t"
+        "pshuflw $0x55, %%xmm4, %%xmm1    \n\t"
+        "pshuflw $0xaa, %%xmm4, %%xmm2    \n\t"
+        "pshuflw $0xff, %%xmm4, %%xmm3    \n\t"
+        "pshufhw $0x00, %%xmm4, %%xmm5    \n\t"
+        "pshufhw $0x55, %%xmm4, %%xmm6    \n\t"
+        "movq   %%xmm0, (%0)              \n\t"
+        "movq   %%xmm1, (%0,%1)           \n\t"
+        "pshufhw $0xaa, %%xmm4, %%xmm0    \n\t"
+        "pshufhw $0xff, %%xmm4, %%xmm1    \n\t"
+        "lea    (%0,%1,2), %0             \n\t"
+        "movq   %%xmm2, (%0)              \n\t"
+        "movq   %%xmm3, (%0,%1)           \n\t"
+        "lea    (%0,%1,2), %0             \n\t"
+        "movhps %%xmm5, (%0)              \n\t"
+        "movhps %%xmm6, (%0,%1)           \n\t"
+        "lea    (%0,%1,2), %0             \n\t"
+        "movhps %%xmm0, (%0)              \n\t"
+        "movhps %%xmm1, (%0,%1)           \n\t"
+        : "+&r"(src)
+        : "r"((x86_reg)stride), [pb_1] "m"(pb_1), PRED8x8L_LEFT_ARGS
+        : PRED8x8L_CLOBBERS);
+}
+
+static void pred8x8l_dc_sse2(uint8_t *src, int has_topleft, int has_topright, int stride)
+{
+    const uint64_t left = load_left8(src, stride);
+    __asm__ volatile(
+        "movdqa %[pb_1], %%xmm7           \n\t"
+        PRED8x8L_TOP
+        PRED8x8L_LEFT
+        "movq   %%xmm0, %%xmm0            \n\t"
+        "movq   %%xmm4, %%xmm4            \n\t"
+        "pxor   %%xmm1, %%xmm1            \n\t"
+        "psadbw %%xmm1, %%xmm0            \n\t"
+        "psadbw %%xmm1, %%xmm4            \n\t"
+        "paddw  %%xmm4, %%xmm0            \n\t"
+        "paddw  %[pw_8], %%xmm0           \n\t"
+        "psrlw  $4, %%xmm0                \n\t"
+        "punpcklbw %%xmm0, %%xmm0         \n\t"
+        "pshuflw $0, %%xmm0, %%xmm0       \n\t"
+        STORE8_ROWS(%%xmm0)
+        : "+&r"(src)
+        : "r"((x86_reg)stride), [pb_1] "m"(pb_1), [pw_8] "m"(ff_pw_8),
+          PRED8x8L_TOP_ARGS, PRED8x8L_LEFT_ARGS
+        : PRED8x8L_CLOBBERS);
+}
+
+static void pred8x8l_left_dc_sse2(uint8_t *src, int has_topleft, int has_topright, int stride)
+{
+    const uint64_t left = load_left8(src, stride);
+    __asm__ volatile(
+        "movdqa %[pb_1], %%xmm7           \n\t"
+        PRED8x8L_LEFT
+        "movq   %%xmm4, %%xmm0            \n\t"
+        "pxor   %%xmm1, %%xmm1            \n\t"
+        "psadbw %%xmm1, %%xmm0            \n\t"
+        "movq   %[pw_4], %%xmm1           \n\t"
+        "paddw  %%xmm1, %%xmm0            \n\t"
+        "psrlw  $3, %%xmm0                \n\t"
+        "punpcklbw %%xmm0, %%xmm0         \n\t"
+        "pshuflw $0, %%xmm0, %%xmm0       \n\t"
+        STORE8_ROWS(%%xmm0)
+        : "+&r"(src)
+        : "r"((x86_reg)stride), [pb_1] "m"(pb_1), [pw_4] "m"(ff_pw_4),
+          PRED8x8L_LEFT_ARGS
+        : PRED8x8L_CLOBBERS);
+}
+
+static void pred8x8l_top_dc_sse2(uint8_t *src, int has_topleft, int has_topright, int stride)
+{
+    __asm__ volatile(
+        "movdqa %[pb_1], %%xmm7           \n\t"
+        PRED8x8L_TOP
+        "movq   %%xmm0, %%xmm0            \n\t"
+        "pxor   %%xmm1, %%xmm1            \n\t"
+        "psadbw %%xmm1, %%xmm0            \n\t"
+        "movq   %[pw_4], %%xmm1           \n\t"
+        "paddw  %%xmm1, %%xmm0            \n\t"
+        "psrlw  $3, %%xmm0                \n\t"
+        "punpcklbw %%xmm0, %%xmm0         \n\t"
+        "pshuflw $0, %%xmm0, %%xmm0       \n\t"
+        STORE8_ROWS(%%xmm0)
+        : "+&r"(src)
+        : "r"((x86_reg)stride), [pb_1] "m"(pb_1), [pw_4] "m"(ff_pw_4),
+          PRED8x8L_TOP_ARGS
+        : PRED8x8L_CLOBBERS);
+}
+
+static void pred8x8l_128_dc_sse2(uint8_t *src, int has_topleft, int has_topright, int stride)
+{
+    pred8x8_fill_sse2(src, stride, 128, 128, 128, 128);
+}
+
+static void pred8x8l_down_left_sse2(uint8_t *src, int has_topleft, int has_topright, int stride)
+{
+    __asm__ volatile(
+        "movdqa %[pb_1], %%xmm7           \n\t"
+        PRED8x8L_TOP
+        /* t0..t15, t1..t15 and t2..t15,t15 */
+        "movdqa %%xmm0, %%xmm1            \n\t"
+        "movdqa %%xmm0, %%xmm2            \n\t"
+        "movdqa %%xmm0, %%xmm4            \n\t"
+        "psrldq $1, %%xmm1                \n\t"
+        "psrldq $2, %%xmm2                \n\t"
+        "psrldq $15, %%xmm4               \n\t"
+        "pslldq $14, %%xmm4               \n\t"
+        "por    %%xmm4, %%xmm2            \n\t"
+        LOWPASS(%%xmm0, %%xmm1, %%xmm2, %%xmm3)
+        STORE8_ROWS_SHIFT(%%xmm0, 1)
+        : "+&r"(src)
+        : "r"((x86_reg)stride), [pb_1] "m"(pb_1), PRED8x8L_TOP_ARGS
+        : PRED8x8L_CLOBBERS);
+}
+
+static void pred8x8l_vertical_left_sse2(uint8_t *src, int has_topleft, int has_topright, int stride)
+{
+    __asm__ volatile(
+        "movdqa %[pb_1], %%xmm7           \n\t"
+        PRED8x8L_TOP
+        "movdqa %%xmm0, %%xmm1            \n\t"
+        "movdqa %%xmm0, %%xmm2            \n\t"
+        "psrldq $1, %%xmm1                \n\t"
+        "psrldq $2, %%xmm2                \n\t"
+        "movdqa %%xmm0, %%xmm4            \n\t"
+        "pavgb  %%xmm1, %%xmm4            \n\t" /* even rows */
+        LOWPASS(%%xmm0, %%xmm1, %%xmm2, %%xmm3) /* odd rows */
+        STORE8_SHIFT(%%xmm4, 1, "(%0)")
+        STORE8_SHIFT(%%xmm0, 1, "(%0,%1)")
+        "lea    (%0,%1,2), %0             \n\t"
+        STORE8_SHIFT(%%xmm4, 1, "(%0)")
+        STORE8_SHIFT(%%xmm0, 1, "(%0,%1)")
+        "lea    (%0,%1,2), %0             \n\t"
+        STORE8_SHIFT(%%xmm4, 1, "(%0)")
+        STORE8_SHIFT(%%xmm0, 1, "(%0,%1)")
+        "lea    (%0,%1,2), %0             \n\t"
+        "movq   %%xmm4, (%0)              \n\t"
+        "movq   %%xmm0, (%0,%1)           \n\t"
+        : "+&r"(src)
+        : "r"((x86_reg)stride), [pb_1] "m"(pb_1), PRED8x8L_TOP_ARGS
+        : PRED8x8L_CLOBBERS);
+}
+
+static void pred8x8l_horizontal_up_sse2(uint8_t *src, int has_topleft, int has_topright, int stride)
+{
+    const uint64_t left = load_left8(src, stride);
+    __asm__ volatile(
+        "movdqa %[pb_1], %%xmm7           \n\t"
+        PRED8x8L_LEFT
+        PRED8x8L_LEFT_PAD
+        /* xmm4 = l0..l7,l7..; xmm1 = l7 in the top two bytes, shifted
+         * in for the lower rows */
+        "movdqa %%xmm4, %%xmm1            \n\t"
+        "psrldq $14, %%xmm1               \n\t"
+        "pslldq $14, %%xmm1               \n\t"
+        "movdqa %%xmm4, %%xmm5            \n\t"
+        "movdqa %%xmm4, %%xmm6            \n\t"
+        "psrldq $1, %%xmm5                \n\t"
+        "psrldq $2, %%xmm6                \n\t"
+        "movdqa %%xmm4, %%xmm0            \n\t"
+        "pavgb  %%xmm5, %%xmm0            \n\t"
+        LOWPASS(%%xmm4, %%xmm5, %%xmm6, %%xmm3)
+        "punpcklbw %%xmm4, %%xmm0         \n\t"
+        STORE8_SHIFT(%%xmm0, 2, "(%0)")
+        "por    %%xmm1, %%xmm0            \n\t"
+        STORE8_SHIFT(%%xmm0, 2, "(%0,%1)")
+        "por    %%xmm1, %%xmm0            \n\t"
+        "lea    (%0,%1,2), %0             \n\t"
+        STORE8_SHIFT(%%xmm0, 2, "(%0)")
+        "por    %%xmm1, %%xmm0            \n\t"
+        STORE8_SHIFT(%%xmm0, 2, "(%0,%1)")
+        "por    %%xmm1, %%xmm0            \n\t"
+        "lea    (%0,%1,2), %0             \n\t"
+        STORE8_SHIFT(%%xmm0, 2, "(%0)")
+        "por    %%xmm1, %%xmm0            \n\t"
+        STORE8_SHIFT(%%xmm0, 2, "(%0,%1)")
+        "por    %%xmm1, %%xmm0            \n\t"
+        "lea    (%0,%1,2), %0             \n\t"
+        STORE8_SHIFT(%%xmm0, 2, "(%0)")
+        "por    %%xmm1, %%xmm0            \n\t"
+        "movq   %%xmm0, (%0,%1)           \n\t"
+        : "+&r"(src)
+        : "r"((x86_reg)stride), [pb_1] "m"(pb_1), PRED8x8L_LEFT_ARGS
+        : PRED8x8L_CLOBBERS);
+}
+
+/**
+ * Filtered edge l7..l0,lt,t0..t6 of an 8x8 luma block into xmm0 and
+ * t7 into xmm1, clobbers xmm2-xmm3. Uses the operands of
+ * PRED8x8L_EDGE_ARGS and needs pb_1 in xmm7.
+ */
+#define PRED8x8L_EDGE                      \
+    "movq      %[rleft], %%xmm1       \n\t"\
+    "movq    -1(%[top]), %%xmm0       \n\t"\
+    "punpcklqdq %%xmm0, %%xmm1        \n\t"\
+    "movdqa     %%xmm1, %%xmm0        \n\t"\
+    "movdqa     %%xmm1, %%xmm2        \n\t"\
+    "pslldq     $1, %%xmm0            \n\t"\
+    "psrldq     $1, %%xmm2            \n\t"\
+    "pinsrw     $0, %[w0], %%xmm0     \n\t"\
+    "pinsrw     $4, %[w4], %%xmm0     \n\t"\
+    "pinsrw     $3, %[w3], %%xmm2     \n\t"\
+    "pinsrw     $7, %[w7], %%xmm2     \n\t"\
+    LOWPASS(%%xmm0, %%xmm1, %%xmm2, %%xmm3)\
+    "movd       %[t7], %%xmm1         \n\t"
+
+#define PRED8x8L_EDGE_ARGS                                          \
+    [top]   "r"(src - stride),                                      \
+    [rleft] "m"(rleft),                                             \
+    [w0]    "rm"(src[-1+7*stride] * 0x101),                         \
+    [w4]    "rm"(src[-1] | (has_topleft ? src[-1-stride] : src[-stride]) << 8),\
+    [w3]    "rm"(src[-1] | (has_topleft ? src[-1-stride] : src[-1]) << 8),\
+    [w7]    "rm"(src[6-stride] | src[7-stride] << 8),               \
+    [t7]    "rm"((src[6-stride] + 2*src[7-stride] +                 \
+                 src[(has_topright ? 8 : 7) - stride] + 2) >> 2)
+
+#define LOAD_RLEFT \
+    const uint64_t rleft = bswap_64(load_left8(src, stride))
+
+static void pred8x8l_down_right_sse2(uint8_t *src, int has_topleft, int has_topright, int stride)
+{
+    LOAD_RLEFT;
+    __asm__ volatile(
+        "movdqa %[pb_1], %%xmm7           \n\t"
+        PRED8x8L_EDGE
+        WINDOW(%%xmm0, %%xmm1, 1, %%xmm4, %%xmm3)
+        WINDOW(%%xmm0, %%xmm1, 2, %%xmm5, %%xmm3)
+        LOWPASS(%%xmm0, %%xmm4, %%xmm5, %%xmm3)
+        /* row 7 is the lowpassed edge, each row above starts one pixel later */
+        STORE8_ROWS_UP_SHIFT(%%xmm0, %%xmm0, 1)
+        : "+&r"(src)
+        : "r"((x86_reg)stride), [pb_1] "m"(pb_1), PRED8x8L_EDGE_ARGS
+        : PRED8x8L_CLOBBERS);
+}
+
+static void pred8x8l_vertical_right_sse2(uint8_t *src, int has_topleft, int has_topright, int stride)
+{
+    LOAD_RLEFT;
+    __asm__ volatile(
+        "movdqa %[pb_1], %%xmm7           \n\t"
+        PRED8x8L_EDGE
+        WINDOW(%%xmm0, %%xmm1, 8, %%xmm4, %%xmm3)
+        WINDOW(%%xmm0, %%xmm1, 9, %%xmm5, %%xmm3)
+        "pavgb  %%xmm5, %%xmm4            \n\t" /* A8.. */
+        WINDOW(%%xmm0, %%xmm1, 1, %%xmm5, %%xmm3)
+        WINDOW(%%xmm0, %%xmm1, 2, %%xmm6, %%xmm3)
+        LOWPASS(%%xmm0, %%xmm5, %%xmm6, %%xmm3) /* Q0.. */
+        /* even rows: Q2,Q4,Q6,A8..  odd rows: Q1,Q3,Q5,Q7.. */
+        "pcmpeqb %%xmm1, %%xmm1           \n\t"
+        "psrlw  $8, %%xmm1                \n\t"
+        "movdqa %%xmm0, %%xmm2            \n\t"
+        "movdqa %%xmm0, %%xmm3            \n\t"
+        "pand   %%xmm1, %%xmm2            \n\t"
+        "psrlw  $8, %%xmm3                \n\t"
+        "packuswb %%xmm2, %%xmm2          \n\t"
+        "packuswb %%xmm3, %%xmm3          \n\t"
+        "psrldq $1, %%xmm2                \n\t"
+        LOW_BYTES(%%xmm2, 3)
+        LOW_BYTES(%%xmm3, 3)
+        "pslldq $3, %%xmm4                \n\t"
+        "por    %%xmm2, %%xmm4            \n\t"
+        "psrldq $7, %%xmm0                \n\t"
+        "pslldq $3, %%xmm0                \n\t"
+        "por    %%xmm3, %%xmm0            \n\t"
+        STORE8_ROWS_UP_SHIFT(%%xmm0, %%xmm4, 1)
+        : "+&r"(src)
+        : "r"((x86_reg)stride), [pb_1] "m"(pb_1), PRED8x8L_EDGE_ARGS
+        : PRED8x8L_CLOBBERS);
+}
+
+static void pred8x8l_horizontal_down_sse2(uint8_t *src, int has_topleft, int has_topright, int stride)
+{
+    LOAD_RLEFT;
+    __asm__ volatile(
+        "movdqa %[pb_1], %%xmm7           \n\t"
+        PRED8x8L_EDGE
+        WINDOW(%%xmm0, %%xmm1, 1, %%xmm4, %%xmm3)
+        WINDOW(%%xmm0, %%xmm1, 2, %%xmm5, %%xmm3)
+        "movdqa %%xmm0, %%xmm6            \n\t"
+        "pavgb  %%xmm4, %%xmm6            \n\t" /* A0.. */
+        LOWPASS(%%xmm0, %%xmm4, %%xmm5, %%xmm3) /* Q0.. */
+        "punpcklbw %%xmm0, %%xmm6         \n\t" /* A0,Q0,A1,Q1.. */
+        "psrldq $8, %%xmm0                \n\t" /* Q8.. */
+        /* row 7 starts at A0, each row above starts two bytes later */
+        "lea    (%0,%1,8), %0             \n\t"
+        "sub    %1, %0                    \n\t"
+        "movq   %%xmm6, (%0)              \n\t"
+        WINDOW(%%xmm6, %%xmm0, 2, %%xmm4, %%xmm3)
+        "sub    %1, %0                    \n\t"
+        "movq   %%xmm4, (%0)              \n\t"
+        WINDOW(%%xmm6, %%xmm0, 4, %%xmm4, %%xmm3)
+        "sub    %1, %0                    \n\t"
+        "movq   %%xmm4, (%0)              \n\t"
+        WINDOW(%%xmm6, %%xmm0, 6, %%xmm4, %%xmm3)
+        "sub    %1, %0                    \n\t"
+        "movq   %%xmm4, (%0)              \n\t"
+        WINDOW(%%xmm6, %%xmm0, 8, %%xmm4, %%xmm3)
+        "sub    %1, %0                    \n\t"
+        "movq   %%xmm4, (%0)              \n\t"
+        WINDOW(%%xmm6, %%xmm0, 10, %%xmm4, %%xmm3)
+        "sub    %1, %0                    \n\t"
+        "movq   %%xmm4, (%0)              \n\t"
+        WINDOW(%%xmm6, %%xmm0, 12, %%xmm4, %%xmm3)
+        "sub    %1, %0                    \n\t"
+        "movq   %%xmm4, (%0)              \n\t"
+        WINDOW(%%xmm6, %%xmm0, 14, %%xmm4, %%xmm3)
+        "sub    %1, %0                    \n\t"
+        "movq   %%xmm4, (%0)              \n\t"
+        : "+&r"(src)
+        : "r"((x86_reg)stride), [pb_1] "m"(pb_1), PRED8x8L_EDGE_ARGS
+        : PRED8x8L_CLOBBERS);
+}
+
+/* 4x4 */
+
+/**
+ * a = (a + b + 1) >> 1 in xmm1 and (a + 2*b + c + 2) >> 2 in xmm0 of the
+ * 16 byte edge in xmm0 and its neighbours, clobbers xmm2-xmm3, xmm7.
+ */
+#define PRED4x4_AVG_LOWPASS                \
+    "movdqa %[pb_1], %%xmm7           \n\t"\
+    "movdqa %%xmm0, %%xmm1            \n\t"\
+    "movdqa %%xmm0, %%xmm2            \n\t"\
+    "movdqa %%xmm0, %%xmm3            \n\t"\
+    "psrldq $1, %%xmm2                \n\t"\
+    "psrldq $2, %%xmm3                \n\t"\
+    "pavgb  %%xmm2, %%xmm1            \n\t"\
+    LOWPASS(%%xmm0, %%xmm2, %%xmm3, %%xmm4)
+
+#define STORE4_SHIFT(a, n, dst)            \
+    "movd      "#a", "dst"            \n\t"\
+    "psrldq  $"#n" , "#a"             \n\t"
+
+#define PRED4x4_CLOBBERS \
+    XMM_CLOBBERS("%xmm0", "%xmm1", "%xmm2", "%xmm3", "%xmm4", "%xmm7") "memory"
+
+/** edge l3,l2,l1,l0,lt,t0..t3 */
+#define LOAD_EDGE4                                                  \
+    const uint64_t edge = src[-1+3*stride] | src[-1+2*stride] << 8 |\
+                          src[-1+1*stride] << 16 | (uint32_t)src[-1] << 24 | \
+                          (uint64_t)*(const uint32_t*)(src-1-stride) << 32; \
+    const int t3 = src[3-stride]
+
+static void pred4x4_down_right_sse2(uint8_t *src, uint8_t *topright, int stride)
+{
+    LOAD_EDGE4;
+    __asm__ volatile(
+        "movq   %[edge], %%xmm0           \n\t"
+        "pinsrw $4, %[t3], %%xmm0         \n\t"
+        PRED4x4_AVG_LOWPASS
+        "lea    (%0,%1,2), %0             \n\t"
+        STORE4_SHIFT(%%xmm0, 1, "(%0,%1)")
+        STORE4_SHIFT(%%xmm0, 1, "(%0)")
+        "sub    %1, %0                    \n\t"
+        STORE4_SHIFT(%%xmm0, 1, "(%0)")
+        "sub    %1, %0                    \n\t"
+        "movd   %%xmm0, (%0)              \n\t"
+        : "+&r"(src)
+        : "r"((x86_reg)stride), [pb_1] "m"(pb_1), [edge] "m"(edge), [t3] "rm"(t3)
+        : PRED4x4_CLOBBERS);
+}
+
+static void pred4x4_vertical_right_sse2(uint8_t *src, uint8_t *topright, int stride)
+{
+    LOAD_EDGE4;
+    __asm__ volatile(
+        "movq   %[edge], %%xmm0           \n\t"
+        "pinsrw $4, %[t3], %%xmm0         \n\t"
+        PRED4x4_AVG_LOWPASS
+        /* rows: A4..A7, Q3..Q6, Q2,A4..A6, Q1,Q3..Q5 */
+        "psrldq $4, %%xmm1                \n\t"
+        "movd   %%xmm1, (%0)              \n\t"
+        "movdqa %%xmm0, %%xmm2            \n\t"
+        "psrldq $3, %%xmm2                \n\t"
+        "movd   %%xmm2, (%0,%1)           \n\t"
+        "pslldq $1, %%xmm1                \n\t"
+        "pslldq $1, %%xmm2                \n\t"
+        "movdqa %%xmm0, %%xmm3            \n\t"
+        "psrldq $2, %%xmm3                \n\t"
+        LOW_BYTES(%%xmm3, 1)
+        "por    %%xmm3, %%xmm1            \n\t"
+        "movd   %%xmm1, (%0,%1,2)         \n\t"
+        "psrldq $1, %%xmm0                \n\t"
+        LOW_BYTES(%%xmm0, 1)
+        "por    %%xmm0, %%xmm2            \n\t"
+        "lea    (%0,%1,2), %0             \n\t"
+        "movd   %%xmm2, (%0,%1)           \n\t"
+        : "+&r"(src)
+        : "r"((x86_reg)stride), [pb_1] "m"(pb_1), [edge] "m"(edge), [t3] "rm"(t3)
+        : PRED4x4_CLOBBERS);
+}
+
+static void pred4x4_horizontal_down_sse2(uint8_t *src, uint8_t *topright, int stride)
+{
+    LOAD_EDGE4;
+    __asm__ volatile(
+        "movq   %[edge], %%xmm0           \n\t"
+        "pinsrw $4, %[t3], %%xmm0         \n\t"
+        PRED4x4_AVG_LOWPASS
+        /* rows 3..1 start at A0,A1,A2 of A0,Q0,A1,Q1..; row 0 is A3,Q3,Q4,Q5 */
+        "punpcklbw %%xmm0, %%xmm1         \n\t"
+        "lea    (%0,%1,2), %0             \n\t"
+        STORE4_SHIFT(%%xmm1, 2, "(%0,%1)")
+        STORE4_SHIFT(%%xmm1, 2, "(%0)")
+        "sub    %1, %0                    \n\t"
+        STORE4_SHIFT(%%xmm1, 2, "(%0)")
+        "sub    %1, %0                    \n\t"
+        LOW_BYTES(%%xmm1, 2)
+        "psrldq $4, %%xmm0                \n\t"
+        "pslldq $2, %%xmm0                \n\t"
+        "por    %%xmm1, %%xmm0            \n\t"
+        "movd   %%xmm0, (%0)              \n\t"
+        : "+&r"(src)
+        : "r"((x86_reg)stride), [pb_1] "m"(pb_1), [edge] "m"(edge), [t3] "rm"(t3)
+        : PRED4x4_CLOBBERS);
+}
+
+static void pred4x4_down_left_sse2(uint8_t *src, uint8_t *topright, int stride)
+{
+    __asm__ volatile(
+        "movd   %[top], %%xmm0            \n\t"
+        "movd   %[tr], %%xmm1             \n\t"
+        "punpckldq %%xmm1, %%xmm0         \n\t"
+        "pinsrw $4, %[t7], %%xmm0         \n\t"
+        PRED4x4_AVG_LOWPASS
+        STORE4_SHIFT(%%xmm0, 1, "(%0)")
+        STORE4_SHIFT(%%xmm0, 1, "(%0,%1)")
+        STORE4_SHIFT(%%xmm0, 1, "(%0,%1,2)")
+        "lea    (%0,%1,2), %0             \n\t"
+        "movd   %%xmm0, (%0,%1)           \n\t"
+        : "+&r"(src)
+        : "r"((x86_reg)stride), [pb_1] "m"(pb_1),
+          [top] "m"(*(const uint32_t*)(src - stride)),
+          [tr] "m"(*(const uint32_t*)topright), [t7] "rm"((int)topright[3])
+        : PRED4x4_CLOBBERS);
+}
+
+static void pred4x4_vertical_left_sse2(uint8_t *src, uint8_t *topright, int stride)
+{
+    __asm__ volatile(
+        "movd   %[top], %%xmm0            \n\t"
+        "movd   %[tr], %%xmm1             \n\t"
+        "punpckldq %%xmm1, %%xmm0         \n\t"
+        PRED4x4_AVG_LOWPASS
+        STORE4_SHIFT(%%xmm1, 1, "(%0)")
+        STORE4_SHIFT(%%xmm0, 1, "(%0,%1)")
+        "movd   %%xmm1, (%0,%1,2)         \n\t"
+        "lea    (%0,%1,2), %0             \n\t"
+        "movd   %%xmm0, (%0,%1)           \n\t"
+        : "+&r"(src)
+        : "r"((x86_reg)stride), [pb_1] "m"(pb_1),
+          [top] "m"(*(const uint32_t*)(src - stride)),
+          [tr] "m"(*(const uint32_t*)topright)
+        : PRED4x4_CLOBBERS);
+}
+
+static void pred4x4_horizontal_up_sse2(uint8_t *src, uint8_t *topright, int stride)
+{
+    const int l3 = src[-1+3*stride];
+    const uint64_t edge = src[-1] | src[-1+stride] << 8 | src[-1+2*stride] << 16 |
+                          l3 * 0x0101010101000000ULL;
+    __asm__ volatile(
+        "movq   %[edge], %%xmm0           \n\t"
+        PRED4x4_AVG_LOWPASS
+        "punpcklbw %%xmm0, %%xmm1         \n\t"
+        STORE4_SHIFT(%%xmm1, 2, "(%0)")
+        STORE4_SHIFT(%%xmm1, 2, "(%0,%1)")
+        STORE4_SHIFT(%%xmm1, 2, "(%0,%1,2)")
+        "lea    (%0,%1,2), %0             \n\t"
+        "movd   %%xmm1, (%0,%1)           \n\t"
+        : "+&r"(src)
+        : "r"((x86_reg)stride), [pb_1] "m"(pb_1), [edge] "m"(edge)
+        : PRED4x4_CLOBBERS);
+}
+
+void ff_h264_pred_init_x86(H264PredContext *h, int codec_id)
+{
+    int flags = mm_support();
+
+    if (flags & FF_MM_SSE2) {
+        if (codec_id != CODEC_ID_RV40) {
+            if (codec_id != CODEC_ID_SVQ3)
+                h->pred4x4[DIAG_DOWN_LEFT_PRED] = pred4x4_down_left_sse2;
+            h->pred4x4[VERT_LEFT_PRED      ] = pred4x4_vertical_left_sse2;
+            h->pred4x4[HOR_UP_PRED         ] = pred4x4_horizontal_up_sse2;
+        }
+        h->pred4x4[DIAG_DOWN_RIGHT_PRED] = pred4x4_down_right_sse2;
+        h->pred4x4[VERT_RIGHT_PRED     ] = pred4x4_vertical_right_sse2;
+        h->pred4x4[HOR_DOWN_PRED       ] = pred4x4_horizontal_down_sse2;
+
+        h->pred8x8l[VERT_PRED           ] = pred8x8l_vertical_sse2;
+        h->pred8x8l[HOR_PRED            ] = pred8x8l_horizontal_sse2;
+        h->pred8x8l[DC_PRED             ] = pred8x8l_dc_sse2;
+        h->pred8x8l[DIAG_DOWN_LEFT_PRED ] = pred8x8l_down_left_sse2;
+        h->pred8x8l[DIAG_DOWN_RIGHT_PRED] = pred8x8l_down_right_sse2;
+        h->pred8x8l[VERT_RIGHT_PRED     ] = pred8x8l_vertical_right_sse2;
+        h->pred8x8l[HOR_DOWN_PRED       ] = pred8x8l_horizontal_down_sse2;
+        h->pred8x8l[VERT_LEFT_PRED      ] = pred8x8l_vertical_left_sse2;
+        h->pred8x8l[HOR_UP_PRED         ] = pred8x8l_horizontal_up_sse2;
+        h->pred8x8l[LEFT_DC_PRED        ] = pred8x8l_left_dc_sse2;
+        h->pred8x8l[TOP_DC_PRED         ] = pred8x8l_top_dc_sse2;
+        h->pred8x8l[DC_128_PRED         ] = pred8x8l_128_dc_sse2;
+
+        h->pred8x8[VERT_PRED8x8   ] = pred8x8_vertical_sse2;
+        h->pred8x8[HOR_PRED8x8    ] = pred8x8_horizontal_sse2;
+        h->pred8x8[PLANE_PRED8x8  ] = pred8x8_plane_sse2;
+        if (codec_id != CODEC_ID_RV40) {
+            h->pred8x8[DC_PRED8x8     ] = pred8x8_dc_sse2;
+            h->pred8x8[LEFT_DC_PRED8x8] = pred8x8_left_dc_sse2;
+            h->pred8x8[TOP_DC_PRED8x8 ] = pred8x8_top_dc_sse2;
+        } else {
+            h->pred8x8[DC_PRED8x8     ] = pred8x8_dc_rv40_sse2;
+            h->pred8x8[LEFT_DC_PRED8x8] = pred8x8_left_dc_rv40_sse2;
+            h->pred8x8[TOP_DC_PRED8x8 ] = pred8x8_top_dc_rv40_sse2;
+        }
+        h->pred8x8[DC_128_PRED8x8 ] = pred8x8_128_dc_sse2;
+
+        h->pred16x16[VERT_PRED8x8   ] = pred16x16_vertical_sse2;
+        h->pred16x16[HOR_PRED8x8    ] = pred16x16_horizontal_sse2;
+        h->pred16x16[DC_PRED8x8     ] = pred16x16_dc_sse2;
+        h->pred16x16[LEFT_DC_PRED8x8] = pred16x16_left_dc_sse2;
+        h->pred16x16[TOP_DC_PRED8x8 ] = pred16x16_top_dc_sse2;
+        h->pred16x16[DC_128_PRED8x8 ] = pred16x16_128_dc_sse2;
+        switch (codec_id) {
+        case CODEC_ID_SVQ3:
+            h->pred16x16[PLANE_PRED8x8] = pred16x16_plane_svq3_sse2;
+            break;
+        case CODEC_ID_RV40:
+            h->pred16x16[PLANE_PRED8x8] = pred16x16_plane_rv40_sse2;
+            break;
+        default:
+            h->pred16x16[PLANE_PRED8x8] = pred16x16_plane_sse2;
+        }
+    }
+
+    if (flags & FF_MM_SSSE3) {
+        h->pred8x8  [HOR_PRED8x8] = pred8x8_horizontal_ssse3;
+        h->pred16x16[HOR_PRED8x8] = pred16x16_horizontal_ssse3;
+    }
+}